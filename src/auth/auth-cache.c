@@ -2,6 +2,8 @@
 
 #include "auth-common.h"
 #include "lib-signals.h"
+#include "ioloop.h"
+#include "array.h"
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
@@ -11,14 +13,36 @@
 
 #include <time.h>
 
+struct auth_cache_waiter {
+	struct auth_request *request;
+	auth_cache_wait_callback_t *callback;
+};
+
+struct auth_cache_lookup {
+	struct auth_cache *cache;
+	struct auth_request *request;
+	char *key;
+
+	ARRAY(struct auth_cache_waiter) waiters;
+};
+
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
-	struct auth_cache_node *head, *tail;
+	/* expanded cache key => db lookup in progress */
+	HASH_TABLE(char *, struct auth_cache_lookup *) lookups;
+	/* waiters whose lookup has finished, woken up by to_wakeup */
+	ARRAY(struct auth_cache_waiter) wakeups;
+	struct timeout *to_wakeup;
+
+	/* Next node to be considered for eviction. New nodes are linked
+	   right behind it, so they get a full round before they can be
+	   evicted. */
+	struct auth_cache_node *hand;
 
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
-	unsigned int hit_count, miss_count;
+	unsigned int hit_count, miss_count, coalesced_count;
 	unsigned int pos_entries, neg_entries;
 	unsigned long long pos_size, neg_size;
 };
@@ -146,33 +170,32 @@ char *auth_cache_parse_key(pool_t pool, const char *query)
 static void
 auth_cache_node_unlink(struct auth_cache *cache, struct auth_cache_node *node)
 {
-	if (node->prev != NULL)
-		node->prev->next = node->next;
-	else {
-		/* unlinking tail */
-		cache->tail = node->next;
+	if (node->next == node) {
+		/* unlinking the last node */
+		cache->hand = NULL;
+		return;
 	}
 
-	if (node->next != NULL)
-		node->next->prev = node->prev;
-	else {
-		/* unlinking head */
-		cache->head = node->prev;
-	}
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	if (cache->hand == node)
+		cache->hand = node->next;
 }
 
 static void
-auth_cache_node_link_head(struct auth_cache *cache,
-			  struct auth_cache_node *node)
+auth_cache_node_link(struct auth_cache *cache, struct auth_cache_node *node)
 {
-	node->prev = cache->head;
-	node->next = NULL;
-
-	cache->head = node;
-	if (node->prev != NULL)
-		node->prev->next = node;
-	else
-		cache->tail = node;
+	if (cache->hand == NULL) {
+		node->prev = node->next = node;
+		cache->hand = node;
+		return;
+	}
+
+	/* link behind the hand, i.e. the node it reaches last */
+	node->next = cache->hand;
+	node->prev = cache->hand->prev;
+	node->prev->next = node;
+	cache->hand->prev = node;
 }
 
 static void
@@ -187,6 +210,20 @@ auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
 	i_free(node);
 }
 
+static void auth_cache_evict_next(struct auth_cache *cache)
+{
+	struct auth_cache_node *node;
+
+	/* CLOCK / second chance: skip over nodes that have been hit since
+	   the last round, clearing their referenced-flag as we go. This
+	   terminates within one full round. */
+	while ((node = cache->hand)->referenced) {
+		node->referenced = FALSE;
+		cache->hand = node->next;
+	}
+	auth_cache_node_destroy(cache, node);
+}
+
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
@@ -202,9 +239,11 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	size_t cache_used;
 
 	total_count = cache->hit_count + cache->miss_count;
-	i_info("Authentication cache hits %u/%u (%u%%)",
+	i_info("Authentication cache hits %u/%u (%u%%), "
+	       "coalesced lookups %u",
 	       cache->hit_count, total_count,
-	       total_count == 0 ? 100 : (cache->hit_count * 100 / total_count));
+	       total_count == 0 ? 100 : (cache->hit_count * 100 / total_count),
+	       cache->coalesced_count);
 
 	i_info("Authentication cache inserts: "
 	       "positive: %u entries %llu bytes, "
@@ -219,11 +258,18 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	       (unsigned int)(cache_used * 100ULL / cache->max_size));
 
 	/* reset counters */
-	cache->hit_count = cache->miss_count = 0;
+	cache->hit_count = cache->miss_count = cache->coalesced_count = 0;
 	cache->pos_entries = cache->neg_entries = 0;
 	cache->pos_size = cache->neg_size = 0;
 }
 
+static void auth_cache_lookup_free(struct auth_cache_lookup *lookup)
+{
+	array_free(&lookup->waiters);
+	i_free(lookup->key);
+	i_free(lookup);
+}
+
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 				  unsigned int neg_ttl_secs
 )
@@ -232,6 +278,8 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 
 	cache = i_new(struct auth_cache, 1);
 	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	hash_table_create(&cache->lookups, default_pool, 0, str_hash, strcmp);
+	i_array_init(&cache->wakeups, 8);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
@@ -247,11 +295,31 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 void auth_cache_free(struct auth_cache **_cache)
 {
 	struct auth_cache *cache = *_cache;
+	struct hash_iterate_context *iter;
+	struct auth_cache_lookup *lookup;
+	struct auth_cache_waiter *waiter;
+	char *key;
 
 	*_cache = NULL;
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
+	iter = hash_table_iterate_init(cache->lookups);
+	while (hash_table_iterate(iter, cache->lookups, &key, &lookup)) {
+		lookup->request->cache_lookup = NULL;
+		array_append_array(&cache->wakeups, &lookup->waiters);
+		auth_cache_lookup_free(lookup);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&cache->lookups);
+
+	/* we're deinitializing, just drop the waiting requests */
+	array_foreach_modifiable(&cache->wakeups, waiter)
+		auth_request_unref(&waiter->request);
+	array_free(&cache->wakeups);
+	if (cache->to_wakeup != NULL)
+		timeout_remove(&cache->to_wakeup);
+
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
 	i_free(cache);
@@ -261,8 +329,8 @@ unsigned int auth_cache_clear(struct auth_cache *cache)
 {
 	unsigned int ret = hash_table_count(cache->hash);
 
-	while (cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
+	while (cache->hand != NULL)
+		auth_cache_node_destroy(cache, cache->hand);
 	hash_table_clear(cache->hash, FALSE);
 	return ret;
 }
@@ -315,14 +383,17 @@ unsigned int auth_cache_clear_users(struct auth_cache *cache,
 				    const char *const *usernames)
 {
 	struct auth_cache_node *node, *next;
-	unsigned int ret = 0;
+	unsigned int i, count, ret = 0;
 
-	for (node = cache->tail; node != NULL; node = next) {
+	count = hash_table_count(cache->hash);
+	node = cache->hand;
+	for (i = 0; i < count; i++) {
 		next = node->next;
 		if (auth_cache_node_is_one_of_users(node, usernames)) {
 			auth_cache_node_destroy(cache, node);
 			ret++;
 		}
+		node = next;
 	}
 	return ret;
 }
@@ -383,11 +454,9 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		cache->miss_count++;
 		*expired_r = TRUE;
 	} else {
-		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
-		}
+		/* just mark it used, the CLOCK hand gives it a second chance.
+		   this way hits don't need to touch the list. */
+		node->referenced = TRUE;
 		cache->hit_count++;
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
@@ -429,8 +498,8 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		sizeof(node->data) + data_size;
 
 	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
+	while (cache->size_left < alloc_size && cache->hand != NULL)
+		auth_cache_evict_next(cache);
 
 	node = hash_table_lookup(cache->hash, key);
 	if (node != NULL) {
@@ -446,7 +515,7 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	memcpy(node->data, key, key_len);
 	memcpy(node->data + key_len + 1, value, value_len);
 
-	auth_cache_node_link_head(cache, node);
+	auth_cache_node_link(cache, node);
 
 	cache->size_left -= alloc_size;
 	hash_key = node->data;
@@ -461,6 +530,85 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 	}
 }
 
+static void auth_cache_wakeup(struct auth_cache *cache)
+{
+	ARRAY(struct auth_cache_waiter) wakeups;
+	struct auth_cache_waiter *waiter;
+
+	timeout_remove(&cache->to_wakeup);
+
+	/* the callbacks may add new waiters */
+	t_array_init(&wakeups, array_count(&cache->wakeups));
+	array_append_array(&wakeups, &cache->wakeups);
+	array_clear(&cache->wakeups);
+
+	array_foreach_modifiable(&wakeups, waiter) {
+		waiter->callback(waiter->request);
+		auth_request_unref(&waiter->request);
+	}
+}
+
+bool auth_cache_lookup_wait(struct auth_cache *cache,
+			    struct auth_request *request, const char *key,
+			    auth_cache_wait_callback_t *callback)
+{
+	struct auth_cache_lookup *lookup;
+	struct auth_cache_waiter *waiter;
+
+	i_assert(request->cache_lookup == NULL);
+
+	key = auth_request_expand_cache_key(request, key);
+	if (request->cache_lookup_waited_key != NULL &&
+	    strcmp(request->cache_lookup_waited_key, key) == 0) {
+		/* we already waited for this, but the result apparently
+		   wasn't cached (e.g. internal failure). */
+		return FALSE;
+	}
+
+	lookup = hash_table_lookup(cache->lookups, key);
+	if (lookup == NULL) {
+		lookup = i_new(struct auth_cache_lookup, 1);
+		lookup->cache = cache;
+		lookup->request = request;
+		lookup->key = i_strdup(key);
+		i_array_init(&lookup->waiters, 4);
+		hash_table_insert(cache->lookups, lookup->key, lookup);
+		request->cache_lookup = lookup;
+		return FALSE;
+	}
+
+	request->cache_lookup_waited_key = p_strdup(request->pool, key);
+	auth_request_ref(request);
+	waiter = array_append_space(&lookup->waiters);
+	waiter->request = request;
+	waiter->callback = callback;
+	cache->coalesced_count++;
+	return TRUE;
+}
+
+void auth_cache_lookup_finished(struct auth_request *request)
+{
+	struct auth_cache_lookup *lookup = request->cache_lookup;
+	struct auth_cache *cache;
+
+	if (lookup == NULL)
+		return;
+	request->cache_lookup = NULL;
+
+	cache = lookup->cache;
+	hash_table_remove(cache->lookups, lookup->key);
+	if (array_count(&lookup->waiters) > 0) {
+		/* wake up the waiters only after the caller has had a
+		   chance to insert the result into the cache */
+		array_append_array(&cache->wakeups, &lookup->waiters);
+		if (cache->to_wakeup == NULL) {
+			cache->to_wakeup =
+				timeout_add_short(0, auth_cache_wakeup, cache);
+		}
+	}
+	auth_cache_lookup_free(lookup);
+}
+
 void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request, const char *key)
 {
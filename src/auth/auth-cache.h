@@ -2,11 +2,14 @@
 #define AUTH_CACHE_H
 
 struct auth_cache_node {
+	/* Circular list of all nodes, walked by the CLOCK hand */
 	struct auth_cache_node *prev, *next;
 
 	time_t created;
 	/* Total number of bytes used by this node */
-	uint32_t alloc_size:31;
+	uint32_t alloc_size:30;
+	/* TRUE if the node has been hit since the CLOCK hand last passed it */
+	bool referenced:1;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
 
@@ -16,6 +19,8 @@ struct auth_cache_node {
 struct auth_cache;
 struct auth_request;
 
+typedef void auth_cache_wait_callback_t(struct auth_request *request);
+
 /* Parses all %x variables from query and compresses them into tab-separated
    list, so it can be used as a cache key. */
 char *auth_cache_parse_key(pool_t pool, const char *query);
@@ -45,6 +50,19 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success);
 
+/* Called after a cache miss, before doing the db lookup. Returns TRUE if
+   another request is already doing the db lookup for the same key. The
+   request is then referenced and callback is called once the lookup has
+   finished, so the request can try the cache again. Otherwise returns FALSE
+   and the request does the lookup itself. */
+bool auth_cache_lookup_wait(struct auth_cache *cache,
+			    struct auth_request *request, const char *key,
+			    auth_cache_wait_callback_t *callback);
+/* The db lookup done by the request has finished and its result has been
+   (or is just about to be) inserted into the cache. Wake up the requests
+   waiting for it. Does nothing if the request has no such lookup. */
+void auth_cache_lookup_finished(struct auth_request *request);
+
 /* Remove key from cache */
 void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request,
@@ -10,6 +10,7 @@
 #include "safe-memset.h"
 #include "str-sanitize.h"
 #include "strescape.h"
+#include "time-util.h"
 #include "var-expand.h"
 #include "dns-lookup.h"
 #include "auth-cache.h"
@@ -76,6 +77,10 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 						     lookup_credentials_callback_t *callback);
 static
 void auth_request_policy_check_callback(int result, void *context);
+static void auth_request_verify_plain_passdb(struct auth_request *request);
+static void
+auth_request_lookup_credentials_passdb(struct auth_request *request);
+static void auth_request_lookup_user_userdb(struct auth_request *request);
 
 struct auth_request *
 auth_request_new(const struct mech_module *mech)
@@ -235,6 +240,8 @@ void auth_request_unref(struct auth_request **_request)
 	if (--request->refcount > 0)
 		return;
 
+	/* don't leave other requests waiting for our lookup */
+	auth_cache_lookup_finished(request);
 	auth_request_stats_send(request);
 	auth_request_state_count[request->state]--;
 	auth_refresh_proctitle();
@@ -463,6 +470,22 @@ void auth_request_continue(struct auth_request *request,
 	request->mech->auth_continue(request, data, data_size);
 }
 
+static bool
+auth_request_cache_lookup_wait(struct auth_request *request, const char *key,
+			       auth_cache_wait_callback_t *callback)
+{
+	struct auth_stats *stats;
+
+	if (!auth_cache_lookup_wait(passdb_cache, request, key, callback))
+		return FALSE;
+
+	stats = auth_request_stats_get(request);
+	stats->auth_cache_coalesced_count++;
+	auth_request_log_debug(request, AUTH_SUBSYS_DB,
+			       "Waiting for identical lookup to finish");
+	return TRUE;
+}
+
 static void auth_request_save_cache(struct auth_request *request,
 				    enum passdb_result result)
 {
@@ -768,6 +791,7 @@ void auth_request_verify_plain_callback(enum passdb_result result,
 	i_assert(request->state == AUTH_REQUEST_STATE_PASSDB);
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_MECH_CONTINUE);
+	auth_cache_lookup_finished(request);
 
 	if (result != PASSDB_RESULT_INTERNAL_FAILURE)
 		auth_request_save_cache(request, result);
@@ -892,10 +916,6 @@ void auth_request_verify_plain_continue(struct auth_request *request,
 					char *password,
 					verify_plain_callback_t *callback) {
 
-	struct auth_passdb *passdb;
-	enum passdb_result result;
-	const char *cache_key;
-
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
 
 	if (auth_request_is_disabled_master_user(request)) {
@@ -910,7 +930,6 @@ void auth_request_verify_plain_continue(struct auth_request *request,
 		return;
 	}
 
-        passdb = request->passdb;
 	if (request->mech_password == NULL)
 		/* this is allocated on start */
 		request->mech_password = password;
@@ -918,12 +937,26 @@ void auth_request_verify_plain_continue(struct auth_request *request,
 		i_assert(request->mech_password == password);
 	request->private_callback.verify_plain = callback;
 
+	auth_request_verify_plain_passdb(request);
+}
+
+static void auth_request_verify_plain_passdb(struct auth_request *request)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *password = request->mech_password;
+	enum passdb_result result;
+	const char *cache_key;
+
 	cache_key = passdb_cache == NULL ? NULL : passdb->cache_key;
 	if (passdb_cache_verify_plain(request, cache_key, password,
 				      &result, FALSE)) {
 		auth_request_verify_plain_callback_finish(result, request);
 		return;
 	}
+	if (cache_key != NULL &&
+	    auth_request_cache_lookup_wait(request, cache_key,
+					   auth_request_verify_plain_passdb))
+		return;
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
 	request->credentials_scheme = NULL;
@@ -1003,6 +1036,7 @@ void auth_request_lookup_credentials_callback(enum passdb_result result,
 	i_assert(request->state == AUTH_REQUEST_STATE_PASSDB);
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_MECH_CONTINUE);
+	auth_cache_lookup_finished(request);
 
 	if (result != PASSDB_RESULT_INTERNAL_FAILURE)
 		auth_request_save_cache(request, result);
@@ -1055,22 +1089,27 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 						     const char *scheme,
 						     lookup_credentials_callback_t *callback)
 {
-	struct auth_passdb *passdb;
-	const char *cache_key, *cache_cred, *cache_scheme;
-	enum passdb_result result;
-
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
 
 	if (auth_request_is_disabled_master_user(request)) {
 		callback(PASSDB_RESULT_USER_UNKNOWN, NULL, 0, request);
 		return;
 	}
-	passdb = request->passdb;
 
 	if (request->credentials_scheme == NULL)
 		request->credentials_scheme = p_strdup(request->pool, scheme);
 	request->private_callback.lookup_credentials = callback;
 
+	auth_request_lookup_credentials_passdb(request);
+}
+
+static void
+auth_request_lookup_credentials_passdb(struct auth_request *request)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *cache_key, *cache_cred, *cache_scheme;
+	enum passdb_result result;
+
 	cache_key = passdb_cache == NULL ? NULL : passdb->cache_key;
 	if (cache_key != NULL) {
 		if (passdb_cache_lookup_credentials(request, cache_key,
@@ -1082,6 +1121,9 @@ void auth_request_lookup_credentials_policy_continue(struct auth_request *reques
 				request);
 			return;
 		}
+		if (auth_request_cache_lookup_wait(request, cache_key,
+				auth_request_lookup_credentials_passdb))
+			return;
 	}
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
@@ -1213,6 +1255,8 @@ void auth_request_userdb_callback(enum userdb_result result,
 	enum auth_db_rule result_rule;
 	bool userdb_continue = FALSE;
 
+	auth_cache_lookup_finished(request);
+
 	switch (result) {
 	case USERDB_RESULT_OK:
 		result_rule = userdb->result_success;
@@ -1323,7 +1367,6 @@ void auth_request_lookup_user(struct auth_request *request,
 			      userdb_callback_t *callback)
 {
 	struct auth_userdb *userdb = request->userdb;
-	const char *cache_key;
 
 	request->private_callback.userdb = callback;
 	request->userdb_lookup = TRUE;
@@ -1335,6 +1378,13 @@ void auth_request_lookup_user(struct auth_request *request,
 		   unwanted, ":protected" can be used). */
 		userdb_template_export(userdb->default_fields_tmpl, request);
 	}
+	auth_request_lookup_user_userdb(request);
+}
+
+static void auth_request_lookup_user_userdb(struct auth_request *request)
+{
+	struct auth_userdb *userdb = request->userdb;
+	const char *cache_key;
 
 	/* (for now) auth_cache is shared between passdb and userdb */
 	cache_key = passdb_cache == NULL ? NULL : userdb->cache_key;
@@ -1346,6 +1396,9 @@ void auth_request_lookup_user(struct auth_request *request,
 			auth_request_userdb_callback(result, request);
 			return;
 		}
+		if (auth_request_cache_lookup_wait(request, cache_key,
+				auth_request_lookup_user_userdb))
+			return;
 	}
 
 	if (userdb->userdb->iface->lookup == NULL) {
@@ -2185,16 +2238,10 @@ void auth_request_log_unknown_user(struct auth_request *request,
 	i_info("%s", str_c(str));
 }
 
-int auth_request_password_verify(struct auth_request *request,
-				 const char *plain_password,
-				 const char *crypted_password,
-				 const char *scheme, const char *subsystem)
+static int
+auth_request_password_verify_preset(struct auth_request *request,
+				    const char *subsystem)
 {
-	const unsigned char *raw_password;
-	size_t raw_password_size;
-	const char *error;
-	int ret;
-
 	if (request->skip_password_check) {
 		/* passdb continue* rule after a successful authentication */
 		return 1;
@@ -2210,6 +2257,21 @@ int auth_request_password_verify(struct auth_request *request,
 				       "Allowing any password");
 		return 1;
 	}
+	/* the password needs to be verified */
+	return -1;
+}
+
+static int
+auth_request_password_verify_scheme(struct auth_request *request,
+				    const char *plain_password,
+				    const char *crypted_password,
+				    const char *scheme, const char *subsystem)
+{
+	const unsigned char *raw_password;
+	size_t raw_password_size;
+	const char *error;
+	struct timeval start_time, end_time;
+	int ret;
 
 	ret = password_decode(crypted_password, scheme,
 			      &raw_password, &raw_password_size, &error);
@@ -2228,8 +2290,16 @@ int auth_request_password_verify(struct auth_request *request,
 	/* Use original_username since it may be important for some
 	   password schemes (eg. digest-md5). Otherwise the username is used
 	   only for logging purposes. */
+	if (gettimeofday(&start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
 	ret = password_verify(plain_password, request->original_username,
 			      scheme, raw_password, raw_password_size, &error);
+	if (gettimeofday(&end_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	if (!worker) {
+		passdb_blocking_scheme_add_timing(scheme,
+			timeval_diff_usecs(&end_time, &start_time));
+	}
 	if (ret < 0) {
 		const char *password_str = request->set->debug_passwords ?
 			t_strdup_printf(" '%s'", crypted_password) : "";
@@ -2248,6 +2318,45 @@ int auth_request_password_verify(struct auth_request *request,
 	return ret;
 }
 
+int auth_request_password_verify(struct auth_request *request,
+				 const char *plain_password,
+				 const char *crypted_password,
+				 const char *scheme, const char *subsystem)
+{
+	int ret;
+
+	ret = auth_request_password_verify_preset(request, subsystem);
+	if (ret >= 0)
+		return ret;
+	return auth_request_password_verify_scheme(request, plain_password,
+						   crypted_password, scheme,
+						   subsystem);
+}
+
+void auth_request_password_verify_async(struct auth_request *request,
+					const char *plain_password,
+					const char *crypted_password,
+					const char *scheme,
+					verify_plain_callback_t *callback)
+{
+	int ret;
+
+	ret = auth_request_password_verify_preset(request, AUTH_SUBSYS_DB);
+	if (ret < 0 && !worker && passdb_blocking_scheme_is_slow(scheme)) {
+		passdb_blocking_password_verify(request, plain_password,
+						crypted_password, scheme,
+						callback);
+		return;
+	}
+	if (ret < 0) {
+		ret = auth_request_password_verify_scheme(request,
+				plain_password, crypted_password, scheme,
+				AUTH_SUBSYS_DB);
+	}
+	callback(ret > 0 ? PASSDB_RESULT_OK : PASSDB_RESULT_PASSWORD_MISMATCH,
+		 request);
+}
+
 static void get_log_prefix(string_t *str, struct auth_request *auth_request,
 			   const char *subsystem)
 {
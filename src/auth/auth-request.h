@@ -62,6 +62,12 @@ struct auth_request {
         struct auth_userdb *userdb;
 
 	struct stats *stats;
+	/* Cache lookup that this request is currently doing the db lookup
+	   for. Other requests for the same cache key wait for it. */
+	struct auth_cache_lookup *cache_lookup;
+	/* Expanded cache key that this request already waited for. It's not
+	   waited again, in case the result didn't get cached. */
+	const char *cache_lookup_waited_key;
 
 	/* passdb lookups have a handler, userdb lookups don't */
 	struct auth_request_handler *handler;
@@ -232,6 +238,16 @@ int auth_request_password_verify(struct auth_request *request,
 				 const char *plain_password,
 				 const char *crypted_password,
 				 const char *scheme, const char *subsystem);
+/* Like auth_request_password_verify(), but call the callback with
+   PASSDB_RESULT_OK or PASSDB_RESULT_PASSWORD_MISMATCH. If verifying the
+   scheme has been slow, the password is verified in an auth worker process
+   so it won't block other requests, and the callback is called later
+   (with PASSDB_RESULT_INTERNAL_FAILURE if the worker failed). */
+void auth_request_password_verify_async(struct auth_request *request,
+					const char *plain_password,
+					const char *crypted_password,
+					const char *scheme,
+					verify_plain_callback_t *callback);
 
 void auth_request_log_debug(struct auth_request *auth_request,
 			    const char *subsystem,
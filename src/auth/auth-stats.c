@@ -15,7 +15,8 @@ static struct stats_parser_field auth_stats_fields[] = {
 	EN("auth_db_tempfails", auth_db_tempfail_count),
 
 	EN("auth_cache_hits", auth_cache_hit_count),
-	EN("auth_cache_misses", auth_cache_miss_count)
+	EN("auth_cache_misses", auth_cache_miss_count),
+	EN("auth_cache_coalesced", auth_cache_coalesced_count)
 };
 
 static size_t auth_stats_alloc_size(void)
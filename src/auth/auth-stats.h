@@ -9,6 +9,7 @@ struct auth_stats {
 
 	uint32_t auth_cache_hit_count;
 	uint32_t auth_cache_miss_count;
+	uint32_t auth_cache_coalesced_count;
 };
 
 extern const struct stats_vfuncs auth_stats_vfuncs;
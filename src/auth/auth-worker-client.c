@@ -103,6 +103,25 @@ worker_auth_request_new(struct auth_worker_client *client, unsigned int id,
 	return auth_request;
 }
 
+static struct auth_passdb *
+worker_auth_request_find_passdb(struct auth_request *auth_request,
+				unsigned int passdb_id)
+{
+	struct auth_passdb *passdb;
+
+	passdb = auth_request->passdb;
+	while (passdb != NULL && passdb->passdb->id != passdb_id)
+		passdb = passdb->next;
+
+	if (passdb == NULL) {
+		/* could be a masterdb */
+		passdb = auth_request_get_auth(auth_request)->masterdbs;
+		while (passdb != NULL && passdb->passdb->id != passdb_id)
+			passdb = passdb->next;
+	}
+	return passdb;
+}
+
 static void auth_worker_send_reply(struct auth_worker_client *client,
 				   struct auth_request *request,
 				   string_t *str)
@@ -198,21 +217,11 @@ auth_worker_handle_passv(struct auth_worker_client *client,
 		return FALSE;
 	}
 
-	passdb = auth_request->passdb;
-	while (passdb != NULL && passdb->passdb->id != passdb_id)
-		passdb = passdb->next;
-
+	passdb = worker_auth_request_find_passdb(auth_request, passdb_id);
 	if (passdb == NULL) {
-		/* could be a masterdb */
-		passdb = auth_request_get_auth(auth_request)->masterdbs;
-		while (passdb != NULL && passdb->passdb->id != passdb_id)
-			passdb = passdb->next;
-
-		if (passdb == NULL) {
-			i_error("BUG: PASSV had invalid passdb ID");
-			auth_request_unref(&auth_request);
-			return FALSE;
-		}
+		i_error("BUG: PASSV had invalid passdb ID");
+		auth_request_unref(&auth_request);
+		return FALSE;
 	}
 
 	auth_request->passdb = passdb;
@@ -221,6 +230,55 @@ auth_worker_handle_passv(struct auth_worker_client *client,
 	return TRUE;
 }
 
+static bool
+auth_worker_handle_passw(struct auth_worker_client *client,
+			 unsigned int id, const char *const *args)
+{
+	/* verify plaintext password against the given crypted password */
+	struct auth_request *auth_request;
+	struct auth_passdb *passdb;
+	const char *password, *crypted, *scheme;
+	unsigned int passdb_id;
+	string_t *str;
+	int ret;
+
+	/* <passdb id> <password> <crypted password> <scheme> [<args>] */
+	if (str_to_uint(args[0], &passdb_id) < 0 || args[1] == NULL ||
+	    args[2] == NULL || args[3] == NULL) {
+		i_error("BUG: Auth worker server sent us invalid PASSW");
+		return FALSE;
+	}
+	password = args[1];
+	crypted = args[2];
+	scheme = args[3];
+
+	auth_request = worker_auth_request_new(client, id, args + 4);
+	if (auth_request->user == NULL || auth_request->service == NULL) {
+		i_error("BUG: PASSW had missing parameters");
+		auth_request_unref(&auth_request);
+		return FALSE;
+	}
+
+	passdb = worker_auth_request_find_passdb(auth_request, passdb_id);
+	if (passdb == NULL) {
+		i_error("BUG: PASSW had invalid passdb ID");
+		auth_request_unref(&auth_request);
+		return FALSE;
+	}
+	auth_request->passdb = passdb;
+
+	ret = auth_request_password_verify(auth_request, password, crypted,
+					   scheme, AUTH_SUBSYS_DB);
+	str = t_str_new(32);
+	str_printfa(str, "%u\t%s\n", id, ret > 0 ? "OK" : "FAIL");
+	auth_worker_send_reply(client, auth_request, str);
+
+	auth_request_unref(&auth_request);
+	auth_worker_client_check_throttle(client);
+	auth_worker_client_unref(&client);
+	return TRUE;
+}
+
 static void
 lookup_credentials_callback(enum passdb_result result,
 			    const unsigned char *credentials, size_t size,
@@ -579,7 +637,10 @@ auth_worker_handle_list(struct auth_worker_client *client,
 		return FALSE;
 	}
 
-	io_remove(&ctx->client->io);
+	/* input may already be throttled by replies to earlier pipelined
+	   requests */
+	if (ctx->client->io != NULL)
+		io_remove(&ctx->client->io);
 	if (ctx->client->to_idle != NULL)
 		timeout_remove(&ctx->client->to_idle);
 
@@ -611,6 +672,8 @@ auth_worker_handle_line(struct auth_worker_client *client, const char *line)
 	auth_worker_refresh_proctitle(args[1]);
 	if (strcmp(args[1], "PASSV") == 0)
 		ret = auth_worker_handle_passv(client, id, args + 2);
+	else if (strcmp(args[1], "PASSW") == 0)
+		ret = auth_worker_handle_passw(client, id, args + 2);
 	else if (strcmp(args[1], "PASSL") == 0)
 		ret = auth_worker_handle_passl(client, id, args + 2);
 	else if (strcmp(args[1], "SETCRED") == 0)
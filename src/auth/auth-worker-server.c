@@ -27,6 +27,10 @@
 #define AUTH_WORKER_ABORT_SECS 60
 #define AUTH_WORKER_DELAY_WARN_SECS 3
 #define AUTH_WORKER_DELAY_WARN_MIN_INTERVAL_SECS 300
+/* Maximum number of requests sent to a single worker without waiting for
+   their replies. Requests are pipelined only after auth_worker_max_count
+   has been reached, and only if they don't block the worker. */
+#define AUTH_WORKER_MAX_PIPELINED_REQUESTS 32
 
 struct auth_worker_request {
 	unsigned int id;
@@ -35,6 +39,20 @@ struct auth_worker_request {
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	/* Multi-line reply (LIST). The worker is used exclusively for this
+	   request until it's finished. */
+	bool multiline:1;
+	/* The request doesn't block the worker, so it can be sent to a worker
+	   that is busy with other requests. */
+	bool pipeline:1;
+	/* The request was sent to a worker that was busy with other requests.
+	   It's aborted if it has been waiting for too long. */
+	bool pipelined:1;
+	/* The request was already failed because it had been waiting for too
+	   long. This is a copy of the original request, which may already be
+	   freed. The worker's reply is ignored. */
+	bool aborted:1;
 };
 
 struct auth_worker_connection {
@@ -44,8 +62,10 @@ struct auth_worker_connection {
 	struct istream *input;
 	struct ostream *output;
 	struct timeout *to;
+	struct timeout *to_abort;
 
-	struct auth_worker_request *request;
+	/* requests sent to the worker, waiting for their replies */
+	ARRAY(struct auth_worker_request *) requests;
 	unsigned int id_counter;
 
 	bool received_error:1;
@@ -55,6 +75,10 @@ struct auth_worker_connection {
 	bool resuming:1;
 };
 
+unsigned int auth_worker_lookup_timeout_msecs =
+	AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000;
+unsigned int auth_worker_abort_secs = AUTH_WORKER_ABORT_SECS;
+
 static ARRAY(struct auth_worker_connection *) connections = ARRAY_INIT;
 static unsigned int idle_count = 0, auth_workers_with_errors = 0;
 static ARRAY(struct auth_worker_request *) worker_request_array;
@@ -70,7 +94,7 @@ static void auth_worker_destroy(struct auth_worker_connection **conn,
 
 static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request == NULL);
+	i_assert(array_count(&conn->requests) == 0);
 
 	if (idle_count > 1)
 		auth_worker_destroy(&conn, NULL, FALSE);
@@ -80,11 +104,69 @@ static void auth_worker_idle_timeout(struct auth_worker_connection *conn)
 
 static void auth_worker_call_timeout(struct auth_worker_connection *conn)
 {
-	i_assert(conn->request != NULL);
+	i_assert(array_count(&conn->requests) > 0);
 
 	auth_worker_destroy(&conn, "Lookup timed out", TRUE);
 }
 
+static void auth_worker_abort_timeout(struct auth_worker_connection *conn);
+
+static void
+auth_worker_abort_timeout_update(struct auth_worker_connection *conn)
+{
+	struct auth_worker_request *const *requestp;
+	time_t oldest = 0, abort_time;
+
+	if (conn->to_abort != NULL)
+		timeout_remove(&conn->to_abort);
+
+	/* the lookup timeout is restarted whenever the worker finishes a
+	   request, so it doesn't catch pipelined requests that stay waiting
+	   while the worker keeps finishing others. */
+	array_foreach(&conn->requests, requestp) {
+		const struct auth_worker_request *request = *requestp;
+
+		if (request->pipelined && !request->aborted &&
+		    (oldest == 0 || request->created < oldest))
+			oldest = request->created;
+	}
+	if (oldest == 0)
+		return;
+
+	abort_time = oldest + auth_worker_abort_secs;
+	conn->to_abort = timeout_add(abort_time <= ioloop_time ? 0 :
+				     (abort_time - ioloop_time) * 1000,
+				     auth_worker_abort_timeout, conn);
+}
+
+static void auth_worker_abort_timeout(struct auth_worker_connection *conn)
+{
+	struct auth_worker_request *request, *aborted;
+	unsigned int i, age_secs;
+
+	/* the callbacks may pipeline more requests to this connection */
+	for (i = 0; i < array_count(&conn->requests); i++) {
+		request = *array_idx(&conn->requests, i);
+		age_secs = ioloop_time - request->created;
+		if (!request->pipelined || request->aborted ||
+		    age_secs < auth_worker_abort_secs)
+			continue;
+
+		i_error("Aborting auth request that was pipelined to "
+			"a busy auth worker for %u secs", age_secs);
+		aborted = i_new(struct auth_worker_request, 1);
+		aborted->id = request->id;
+		aborted->created = request->created;
+		aborted->aborted = TRUE;
+		array_idx_set(&conn->requests, i, &aborted);
+
+		request->callback(t_strdup_printf(
+			"FAIL\t%d", PASSDB_RESULT_INTERNAL_FAILURE),
+			request->context);
+	}
+	auth_worker_abort_timeout_update(conn);
+}
+
 static bool auth_worker_request_send(struct auth_worker_connection *conn,
 				     struct auth_worker_request *request)
 {
@@ -93,7 +175,7 @@ static bool auth_worker_request_send(struct auth_worker_connection *conn,
 
 	i_assert(conn->to != NULL);
 
-	if (age_secs >= AUTH_WORKER_ABORT_SECS) {
+	if (age_secs >= auth_worker_abort_secs) {
 		i_error("Aborting auth request that was queued for %d secs, "
 			"%d left in queue",
 			age_secs, aqueue_count(worker_request_queue));
@@ -123,29 +205,60 @@ static bool auth_worker_request_send(struct auth_worker_connection *conn,
 
 	o_stream_nsendv(conn->output, iov, 3);
 
-	i_assert(conn->request == NULL);
-	conn->request = request;
-
-	timeout_remove(&conn->to);
-	conn->to = timeout_add(AUTH_WORKER_LOOKUP_TIMEOUT_SECS * 1000,
-			       auth_worker_call_timeout, conn);
-	idle_count--;
+	i_assert(!request->multiline || array_count(&conn->requests) == 0);
+	i_assert(request->pipeline || array_count(&conn->requests) == 0);
+	array_append(&conn->requests, &request, 1);
+	if (array_count(&conn->requests) > 1) {
+		request->pipelined = TRUE;
+		if (conn->to_abort == NULL)
+			auth_worker_abort_timeout_update(conn);
+	} else {
+		/* the lookup timeout is restarted whenever the worker
+		   finishes a request, so with pipelined requests it
+		   catches a worker that has stopped making progress. */
+		timeout_remove(&conn->to);
+		conn->to = timeout_add(auth_worker_lookup_timeout_msecs,
+				       auth_worker_call_timeout, conn);
+		idle_count--;
+	}
 	return TRUE;
 }
 
+static bool auth_worker_can_pipeline(struct auth_worker_connection *conn)
+{
+	struct auth_worker_request *const *requestp;
+	unsigned int count = array_count(&conn->requests);
+
+	if (count == 0)
+		return TRUE;
+	if (count >= AUTH_WORKER_MAX_PIPELINED_REQUESTS ||
+	    conn->restart || conn->shutdown)
+		return FALSE;
+	/* don't pile more requests on a worker that is failing. the other
+	   workers were throttled because of it. */
+	if (conn->received_error)
+		return FALSE;
+	/* a multi-line request is always the only one */
+	requestp = array_idx(&conn->requests, 0);
+	return !(*requestp)->multiline;
+}
+
 static void auth_worker_request_send_next(struct auth_worker_connection *conn)
 {
 	struct auth_worker_request *request, *const *requestp;
 
-	do {
-		if (aqueue_count(worker_request_queue) == 0)
-			return;
-
+	while (aqueue_count(worker_request_queue) > 0 &&
+	       auth_worker_can_pipeline(conn)) {
 		requestp = array_idx(&worker_request_array,
 				     aqueue_idx(worker_request_queue, 0));
 		request = *requestp;
+		if (!request->pipeline && array_count(&conn->requests) > 0) {
+			/* wait until some worker becomes idle */
+			break;
+		}
 		aqueue_delete_tail(worker_request_queue);
-	} while (!auth_worker_request_send(conn, request));
+		(void)auth_worker_request_send(conn, request);
+	}
 }
 
 static void auth_worker_send_handshake(struct auth_worker_connection *conn)
@@ -192,6 +305,7 @@ static struct auth_worker_connection *auth_worker_create(void)
 
 	conn = i_new(struct auth_worker_connection, 1);
 	conn->fd = fd;
+	i_array_init(&conn->requests, 8);
 	conn->input = i_stream_create_fd(fd, AUTH_WORKER_MAX_LINE_LENGTH);
 	conn->output = o_stream_create_fd(fd, (size_t)-1);
 	o_stream_set_no_error_handling(conn->output, TRUE);
@@ -210,6 +324,7 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 {
 	struct auth_worker_connection *conn = *_conn;
 	struct auth_worker_connection *const *conns;
+	struct auth_worker_request *const *requestp;
 	unsigned int idx;
 
 	*_conn = NULL;
@@ -228,17 +343,26 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 		}
 	}
 
-	if (conn->request == NULL)
+	if (array_count(&conn->requests) == 0)
 		idle_count--;
 
-	if (conn->request != NULL) {
+	/* the connection is no longer in the connections array, so the
+	   callbacks can't send new requests to it */
+	array_foreach(&conn->requests, requestp) {
+		struct auth_worker_request *request = *requestp;
+
+		if (request->aborted) {
+			i_free(request);
+			continue;
+		}
 		i_error("auth worker: Aborted %s request for %s: %s",
-			t_strcut(conn->request->data, '\t'),
-			conn->request->username, reason);
-		conn->request->callback(t_strdup_printf(
+			t_strcut(request->data, '\t'),
+			request->username, reason);
+		request->callback(t_strdup_printf(
 				"FAIL\t%d", PASSDB_RESULT_INTERNAL_FAILURE),
-				conn->request->context);
+				request->context);
 	}
+	array_free(&conn->requests);
 
 	if (conn->io != NULL)
 		io_remove(&conn->io);
@@ -246,6 +370,8 @@ static void auth_worker_destroy(struct auth_worker_connection **_conn,
 	o_stream_destroy(&conn->output);
 	if (conn->to != NULL)
 		timeout_remove(&conn->to);
+	if (conn->to_abort != NULL)
+		timeout_remove(&conn->to_abort);
 
 	if (close(conn->fd) < 0)
 		i_error("close(auth worker) failed: %m");
@@ -268,16 +394,46 @@ static struct auth_worker_connection *auth_worker_find_free(void)
 	array_foreach_modifiable(&connections, conns) {
 		struct auth_worker_connection *conn = *conns;
 
-		if (conn->request == NULL)
+		if (array_count(&conn->requests) == 0)
 			return conn;
 	}
 	i_unreached();
 	return NULL;
 }
 
+static struct auth_worker_connection *auth_worker_find_least_busy(void)
+{
+	struct auth_worker_connection *const *conns, *best = NULL;
+
+	array_foreach(&connections, conns) {
+		struct auth_worker_connection *conn = *conns;
+
+		if (auth_worker_can_pipeline(conn) &&
+		    (best == NULL || array_count(&conn->requests) <
+		     array_count(&best->requests)))
+			best = conn;
+	}
+	return best;
+}
+
+static struct auth_worker_request *
+auth_worker_request_lookup(struct auth_worker_connection *conn,
+			   unsigned int id, unsigned int *idx_r)
+{
+	struct auth_worker_request *const *requestp;
+
+	array_foreach(&conn->requests, requestp) {
+		if ((*requestp)->id == id) {
+			*idx_r = array_foreach_idx(&conn->requests, requestp);
+			return *requestp;
+		}
+	}
+	return NULL;
+}
+
 static bool auth_worker_request_handle(struct auth_worker_connection *conn,
 				       struct auth_worker_request *request,
-				       const char *line)
+				       unsigned int idx, const char *line)
 {
 	if (strncmp(line, "*\t", 2) == 0) {
 		/* multi-line reply, not finished yet */
@@ -291,14 +447,26 @@ static bool auth_worker_request_handle(struct auth_worker_connection *conn,
 		}
 	} else {
 		conn->resuming = FALSE;
-		conn->request = NULL;
+		array_delete(&conn->requests, idx, 1);
 		conn->timeout_pending_resume = FALSE;
 		timeout_remove(&conn->to);
-		conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
-				       auth_worker_idle_timeout, conn);
-		idle_count++;
+		if (array_count(&conn->requests) > 0) {
+			conn->to = timeout_add(auth_worker_lookup_timeout_msecs,
+					       auth_worker_call_timeout, conn);
+		} else {
+			conn->to = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
+					       auth_worker_idle_timeout, conn);
+			idle_count++;
+		}
+		if (request->pipelined && conn->to_abort != NULL)
+			auth_worker_abort_timeout_update(conn);
 	}
 
+	if (request->aborted) {
+		/* the request was already failed */
+		i_free(request);
+		return TRUE;
+	}
 	if (!request->callback(line, request->context) && conn->io != NULL) {
 		conn->timeout_pending_resume = FALSE;
 		timeout_remove(&conn->to);
@@ -355,8 +523,9 @@ static void auth_worker_success(struct auth_worker_connection *conn)
 
 static void worker_input(struct auth_worker_connection *conn)
 {
+	struct auth_worker_request *request;
 	const char *line, *id_str;
-	unsigned int id;
+	unsigned int id, idx;
 
 	switch (i_stream_read(conn->input)) {
 	case 0:
@@ -398,25 +567,23 @@ static void worker_input(struct auth_worker_connection *conn)
 		    str_to_uint(t_strdup_until(id_str, line), &id) < 0)
 			continue;
 
-		if (conn->request != NULL && id == conn->request->id) {
-			if (!auth_worker_request_handle(conn, conn->request,
+		request = auth_worker_request_lookup(conn, id, &idx);
+		if (request != NULL) {
+			if (!auth_worker_request_handle(conn, request, idx,
 							line + 1))
 				break;
 		} else {
-			if (conn->request != NULL) {
-				i_error("BUG: Worker sent reply with id %u, "
-					"expected %u", id, conn->request->id);
-			} else {
-				i_error("BUG: Worker sent reply with id %u, "
-					"none was expected", id);
-			}
+			i_error("BUG: Worker sent reply with id %u, "
+				"none was expected", id);
 			auth_worker_destroy(&conn, "Worker is buggy", TRUE);
 			return;
 		}
 	}
 
-	if (conn->request != NULL) {
-		/* there's still a pending request */
+	if (array_count(&conn->requests) > 0) {
+		/* there are still pending requests. more may still be
+		   pipelined, unless the worker is about to go away. */
+		auth_worker_request_send_next(conn);
 	} else if (conn->restart)
 		auth_worker_destroy(&conn, "Max requests limit", TRUE);
 	else if (conn->shutdown)
@@ -436,7 +603,8 @@ static void worker_input_resume(struct auth_worker_connection *conn)
 
 struct auth_worker_connection *
 auth_worker_call(pool_t pool, const char *username, const char *data,
-		 auth_worker_callback_t *callback, void *context)
+		 bool pipeline, auth_worker_callback_t *callback,
+		 void *context)
 {
 	struct auth_worker_connection *conn;
 	struct auth_worker_request *request;
@@ -447,6 +615,8 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 	request->data = p_strdup(pool, data);
 	request->callback = callback;
 	request->context = context;
+	request->multiline = strncmp(data, "LIST\t", 5) == 0;
+	request->pipeline = pipeline && !request->multiline;
 
 	if (aqueue_count(worker_request_queue) > 0) {
 		/* requests are already being queued, no chance of
@@ -458,6 +628,12 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 			/* no free connections, create a new one */
 			conn = auth_worker_create();
 		}
+		if (conn == NULL && request->pipeline) {
+			/* all workers are busy, but the request doesn't
+			   block the worker. pipeline it to the one with the
+			   fewest pending requests. */
+			conn = auth_worker_find_least_busy();
+		}
 	}
 	if (conn != NULL) {
 		if (!auth_worker_request_send(conn, request))
@@ -471,7 +647,7 @@ auth_worker_call(pool_t pool, const char *username, const char *data,
 
 void auth_worker_server_resume_input(struct auth_worker_connection *conn)
 {
-	if (conn->request == NULL) {
+	if (array_count(&conn->requests) == 0) {
 		/* request was just finished, don't try to resume it */
 		return;
 	}
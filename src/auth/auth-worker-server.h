@@ -6,9 +6,18 @@ struct auth_stream_reply;
 
 typedef bool auth_worker_callback_t(const char *reply, void *context);
 
+/* Timeout for a worker to finish its next request. Changed by unit tests. */
+extern unsigned int auth_worker_lookup_timeout_msecs;
+/* Max time a request may wait for a worker. Changed by unit tests. */
+extern unsigned int auth_worker_abort_secs;
+
+/* Send a request to an auth worker. If pipeline is TRUE, the request doesn't
+   block the worker process, so it may be sent to a worker that is still
+   busy with earlier requests. Otherwise it waits until a worker is free. */
 struct auth_worker_connection * ATTR_NOWARN_UNUSED_RESULT
 auth_worker_call(pool_t pool, const char *username, const char *data,
-		 auth_worker_callback_t *callback, void *context);
+		 bool pipeline, auth_worker_callback_t *callback,
+		 void *context);
 void auth_worker_server_resume_input(struct auth_worker_connection *conn);
 
 void auth_worker_server_init(void);
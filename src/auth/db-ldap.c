@@ -5,6 +5,7 @@
 #if defined(BUILTIN_LDAP) || defined(PLUGIN_BUILD)
 
 #include "net.h"
+#include "lib-signals.h"
 #include "ioloop.h"
 #include "array.h"
 #include "hash.h"
@@ -120,6 +121,7 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(connection_count),
 
 	{ 0, NULL, 0 }
 };
@@ -156,7 +158,8 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.connection_count = 1
 };
 
 static struct ldap_connection *ldap_connections = NULL;
@@ -408,6 +411,8 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	if (ret > 0) {
 		/* success */
 		i_assert(request->msgid != -1);
+		if (request->send_time.tv_sec == 0)
+			request->send_time = ioloop_timeval;
 		conn->pending_count++;
 		return TRUE;
 	} else if (ret < 0) {
@@ -421,6 +426,125 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	}
 }
 
+static bool db_ldap_conn_is_healthy(struct ldap_connection *conn)
+{
+	return conn->last_connect_failure == 0 ||
+		ioloop_time - conn->last_connect_failure >=
+		DB_LDAP_POOL_FAILURE_RETRY_SECS;
+}
+
+static unsigned int db_ldap_conn_get_load(struct ldap_connection *conn)
+{
+	if (!db_ldap_conn_is_healthy(conn))
+		return UINT_MAX;
+	return aqueue_count(conn->request_queue);
+}
+
+static void db_ldap_pool_init(struct ldap_connection *conn)
+{
+	struct ldap_connection *pconn;
+	unsigned int i;
+
+	/* the pool is created only when the first request is sent, so
+	   passdb/userdb have already set up the attribute maps. they're
+	   never modified after that, so they can be shared. */
+	i_array_init(&conn->pool_conns, conn->set.connection_count - 1);
+	for (i = 1; i < conn->set.connection_count; i++) {
+		pconn = p_new(conn->pool, struct ldap_connection, 1);
+		pconn->pool = conn->pool;
+		pconn->refcount = 1;
+		pconn->pool_main = conn;
+
+		pconn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+		pconn->default_bind_msgid = -1;
+		pconn->fd = -1;
+		pconn->config_path = conn->config_path;
+		pconn->set = conn->set;
+
+		pconn->pass_attr_names = conn->pass_attr_names;
+		pconn->user_attr_names = conn->user_attr_names;
+		pconn->iterate_attr_names = conn->iterate_attr_names;
+		pconn->pass_attr_map = conn->pass_attr_map;
+		pconn->user_attr_map = conn->user_attr_map;
+		pconn->iterate_attr_map = conn->iterate_attr_map;
+		pconn->userdb_used = conn->userdb_used;
+
+		i_array_init(&pconn->request_array, 512);
+		pconn->request_queue = aqueue_init(&pconn->request_array.arr);
+		array_append(&conn->pool_conns, &pconn, 1);
+	}
+}
+
+static struct ldap_connection *
+db_ldap_pool_get_conn(struct ldap_connection *conn)
+{
+	struct ldap_connection *const *connp, *best;
+	unsigned int load, best_load;
+
+	if (conn->pool_main != NULL)
+		conn = conn->pool_main;
+	if (conn->set.connection_count <= 1)
+		return conn;
+	if (!array_is_created(&conn->pool_conns))
+		db_ldap_pool_init(conn);
+
+	/* use the connection with the fewest queued and pending requests.
+	   recently failed connections are used only if all of them have
+	   failed, in which case the first connection keeps retrying. */
+	best = conn;
+	best_load = db_ldap_conn_get_load(conn);
+	array_foreach(&conn->pool_conns, connp) {
+		load = db_ldap_conn_get_load(*connp);
+		if (load < best_load) {
+			best = *connp;
+			best_load = load;
+		}
+	}
+	return best;
+}
+
+static void db_ldap_pool_move_requests(struct ldap_connection *conn)
+{
+	struct ldap_connection *dest;
+	struct ldap_request *const *requestp;
+
+	i_assert(conn->pending_count == 0);
+
+	if (aqueue_count(conn->request_queue) == 0)
+		return;
+	dest = db_ldap_pool_get_conn(conn);
+	if (dest == conn || !db_ldap_conn_is_healthy(dest))
+		return;
+
+	/* none of the requests have been sent, so another connection can
+	   handle them. create_time is kept, so timeouts still apply. */
+	while (aqueue_count(conn->request_queue) > 0) {
+		requestp = array_idx(&conn->request_array,
+				     aqueue_idx(conn->request_queue, 0));
+		aqueue_append(dest->request_queue, requestp);
+		aqueue_delete_tail(conn->request_queue);
+	}
+	while (db_ldap_request_queue_next(dest))
+		;
+}
+
+static void
+db_ldap_conn_add_latency(struct ldap_connection *conn,
+			 const struct ldap_request *request)
+{
+	unsigned int i;
+	int msecs;
+
+	msecs = timeval_diff_msecs(&ioloop_timeval, &request->send_time);
+	if (msecs < 0)
+		msecs = 0;
+	for (i = 0; i < DB_LDAP_LATENCY_BUCKETS-1; i++) {
+		if ((unsigned int)msecs < (1U << i))
+			break;
+	}
+	conn->latency_histogram[i]++;
+}
+
 static bool
 db_ldap_check_limits(struct ldap_connection *conn, struct ldap_request *request)
 {
@@ -451,7 +575,9 @@ void db_ldap_request(struct ldap_connection *conn,
 
 	request->msgid = -1;
 	request->create_time = ioloop_time;
+	memset(&request->send_time, 0, sizeof(request->send_time));
 
+	conn = db_ldap_pool_get_conn(conn);
 	if (!db_ldap_check_limits(conn, request)) {
 		request->callback(conn, request, NULL);
 		return;
@@ -467,18 +593,21 @@ static int db_ldap_connect_finish(struct ldap_connection *conn, int ret)
 		i_error("LDAP: Can't connect to server: %s",
 			conn->set.uris != NULL ?
 			conn->set.uris : conn->set.hosts);
+		conn->last_connect_failure = ioloop_time;
 		return -1;
 	}
 	if (ret != LDAP_SUCCESS) {
 		i_error("LDAP: binding failed (dn %s): %s",
 			conn->set.dn == NULL ? "(none)" : conn->set.dn,
 			ldap_get_error(conn));
+		conn->last_connect_failure = ioloop_time;
 		return -1;
 	}
 
 	if (conn->to != NULL)
 		timeout_remove(&conn->to);
 	conn->conn_state = LDAP_CONN_STATE_BOUND_DEFAULT;
+	conn->last_connect_failure = 0;
 	while (db_ldap_request_queue_next(conn))
 		;
 	return 0;
@@ -814,6 +943,7 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 	if (final_result) {
 		conn->pending_count--;
 		aqueue_delete(conn->request_queue, idx);
+		db_ldap_conn_add_latency(conn, request);
 	}
 
 	T_BEGIN {
@@ -990,6 +1120,7 @@ static void ldap_connection_timeout(struct ldap_connection *conn)
 
 	i_error("LDAP %s: Initial binding to LDAP server timed out",
 		conn->config_path);
+	conn->last_connect_failure = ioloop_time;
 	db_ldap_conn_close(conn);
 }
 
@@ -1187,6 +1318,7 @@ int db_ldap_connect(struct ldap_connection *conn)
 			}
 			i_error("LDAP %s: ldap_start_tls_s() failed: %s",
 				conn->config_path, ldap_err2string(ret));
+			conn->last_connect_failure = ioloop_time;
 			return -1;
 		}
 #else
@@ -1308,6 +1440,11 @@ static void db_ldap_conn_close(struct ldap_connection *conn)
 		io_remove_closed(&conn->io);
 	}
 
+	if (!db_ldap_conn_is_healthy(conn)) {
+		/* let the other connections in the pool handle the queued
+		   requests while this one is failing */
+		db_ldap_pool_move_requests(conn);
+	}
 	if (aqueue_count(conn->request_queue) > 0) {
 		conn->to = timeout_add(DB_LDAP_REQUEST_DISCONNECT_TIMEOUT_SECS *
 				       1000/2, db_ldap_disconnect_timeout, conn);
@@ -1796,6 +1933,50 @@ static struct ldap_connection *ldap_conn_find(const char *config_path)
 	return NULL;
 }
 
+static void
+db_ldap_conn_log_stats(struct ldap_connection *conn, unsigned int conn_idx)
+{
+	string_t *str = t_str_new(128);
+	unsigned int i, count = 0;
+
+	for (i = 0; i < DB_LDAP_LATENCY_BUCKETS; i++) {
+		if (conn->latency_histogram[i] != 0)
+			count = i + 1;
+	}
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append_c(str, ' ');
+		if (i < DB_LDAP_LATENCY_BUCKETS-1)
+			str_printfa(str, "<%u", 1U << i);
+		else
+			str_printfa(str, ">=%u", 1U << (i-1));
+		str_printfa(str, ":%u", conn->latency_histogram[i]);
+	}
+	i_info("LDAP %s: Connection %u%s: %u requests queued, %u pending, "
+	       "reply latency msecs: %s", conn->config_path, conn_idx,
+	       db_ldap_conn_is_healthy(conn) ? "" : " (failing)",
+	       aqueue_count(conn->request_queue), conn->pending_count,
+	       count == 0 ? "(no replies)" : str_c(str));
+
+	/* reset counters */
+	memset(conn->latency_histogram, 0, sizeof(conn->latency_histogram));
+}
+
+static void sig_db_ldap_stats(const siginfo_t *si ATTR_UNUSED, void *context)
+{
+	struct ldap_connection *conn = context;
+	struct ldap_connection *const *connp;
+	unsigned int conn_idx = 1;
+
+	T_BEGIN {
+		db_ldap_conn_log_stats(conn, conn_idx++);
+		if (array_is_created(&conn->pool_conns)) {
+			array_foreach(&conn->pool_conns, connp)
+				db_ldap_conn_log_stats(*connp, conn_idx++);
+		}
+	} T_END;
+}
+
 struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 {
 	struct ldap_connection *conn;
@@ -1833,6 +2014,8 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 
 	if (conn->set.uris == NULL && conn->set.hosts == NULL)
 		i_fatal("LDAP %s: No uris or hosts set", config_path);
+	if (conn->set.connection_count == 0)
+		i_fatal("LDAP %s: connection_count must be at least 1", config_path);
 #ifndef LDAP_HAVE_INITIALIZE
 	if (conn->set.uris != NULL) {
 		i_fatal("LDAP %s: uris set, but Dovecot compiled without support for LDAP uris "
@@ -1883,14 +2066,30 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	conn->next = ldap_connections;
         ldap_connections = conn;
 
+	/* the per-connection stats are useful only with a pool */
+	if (conn->set.connection_count > 1) {
+		lib_signals_set_handler(SIGUSR2, LIBSIG_FLAGS_SAFE,
+					sig_db_ldap_stats, conn);
+	}
 	db_ldap_init_ld(conn);
 	return conn;
 }
 
+static void db_ldap_conn_deinit(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+}
+
 void db_ldap_unref(struct ldap_connection **_conn)
 {
         struct ldap_connection *conn = *_conn;
-	struct ldap_connection **p;
+	struct ldap_connection **p, *const *connp;
 
 	*_conn = NULL;
 	i_assert(conn->refcount >= 0);
@@ -1904,14 +2103,14 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
-
+	if (conn->set.connection_count > 1)
+		lib_signals_unset_handler(SIGUSR2, sig_db_ldap_stats, conn);
+	if (array_is_created(&conn->pool_conns)) {
+		array_foreach(&conn->pool_conns, connp)
+			db_ldap_conn_deinit(*connp);
+		array_free(&conn->pool_conns);
+	}
+	db_ldap_conn_deinit(conn);
 	pool_unref(&conn->pool);
 }
 
@@ -17,6 +17,12 @@
 /* If server disconnects us, don't reconnect if no requests have been sent
    for this many seconds. */
 #define DB_LDAP_IDLE_RECONNECT_SECS 60
+/* Don't send new requests to a pooled connection for this many seconds
+   after it failed to connect, if other connections are usable. */
+#define DB_LDAP_POOL_FAILURE_RETRY_SECS 10
+/* Number of reply latency histogram buckets. The last bucket contains
+   replies that took 2^(n-2) msecs or longer. */
+#define DB_LDAP_LATENCY_BUCKETS 16
 
 #include <ldap.h>
 
@@ -67,6 +73,7 @@ struct ldap_settings {
 	const char *default_pass_scheme;
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
+	unsigned int connection_count;
 
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
@@ -103,6 +110,8 @@ struct ldap_request {
 	int msgid;
 	/* timestamp when request was created */
 	time_t create_time;
+	/* time when the request was first sent */
+	struct timeval send_time;
 
 	bool failed;
 
@@ -174,6 +183,17 @@ struct ldap_connection {
 
 	/* Timestamp when we last received a reply */
 	time_t last_reply_stamp;
+	/* Timestamp when connecting or binding last failed, 0 if the last
+	   attempt succeeded */
+	time_t last_connect_failure;
+	/* Number of replies in each latency bucket since the last stats */
+	unsigned int latency_histogram[DB_LDAP_LATENCY_BUCKETS];
+
+	/* The first connection to the config file owns the other connections
+	   in its pool. pool_main is NULL for the first connection, and
+	   pool_conns is created only for it. */
+	struct ldap_connection *pool_main;
+	ARRAY(struct ldap_connection *) pool_conns;
 
 	char **pass_attr_names, **user_attr_names, **iterate_attr_names;
 	ARRAY_TYPE(ldap_field) pass_attr_map, user_attr_map, iterate_attr_map;
@@ -181,7 +201,8 @@ struct ldap_connection {
 	bool delayed_connect;
 };
 
-/* Send/queue request */
+/* Send/queue request using the least busy connection in conn's pool. The
+   callback is called with the connection that handled the request. */
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request);
 
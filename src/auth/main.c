@@ -19,6 +19,7 @@
 #include "dict.h"
 #include "password-scheme.h"
 #include "passdb-cache.h"
+#include "passdb-blocking.h"
 #include "mech.h"
 #include "auth.h"
 #include "auth-penalty.h"
@@ -245,6 +246,7 @@ static void main_init(void)
 
 	child_wait_init();
 	auth_worker_server_init();
+	passdb_blocking_init();
 	auths_init();
 	auth_request_handler_init();
 	auth_policy_init();
@@ -296,6 +298,7 @@ static void main_deinit(void)
 
 	userdbs_deinit();
 	passdbs_deinit();
+	passdb_blocking_deinit();
 	passdb_cache_deinit();
         password_schemes_deinit();
 	auth_request_stats_deinit();
@@ -1,6 +1,8 @@
 /* Copyright (c) 2005-2016 Dovecot authors, see the included COPYING file */
 
 #include "auth-common.h"
+#include "lib-signals.h"
+#include "hash.h"
 #include "str.h"
 #include "strescape.h"
 #include "auth-worker-server.h"
@@ -8,6 +10,31 @@
 #include "passdb.h"
 #include "passdb-blocking.h"
 
+/* Password verification latency histogram buckets. The first bucket is for
+   <64 usecs, and each following bucket is twice as large as the previous. */
+#define PASSWORD_VERIFY_HISTOGRAM_BUCKETS 16
+#define PASSWORD_VERIFY_HISTOGRAM_MIN_USECS 64
+/* Start verifying the scheme's passwords in auth workers when the median
+   verification time is at least this much. */
+#define PASSWORD_VERIFY_SLOW_USECS 1000
+/* Don't make the decision until the scheme has been verified this many
+   times */
+#define PASSWORD_VERIFY_SLOW_MIN_COUNT 8
+
+struct password_verify_stats {
+	char *scheme;
+	unsigned int count;
+	unsigned int histogram[PASSWORD_VERIFY_HISTOGRAM_BUCKETS];
+
+	bool slow:1;
+};
+
+struct passdb_blocking_verify_context {
+	struct auth_request *request;
+	verify_plain_callback_t *callback;
+};
+
+static HASH_TABLE(char *, struct password_verify_stats *) password_verify_stats;
 
 static void
 auth_worker_reply_parse_args(struct auth_request *request,
@@ -88,6 +115,7 @@ void passdb_blocking_verify_plain(struct auth_request *request)
 
 	auth_request_ref(request);
 	auth_worker_call(request->pool, request->user, str_c(str),
+			 request->passdb->passdb->async_in_worker,
 			 verify_plain_callback, request);
 }
 
@@ -128,6 +156,7 @@ void passdb_blocking_lookup_credentials(struct auth_request *request)
 
 	auth_request_ref(request);
 	auth_worker_call(request->pool, request->user, str_c(str),
+			 request->passdb->passdb->async_in_worker,
 			 lookup_credentials_callback, request);
 }
 
@@ -156,5 +185,219 @@ void passdb_blocking_set_credentials(struct auth_request *request,
 
 	auth_request_ref(request);
 	auth_worker_call(request->pool, request->user, str_c(str),
+			 request->passdb->passdb->async_in_worker,
 			 set_credentials_callback, request);
 }
+
+static unsigned int password_verify_histogram_bucket_usecs(unsigned int idx)
+{
+	return idx == 0 ? 0 : PASSWORD_VERIFY_HISTOGRAM_MIN_USECS << (idx-1);
+}
+
+static unsigned int
+password_verify_stats_median_idx(const struct password_verify_stats *stats)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < PASSWORD_VERIFY_HISTOGRAM_BUCKETS-1; i++) {
+		count += stats->histogram[i];
+		if (count > stats->count / 2)
+			break;
+	}
+	return i;
+}
+
+static struct password_verify_stats *
+password_verify_stats_get(const char *scheme)
+{
+	struct password_verify_stats *stats;
+
+	if (!hash_table_is_created(password_verify_stats)) {
+		hash_table_create(&password_verify_stats, default_pool, 0,
+				  strcase_hash, strcasecmp);
+	}
+	stats = hash_table_lookup(password_verify_stats, scheme);
+	if (stats == NULL) {
+		stats = i_new(struct password_verify_stats, 1);
+		stats->scheme = i_strdup(scheme);
+		hash_table_insert(password_verify_stats, stats->scheme, stats);
+	}
+	return stats;
+}
+
+void passdb_blocking_scheme_add_timing(const char *scheme, long long usecs)
+{
+	struct password_verify_stats *stats;
+	unsigned int idx, median_idx;
+
+	idx = 0;
+	for (usecs /= PASSWORD_VERIFY_HISTOGRAM_MIN_USECS; usecs > 0; usecs /= 2) {
+		if (++idx == PASSWORD_VERIFY_HISTOGRAM_BUCKETS-1)
+			break;
+	}
+
+	stats = password_verify_stats_get(scheme);
+	stats->histogram[idx]++;
+	stats->count++;
+
+	if (stats->slow || stats->count < PASSWORD_VERIFY_SLOW_MIN_COUNT)
+		return;
+	median_idx = password_verify_stats_median_idx(stats);
+	if (password_verify_histogram_bucket_usecs(median_idx) >=
+	    PASSWORD_VERIFY_SLOW_USECS) {
+		stats->slow = TRUE;
+		i_info("Password scheme %s verification is slow "
+		       "(median %u..%u usecs) - verifying it in auth workers",
+		       stats->scheme,
+		       password_verify_histogram_bucket_usecs(median_idx),
+		       password_verify_histogram_bucket_usecs(median_idx+1));
+	}
+}
+
+const char *passdb_blocking_scheme_get_stats(const char *scheme)
+{
+	struct password_verify_stats *stats;
+	string_t *str;
+	unsigned int i, median_idx;
+
+	if (!hash_table_is_created(password_verify_stats))
+		return NULL;
+	stats = hash_table_lookup(password_verify_stats, scheme);
+	if (stats == NULL)
+		return NULL;
+
+	median_idx = password_verify_stats_median_idx(stats);
+	str = t_str_new(128);
+	str_printfa(str, "Password scheme %s verifications: %u, "
+		    "median %u..%u usecs%s, histogram:", stats->scheme,
+		    stats->count,
+		    password_verify_histogram_bucket_usecs(median_idx),
+		    password_verify_histogram_bucket_usecs(median_idx+1),
+		    stats->slow ? " (verified in auth workers)" : "");
+	for (i = 0; i < PASSWORD_VERIFY_HISTOGRAM_BUCKETS; i++) {
+		if (stats->histogram[i] == 0)
+			continue;
+		if (i == PASSWORD_VERIFY_HISTOGRAM_BUCKETS-1) {
+			str_printfa(str, " >=%u:%u",
+				    password_verify_histogram_bucket_usecs(i),
+				    stats->histogram[i]);
+		} else {
+			str_printfa(str, " <%u:%u",
+				    password_verify_histogram_bucket_usecs(i+1),
+				    stats->histogram[i]);
+		}
+	}
+	return str_c(str);
+}
+
+static void
+sig_passdb_blocking_stats(const siginfo_t *si ATTR_UNUSED,
+			  void *context ATTR_UNUSED)
+{
+	struct hash_iterate_context *iter;
+	char *scheme;
+	struct password_verify_stats *stats;
+
+	if (!hash_table_is_created(password_verify_stats))
+		return;
+
+	iter = hash_table_iterate_init(password_verify_stats);
+	while (hash_table_iterate(iter, password_verify_stats,
+				  &scheme, &stats)) T_BEGIN {
+		i_info("%s", passdb_blocking_scheme_get_stats(scheme));
+	} T_END;
+	hash_table_iterate_deinit(&iter);
+}
+
+bool passdb_blocking_scheme_is_slow(const char *scheme)
+{
+	struct password_verify_stats *stats;
+
+	if (!hash_table_is_created(password_verify_stats))
+		return FALSE;
+	stats = hash_table_lookup(password_verify_stats, scheme);
+	return stats != NULL && stats->slow;
+}
+
+static bool password_verify_callback(const char *reply, void *context)
+{
+	struct passdb_blocking_verify_context *ctx = context;
+	struct auth_request *request = ctx->request;
+	enum passdb_result result;
+
+	/* OK | FAIL [\t result] */
+	if (strcmp(reply, "OK") == 0)
+		result = PASSDB_RESULT_OK;
+	else if (strcmp(reply, "FAIL") == 0)
+		result = PASSDB_RESULT_PASSWORD_MISMATCH;
+	else {
+		/* worker failed or request was aborted */
+		if (strncmp(reply, "FAIL\t", 5) != 0) {
+			auth_request_log_error(request, AUTH_SUBSYS_DB,
+				"Received invalid reply from worker: %s", reply);
+		}
+		result = PASSDB_RESULT_INTERNAL_FAILURE;
+	}
+	ctx->callback(result, request);
+	auth_request_unref(&request);
+	return TRUE;
+}
+
+void passdb_blocking_password_verify(struct auth_request *request,
+				     const char *plain_password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback)
+{
+	struct passdb_blocking_verify_context *ctx;
+	string_t *str;
+
+	ctx = p_new(request->pool, struct passdb_blocking_verify_context, 1);
+	ctx->request = request;
+	ctx->callback = callback;
+
+	str = t_str_new(128);
+	str_printfa(str, "PASSW\t%u\t", request->passdb->passdb->id);
+	str_append_tabescaped(str, plain_password);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, crypted_password);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, scheme);
+	str_append_c(str, '\t');
+	auth_request_export(request, str);
+
+	auth_request_ref(request);
+	auth_worker_call(request->pool, request->user, str_c(str), FALSE,
+			 password_verify_callback, ctx);
+}
+
+void passdb_blocking_init(void)
+{
+	/* the password verification latencies are measured only by the
+	   main auth process */
+	if (!worker) {
+		lib_signals_set_handler(SIGUSR2, LIBSIG_FLAGS_SAFE,
+					sig_passdb_blocking_stats, NULL);
+	}
+}
+
+void passdb_blocking_deinit(void)
+{
+	struct hash_iterate_context *iter;
+	char *scheme;
+	struct password_verify_stats *stats;
+
+	if (!worker)
+		lib_signals_unset_handler(SIGUSR2, sig_passdb_blocking_stats,
+					  NULL);
+	if (!hash_table_is_created(password_verify_stats))
+		return;
+
+	iter = hash_table_iterate_init(password_verify_stats);
+	while (hash_table_iterate(iter, password_verify_stats, &scheme, &stats)) {
+		i_free(stats->scheme);
+		i_free(stats);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&password_verify_stats);
+}
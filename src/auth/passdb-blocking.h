@@ -6,4 +6,24 @@ void passdb_blocking_lookup_credentials(struct auth_request *request);
 void passdb_blocking_set_credentials(struct auth_request *request,
 				     const char *new_credentials);
 
+/* Verify the password in an auth worker process. */
+void passdb_blocking_password_verify(struct auth_request *request,
+				     const char *plain_password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback);
+/* Add the time spent verifying a password using the scheme to its latency
+   histogram. */
+void passdb_blocking_scheme_add_timing(const char *scheme, long long usecs);
+/* Returns TRUE if verifying passwords with the scheme has been slow enough
+   that it should be done in auth worker processes. */
+bool passdb_blocking_scheme_is_slow(const char *scheme);
+/* Returns the scheme's verification count and latency histogram as a
+   human-readable string, or NULL if it hasn't been verified yet. These are
+   logged on SIGUSR2. */
+const char *passdb_blocking_scheme_get_stats(const char *scheme);
+
+void passdb_blocking_init(void);
+void passdb_blocking_deinit(void);
+
 #endif
@@ -70,7 +70,6 @@ ldap_lookup_finish(struct auth_request *auth_request,
 {
 	enum passdb_result passdb_result;
 	const char *password = NULL, *scheme;
-	int ret;
 
 	if (res == NULL) {
 		passdb_result = PASSDB_RESULT_INTERNAL_FAILURE;
@@ -102,15 +101,11 @@ ldap_lookup_finish(struct auth_request *auth_request,
 		passdb_handle_credentials(passdb_result, password, scheme,
 			ldap_request->callback.lookup_credentials,
 			auth_request);
+	} else if (password != NULL) {
+		auth_request_password_verify_async(auth_request,
+				auth_request->mech_password, password, scheme,
+				ldap_request->callback.verify_plain);
 	} else {
-		if (password != NULL) {
-			ret = auth_request_password_verify(auth_request,
-					auth_request->mech_password,
-					password, scheme, AUTH_SUBSYS_DB);
-			passdb_result = ret > 0 ? PASSDB_RESULT_OK :
-				PASSDB_RESULT_PASSWORD_MISMATCH;
-		}
-
 		ldap_request->callback.verify_plain(passdb_result,
 						    auth_request);
 	}
@@ -436,6 +431,7 @@ passdb_ldap_preinit(pool_t pool, const char *args)
 			  &conn->pass_attr_map,
 			  conn->set.auth_bind ? "password" : NULL);
 	module->module.blocking = conn->set.blocking;
+	module->module.async_in_worker = TRUE;
 	module->module.default_cache_key =
 		auth_cache_parse_key(pool,
 				     t_strconcat(conn->set.base,
@@ -66,7 +66,6 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 		(struct passwd_file_passdb_module *)_module;
 	struct passwd_user *pu;
 	const char *scheme, *crypted_pass;
-        int ret;
 
 	pu = db_passwd_file_lookup(module->pwf, request,
 				   module->username_format);
@@ -77,11 +76,8 @@ passwd_file_verify_plain(struct auth_request *request, const char *password,
 
 	passwd_file_save_results(request, pu, &crypted_pass, &scheme);
 
-	ret = auth_request_password_verify(request, password, crypted_pass,
-					   scheme, AUTH_SUBSYS_DB);
-
-	callback(ret > 0 ? PASSDB_RESULT_OK : PASSDB_RESULT_PASSWORD_MISMATCH,
-		 request);
+	auth_request_password_verify_async(request, password, crypted_pass,
+					   scheme, callback);
 }
 
 static void
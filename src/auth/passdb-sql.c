@@ -130,13 +130,10 @@ static void sql_query_callback(struct sql_result *result,
 		return;
 	}
 
-	ret = auth_request_password_verify(auth_request,
+	auth_request_password_verify_async(auth_request,
 					   auth_request->mech_password,
-					   password, scheme, AUTH_SUBSYS_DB);
-
-	sql_request->callback.verify_plain(ret > 0 ? PASSDB_RESULT_OK :
-					   PASSDB_RESULT_PASSWORD_MISMATCH,
-					   auth_request);
+					   password, scheme,
+					   sql_request->callback.verify_plain);
 	auth_request_unref(&auth_request);
 }
 
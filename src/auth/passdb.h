@@ -64,6 +64,9 @@ struct passdb_module {
 	/* If blocking is set to TRUE, use child processes to access
 	   this passdb. */
 	bool blocking;
+	/* The lookups don't block the auth worker process, so more requests
+	   can be pipelined to a worker while it's busy with earlier ones. */
+	bool async_in_worker;
         /* id is used by blocking passdb to identify the passdb */
 	unsigned int id;
 
@@ -1,6 +1,7 @@
 /* Copyright (c) 2013-2016 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 #include "test-common.h"
@@ -24,6 +25,15 @@ auth_request_get_var_expand_table(const struct auth_request *auth_request ATTR_U
 	return auth_request_var_expand_static_tab;
 }
 
+void auth_request_ref(struct auth_request *request ATTR_UNUSED)
+{
+}
+
+void auth_request_unref(struct auth_request **request)
+{
+	*request = NULL;
+}
+
 static void test_auth_cache_parse_key(void)
 {
 	struct {
@@ -59,10 +69,103 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static bool test_auth_cache_exists(struct auth_cache *cache,
+				   const struct auth_request *request,
+				   const char *key)
+{
+	bool expired, neg_expired;
+
+	return auth_cache_lookup(cache, request, key, NULL,
+				 &expired, &neg_expired) != NULL;
+}
+
+static void test_auth_cache_clock_eviction(void)
+{
+	struct auth_request request;
+	struct auth_cache *cache;
+
+	test_begin("auth cache clock eviction");
+	memset(&request, 0, sizeof(request));
+
+	/* room for exactly two nodes */
+	cache = auth_cache_new(sizeof(struct auth_cache_node)*2 + 16,
+			       3600, 3600);
+	auth_cache_insert(cache, &request, "a", "1", TRUE);
+	auth_cache_insert(cache, &request, "b", "1", TRUE);
+	test_assert(test_auth_cache_exists(cache, &request, "a"));
+
+	/* "a" was referenced, so "b" gets evicted */
+	auth_cache_insert(cache, &request, "c", "1", TRUE);
+	test_assert(test_auth_cache_exists(cache, &request, "c"));
+	test_assert(!test_auth_cache_exists(cache, &request, "b"));
+
+	/* "a" already used its second chance */
+	auth_cache_insert(cache, &request, "d", "1", TRUE);
+	test_assert(!test_auth_cache_exists(cache, &request, "a"));
+	test_assert(test_auth_cache_exists(cache, &request, "c"));
+	test_assert(test_auth_cache_exists(cache, &request, "d"));
+
+	test_assert(auth_cache_clear(cache) == 2);
+	auth_cache_free(&cache);
+	test_end();
+}
+
+static struct auth_cache *test_cache;
+static unsigned int test_wakeup_count;
+
+static void test_auth_cache_wakeup(struct auth_request *request)
+{
+	test_wakeup_count++;
+	/* the same lookup isn't waited for twice */
+	test_assert(!auth_cache_lookup_wait(test_cache, request, "key",
+					    test_auth_cache_wakeup));
+	test_assert(request->cache_lookup == NULL);
+	io_loop_stop(current_ioloop);
+}
+
+static void test_auth_cache_lookup_wait(void)
+{
+	struct auth_request requests[3];
+	struct ioloop *ioloop;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("auth cache lookup wait");
+	ioloop = io_loop_create();
+	pool = pool_alloconly_create("auth cache test", 1024);
+	memset(requests, 0, sizeof(requests));
+	for (i = 0; i < N_ELEMENTS(requests); i++)
+		requests[i].pool = pool;
+	test_cache = auth_cache_new(1024*1024, 3600, 3600);
+
+	test_assert(!auth_cache_lookup_wait(test_cache, &requests[0], "key",
+					    test_auth_cache_wakeup));
+	test_assert(requests[0].cache_lookup != NULL);
+	test_assert(auth_cache_lookup_wait(test_cache, &requests[1], "key",
+					   test_auth_cache_wakeup));
+	test_assert(!auth_cache_lookup_wait(test_cache, &requests[2], "key2",
+					    test_auth_cache_wakeup));
+
+	/* waiters are woken up only after returning to ioloop */
+	auth_cache_lookup_finished(&requests[0]);
+	test_assert(requests[0].cache_lookup == NULL);
+	test_assert(test_wakeup_count == 0);
+	io_loop_run(ioloop);
+	test_assert(test_wakeup_count == 1);
+
+	auth_cache_lookup_finished(&requests[2]);
+	auth_cache_free(&test_cache);
+	pool_unref(&pool);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_clock_eviction,
+		test_auth_cache_lookup_wait,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,547 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "istream.h"
+#include "write-full.h"
+#include "auth-settings.h"
+#include "passdb.h"
+#include "userdb.h"
+#include "auth-worker-server.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <poll.h>
+
+#define TEST_WORKER_SOCKET_PATH "auth-worker"
+#define TEST_LOOKUP_TIMEOUT_MSECS 500
+
+struct test_worker {
+	int fd;
+	struct istream *input;
+};
+
+struct test_request {
+	char *reply;
+	unsigned int line_count;
+	bool finished;
+};
+
+static struct auth_settings test_auth_settings;
+struct auth_settings *global_auth_settings = &test_auth_settings;
+
+static int test_listen_fd;
+static unsigned int test_finished_count, test_wait_count;
+static bool test_timed_out;
+static pool_t test_pool;
+
+void passdbs_generate_md5(unsigned char md5[STATIC_ARRAY MD5_RESULTLEN])
+{
+	memset(md5, 0, MD5_RESULTLEN);
+}
+
+void userdbs_generate_md5(unsigned char md5[STATIC_ARRAY MD5_RESULTLEN])
+{
+	memset(md5, 0, MD5_RESULTLEN);
+}
+
+static bool test_callback(const char *reply, void *context)
+{
+	struct test_request *request = context;
+
+	i_free(request->reply);
+	request->reply = i_strdup(reply);
+	request->line_count++;
+	if (strncmp(reply, "*\t", 2) != 0) {
+		request->finished = TRUE;
+		if (++test_finished_count >= test_wait_count)
+			io_loop_stop(current_ioloop);
+	}
+	return TRUE;
+}
+
+static struct auth_worker_connection *
+test_call_full(const char *data, bool pipeline, struct test_request *request)
+{
+	memset(request, 0, sizeof(*request));
+	return auth_worker_call(test_pool, "testuser", data, pipeline,
+				test_callback, request);
+}
+
+static struct auth_worker_connection *
+test_call(const char *data, struct test_request *request)
+{
+	return test_call_full(data, TRUE, request);
+}
+
+/* Request to a passdb/userdb that blocks the worker */
+static struct auth_worker_connection *
+test_call_blocking(const char *data, struct test_request *request)
+{
+	return test_call_full(data, FALSE, request);
+}
+
+static void test_timeout(bool *timed_out)
+{
+	*timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_run_ioloop(unsigned int msecs)
+{
+	struct timeout *to;
+
+	to = timeout_add(msecs, test_timeout, &test_timed_out);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to);
+}
+
+/* Run ioloop until the given number of requests have finished in total */
+static void test_wait_finished(unsigned int count)
+{
+	test_wait_count = count;
+	test_timed_out = FALSE;
+	if (test_finished_count < count)
+		test_run_ioloop(5000);
+	test_assert(!test_timed_out);
+	test_assert(test_finished_count == count);
+}
+
+/* Let the auth worker server process everything it has received */
+static void test_run_pending(unsigned int msecs)
+{
+	test_wait_count = UINT_MAX;
+	test_run_ioloop(msecs);
+}
+
+static const char *test_worker_read_line(struct test_worker *worker)
+{
+	struct pollfd pfd;
+	const char *line;
+
+	while ((line = i_stream_next_line(worker->input)) == NULL) {
+		memset(&pfd, 0, sizeof(pfd));
+		pfd.fd = worker->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 100) <= 0)
+			return NULL;
+		if (i_stream_read(worker->input) < 0)
+			return NULL;
+	}
+	return line;
+}
+
+static void test_worker_accept(struct test_worker *worker)
+{
+	const char *line;
+
+	worker->fd = net_accept(test_listen_fd, NULL, NULL);
+	test_assert(worker->fd >= 0);
+	if (worker->fd < 0)
+		i_fatal("auth worker connection wasn't created");
+	worker->input = i_stream_create_fd(worker->fd, 1024);
+
+	line = test_worker_read_line(worker);
+	test_assert(line != NULL && strncmp(line, "VERSION\t", 8) == 0);
+	line = test_worker_read_line(worker);
+	test_assert(line != NULL && strncmp(line, "DBHASH\t", 7) == 0);
+}
+
+static void test_worker_deinit(struct test_worker *worker)
+{
+	i_stream_destroy(&worker->input);
+	net_disconnect(worker->fd);
+}
+
+/* Read the next request, which must be the given command. Returns its ID. */
+static unsigned int
+test_worker_read_request(struct test_worker *worker, const char *cmd)
+{
+	const char *line, *p;
+	unsigned int id = 0;
+
+	line = test_worker_read_line(worker);
+	test_assert(line != NULL);
+	if (line == NULL)
+		return 0;
+	p = strchr(line, '\t');
+	test_assert(p != NULL &&
+		    str_to_uint(t_strdup_until(line, p), &id) == 0);
+	test_assert_strcmp(p == NULL ? "" : p + 1, cmd);
+	return id;
+}
+
+static void test_worker_send(struct test_worker *worker, const char *str)
+{
+	if (write_full(worker->fd, str, strlen(str)) < 0)
+		i_fatal("write(auth worker) failed: %m");
+}
+
+static void
+test_worker_reply(struct test_worker *worker, unsigned int id,
+		  const char *reply)
+{
+	test_worker_send(worker, t_strdup_printf("%u\t%s\n", id, reply));
+}
+
+static void test_server_init(unsigned int max_count)
+{
+	test_auth_settings.worker_max_count = max_count;
+	test_finished_count = 0;
+	test_pool = pool_alloconly_create("auth worker requests", 1024);
+
+	(void)unlink(TEST_WORKER_SOCKET_PATH);
+	test_listen_fd = net_listen_unix(TEST_WORKER_SOCKET_PATH, 128);
+	if (test_listen_fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m",
+			TEST_WORKER_SOCKET_PATH);
+	net_set_nonblock(test_listen_fd, TRUE);
+	auth_worker_server_init();
+}
+
+static void test_server_deinit(void)
+{
+	/* no new connections were created */
+	test_assert(net_accept(test_listen_fd, NULL, NULL) == -1);
+
+	auth_worker_server_deinit();
+	i_close_fd(&test_listen_fd);
+	(void)unlink(TEST_WORKER_SOCKET_PATH);
+	pool_unref(&test_pool);
+}
+
+static void test_requests_free(struct test_request *requests,
+			       unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		i_free(requests[i].reply);
+}
+
+static void test_auth_worker_least_busy(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1, w2;
+	struct test_request r[6];
+	unsigned int id_a, id_b, id_c, id_d, id_e, id_f;
+
+	test_begin("auth worker least busy");
+	ioloop = io_loop_create();
+	test_server_init(2);
+
+	test_call("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call("PASSV\tb", &r[1]);
+	test_worker_accept(&w2);
+	id_b = test_worker_read_request(&w2, "PASSV\tb");
+	/* both workers are busy and no more can be created */
+	test_call("PASSV\tc", &r[2]);
+	id_c = test_worker_read_request(&w1, "PASSV\tc");
+
+	/* w2 becomes idle and is used again */
+	test_worker_reply(&w2, id_b, "OK\tb");
+	test_wait_finished(1);
+	test_assert_strcmp(r[1].reply, "OK\tb");
+	test_call("PASSV\td", &r[3]);
+	id_d = test_worker_read_request(&w2, "PASSV\td");
+	/* w1 has two pending requests, w2 only one */
+	test_call("PASSV\te", &r[4]);
+	id_e = test_worker_read_request(&w2, "PASSV\te");
+	test_assert(test_worker_read_line(&w1) == NULL);
+
+	/* replies are matched by their IDs, not by their order */
+	test_worker_reply(&w1, id_c, "OK\tc");
+	test_worker_reply(&w1, id_a, "OK\ta");
+	test_worker_reply(&w2, id_e, "OK\te");
+	test_worker_reply(&w2, id_d, "OK\td");
+	test_wait_finished(5);
+	test_assert_strcmp(r[0].reply, "OK\ta");
+	test_assert_strcmp(r[2].reply, "OK\tc");
+	test_assert_strcmp(r[3].reply, "OK\td");
+	test_assert_strcmp(r[4].reply, "OK\te");
+
+	/* both workers are idle now, the first one gets the next request */
+	test_call("PASSV\tf", &r[5]);
+	id_f = test_worker_read_request(&w1, "PASSV\tf");
+	test_assert(id_f == id_c + 1);
+	test_worker_reply(&w1, id_f, "OK\tf");
+	test_wait_finished(6);
+	test_assert_strcmp(r[5].reply, "OK\tf");
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_worker_deinit(&w2);
+	test_requests_free(r, N_ELEMENTS(r));
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_timeout(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1, w2;
+	struct test_request r[3];
+	unsigned int id_a, id_b;
+
+	test_begin("auth worker timeout");
+	ioloop = io_loop_create();
+	auth_worker_lookup_timeout_msecs = TEST_LOOKUP_TIMEOUT_MSECS;
+	test_server_init(1);
+
+	test_call("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call("PASSV\tb", &r[1]);
+	id_b = test_worker_read_request(&w1, "PASSV\tb");
+
+	/* the timeout is restarted when the worker finishes a request, so
+	   the second request isn't aborted even though it has been pending
+	   for longer than the timeout. */
+	test_run_pending(TEST_LOOKUP_TIMEOUT_MSECS * 3 / 5);
+	test_worker_reply(&w1, id_a, "OK\ta");
+	test_wait_finished(1);
+	test_run_pending(TEST_LOOKUP_TIMEOUT_MSECS * 3 / 5);
+	test_worker_reply(&w1, id_b, "OK\tb");
+	test_wait_finished(2);
+	test_assert_strcmp(r[0].reply, "OK\ta");
+	test_assert_strcmp(r[1].reply, "OK\tb");
+
+	/* a stalled worker gets its requests failed and is replaced */
+	test_call("PASSV\tc", &r[2]);
+	(void)test_worker_read_request(&w1, "PASSV\tc");
+	test_expect_errors(1);
+	test_wait_finished(3);
+	test_expect_no_more_errors();
+	test_assert(strncmp(r[2].reply, "FAIL\t", 5) == 0);
+	test_worker_accept(&w2);
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_worker_deinit(&w2);
+	test_requests_free(r, N_ELEMENTS(r));
+	auth_worker_lookup_timeout_msecs = 60*1000;
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_list(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1;
+	struct test_request r[4];
+	unsigned int id_a, id_b, id_list, id_c;
+
+	test_begin("auth worker LIST");
+	ioloop = io_loop_create();
+	test_server_init(1);
+
+	test_call("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call("PASSV\tb", &r[1]);
+	id_b = test_worker_read_request(&w1, "PASSV\tb");
+	/* LIST isn't pipelined, and the requests after it are queued */
+	test_assert(test_call("LIST\t1", &r[2]) == NULL);
+	test_assert(test_call("PASSV\tc", &r[3]) == NULL);
+	test_assert(test_worker_read_line(&w1) == NULL);
+
+	/* LIST is sent only after the worker has become idle, and the queued
+	   request waits until it's finished */
+	test_worker_reply(&w1, id_a, "OK\ta");
+	test_wait_finished(1);
+	test_assert(test_worker_read_line(&w1) == NULL);
+	test_worker_reply(&w1, id_b, "OK\tb");
+	test_wait_finished(2);
+	id_list = test_worker_read_request(&w1, "LIST\t1");
+	test_assert(test_worker_read_line(&w1) == NULL);
+	test_worker_reply(&w1, id_list, "*\tuser1");
+	test_run_pending(100);
+	test_assert(r[2].line_count == 1 && !r[2].finished);
+	test_assert(test_worker_read_line(&w1) == NULL);
+	test_worker_reply(&w1, id_list, "*\tuser2");
+	test_worker_reply(&w1, id_list, "OK");
+	test_wait_finished(3);
+	test_assert(r[2].line_count == 3);
+	test_assert_strcmp(r[2].reply, "OK");
+
+	id_c = test_worker_read_request(&w1, "PASSV\tc");
+	test_worker_reply(&w1, id_c, "OK\tc");
+	test_wait_finished(4);
+	test_assert_strcmp(r[3].reply, "OK\tc");
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_requests_free(r, N_ELEMENTS(r));
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_error(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1, w2;
+	struct test_request r[4];
+	unsigned int id_a, id_b, id_c, id_d;
+
+	test_begin("auth worker error");
+	ioloop = io_loop_create();
+	test_server_init(2);
+
+	test_call("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call("PASSV\tb", &r[1]);
+	test_worker_accept(&w2);
+	id_b = test_worker_read_request(&w2, "PASSV\tb");
+	test_call("PASSV\tc", &r[2]);
+	id_c = test_worker_read_request(&w1, "PASSV\tc");
+
+	/* w1 fails. it has fewer pending requests than w2 after this, but
+	   new requests are still pipelined to w2. */
+	test_worker_send(&w1, "ERROR\n");
+	test_worker_reply(&w1, id_a, "FAIL\t1");
+	test_wait_finished(1);
+	test_call("PASSV\td", &r[3]);
+	id_d = test_worker_read_request(&w2, "PASSV\td");
+	test_assert(test_worker_read_line(&w1) == NULL);
+
+	test_worker_send(&w1, "SUCCESS\n");
+	test_worker_reply(&w1, id_c, "OK\tc");
+	test_worker_reply(&w2, id_b, "OK\tb");
+	test_worker_reply(&w2, id_d, "OK\td");
+	test_wait_finished(4);
+	test_assert_strcmp(r[0].reply, "FAIL\t1");
+	test_assert_strcmp(r[1].reply, "OK\tb");
+	test_assert_strcmp(r[2].reply, "OK\tc");
+	test_assert_strcmp(r[3].reply, "OK\td");
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_worker_deinit(&w2);
+	test_requests_free(r, N_ELEMENTS(r));
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_blocking(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1, w2;
+	struct test_request r[5];
+	unsigned int id_a, id_b, id_c, id_d, id_e;
+
+	test_begin("auth worker blocking requests");
+	ioloop = io_loop_create();
+	test_server_init(2);
+
+	test_call_blocking("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call_blocking("PASSV\tb", &r[1]);
+	test_worker_accept(&w2);
+	id_b = test_worker_read_request(&w2, "PASSV\tb");
+	/* both workers are busy, so the request is queued */
+	test_assert(test_call_blocking("PASSV\tc", &r[2]) == NULL);
+	test_assert(test_worker_read_line(&w1) == NULL);
+	test_assert(test_worker_read_line(&w2) == NULL);
+
+	/* it's sent to the worker that becomes free first */
+	test_worker_reply(&w2, id_b, "OK\tb");
+	test_wait_finished(1);
+	id_c = test_worker_read_request(&w2, "PASSV\tc");
+
+	/* non-blocking requests are still pipelined */
+	test_call("PASSV\td", &r[3]);
+	id_d = test_worker_read_request(&w1, "PASSV\td");
+	test_assert(test_call_blocking("PASSV\te", &r[4]) == NULL);
+
+	/* w1 finishing a request doesn't make it free */
+	test_worker_reply(&w1, id_d, "OK\td");
+	test_wait_finished(2);
+	test_assert(test_worker_read_line(&w1) == NULL);
+	test_worker_reply(&w2, id_c, "OK\tc");
+	test_wait_finished(3);
+	id_e = test_worker_read_request(&w2, "PASSV\te");
+	test_assert(test_worker_read_line(&w1) == NULL);
+
+	test_worker_reply(&w1, id_a, "OK\ta");
+	test_worker_reply(&w2, id_e, "OK\te");
+	test_wait_finished(5);
+	test_assert_strcmp(r[0].reply, "OK\ta");
+	test_assert_strcmp(r[1].reply, "OK\tb");
+	test_assert_strcmp(r[2].reply, "OK\tc");
+	test_assert_strcmp(r[3].reply, "OK\td");
+	test_assert_strcmp(r[4].reply, "OK\te");
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_worker_deinit(&w2);
+	test_requests_free(r, N_ELEMENTS(r));
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_worker_pipelined_abort(void)
+{
+	struct ioloop *ioloop;
+	struct test_worker w1;
+	struct test_request r[3];
+	unsigned int id_a, id_b, id_c;
+
+	test_begin("auth worker pipelined abort");
+	ioloop = io_loop_create();
+	auth_worker_abort_secs = 1;
+	test_server_init(1);
+
+	test_call("PASSV\ta", &r[0]);
+	test_worker_accept(&w1);
+	id_a = test_worker_read_request(&w1, "PASSV\ta");
+	test_call("PASSV\tb", &r[1]);
+	id_b = test_worker_read_request(&w1, "PASSV\tb");
+
+	/* the pipelined request is failed after waiting for too long, even
+	   though the worker isn't stalled */
+	test_expect_errors(1);
+	test_wait_finished(1);
+	test_expect_no_more_errors();
+	test_assert(r[1].finished && strncmp(r[1].reply, "FAIL\t", 5) == 0);
+	test_assert(!r[0].finished);
+
+	/* its reply is ignored when it finally comes */
+	test_worker_reply(&w1, id_b, "OK\tb");
+	test_worker_reply(&w1, id_a, "OK\ta");
+	test_wait_finished(2);
+	test_assert_strcmp(r[0].reply, "OK\ta");
+	test_assert(r[1].line_count == 1);
+
+	/* the worker is still used */
+	test_call("PASSV\tc", &r[2]);
+	id_c = test_worker_read_request(&w1, "PASSV\tc");
+	test_worker_reply(&w1, id_c, "OK\tc");
+	test_wait_finished(3);
+	test_assert_strcmp(r[2].reply, "OK\tc");
+
+	test_server_deinit();
+	test_worker_deinit(&w1);
+	test_requests_free(r, N_ELEMENTS(r));
+	auth_worker_abort_secs = 60;
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_auth_worker_least_busy,
+		test_auth_worker_timeout,
+		test_auth_worker_list,
+		test_auth_worker_error,
+		test_auth_worker_blocking,
+		test_auth_worker_pipelined_abort,
+		NULL
+	};
+	return test_run(test_functions);
+}
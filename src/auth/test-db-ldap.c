@@ -0,0 +1,573 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "aqueue.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "lib-signals.h"
+#include "env-util.h"
+#include "net.h"
+#include "write-full.h"
+#include "auth-request.h"
+#include "db-ldap.h"
+#include "test-common.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_LDAP_CONFIG_PATH ".test-db-ldap.conf"
+
+/* LDAPMessage protocolOp tags */
+#define TEST_LDAP_OP_BIND_REQUEST 0x60
+#define TEST_LDAP_OP_BIND_RESPONSE 0x61
+#define TEST_LDAP_OP_UNBIND_REQUEST 0x42
+#define TEST_LDAP_OP_SEARCH_REQUEST 0x63
+#define TEST_LDAP_OP_SEARCH_ENTRY 0x64
+#define TEST_LDAP_OP_SEARCH_DONE 0x65
+
+/* A minimal LDAP server, which understands just enough BER to parse the
+   requests' message IDs and search bases. */
+struct test_ldap_server {
+	int fd;
+	struct istream *input;
+};
+
+struct test_ldap_msg {
+	int msgid;
+	unsigned char op;
+	/* search base for search requests */
+	const char *base;
+};
+
+struct test_request {
+	/* must be the first field */
+	struct ldap_request_search search;
+
+	/* connection that handled the request */
+	struct ldap_connection *conn;
+	bool finished;
+	bool success;
+};
+
+static int test_listen_fd;
+static in_port_t test_port;
+static unsigned int test_finished_count, test_wait_count;
+static bool test_timed_out;
+static struct auth_request *test_auth_request;
+static ARRAY_TYPE(ldap_field) test_attr_map;
+
+const char auth_default_subsystems[2];
+
+void auth_request_ref(struct auth_request *request ATTR_UNUSED)
+{
+}
+
+void auth_request_unref(struct auth_request **request)
+{
+	*request = NULL;
+}
+
+void auth_request_log_debug(struct auth_request *auth_request ATTR_UNUSED,
+			    const char *subsystem ATTR_UNUSED,
+			    const char *format ATTR_UNUSED, ...)
+{
+}
+
+void auth_request_log_info(struct auth_request *auth_request ATTR_UNUSED,
+			   const char *subsystem ATTR_UNUSED,
+			   const char *format ATTR_UNUSED, ...)
+{
+}
+
+void auth_request_log_warning(struct auth_request *auth_request ATTR_UNUSED,
+			      const char *subsystem ATTR_UNUSED,
+			      const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	i_warning("%s", t_strdup_vprintf(format, args));
+	va_end(args);
+}
+
+void auth_request_log_error(struct auth_request *auth_request ATTR_UNUSED,
+			    const char *subsystem ATTR_UNUSED,
+			    const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	i_error("%s", t_strdup_vprintf(format, args));
+	va_end(args);
+}
+
+static bool
+test_ber_get_length(const unsigned char *data, size_t size,
+		    size_t *pos, size_t *len_r)
+{
+	unsigned int i, count;
+
+	if (*pos >= size)
+		return FALSE;
+	if ((data[*pos] & 0x80) == 0) {
+		*len_r = data[(*pos)++];
+		return TRUE;
+	}
+	count = data[(*pos)++] & 0x7f;
+	if (count > sizeof(*len_r) || *pos + count > size)
+		return FALSE;
+	*len_r = 0;
+	for (i = 0; i < count; i++)
+		*len_r = (*len_r << 8) | data[(*pos)++];
+	return TRUE;
+}
+
+/* Returns TRUE if a full message was parsed from the input buffer. */
+static bool
+test_server_parse(struct test_ldap_server *server, struct test_ldap_msg *msg_r)
+{
+	const unsigned char *data;
+	size_t size, pos = 1, len, msg_end, i;
+
+	memset(msg_r, 0, sizeof(*msg_r));
+	data = i_stream_get_data(server->input, &size);
+	if (size == 0)
+		return FALSE;
+	if (data[0] != 0x30)
+		i_fatal("LDAP client sent invalid message");
+	if (!test_ber_get_length(data, size, &pos, &len) || pos + len > size)
+		return FALSE;
+	msg_end = pos + len;
+
+	/* messageID INTEGER */
+	if (data[pos++] != 0x02 ||
+	    !test_ber_get_length(data, msg_end, &pos, &len) ||
+	    len == 0 || len > 4 || pos + len > msg_end)
+		i_fatal("LDAP client sent invalid messageID");
+	for (i = 0; i < len; i++)
+		msg_r->msgid = (msg_r->msgid << 8) | data[pos++];
+
+	/* protocolOp */
+	msg_r->op = data[pos++];
+	if (!test_ber_get_length(data, msg_end, &pos, &len))
+		i_fatal("LDAP client sent invalid protocolOp");
+	if (msg_r->op == TEST_LDAP_OP_SEARCH_REQUEST) {
+		/* baseObject is the first field */
+		if (data[pos++] != 0x04 ||
+		    !test_ber_get_length(data, msg_end, &pos, &len) ||
+		    pos + len > msg_end)
+			i_fatal("LDAP client sent invalid search request");
+		msg_r->base = t_strndup(data + pos, len);
+	}
+	i_stream_skip(server->input, msg_end);
+	return TRUE;
+}
+
+static void test_timeout(bool *timed_out)
+{
+	*timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void test_server_readable(struct test_ldap_server *server ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+/* Read the next message from the client. The ioloop runs while waiting, so
+   the LDAP client can process its input and send more requests. Returns
+   FALSE if nothing was received within the timeout or the client
+   disconnected. */
+static bool
+test_server_read(struct test_ldap_server *server, unsigned int timeout_msecs,
+		 struct test_ldap_msg *msg_r)
+{
+	struct timeout *to;
+	struct io *io;
+	bool timed_out = FALSE;
+	ssize_t ret;
+
+	while (!test_server_parse(server, msg_r)) {
+		if ((ret = i_stream_read(server->input)) < 0)
+			return FALSE;
+		if (ret > 0)
+			continue;
+		if (timed_out)
+			return FALSE;
+
+		io = io_add(server->fd, IO_READ, test_server_readable, server);
+		to = timeout_add(timeout_msecs, test_timeout, &timed_out);
+		io_loop_run(current_ioloop);
+		timeout_remove(&to);
+		io_remove(&io);
+	}
+	return TRUE;
+}
+
+static void test_server_accept(struct test_ldap_server *server)
+{
+	server->fd = net_accept(test_listen_fd, NULL, NULL);
+	test_assert(server->fd >= 0);
+	if (server->fd < 0)
+		i_fatal("LDAP connection wasn't created");
+	net_set_nonblock(server->fd, TRUE);
+	server->input = i_stream_create_fd(server->fd, (size_t)-1);
+}
+
+static void test_server_deinit(struct test_ldap_server *server)
+{
+	i_stream_destroy(&server->input);
+	net_disconnect(server->fd);
+}
+
+static int test_server_expect_bind(struct test_ldap_server *server)
+{
+	struct test_ldap_msg msg;
+
+	test_assert(test_server_read(server, 5000, &msg));
+	test_assert(msg.op == TEST_LDAP_OP_BIND_REQUEST);
+	return msg.msgid;
+}
+
+static int
+test_server_expect_search(struct test_ldap_server *server, const char *base)
+{
+	struct test_ldap_msg msg;
+
+	test_assert(test_server_read(server, 5000, &msg));
+	test_assert(msg.op == TEST_LDAP_OP_SEARCH_REQUEST);
+	test_assert_strcmp(msg.base == NULL ? "" : msg.base, base);
+	return msg.msgid;
+}
+
+static void test_server_expect_nothing(struct test_ldap_server *server)
+{
+	struct test_ldap_msg msg;
+
+	test_assert(!test_server_read(server, 100, &msg));
+	test_assert(!server->input->eof);
+}
+
+static void test_server_expect_close(struct test_ldap_server *server)
+{
+	struct test_ldap_msg msg;
+
+	test_assert(test_server_read(server, 5000, &msg));
+	test_assert(msg.op == TEST_LDAP_OP_UNBIND_REQUEST);
+	test_assert(!test_server_read(server, 5000, &msg));
+	test_assert(server->input->eof);
+}
+
+static void
+test_server_send(struct test_ldap_server *server, int msgid, unsigned char op,
+		 const void *data, size_t size)
+{
+	buffer_t *buf = buffer_create_dynamic(pool_datastack_create(), 128);
+
+	/* short form lengths are enough for these tests */
+	i_assert(msgid > 0 && msgid < 0x80);
+	i_assert(size + 5 < 0x80);
+
+	buffer_append_c(buf, 0x30);
+	buffer_append_c(buf, size + 5);
+	buffer_append_c(buf, 0x02);
+	buffer_append_c(buf, 1);
+	buffer_append_c(buf, msgid);
+	buffer_append_c(buf, op);
+	buffer_append_c(buf, size);
+	buffer_append(buf, data, size);
+	if (write_full(server->fd, buf->data, buf->used) < 0)
+		i_fatal("write(LDAP client) failed: %m");
+}
+
+static void
+test_server_send_result(struct test_ldap_server *server, int msgid,
+			unsigned char op, unsigned char result_code)
+{
+	/* resultCode, empty matchedDN and diagnosticMessage */
+	const unsigned char result[] = {
+		0x0a, 0x01, result_code, 0x04, 0x00, 0x04, 0x00
+	};
+	test_server_send(server, msgid, op, result, sizeof(result));
+}
+
+static void
+test_server_reply_search(struct test_ldap_server *server, int msgid,
+			 const char *dn)
+{
+	buffer_t *buf = buffer_create_dynamic(pool_datastack_create(), 64);
+
+	/* objectName followed by an empty attribute list */
+	buffer_append_c(buf, 0x04);
+	buffer_append_c(buf, strlen(dn));
+	buffer_append(buf, dn, strlen(dn));
+	buffer_append_c(buf, 0x30);
+	buffer_append_c(buf, 0);
+	test_server_send(server, msgid, TEST_LDAP_OP_SEARCH_ENTRY,
+			 buf->data, buf->used);
+	test_server_send_result(server, msgid, TEST_LDAP_OP_SEARCH_DONE,
+				LDAP_SUCCESS);
+}
+
+static void
+test_search_callback(struct ldap_connection *conn,
+		     struct ldap_request *request, LDAPMessage *res)
+{
+	struct test_request *req = (struct test_request *)request;
+
+	if (res != NULL && ldap_msgtype(res) == LDAP_RES_SEARCH_ENTRY) {
+		/* the final result follows */
+		return;
+	}
+	i_assert(!req->finished);
+	req->conn = conn;
+	req->finished = TRUE;
+	req->success = res != NULL;
+	if (++test_finished_count >= test_wait_count)
+		io_loop_stop(current_ioloop);
+}
+
+static void
+test_search(struct ldap_connection *conn, const char *base,
+	    struct test_request *req)
+{
+	memset(req, 0, sizeof(*req));
+	req->search.request.type = LDAP_REQUEST_TYPE_SEARCH;
+	req->search.request.callback = test_search_callback;
+	req->search.request.auth_request = test_auth_request;
+	req->search.base = base;
+	req->search.filter = "(objectClass=*)";
+	req->search.attr_map = &test_attr_map;
+	db_ldap_request(conn, &req->search.request);
+}
+
+/* Run ioloop until the given number of requests have finished in total */
+static void test_wait_finished(unsigned int count)
+{
+	struct timeout *to;
+
+	test_wait_count = count;
+	test_timed_out = FALSE;
+	if (test_finished_count < count) {
+		to = timeout_add(5000, test_timeout, &test_timed_out);
+		io_loop_run(current_ioloop);
+		timeout_remove(&to);
+	}
+	test_assert(!test_timed_out);
+	test_assert(test_finished_count == count);
+}
+
+static unsigned int test_conn_reply_count(struct ldap_connection *conn)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < DB_LDAP_LATENCY_BUCKETS; i++)
+		count += conn->latency_histogram[i];
+	return count;
+}
+
+static struct ldap_connection *test_db_ldap_init(unsigned int conn_count)
+{
+	struct ip_addr ip;
+	pool_t pool;
+	const char *config;
+	int fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	test_port = 0;
+	test_listen_fd = net_listen(&ip, &test_port, 16);
+	if (test_listen_fd == -1)
+		i_fatal("net_listen() failed: %m");
+	net_set_nonblock(test_listen_fd, TRUE);
+
+	config = t_strdup_printf("uris = ldap://127.0.0.1:%u\n"
+				 "base = dc=test\n"
+				 "connection_count = %u\n",
+				 test_port, conn_count);
+	fd = creat(TEST_LDAP_CONFIG_PATH, 0600);
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", TEST_LDAP_CONFIG_PATH);
+	if (write_full(fd, config, strlen(config)) < 0)
+		i_fatal("write(%s) failed: %m", TEST_LDAP_CONFIG_PATH);
+	i_close_fd(&fd);
+
+	pool = pool_alloconly_create("test auth request", 1024);
+	test_auth_request = p_new(pool, struct auth_request, 1);
+	test_auth_request->pool = pool;
+	i_array_init(&test_attr_map, 1);
+	test_finished_count = 0;
+	return db_ldap_init(TEST_LDAP_CONFIG_PATH, FALSE);
+}
+
+static void test_db_ldap_deinit(struct ldap_connection **conn)
+{
+	/* no unexpected connections were created */
+	test_assert(net_accept(test_listen_fd, NULL, NULL) == -1);
+
+	db_ldap_unref(conn);
+	i_close_fd(&test_listen_fd);
+	i_unlink(TEST_LDAP_CONFIG_PATH);
+	array_free(&test_attr_map);
+	pool_unref(&test_auth_request->pool);
+}
+
+static void test_db_ldap_pool_least_busy(void)
+{
+	struct ldap_connection *conn, *conn2;
+	struct test_ldap_server s1, s2;
+	struct test_request r[4];
+	int bind1, bind2, id1, id2, id3, id4;
+	unsigned int i;
+
+	test_begin("db-ldap pool least busy");
+	conn = test_db_ldap_init(2);
+
+	/* the second connection is opened when the first one is busy */
+	test_search(conn, "cn=1", &r[0]);
+	test_server_accept(&s1);
+	bind1 = test_server_expect_bind(&s1);
+	test_search(conn, "cn=2", &r[1]);
+	test_server_accept(&s2);
+	bind2 = test_server_expect_bind(&s2);
+	conn2 = *array_idx(&conn->pool_conns, 0);
+	/* with equal load the first connection is used */
+	test_search(conn, "cn=3", &r[2]);
+	test_assert(aqueue_count(conn->request_queue) == 2);
+	test_search(conn, "cn=4", &r[3]);
+	test_assert(aqueue_count(conn2->request_queue) == 2);
+
+	test_server_send_result(&s1, bind1, TEST_LDAP_OP_BIND_RESPONSE,
+				LDAP_SUCCESS);
+	id1 = test_server_expect_search(&s1, "cn=1");
+	id3 = test_server_expect_search(&s1, "cn=3");
+	test_server_send_result(&s2, bind2, TEST_LDAP_OP_BIND_RESPONSE,
+				LDAP_SUCCESS);
+	id2 = test_server_expect_search(&s2, "cn=2");
+	id4 = test_server_expect_search(&s2, "cn=4");
+
+	test_server_reply_search(&s2, id4, "cn=4,dc=test");
+	test_server_reply_search(&s1, id3, "cn=3,dc=test");
+	test_server_reply_search(&s1, id1, "cn=1,dc=test");
+	test_server_reply_search(&s2, id2, "cn=2,dc=test");
+	test_wait_finished(4);
+	for (i = 0; i < N_ELEMENTS(r); i++)
+		test_assert_idx(r[i].finished && r[i].success, i);
+	test_assert(r[0].conn == conn && r[2].conn == conn);
+	test_assert(r[1].conn == conn2 && r[3].conn == conn2);
+	test_assert(test_conn_reply_count(conn) == 2);
+	test_assert(test_conn_reply_count(conn2) == 2);
+
+	test_db_ldap_deinit(&conn);
+	test_server_expect_close(&s1);
+	test_server_expect_close(&s2);
+	test_server_deinit(&s1);
+	test_server_deinit(&s2);
+	test_end();
+}
+
+static void test_db_ldap_pool_failure(void)
+{
+	struct ldap_connection *conn, *conn2;
+	struct test_ldap_server s1, s2, s3;
+	struct test_request r[6];
+	int bind1, bind2, bind3, id[6];
+	unsigned int i;
+
+	test_begin("db-ldap pool failure");
+	conn = test_db_ldap_init(2);
+
+	test_search(conn, "cn=1", &r[0]);
+	test_server_accept(&s1);
+	bind1 = test_server_expect_bind(&s1);
+	test_search(conn, "cn=2", &r[1]);
+	test_server_accept(&s2);
+	bind2 = test_server_expect_bind(&s2);
+	conn2 = *array_idx(&conn->pool_conns, 0);
+	test_search(conn, "cn=3", &r[2]);
+
+	/* binding fails. the unsent requests move to the other
+	   connection. */
+	test_expect_errors(1);
+	test_server_send_result(&s1, bind1, TEST_LDAP_OP_BIND_RESPONSE,
+				LDAP_INVALID_CREDENTIALS);
+	test_server_expect_close(&s1);
+	test_expect_no_more_errors();
+	test_assert(conn->last_connect_failure != 0);
+	test_assert(aqueue_count(conn->request_queue) == 0);
+	test_assert(aqueue_count(conn2->request_queue) == 3);
+
+	/* the failed connection isn't used even though it's less busy */
+	test_search(conn, "cn=4", &r[3]);
+	test_assert(aqueue_count(conn2->request_queue) == 4);
+
+	test_server_send_result(&s2, bind2, TEST_LDAP_OP_BIND_RESPONSE,
+				LDAP_SUCCESS);
+	id[1] = test_server_expect_search(&s2, "cn=2");
+	id[0] = test_server_expect_search(&s2, "cn=1");
+	id[2] = test_server_expect_search(&s2, "cn=3");
+	id[3] = test_server_expect_search(&s2, "cn=4");
+	for (i = 0; i < 4; i++)
+		test_server_reply_search(&s2, id[i], "cn=x,dc=test");
+	test_wait_finished(4);
+	for (i = 0; i < 4; i++) {
+		test_assert_idx(r[i].finished && r[i].success, i);
+		test_assert_idx(r[i].conn == conn2, i);
+	}
+
+	/* keep the second connection busy */
+	test_search(conn, "cn=5", &r[4]);
+	id[4] = test_server_expect_search(&s2, "cn=5");
+
+	/* after the retry period the failed connection reconnects and binds
+	   again when the next request is sent via it */
+	conn->last_connect_failure -= DB_LDAP_POOL_FAILURE_RETRY_SECS;
+	test_search(conn, "cn=6", &r[5]);
+	test_server_accept(&s3);
+	bind3 = test_server_expect_bind(&s3);
+	test_server_expect_nothing(&s2);
+	test_server_send_result(&s3, bind3, TEST_LDAP_OP_BIND_RESPONSE,
+				LDAP_SUCCESS);
+	id[5] = test_server_expect_search(&s3, "cn=6");
+	test_assert(conn->last_connect_failure == 0);
+
+	test_server_reply_search(&s3, id[5], "cn=6,dc=test");
+	test_server_reply_search(&s2, id[4], "cn=5,dc=test");
+	test_wait_finished(6);
+	test_assert(r[4].finished && r[4].success && r[4].conn == conn2);
+	test_assert(r[5].finished && r[5].success && r[5].conn == conn);
+
+	test_db_ldap_deinit(&conn);
+	test_server_expect_close(&s2);
+	test_server_expect_close(&s3);
+	test_server_deinit(&s1);
+	test_server_deinit(&s2);
+	test_server_deinit(&s3);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_db_ldap_pool_least_busy,
+		test_db_ldap_pool_failure,
+		NULL
+	};
+	struct ioloop *ioloop;
+	int ret;
+
+	/* don't read the system's ldap.conf */
+	env_put("LDAPNOINIT=1");
+	lib_init();
+	lib_signals_init();
+	/* db_ldap_init() adds the signal handler's io to the ioloop, so use
+	   the same ioloop for all the tests */
+	ioloop = io_loop_create();
+	ret = test_run(test_functions);
+	lib_signals_deinit();
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return ret;
+}
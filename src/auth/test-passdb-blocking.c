@@ -0,0 +1,258 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "auth-common.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "hex-binary.h"
+#include "md5.h"
+#include "randgen.h"
+#include "str.h"
+#include "write-full.h"
+#include "settings-parser.h"
+#include "master-service.h"
+#include "auth-settings.h"
+#include "auth-worker-client.h"
+#include "mech.h"
+#include "passdb.h"
+#include "passdb-blocking.h"
+#include "userdb.h"
+#include "password-scheme.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+bool worker = FALSE, worker_restart_request = FALSE;
+time_t process_start_time;
+struct auth_penalty *auth_penalty;
+
+static const char *const test_auth_settings[] = {
+	"passdb=static",
+	"passdb/static/driver=static",
+	"passdb/static/args=password=secret",
+	"userdb=static",
+	"userdb/static/driver=static",
+	"userdb/static/args=uid=1000 gid=1000",
+	NULL
+};
+
+void auth_refresh_proctitle(void)
+{
+}
+
+void auth_module_load(const char *names ATTR_UNUSED)
+{
+}
+
+static void test_passdb_blocking_slow_threshold(void)
+{
+	const char *stats;
+	unsigned int i;
+
+	test_begin("passdb blocking slow scheme threshold");
+	/* the decision isn't made before there are enough samples */
+	for (i = 0; i < 7; i++)
+		passdb_blocking_scheme_add_timing("TEST-SLOW", 5000);
+	test_assert(!passdb_blocking_scheme_is_slow("TEST-SLOW"));
+	passdb_blocking_scheme_add_timing("TEST-SLOW", 5000);
+	test_assert(passdb_blocking_scheme_is_slow("TEST-SLOW"));
+
+	/* the median is in the 512..1024 usecs bucket, which is below
+	   1 msec */
+	for (i = 0; i < 20; i++)
+		passdb_blocking_scheme_add_timing("TEST-FAST", 1023);
+	test_assert(!passdb_blocking_scheme_is_slow("TEST-FAST"));
+
+	/* 1024 usecs goes to the next bucket, but only the median counts */
+	for (i = 0; i < 5; i++)
+		passdb_blocking_scheme_add_timing("TEST-MEDIAN", 10);
+	for (i = 0; i < 4; i++)
+		passdb_blocking_scheme_add_timing("TEST-MEDIAN", 1024);
+	test_assert(!passdb_blocking_scheme_is_slow("TEST-MEDIAN"));
+	passdb_blocking_scheme_add_timing("TEST-MEDIAN", 1024);
+	test_assert(passdb_blocking_scheme_is_slow("TEST-MEDIAN"));
+
+	/* scheme names are case-insensitive */
+	test_assert(passdb_blocking_scheme_is_slow("test-slow"));
+	test_assert(!passdb_blocking_scheme_is_slow("TEST-UNKNOWN"));
+
+	/* the histograms are exported for SIGUSR2 */
+	test_assert(passdb_blocking_scheme_get_stats("TEST-UNKNOWN") == NULL);
+	stats = passdb_blocking_scheme_get_stats("TEST-MEDIAN");
+	test_assert_strcmp(stats, "Password scheme TEST-MEDIAN "
+			   "verifications: 10, median 1024..2048 usecs "
+			   "(verified in auth workers), histogram: "
+			   "<64:5 <2048:5");
+	stats = passdb_blocking_scheme_get_stats("TEST-FAST");
+	test_assert_strcmp(stats, "Password scheme TEST-FAST "
+			   "verifications: 20, median 512..1024 usecs, "
+			   "histogram: <1024:20");
+	test_end();
+}
+
+static struct auth_settings *test_auth_settings_init(pool_t pool)
+{
+	struct setting_parser_context *parser;
+	const char *error;
+	unsigned int i;
+
+	parser = settings_parser_init(pool, &auth_setting_parser_info, 0);
+	for (i = 0; test_auth_settings[i] != NULL; i++) {
+		if (settings_parse_line(parser, test_auth_settings[i]) < 0) {
+			i_fatal("settings_parse_line(%s) failed: %s",
+				test_auth_settings[i],
+				settings_parser_get_error(parser));
+		}
+	}
+	if (!settings_parser_check(parser, pool, &error))
+		i_fatal("Invalid auth settings: %s", error);
+	return settings_parser_get(parser);
+}
+
+static bool test_timed_out;
+
+static void test_worker_input(struct istream *input)
+{
+	if (i_stream_read(input) != 0)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_worker_timeout(void *context ATTR_UNUSED)
+{
+	test_timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+/* Run ioloop until the worker client has replied with a line. Returns NULL
+   if it disconnected instead. */
+static const char *test_worker_read_line(struct istream *input)
+{
+	struct timeout *to;
+	struct io *io;
+	const char *line;
+
+	test_timed_out = FALSE;
+	io = io_add_istream(input, test_worker_input, input);
+	to = timeout_add(5000, test_worker_timeout, (void *)NULL);
+	while ((line = i_stream_next_line(input)) == NULL &&
+	       !input->eof && !test_timed_out)
+		io_loop_run(current_ioloop);
+	timeout_remove(&to);
+	io_remove(&io);
+	test_assert(!test_timed_out);
+	return line;
+}
+
+static void test_worker_send(int fd, const char *str)
+{
+	if (write_full(fd, str, strlen(str)) < 0)
+		i_fatal("write(auth worker) failed: %m");
+}
+
+static void test_passdb_blocking_passw(void)
+{
+	struct ioloop *ioloop;
+	struct auth_worker_client *client;
+	struct mechanisms_register *mech_reg;
+	struct istream *input;
+	const char *const services[] = { NULL };
+	unsigned char passdb_md5[MD5_RESULTLEN];
+	unsigned char userdb_md5[MD5_RESULTLEN];
+	unsigned int passdb_id;
+	string_t *str;
+	pool_t pool;
+	int fds[2];
+
+	test_begin("passdb blocking PASSW");
+	ioloop = io_loop_create();
+	pool = pool_alloconly_create("auth settings", 1024*4);
+	global_auth_settings = test_auth_settings_init(pool);
+	random_init();
+	passdbs_init();
+	userdbs_init();
+	password_schemes_init();
+	mech_init(global_auth_settings);
+	mech_reg = mech_register_init(global_auth_settings);
+	auths_preinit(global_auth_settings, pool, mech_reg, services);
+	auths_init();
+	passdb_id = auth_default_service()->passdbs->passdb->id;
+
+	worker = TRUE;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	/* the worker client is destroyed like a master service connection */
+	master_service_client_connection_created(master_service);
+	client = auth_worker_client_create(auth_default_service(), fds[0]);
+	input = i_stream_create_fd(fds[1], 1024);
+
+	str = t_str_new(256);
+	str_printfa(str, "VERSION\tauth-worker\t%u\t%u\n",
+		    AUTH_WORKER_PROTOCOL_MAJOR_VERSION,
+		    AUTH_WORKER_PROTOCOL_MINOR_VERSION);
+	passdbs_generate_md5(passdb_md5);
+	userdbs_generate_md5(userdb_md5);
+	str_append(str, "DBHASH\t");
+	binary_to_hex_append(str, passdb_md5, sizeof(passdb_md5));
+	str_append_c(str, '\t');
+	binary_to_hex_append(str, userdb_md5, sizeof(userdb_md5));
+	str_append_c(str, '\n');
+	test_worker_send(fds[1], str_c(str));
+
+	/* the password is verified against the given crypted password,
+	   not the passdb's password */
+	test_worker_send(fds[1], t_strdup_printf(
+		"1\tPASSW\t%u\tpass1\tpass1\tPLAIN\t"
+		"user=testuser\tservice=test\n", passdb_id));
+	test_assert_strcmp(test_worker_read_line(input), "1\tOK");
+	test_worker_send(fds[1], t_strdup_printf(
+		"2\tPASSW\t%u\twrong\t{PLAIN}pass2\tPLAIN\t"
+		"user=testuser\tservice=test\n", passdb_id));
+	test_assert_strcmp(test_worker_read_line(input), "2\tFAIL");
+	/* the timing isn't recorded by workers */
+	test_assert(passdb_blocking_scheme_get_stats("PLAIN") == NULL);
+
+	/* invalid requests disconnect the client */
+	test_expect_errors(1);
+	test_worker_send(fds[1], t_strdup_printf(
+		"3\tPASSW\t%u\tpass\n", passdb_id));
+	test_assert(test_worker_read_line(input) == NULL);
+	test_expect_no_more_errors();
+	test_assert(auth_worker_client == NULL);
+	(void)client;
+
+	i_stream_destroy(&input);
+	i_close_fd(&fds[1]);
+	worker = FALSE;
+	auths_deinit();
+	auths_free();
+	mech_register_deinit(&mech_reg);
+	mech_deinit(global_auth_settings);
+	password_schemes_deinit();
+	userdbs_deinit();
+	passdbs_deinit();
+	random_deinit();
+	pool_unref(&pool);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_passdb_blocking_slow_threshold,
+		test_passdb_blocking_passw,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-passdb-blocking",
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS,
+		&argc, &argv, "");
+	master_service_init_finish(master_service);
+	passdb_blocking_init();
+	ret = test_run(test_functions);
+	passdb_blocking_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -160,6 +160,10 @@ static void userdb_ldap_iterate_callback(struct ldap_connection *conn,
 	   it won't be aborted while it's still running */
 	request->create_time = ioloop_time;
 
+	/* the request may have been sent via another connection in the pool,
+	   which is the one whose input must be paused */
+	ctx->conn = conn;
+
 	ctx->in_callback = TRUE;
 	ldap_iter = db_ldap_result_iterate_init(conn, &urequest->request,
 						res, TRUE);
@@ -266,6 +270,7 @@ userdb_ldap_preinit(pool_t pool, const char *args)
 			  &conn->iterate_attr_names,
 			  &conn->iterate_attr_map, NULL);
 	module->module.blocking = conn->set.blocking;
+	module->module.async_in_worker = TRUE;
 	module->module.default_cache_key =
 		auth_cache_parse_key(pool,
 				     t_strconcat(conn->set.base,
@@ -30,6 +30,9 @@ struct userdb_module {
 	/* If blocking is set to TRUE, use child processes to access
 	   this userdb. */
 	bool blocking;
+	/* The lookups don't block the auth worker process, so more requests
+	   can be pipelined to a worker while it's busy with earlier ones. */
+	bool async_in_worker;
         /* id is used by blocking userdb to identify the userdb */
 	unsigned int id;
 
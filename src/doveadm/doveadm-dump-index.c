@@ -391,6 +391,10 @@ static void dump_cache_hdr(struct mail_cache *cache)
 	printf("field_header_offset .. = %u (0x%08x nontranslated)\n",
 	       mail_index_offset_to_uint32(hdr->field_header_offset),
 	       hdr->field_header_offset);
+	if (hdr->minor_version >= 2) {
+		printf("column_header_offset . = %u\n",
+		       hdr->column_header_offset);
+	}
 
 	printf("-- Cache fields --\n");
 	fields = mail_cache_register_get_list(cache, pool_datastack_create(),
@@ -8,6 +8,7 @@
 #include "net.h"
 #include "iostream.h"
 #include "istream.h"
+#include "istream-ktls.h"
 #include "ostream.h"
 #include "time-util.h"
 #include "var-expand.h"
@@ -102,8 +103,8 @@ struct client *client_create(int fd_in, int fd_out, const char *session_id,
 	client->session_id = p_strdup(pool, session_id);
 	client->fd_in = fd_in;
 	client->fd_out = fd_out;
-	client->input = i_stream_create_fd(fd_in,
-					   set->imap_max_line_length);
+	client->input = i_stream_create_ktls(fd_in,
+					     set->imap_max_line_length);
 	client->output = o_stream_create_fd(fd_out, (size_t)-1);
 	o_stream_set_no_error_handling(client->output, TRUE);
 	i_stream_set_name(client->input, "<imap client>");
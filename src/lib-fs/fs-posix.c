@@ -1,6 +1,8 @@
 /* Copyright (c) 2010-2016 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "ioloop.h"
 #include "buffer.h"
 #include "str.h"
 #include "guid.h"
@@ -36,6 +38,9 @@ struct posix_fs {
 	mode_t mode;
 	bool mode_auto;
 	bool have_dirs;
+
+	/* files with a pending asynchronous fdatasync() */
+	ARRAY(struct posix_fs_file *) fsync_pending;
 };
 
 struct posix_fs_file {
@@ -47,7 +52,13 @@ struct posix_fs_file {
 
 	buffer_t *write_buf;
 
+	struct io_async *fsync_async;
+	int fsync_errno;
+	fs_file_async_callback_t *async_callback;
+	void *async_context;
+
 	bool seek_to_beginning;
+	bool fsync_finished;
 };
 
 struct posix_fs_lock {
@@ -69,6 +80,7 @@ static struct fs *fs_posix_alloc(void)
 
 	fs = i_new(struct posix_fs, 1);
 	fs->fs = fs_class_posix;
+	i_array_init(&fs->fsync_pending, 8);
 	return &fs->fs;
 }
 
@@ -126,6 +138,8 @@ static void fs_posix_deinit(struct fs *_fs)
 {
 	struct posix_fs *fs = (struct posix_fs *)_fs;
 
+	i_assert(array_count(&fs->fsync_pending) == 0);
+	array_free(&fs->fsync_pending);
 	i_free(fs->temp_file_prefix);
 	i_free(fs->root_path);
 	i_free(fs->path_prefix);
@@ -146,6 +160,8 @@ static enum fs_properties fs_posix_get_properties(struct fs *_fs)
 	   able to use doveadm fs commands to delete empty directories. */
 	if (fs->have_dirs)
 		props |= FS_PROPERTY_DIRECTORIES;
+	if (io_async_is_native())
+		props |= FS_PROPERTY_ASYNC;
 	return props;
 }
 
@@ -328,10 +344,36 @@ fs_posix_file_init(struct fs *_fs, const char *path,
 	return &file->file;
 }
 
+static void fs_posix_fsync_remove(struct posix_fs_file *file)
+{
+	struct posix_fs *fs = (struct posix_fs *)file->file.fs;
+	struct posix_fs_file *const *files;
+	unsigned int i, count;
+
+	files = array_get(&fs->fsync_pending, &count);
+	for (i = 0; i < count; i++) {
+		if (files[i] == file) {
+			array_delete(&fs->fsync_pending, i, 1);
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void fs_posix_fsync_abort(struct posix_fs_file *file)
+{
+	if (file->fsync_async != NULL) {
+		io_async_abort(&file->fsync_async);
+		fs_posix_fsync_remove(file);
+	}
+	file->fsync_finished = FALSE;
+}
+
 static void fs_posix_file_close(struct fs_file *_file)
 {
 	struct posix_fs_file *file = (struct posix_fs_file *)_file;
 
+	fs_posix_fsync_abort(file);
 	if (file->fd != -1 && file->file.output == NULL) {
 		if (close(file->fd) < 0) {
 			fs_set_critical(file->file.fs, "close(%s) failed: %m",
@@ -347,6 +389,7 @@ static void fs_posix_file_deinit(struct fs_file *_file)
 
 	i_assert(_file->output == NULL);
 
+	fs_posix_fsync_abort(file);
 	switch (file->open_mode) {
 	case FS_OPEN_MODE_READONLY:
 	case FS_OPEN_MODE_APPEND:
@@ -370,6 +413,27 @@ static void fs_posix_file_deinit(struct fs_file *_file)
 	i_free(file);
 }
 
+static void
+fs_posix_set_async_callback(struct fs_file *_file,
+			    fs_file_async_callback_t *callback, void *context)
+{
+	struct posix_fs_file *file = (struct posix_fs_file *)_file;
+
+	file->async_callback = callback;
+	file->async_context = context;
+}
+
+static void fs_posix_wait_async(struct fs *_fs)
+{
+	struct posix_fs *fs = (struct posix_fs *)_fs;
+	struct posix_fs_file *const *filep;
+
+	if (array_count(&fs->fsync_pending) == 0)
+		return;
+	filep = array_idx(&fs->fsync_pending, 0);
+	io_async_wait((*filep)->fsync_async);
+}
+
 static int fs_posix_open_for_read(struct posix_fs_file *file)
 {
 	i_assert(file->file.output == NULL);
@@ -439,16 +503,57 @@ fs_posix_read_stream(struct fs_file *_file, size_t max_buffer_size)
 	return input;
 }
 
-static int fs_posix_write_finish(struct posix_fs_file *file)
+static void fs_posix_fsync_callback(ssize_t ret, struct posix_fs_file *file)
 {
-	int ret, old_errno;
+	file->fsync_async = NULL;
+	file->fsync_errno = ret < 0 ? errno : 0;
+	file->fsync_finished = TRUE;
+	fs_posix_fsync_remove(file);
+	if (file->async_callback != NULL)
+		file->async_callback(file->async_context);
+}
 
-	if ((file->open_flags & FS_OPEN_FLAG_FSYNC) != 0) {
-		if (fdatasync(file->fd) < 0) {
+static int fs_posix_fsync(struct posix_fs_file *file)
+{
+	struct posix_fs *fs = (struct posix_fs *)file->file.fs;
+
+	if (file->fsync_async != NULL)
+		return 0;
+	if (file->fsync_finished) {
+		file->fsync_finished = FALSE;
+		if (file->fsync_errno != 0) {
+			errno = file->fsync_errno;
 			fs_set_error(file->file.fs, "fdatasync(%s) failed: %m",
 				     file->full_path);
 			return -1;
 		}
+		return 1;
+	}
+
+	if ((file->open_flags & FS_OPEN_FLAG_ASYNC) != 0 &&
+	    current_ioloop != NULL && io_async_is_native()) {
+		/* fdatasync() is the slow part of the write. let the kernel
+		   do it while the caller handles something else. */
+		file->fsync_async = io_async_fsync(file->fd, TRUE,
+			fs_posix_fsync_callback, file);
+		array_append(&fs->fsync_pending, &file, 1);
+		return 0;
+	}
+	if (fdatasync(file->fd) < 0) {
+		fs_set_error(file->file.fs, "fdatasync(%s) failed: %m",
+			     file->full_path);
+		return -1;
+	}
+	return 1;
+}
+
+static int fs_posix_write_finish(struct posix_fs_file *file)
+{
+	int ret, old_errno;
+
+	if ((file->open_flags & FS_OPEN_FLAG_FSYNC) != 0) {
+		if ((ret = fs_posix_fsync(file)) <= 0)
+			return ret;
 	}
 
 	switch (file->open_mode) {
@@ -484,7 +589,7 @@ static int fs_posix_write_finish(struct posix_fs_file *file)
 	file->seek_to_beginning = TRUE;
 	/* allow opening the file after writing to it */
 	file->open_mode = FS_OPEN_MODE_READONLY;
-	return 0;
+	return 1;
 }
 
 static int fs_posix_write(struct fs_file *_file, const void *data, size_t size)
@@ -492,18 +597,26 @@ static int fs_posix_write(struct fs_file *_file, const void *data, size_t size)
 	struct posix_fs_file *file = (struct posix_fs_file *)_file;
 	ssize_t ret;
 
-	if (file->fd == -1) {
+	if (file->fsync_async != NULL || file->fsync_finished) {
+		/* retrying after the async fdatasync() */
+		i_assert(file->open_mode != FS_OPEN_MODE_APPEND);
+	} else if (file->fd == -1) {
 		if (fs_posix_open(file) < 0)
 			return -1;
 	}
 
 	if (file->open_mode != FS_OPEN_MODE_APPEND) {
-		if (write_full(file->fd, data, size) < 0) {
+		if (file->fsync_async == NULL && !file->fsync_finished &&
+		    write_full(file->fd, data, size) < 0) {
 			fs_set_error(_file->fs, "write(%s) failed: %m",
 				     file->full_path);
 			return -1;
 		}
-		return fs_posix_write_finish(file);
+		if ((ret = fs_posix_write_finish(file)) == 0) {
+			fs_set_error_async(_file->fs);
+			return -1;
+		}
+		return ret < 0 ? -1 : 0;
 	}
 
 	/* atomic append - it should either succeed or fail */
@@ -546,7 +659,8 @@ static int fs_posix_write_stream_finish(struct fs_file *_file, bool success)
 	struct posix_fs_file *file = (struct posix_fs_file *)_file;
 	int ret = success ? 0 : -1;
 
-	o_stream_destroy(&_file->output);
+	if (_file->output != NULL)
+		o_stream_destroy(&_file->output);
 
 	switch (file->open_mode) {
 	case FS_OPEN_MODE_APPEND:
@@ -560,7 +674,7 @@ static int fs_posix_write_stream_finish(struct fs_file *_file, bool success)
 	case FS_OPEN_MODE_CREATE_UNIQUE_128:
 	case FS_OPEN_MODE_REPLACE:
 		if (ret == 0)
-			ret = fs_posix_write_finish(file);
+			return fs_posix_write_finish(file);
 		break;
 	case FS_OPEN_MODE_READONLY:
 		i_unreached();
@@ -866,7 +980,8 @@ const struct fs fs_class_posix = {
 		fs_posix_file_deinit,
 		fs_posix_file_close,
 		NULL,
-		NULL, NULL,
+		fs_posix_set_async_callback,
+		fs_posix_wait_async,
 		NULL, NULL,
 		fs_posix_prefetch,
 		fs_posix_read,
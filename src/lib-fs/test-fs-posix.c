@@ -0,0 +1,145 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "unlink-directory.h"
+#include "fs-api.h"
+#include "test-common.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TEST_FS_POSIX_DIR ".test-fs-posix"
+
+static struct fs *test_fs_posix_init(void)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	memset(&fs_set, 0, sizeof(fs_set));
+	fs_set.temp_dir = TEST_FS_POSIX_DIR;
+	if (fs_init("posix", "", &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static void test_fs_posix_check(struct fs *fs, const char *path,
+				const char *data)
+{
+	struct fs_file *file;
+	char buf[32];
+	ssize_t ret;
+
+	file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	ret = fs_read(file, buf, sizeof(buf));
+	test_assert(ret == (ssize_t)strlen(data) &&
+		    memcmp(buf, data, ret) == 0);
+	fs_file_deinit(&file);
+}
+
+static void test_fs_posix_async_write(void)
+{
+	struct ioloop *ioloop;
+	struct fs *fs;
+	struct fs_file *file;
+	int ret;
+
+	test_begin("fs posix async fsync write");
+	ioloop = io_loop_create();
+	fs = test_fs_posix_init();
+
+	file = fs_file_init(fs, TEST_FS_POSIX_DIR"/write", FS_OPEN_MODE_REPLACE |
+			    FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+	while ((ret = fs_write(file, "hello", 5)) < 0 && errno == EAGAIN)
+		fs_wait_async(fs);
+	test_assert(ret == 0);
+	fs_file_deinit(&file);
+	test_fs_posix_check(fs, TEST_FS_POSIX_DIR"/write", "hello");
+
+	/* synchronous writes aren't affected */
+	file = fs_file_init(fs, TEST_FS_POSIX_DIR"/write",
+			    FS_OPEN_MODE_REPLACE | FS_OPEN_FLAG_FSYNC);
+	test_assert(fs_write(file, "world", 5) == 0);
+	fs_file_deinit(&file);
+	test_fs_posix_check(fs, TEST_FS_POSIX_DIR"/write", "world");
+
+	fs_deinit(&fs);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_fs_posix_async_callback(void *context)
+{
+	struct ioloop *ioloop = context;
+
+	io_loop_stop(ioloop);
+}
+
+static void test_fs_posix_async_write_stream(void)
+{
+	struct ioloop *ioloop;
+	struct fs *fs;
+	struct fs_file *file;
+	struct ostream *output;
+	int ret;
+
+	test_begin("fs posix async fsync write stream");
+	ioloop = io_loop_create();
+	fs = test_fs_posix_init();
+
+	file = fs_file_init(fs, TEST_FS_POSIX_DIR"/stream", FS_OPEN_MODE_CREATE |
+			    FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+	fs_file_set_async_callback(file, test_fs_posix_async_callback, ioloop);
+	output = fs_write_stream(file);
+	o_stream_nsend_str(output, "stream");
+	ret = fs_write_stream_finish(file, &output);
+	test_assert(ret == (io_async_is_native() ? 0 : 1));
+	while (ret == 0) {
+		/* the file isn't created until fdatasync() finishes */
+		test_assert(access(TEST_FS_POSIX_DIR"/stream", F_OK) < 0);
+		io_loop_run(ioloop);
+		ret = fs_write_stream_finish_async(file);
+	}
+	test_assert(ret == 1);
+	fs_file_deinit(&file);
+	test_fs_posix_check(fs, TEST_FS_POSIX_DIR"/stream", "stream");
+
+	/* waiting for the fdatasync() without a callback */
+	file = fs_file_init(fs, TEST_FS_POSIX_DIR"/wait", FS_OPEN_MODE_CREATE |
+			    FS_OPEN_FLAG_FSYNC | FS_OPEN_FLAG_ASYNC);
+	output = fs_write_stream(file);
+	o_stream_nsend_str(output, "wait");
+	ret = fs_write_stream_finish(file, &output);
+	while (ret == 0) {
+		fs_wait_async(fs);
+		ret = fs_write_stream_finish_async(file);
+	}
+	test_assert(ret == 1);
+	fs_file_deinit(&file);
+	test_fs_posix_check(fs, TEST_FS_POSIX_DIR"/wait", "wait");
+
+	fs_deinit(&fs);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_fs_posix_async_write,
+		test_fs_posix_async_write_stream,
+		NULL
+	};
+	int ret;
+
+	(void)unlink_directory(TEST_FS_POSIX_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_FS_POSIX_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_FS_POSIX_DIR);
+	ret = test_run(test_functions);
+	if (unlink_directory(TEST_FS_POSIX_DIR, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", TEST_FS_POSIX_DIR);
+	return ret;
+}
@@ -12,6 +12,7 @@
 #include "ostream.h"
 #include "message-parser.h"
 #include "message-decoder.h"
+#include "mail-cache.h"
 #include "mail-storage-private.h"
 #include "mail-namespace.h"
 #include "imap-bodystructure.h"
@@ -461,6 +462,31 @@ imap_msgpart_crlf_seek(struct mail *mail, struct istream *input,
 	return crlf_input;
 }
 
+static void imap_msgpart_lookup_nul_state(struct mail *mail)
+{
+	struct mail_cache_view *cache_view = mail->transaction->cache_view;
+	enum mail_lookup_abort orig_lookup_abort = mail->lookup_abort;
+	struct message_part *parts;
+
+	/* Looking up the message parts from cache also updates the NUL state.
+	   Knowing that there are no NULs avoids wrapping the input with
+	   istream-nonuls, so the data can be sent to the client directly from
+	   the mail file with sendfile(). Don't parse the mail just for this
+	   though. This is only a peek into the cache, so it mustn't make
+	   the message parts wanted in the cache either. */
+	mail_cache_view_update_cache_decisions(cache_view, FALSE);
+	mail->lookup_abort = MAIL_LOOKUP_ABORT_NOT_IN_CACHE;
+	if (mail_get_parts(mail, &parts) < 0 &&
+	    mailbox_get_last_mail_error(mail->box) == MAIL_ERROR_NOTPOSSIBLE) {
+		/* not cached - this isn't an error */
+		mail_storage_clear_error(mail->box->storage);
+	}
+	mail->lookup_abort = orig_lookup_abort;
+	if ((mail->transaction->flags &
+	     MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC) == 0)
+		mail_cache_view_update_cache_decisions(cache_view, TRUE);
+}
+
 static void
 imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 			 bool convert_nuls, bool use_partial_cache,
@@ -501,6 +527,8 @@ imap_msgpart_get_partial(struct mail *mail, const struct imap_msgpart *msgpart,
 		result->size = bytes_left;
 	}
 
+	if (convert_nuls && !mail->has_nuls && !mail->has_no_nuls)
+		imap_msgpart_lookup_nul_state(mail);
 	if (!mail->has_no_nuls && convert_nuls) {
 		/* IMAP literals must not contain NULs. change them to
 		   0x80 characters. */
@@ -562,6 +590,17 @@ imap_msgpart_find_part(struct mail *mail, const struct imap_msgpart *msgpart,
 	return 1;
 }
 
+static bool
+imap_msgpart_get_stream_size(struct istream *input, uoff_t *size_r)
+{
+	/* If the stream reads the mail directly from a file, its size is the
+	   mail's physical size. Looking it up is cheap, unlike with streams
+	   that convert the data (e.g. decompression). */
+	if (!input->readable_fd)
+		return FALSE;
+	return i_stream_get_size(input, TRUE, size_r) > 0;
+}
+
 static int
 imap_msgpart_open_normal(struct mail *mail, struct imap_msgpart *msgpart,
 			 const struct message_part *part,
@@ -594,7 +633,8 @@ imap_msgpart_open_normal(struct mail *mail, struct imap_msgpart *msgpart,
 
 		i_assert(mail->lookup_abort == MAIL_LOOKUP_ABORT_NEVER);
 		mail->lookup_abort = MAIL_LOOKUP_ABORT_READ_MAIL;
-		if (mail_get_physical_size(mail, &body_size.physical_size) < 0)
+		if (mail_get_physical_size(mail, &body_size.physical_size) < 0 &&
+		    !imap_msgpart_get_stream_size(input, &body_size.physical_size))
 			unknown_crlfs = TRUE;
 		mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 		break;
@@ -0,0 +1,151 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Measures how long it takes for a new process to find the log offset for
+   an old modseq, like QRESYNC SELECT does, with and without the saved modseq
+   checkpoints. The log is filled with flag changes, one per transaction, and
+   it's never rotated.
+   Usage: bench-mail-transaction-log-modseq [<transactions> [<selects>]] */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "time-util.h"
+#include "mail-index-private.h"
+#include "mail-index-modseq.h"
+#include "mail-transaction-log-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define BENCH_DIR ".bench-mail-transaction-log-modseq"
+#define BENCH_DEFAULT_TRANSACTIONS 1000000
+#define BENCH_DEFAULT_SELECTS 100
+
+static struct mail_index *bench_index_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(BENCH_DIR, "bench.index");
+	mail_index_set_fsync_mode(index, FSYNC_MODE_NEVER, 0);
+	if (mail_index_open_or_create(index, MAIL_INDEX_OPEN_FLAG_CREATE) < 0)
+		i_fatal("mail_index_open_or_create() failed");
+	return index;
+}
+
+static uint64_t bench_index_create(unsigned int transactions)
+{
+	struct mail_index *index;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 12345;
+	uint64_t highest_modseq;
+	unsigned int i;
+
+	index = bench_index_open();
+	mail_index_modseq_enable(index);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	mail_index_append(trans, 1, &seq);
+	if (mail_index_transaction_commit(&trans) < 0)
+		i_fatal("mail_index_transaction_commit() failed");
+	mail_index_view_close(&view);
+	if (mail_index_sync_begin(index, &sync_ctx, &view, &trans, 0) <= 0 ||
+	    mail_index_sync_commit(&sync_ctx) < 0)
+		i_fatal("mail_index_sync() failed");
+
+	view = mail_index_view_open(index);
+	for (i = 0; i < transactions; i++) {
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_update_flags(trans, 1, i % 2 == 0 ?
+					MODIFY_ADD : MODIFY_REMOVE, MAIL_SEEN);
+		if (mail_index_transaction_commit(&trans) < 0)
+			i_fatal("mail_index_transaction_commit() failed");
+	}
+	mail_index_view_close(&view);
+	highest_modseq = index->log->head->sync_highest_modseq;
+	printf("log size %"PRIuUOFF_T" bytes, highest modseq %llu\n",
+	       index->log->head->sync_offset,
+	       (unsigned long long)highest_modseq);
+	mail_index_close(index);
+	mail_index_free(&index);
+	return highest_modseq;
+}
+
+static void
+bench_selects(const char *name, unsigned int selects, uint64_t highest_modseq,
+	      bool keep_checkpoints)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct timeval start, end;
+	const char *modseq_path;
+	uint32_t log_seq;
+	uoff_t log_offset;
+	unsigned int i;
+	long long usecs = 0;
+
+	modseq_path = t_strconcat(BENCH_DIR"/bench.index.log",
+				  MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL);
+	srand(1);
+	for (i = 0; i < selects; i++) {
+		if (!keep_checkpoints)
+			i_unlink_if_exists(modseq_path);
+
+		/* each SELECT is done by a new process. opening the index
+		   reads the log, but it's not included in the timing. */
+		index = bench_index_open();
+		view = mail_index_view_open(index);
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		if (!mail_index_modseq_get_next_log_offset(view,
+				1 + rand() % highest_modseq,
+				&log_seq, &log_offset))
+			i_fatal("mail_index_modseq_get_next_log_offset() failed");
+		if (gettimeofday(&end, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		usecs += timeval_diff_usecs(&end, &start);
+
+		mail_index_view_close(&view);
+		mail_index_close(index);
+		mail_index_free(&index);
+	}
+	printf("%-12s %10.1f usecs/select\n", name,
+	       (double)usecs / selects);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ioloop *ioloop;
+	unsigned int transactions = BENCH_DEFAULT_TRANSACTIONS;
+	unsigned int selects = BENCH_DEFAULT_SELECTS;
+	uint64_t highest_modseq;
+
+	lib_init();
+	if ((argc > 1 && str_to_uint(argv[1], &transactions) < 0) ||
+	    (argc > 2 && str_to_uint(argv[2], &selects) < 0) ||
+	    transactions == 0 || selects == 0) {
+		i_fatal("Usage: bench-mail-transaction-log-modseq "
+			"[<transactions> [<selects>]]");
+	}
+	/* indexid is taken from ioloop_time */
+	ioloop = io_loop_create();
+
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+	highest_modseq = bench_index_create(transactions);
+
+	bench_selects("scan", selects, highest_modseq, FALSE);
+	bench_selects("checkpoints", selects, highest_modseq, TRUE);
+
+	(void)unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,244 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "mail-cache-private.h"
+
+static uint32_t mail_cache_get_column_header_offset(struct mail_cache *cache)
+{
+	if (MAIL_CACHE_IS_UNUSABLE(cache) || cache->hdr->minor_version < 2)
+		return 0;
+	return cache->hdr->column_header_offset;
+}
+
+bool mail_cache_have_columns(struct mail_cache *cache)
+{
+	return mail_cache_get_column_header_offset(cache) != 0;
+}
+
+static int
+mail_cache_columns_map(struct mail_cache *cache, const void **data_r)
+{
+	uint32_t offset = mail_cache_get_column_header_offset(cache);
+	int ret;
+
+	if (offset == 0) {
+		/* cache was found to be corrupted */
+		return -1;
+	}
+	if ((ret = mail_cache_map(cache, offset, cache->column_area_size,
+				  data_r)) < 0)
+		return -1;
+	if (ret == 0) {
+		mail_cache_set_corrupted(cache,
+			"columns point outside file");
+		return -1;
+	}
+	return 0;
+}
+
+int mail_cache_columns_read(struct mail_cache *cache)
+{
+	const struct mail_cache_column_header *hdr;
+	const struct mail_cache_column *columns;
+	const void *data;
+	uint32_t i, offset, data_size, min_offset;
+	int ret;
+
+	if (cache->columns_read)
+		return 0;
+
+	if (array_is_created(&cache->columns))
+		array_clear(&cache->columns);
+	else
+		i_array_init(&cache->columns, 8);
+	cache->column_row_count = 0;
+
+	offset = mail_cache_get_column_header_offset(cache);
+	if (offset == 0 || cache->map_with_read) {
+		/* no columns, or they'd be too expensive to read every time */
+		cache->columns_read = TRUE;
+		return 0;
+	}
+	if (offset % sizeof(uint32_t) != 0) {
+		mail_cache_set_corrupted(cache, "invalid column header offset");
+		return -1;
+	}
+
+	if ((ret = mail_cache_map(cache, offset, sizeof(*hdr), &data)) <= 0) {
+		if (ret == 0)
+			mail_cache_set_corrupted(cache,
+				"column header points outside file");
+		return -1;
+	}
+	hdr = data;
+	cache->column_area_size = hdr->size;
+	cache->column_row_count = hdr->row_count;
+	cache->column_uid_validity = hdr->uid_validity;
+
+	min_offset = sizeof(*hdr) + hdr->row_count * sizeof(uint32_t) +
+		hdr->column_count * sizeof(struct mail_cache_column);
+	if (hdr->row_count > hdr->size / sizeof(uint32_t) ||
+	    hdr->column_count > hdr->size / sizeof(*columns) ||
+	    min_offset > hdr->size) {
+		mail_cache_set_corrupted(cache, "invalid column header size");
+		return -1;
+	}
+
+	if (mail_cache_columns_map(cache, &data) < 0)
+		return -1;
+	hdr = data;
+	columns = CONST_PTR_OFFSET(data, sizeof(*hdr) +
+				   hdr->row_count * sizeof(uint32_t));
+	for (i = 0; i < hdr->column_count; i++) {
+		data_size = MAIL_CACHE_COLUMN_BITMAP_SIZE(hdr->row_count) +
+			MAIL_CACHE_COLUMN_DATA_SIZE(hdr->row_count,
+						    columns[i].field_size);
+		if (columns[i].field_size == 0 ||
+		    columns[i].field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE ||
+		    columns[i].offset < min_offset ||
+		    columns[i].offset % sizeof(uint32_t) != 0 ||
+		    columns[i].offset > hdr->size ||
+		    hdr->size - columns[i].offset < data_size) {
+			mail_cache_set_corrupted(cache,
+				"invalid column %u", i);
+			return -1;
+		}
+		array_append(&cache->columns, &columns[i], 1);
+	}
+	cache->columns_read = TRUE;
+	return 0;
+}
+
+int mail_cache_columns_find_row(struct mail_cache_view *view, uint32_t seq,
+				uint32_t *row_r)
+{
+	struct mail_cache *cache = view->cache;
+	const struct mail_index_header *idx_hdr;
+	const struct mail_index_ext *ext;
+	const uint32_t *uids;
+	const void *data;
+	uint32_t uid, left, right, idx;
+
+	if (!mail_cache_have_columns(cache))
+		return 0;
+	if (mail_cache_columns_read(cache) < 0)
+		return -1;
+	if (array_count(&cache->columns) == 0)
+		return 0;
+
+	/* the columns are valid only if the index still points to this
+	   cache file */
+	ext = mail_index_view_get_ext(view->view, cache->ext_id);
+	if (ext == NULL || ext->reset_id != cache->hdr->file_seq)
+		return 0;
+	idx_hdr = mail_index_get_header(view->view);
+	if (idx_hdr->uid_validity != cache->column_uid_validity)
+		return 0;
+	if (seq > idx_hdr->messages_count)
+		return 0;
+	mail_index_lookup_uid(view->view, seq, &uid);
+
+	if (mail_cache_columns_map(cache, &data) < 0)
+		return -1;
+	uids = CONST_PTR_OFFSET(data, sizeof(struct mail_cache_column_header));
+
+	/* messages are only expunged after compression, so the row can't be
+	   before seq-1. usually it's exactly there. */
+	left = seq - 1;
+	if (left >= cache->column_row_count)
+		return 0;
+	if (uids[left] == uid) {
+		*row_r = left;
+		return 1;
+	}
+	right = cache->column_row_count;
+	while (left < right) {
+		idx = left + (right - left) / 2;
+		if (uids[idx] < uid)
+			left = idx + 1;
+		else if (uids[idx] > uid)
+			right = idx;
+		else {
+			*row_r = idx;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int mail_cache_column_get_field(struct mail_cache *cache,
+				unsigned int column_idx, uint32_t row,
+				struct mail_cache_iterate_field *field_r)
+{
+	const struct mail_cache_column *column;
+	const unsigned char *bitmap;
+	const void *data;
+	uint32_t file_field;
+
+	i_assert(row < cache->column_row_count);
+
+	column = array_idx(&cache->columns, column_idx);
+	file_field = column->file_field;
+	if (file_field >= cache->file_fields_count) {
+		/* new field, have to re-read fields header */
+		if (!cache->locked) {
+			if (mail_cache_header_fields_read(cache) < 0)
+				return -1;
+		}
+		if (file_field >= cache->file_fields_count) {
+			mail_cache_set_corrupted(cache,
+				"column field index too large (%u >= %u)",
+				file_field, cache->file_fields_count);
+			return -1;
+		}
+	}
+	if (cache->fields[cache->file_field_map[file_field]].field.field_size !=
+	    column->field_size) {
+		mail_cache_set_corrupted(cache,
+			"column field %u size mismatch", file_field);
+		return -1;
+	}
+
+	if (mail_cache_columns_map(cache, &data) < 0)
+		return -1;
+	bitmap = CONST_PTR_OFFSET(data, column->offset);
+	if ((bitmap[row / 8] & (1 << (row % 8))) == 0)
+		return 0;
+
+	field_r->field_idx = cache->file_field_map[file_field];
+	field_r->size = column->field_size;
+	field_r->data = CONST_PTR_OFFSET(bitmap,
+		MAIL_CACHE_COLUMN_BITMAP_SIZE(cache->column_row_count) +
+		row * column->field_size);
+	field_r->offset = mail_cache_get_column_header_offset(cache) +
+		((const unsigned char *)field_r->data -
+		 (const unsigned char *)data);
+	return 1;
+}
+
+int mail_cache_columns_lookup(struct mail_cache_view *view, uint32_t seq,
+			      unsigned int field_idx,
+			      struct mail_cache_iterate_field *field_r)
+{
+	struct mail_cache *cache = view->cache;
+	const struct mail_cache_column *columns;
+	unsigned int i, count;
+	uint32_t file_field, row;
+	int ret;
+
+	file_field = cache->field_file_map[field_idx];
+	if (file_field == (uint32_t)-1)
+		return 0;
+
+	if ((ret = mail_cache_columns_find_row(view, seq, &row)) <= 0)
+		return ret;
+
+	columns = array_get(&cache->columns, &count);
+	for (i = 0; i < count; i++) {
+		if (columns[i].file_field == file_field)
+			return mail_cache_column_get_field(cache, i, row,
+							   field_r);
+	}
+	return 0;
+}
@@ -8,10 +8,18 @@
 #include "file-dotlock.h"
 #include "file-cache.h"
 #include "file-set-size.h"
+#include "time-util.h"
 #include "mail-cache-private.h"
 
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+
+struct mail_cache_copy_column {
+	uint32_t file_field;
+	unsigned int field_size;
+	buffer_t *bitmap, *data;
+};
 
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
@@ -20,6 +28,13 @@ struct mail_cache_copy_context {
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
 
+	/* columns are written only if cache columns are enabled */
+	ARRAY(struct mail_cache_copy_column) columns;
+	/* field_idx -> columns index + 1, 0 if field isn't a column */
+	ARRAY(unsigned int) column_map;
+	ARRAY_TYPE(uint32_t) column_uids;
+	uint32_t column_row;
+
 	uint8_t field_seen_value;
 	bool new_msg;
 };
@@ -46,11 +61,90 @@ mail_cache_merge_bitmask(struct mail_cache_copy_context *ctx,
 		dest[i] |= ((const unsigned char*)field->data)[i];
 }
 
+static bool
+mail_cache_field_want_column(const struct mail_cache_field *field,
+			     enum mail_cache_decision_type dec)
+{
+	/* only fields that are wanted for all messages */
+	if (dec != MAIL_CACHE_DECISION_YES)
+		return FALSE;
+	if (field->type != MAIL_CACHE_FIELD_FIXED_SIZE &&
+	    field->type != MAIL_CACHE_FIELD_BITMASK)
+		return FALSE;
+	return field->field_size > 0 &&
+		field->field_size <= MAIL_CACHE_COLUMN_MAX_FIELD_SIZE;
+}
+
+static struct mail_cache_copy_column *
+mail_cache_copy_get_column(struct mail_cache_copy_context *ctx,
+			   unsigned int field_idx)
+{
+	const unsigned int *idxp;
+
+	if (field_idx >= array_count(&ctx->column_map))
+		return NULL;
+	idxp = array_idx(&ctx->column_map, field_idx);
+	return *idxp == 0 ? NULL :
+		array_idx_modifiable(&ctx->columns, *idxp - 1);
+}
+
+static void
+mail_cache_copy_column_add(struct mail_cache_copy_context *ctx,
+			   const struct mail_cache_iterate_field *field,
+			   uint32_t file_field_idx)
+{
+	struct mail_cache_copy_column *column;
+	unsigned char *bits;
+	unsigned int idx;
+
+	column = mail_cache_copy_get_column(ctx, field->field_idx);
+	if (column == NULL) {
+		column = array_append_space(&ctx->columns);
+		column->file_field = file_field_idx;
+		column->field_size = field->size;
+		column->bitmap = buffer_create_dynamic(default_pool, 1024);
+		column->data = buffer_create_dynamic(default_pool, 4096);
+		idx = array_count(&ctx->columns);
+		array_idx_set(&ctx->column_map, field->field_idx, &idx);
+	}
+
+	bits = buffer_get_space_unsafe(column->bitmap, ctx->column_row / 8, 1);
+	*bits |= 1 << (ctx->column_row % 8);
+	buffer_write(column->data, ctx->column_row * column->field_size,
+		     field->data, field->size);
+}
+
+static bool
+mail_cache_copy_column_has_row(struct mail_cache_copy_context *ctx,
+			       struct mail_cache_copy_column *column)
+{
+	const unsigned char *bits = column->bitmap->data;
+
+	return ctx->column_row / 8 < column->bitmap->used &&
+		(bits[ctx->column_row / 8] & (1 << (ctx->column_row % 8))) != 0;
+}
+
+static void
+mail_cache_copy_column_merge_bitmask(struct mail_cache_copy_context *ctx,
+				     struct mail_cache_copy_column *column,
+				     const struct mail_cache_iterate_field *field)
+{
+	unsigned char *dest;
+	unsigned int i;
+
+	dest = buffer_get_space_unsafe(column->data,
+				       ctx->column_row * column->field_size,
+				       field->size);
+	for (i = 0; i < field->size; i++)
+		dest[i] |= ((const unsigned char*)field->data)[i];
+}
+
 static void
 mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 			  const struct mail_cache_iterate_field *field)
 {
         struct mail_cache_field *cache_field;
+	struct mail_cache_copy_column *column;
 	enum mail_cache_decision_type dec;
 	uint32_t file_field_idx, size32;
 	uint8_t *field_seen;
@@ -65,7 +159,14 @@ mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 					     field->field_idx, 1);
 	if (*field_seen == ctx->field_seen_value) {
 		/* duplicate */
-		if (cache_field->type == MAIL_CACHE_FIELD_BITMASK)
+		if (cache_field->type != MAIL_CACHE_FIELD_BITMASK)
+			return;
+		if (array_is_created(&ctx->columns) &&
+		    (column = mail_cache_copy_get_column(ctx,
+						field->field_idx)) != NULL &&
+		    mail_cache_copy_column_has_row(ctx, column))
+			mail_cache_copy_column_merge_bitmask(ctx, column, field);
+		else
 			mail_cache_merge_bitmask(ctx, field);
 		return;
 	}
@@ -80,6 +181,13 @@ mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 			return;
 	}
 
+	if (array_is_created(&ctx->columns) &&
+	    mail_cache_field_want_column(cache_field, dec) &&
+	    field->size == cache_field->field_size) {
+		mail_cache_copy_column_add(ctx, field, file_field_idx);
+		return;
+	}
+
 	buffer_append(ctx->buffer, &file_field_idx, sizeof(file_field_idx));
 
 	if (cache_field->field_size == UINT_MAX) {
@@ -98,6 +206,86 @@ mail_cache_compress_field(struct mail_cache_copy_context *ctx,
 		buffer_append_zero(ctx->buffer, 4 - (field->size & 3));
 }
 
+static void
+mail_cache_copy_columns_write(struct mail_cache_copy_context *ctx,
+			      struct ostream *output,
+			      const struct mail_index_header *idx_hdr,
+			      struct mail_cache_header *hdr)
+{
+	struct mail_cache_column_header col_hdr;
+	struct mail_cache_copy_column *columns;
+	struct mail_cache_column column;
+	unsigned int i, count;
+	uint32_t offset, bitmap_size;
+
+	columns = array_get_modifiable(&ctx->columns, &count);
+	if (count == 0)
+		return;
+
+	memset(&col_hdr, 0, sizeof(col_hdr));
+	col_hdr.uid_validity = idx_hdr->uid_validity;
+	col_hdr.row_count = ctx->column_row;
+	col_hdr.column_count = count;
+
+	bitmap_size = MAIL_CACHE_COLUMN_BITMAP_SIZE(col_hdr.row_count);
+	offset = sizeof(col_hdr) + col_hdr.row_count * sizeof(uint32_t) +
+		count * sizeof(column);
+	for (i = 0; i < count; i++) {
+		offset += bitmap_size +
+			MAIL_CACHE_COLUMN_DATA_SIZE(col_hdr.row_count,
+						    columns[i].field_size);
+	}
+	col_hdr.size = offset;
+
+	/* records are always 32bit aligned, so the columns are too */
+	i_assert(output->offset % sizeof(uint32_t) == 0);
+	hdr->column_header_offset = output->offset;
+	o_stream_nsend(output, &col_hdr, sizeof(col_hdr));
+	o_stream_nsend(output, array_idx(&ctx->column_uids, 0),
+		       col_hdr.row_count * sizeof(uint32_t));
+
+	offset = sizeof(col_hdr) + col_hdr.row_count * sizeof(uint32_t) +
+		count * sizeof(column);
+	for (i = 0; i < count; i++) {
+		memset(&column, 0, sizeof(column));
+		column.file_field = columns[i].file_field;
+		column.field_size = columns[i].field_size;
+		column.offset = offset;
+		o_stream_nsend(output, &column, sizeof(column));
+		offset += bitmap_size +
+			MAIL_CACHE_COLUMN_DATA_SIZE(col_hdr.row_count,
+						    columns[i].field_size);
+	}
+	for (i = 0; i < count; i++) {
+		/* grow the buffers to full size. the unused parts are
+		   zero-filled. */
+		buffer_write_zero(columns[i].bitmap, columns[i].bitmap->used,
+				  bitmap_size - columns[i].bitmap->used);
+		buffer_write_zero(columns[i].data, columns[i].data->used,
+			MAIL_CACHE_COLUMN_DATA_SIZE(col_hdr.row_count,
+						    columns[i].field_size) -
+			columns[i].data->used);
+		o_stream_nsend(output, columns[i].bitmap->data, bitmap_size);
+		o_stream_nsend(output, columns[i].data->data,
+			       columns[i].data->used);
+	}
+}
+
+static void mail_cache_copy_columns_free(struct mail_cache_copy_context *ctx)
+{
+	struct mail_cache_copy_column *column;
+
+	if (!array_is_created(&ctx->columns))
+		return;
+	array_foreach_modifiable(&ctx->columns, column) {
+		buffer_free(&column->bitmap);
+		buffer_free(&column->data);
+	}
+	array_free(&ctx->columns);
+	array_free(&ctx->column_map);
+	array_free(&ctx->column_uids);
+}
+
 static uint32_t get_next_file_seq(struct mail_cache *cache)
 {
 	const struct mail_index_ext *ext;
@@ -200,6 +388,12 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	ctx.field_seen_value = 0;
 	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
 	t_array_init(&ctx.bitmask_pos, 32);
+	if ((cache->index->flags & MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS) != 0) {
+		i_array_init(&ctx.columns, 8);
+		i_array_init(&ctx.column_map, cache->fields_count + 1);
+		i_array_init(&ctx.column_uids,
+			     mail_index_view_get_messages_count(view));
+	}
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
@@ -269,6 +463,16 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
 			mail_cache_compress_field(&ctx, &field);
 
+		if (array_is_created(&ctx.columns)) {
+			/* each message gets a row, even if it doesn't have
+			   any fields in columns yet */
+			uint32_t uid;
+
+			mail_index_lookup_uid(view, seq, &uid);
+			array_append(&ctx.column_uids, &uid, 1);
+			ctx.column_row++;
+		}
+
 		if (ctx.buffer->used == sizeof(cache_rec) ||
 		    ctx.buffer->used > MAIL_CACHE_RECORD_MAX_SIZE) {
 			/* nothing cached */
@@ -287,6 +491,10 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	i_assert(orig_fields_count == cache->fields_count);
 
 	hdr.record_count = record_count;
+	if (array_is_created(&ctx.columns)) {
+		mail_cache_copy_columns_write(&ctx, output, idx_hdr, &hdr);
+		mail_cache_copy_columns_free(&ctx);
+	}
 	hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
 	mail_cache_compress_get_fields(&ctx, used_fields_count);
 	o_stream_nsend(output, ctx.buffer->data, ctx.buffer->used);
@@ -326,10 +534,22 @@ mail_cache_compress_write(struct mail_cache *cache,
 			  int fd, const char *temp_path, bool *unlock)
 {
 	struct stat st;
+	struct timeval start_time, end_time;
 	uint32_t file_seq, old_offset;
 	ARRAY_TYPE(uint32_t) ext_offsets;
 	const uint32_t *offsets;
 	unsigned int i, count;
+	uoff_t old_size = 0;
+
+	if (cache->fd != -1) {
+		if (fstat(cache->fd, &st) < 0) {
+			mail_cache_set_syscall_error(cache, "fstat()");
+			return -1;
+		}
+		old_size = st.st_size;
+	}
+	if (gettimeofday(&start_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
 
 	if (mail_cache_copy(cache, trans, fd, &file_seq, &ext_offsets) < 0)
 		return -1;
@@ -368,6 +588,14 @@ mail_cache_compress_write(struct mail_cache *cache,
 	cache->st_ino = st.st_ino;
 	cache->st_dev = st.st_dev;
 	cache->field_header_write_pending = FALSE;
+
+	if (gettimeofday(&end_time, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	cache->compress_stats.count++;
+	cache->compress_stats.last_usecs =
+		timeval_diff_usecs(&end_time, &start_time);
+	cache->compress_stats.last_old_size = old_size;
+	cache->compress_stats.last_new_size = st.st_size;
 	return 0;
 }
 
@@ -503,6 +731,9 @@ int mail_cache_compress(struct mail_cache *cache,
 			buffer_set_used_size(cache->read_buf, 0);
 		cache->hdr = NULL;
 		cache->mmap_length = 0;
+		/* the columns aren't read with map_with_read. read them now,
+		   or their fields won't be copied. */
+		cache->columns_read = FALSE;
 	}
 
 	if (cache->index->lock_method == FILE_LOCK_METHOD_DOTLOCK) {
@@ -558,6 +789,39 @@ void mail_cache_compress_unlock(struct mail_cache_compress_lock **_lock)
 	i_free(lock);
 }
 
+int mail_cache_compress_if_needed(struct mail_cache *cache)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_compress_lock *lock;
+	int ret;
+
+	/* need_compress is updated only when the cache header is read */
+	(void)mail_cache_open_and_verify(cache);
+	if (!mail_cache_need_compress(cache))
+		return 0;
+
+	view = mail_index_view_open(cache->index);
+	trans = mail_index_transaction_begin(view,
+					MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	if (mail_cache_compress(cache, trans, &lock) < 0) {
+		mail_index_transaction_rollback(&trans);
+		ret = -1;
+	} else {
+		ret = mail_index_transaction_commit(&trans) < 0 ? -1 : 1;
+		if (lock != NULL)
+			mail_cache_compress_unlock(&lock);
+	}
+	mail_index_view_close(&view);
+	return ret;
+}
+
+void mail_cache_get_compress_stats(struct mail_cache *cache,
+				   struct mail_cache_compress_stats *stats_r)
+{
+	*stats_r = cache->compress_stats;
+}
+
 bool mail_cache_need_compress(struct mail_cache *cache)
 {
 	return cache->need_compress_file_seq != 0 &&
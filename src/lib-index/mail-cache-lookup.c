@@ -232,6 +232,39 @@ mail_cache_lookup_iter_next_record(struct mail_cache_lookup_iterate_ctx *ctx)
 	return 1;
 }
 
+static int
+mail_cache_lookup_iter_next_column(struct mail_cache_lookup_iterate_ctx *ctx,
+				   struct mail_cache_iterate_field *field_r)
+{
+	struct mail_cache *cache = ctx->view->cache;
+	int ret;
+
+	if (!ctx->columns_checked) {
+		/* all records have been returned. continue with columns. */
+		ctx->columns_checked = TRUE;
+		if (MAIL_CACHE_IS_UNUSABLE(cache))
+			return 0;
+		ret = mail_cache_columns_find_row(ctx->view, ctx->seq,
+						  &ctx->column_row);
+		ctx->remap_counter = cache->remap_counter;
+		if (ret <= 0)
+			return ret;
+		ctx->column_row_found = TRUE;
+	}
+	if (!ctx->column_row_found)
+		return 0;
+
+	ret = 0;
+	while (ret == 0 && ctx->column_idx < array_count(&cache->columns)) {
+		if (MAIL_CACHE_IS_UNUSABLE(cache))
+			return -1;
+		ret = mail_cache_column_get_field(cache, ctx->column_idx++,
+						  ctx->column_row, field_r);
+	}
+	ctx->remap_counter = cache->remap_counter;
+	return ret;
+}
+
 int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 				struct mail_cache_iterate_field *field_r)
 {
@@ -241,6 +274,9 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 	uint32_t file_field;
 	int ret;
 
+	if (ctx->columns_checked)
+		return mail_cache_lookup_iter_next_column(ctx, field_r);
+
 	i_assert(ctx->remap_counter == cache->remap_counter);
 
 	if (ctx->pos + sizeof(uint32_t) > ctx->rec_size) {
@@ -250,8 +286,10 @@ int mail_cache_lookup_iter_next(struct mail_cache_lookup_iterate_ctx *ctx,
 			return -1;
 		}
 
-		if ((ret = mail_cache_lookup_iter_next_record(ctx)) <= 0)
-			return ret;
+		if ((ret = mail_cache_lookup_iter_next_record(ctx)) < 0)
+			return -1;
+		if (ret == 0)
+			return mail_cache_lookup_iter_next_column(ctx, field_r);
 	}
 
 	/* return the next field */
@@ -359,9 +397,20 @@ int mail_cache_field_exists(struct mail_cache_view *view, uint32_t seq,
 
 bool mail_cache_field_exists_any(struct mail_cache_view *view, uint32_t seq)
 {
-	uint32_t reset_id;
+	struct mail_cache_iterate_field field;
+	unsigned int i;
+	uint32_t reset_id, row;
+	int ret = 0;
 
-	return mail_cache_lookup_cur_offset(view->view, seq, &reset_id) != 0;
+	if (mail_cache_lookup_cur_offset(view->view, seq, &reset_id) != 0)
+		return TRUE;
+
+	/* the message may have fields only in columns */
+	if (mail_cache_columns_find_row(view, seq, &row) <= 0)
+		return FALSE;
+	for (i = 0; ret == 0 && i < array_count(&view->cache->columns); i++)
+		ret = mail_cache_column_get_field(view->cache, i, row, &field);
+	return ret > 0;
 }
 
 enum mail_cache_decision_type
@@ -409,6 +458,23 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	struct mail_cache_iterate_field field;
 	int ret;
 
+	if (!view->cache->opened)
+		(void)mail_cache_open_and_verify(view->cache);
+
+	field_def = &view->cache->fields[field_idx].field;
+	if (field_def->type != MAIL_CACHE_FIELD_BITMASK) {
+		/* try first the columns, which avoids going through all
+		   the records. bitmasks may have more bits in records. */
+		ret = mail_cache_columns_lookup(view, seq, field_idx, &field);
+		if (ret != 0) {
+			mail_cache_decision_state_update(view, seq, field_idx);
+			if (ret < 0)
+				return -1;
+			buffer_append(dest_buf, field.data, field.size);
+			return 1;
+		}
+	}
+
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
 	if (ret <= 0)
@@ -416,7 +482,6 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 
 	/* the field should exist */
 	mail_cache_lookup_iter_init(view, seq, &iter);
-	field_def = &view->cache->fields[field_idx].field;
 	if (field_def->type == MAIL_CACHE_FIELD_BITMASK) {
 		return mail_cache_lookup_bitmask(&iter, field_idx,
 						 field_def->field_size,
@@ -6,7 +6,7 @@
 #include "mail-cache.h"
 
 #define MAIL_CACHE_MAJOR_VERSION 1
-#define MAIL_CACHE_MINOR_VERSION 1
+#define MAIL_CACHE_MINOR_VERSION 2
 
 /* Drop fields that haven't been accessed for n seconds */
 #define MAIL_CACHE_FIELD_DROP_SECS (3600*24*30)
@@ -28,6 +28,9 @@
 /* If cache record becomes larger than this, don't add it. */
 #define MAIL_CACHE_RECORD_MAX_SIZE (64*1024)
 
+/* Fixed size fields up to this size can be stored in columns */
+#define MAIL_CACHE_COLUMN_MAX_FIELD_SIZE 16
+
 #define MAIL_CACHE_LOCK_TIMEOUT 10
 #define MAIL_CACHE_LOCK_CHANGE_TIMEOUT 300
 
@@ -54,7 +57,17 @@ struct mail_cache_header {
 	uint32_t deleted_record_count;
 
 	uint32_t field_header_offset;
+
+	/* minor_version >= 2: offset to mail_cache_column_header,
+	   0 if there are no columns. */
+	uint32_t column_header_offset;
 };
+/* Size of the header in minor_version < 2 files */
+#define MAIL_CACHE_HEADER_V1_SIZE \
+	offsetof(struct mail_cache_header, column_header_offset)
+#define MAIL_CACHE_HEADER_SIZE(hdr) \
+	((hdr)->minor_version >= 2 ? sizeof(struct mail_cache_header) : \
+	 MAIL_CACHE_HEADER_V1_SIZE)
 
 struct mail_cache_header_fields {
 	uint32_t next_offset;
@@ -87,6 +100,37 @@ struct mail_cache_header_fields {
 #define MAIL_CACHE_FIELD_NAMES(count) \
 	(MAIL_CACHE_FIELD_DECISION(count) + sizeof(uint8_t) * (count))
 
+/* Columns contain fixed size fields of all the messages that existed when
+   the cache file was compressed. Each row is found by binary searching its
+   UID, which is usually at the message's current seq-1 position. Columns
+   are never modified, so fields for newer messages are added to records. */
+struct mail_cache_column_header {
+	/* size of the whole column area, including this header */
+	uint32_t size;
+	uint32_t uid_validity;
+	uint32_t row_count;
+	uint32_t column_count;
+#if 0
+	uint32_t uids[row_count];
+	struct mail_cache_column columns[column_count];
+#endif
+};
+
+struct mail_cache_column {
+	uint32_t file_field;
+	uint32_t field_size;
+	/* Offset to column data relative to the column header. The data
+	   begins with a bitmap of row_count bits telling which rows have
+	   the field, padded to 32 bits. It's followed by
+	   row_count * field_size bytes of field data, padded to 32 bits. */
+	uint32_t offset;
+};
+
+#define MAIL_CACHE_COLUMN_BITMAP_SIZE(row_count) \
+	((((row_count) + 31) / 32) * sizeof(uint32_t))
+#define MAIL_CACHE_COLUMN_DATA_SIZE(row_count, field_size) \
+	((((row_count) * (field_size)) + 3) & ~3U)
+
 struct mail_cache_record {
 	uint32_t prev_offset;
 	uint32_t size; /* full record size, including this header */
@@ -148,10 +192,16 @@ struct mail_cache {
 	/* 0 is no need for compression, otherwise the file sequence number
 	   which we want compressed. */
 	uint32_t need_compress_file_seq;
+	struct mail_cache_compress_stats compress_stats;
 
 	unsigned int *file_field_map;
 	unsigned int file_fields_count;
 
+	/* Columns of the current file. Offsets are validated and relative
+	   to column_header_offset. */
+	ARRAY(struct mail_cache_column) columns;
+	uint32_t column_row_count, column_uid_validity, column_area_size;
+
 	bool opened:1;
 	bool locked:1;
 	bool last_lock_failed:1;
@@ -159,6 +209,7 @@ struct mail_cache {
 	bool field_header_write_pending:1;
 	bool compressing:1;
 	bool map_with_read:1;
+	bool columns_read:1;
 };
 
 struct mail_cache_loop_track {
@@ -203,11 +254,16 @@ struct mail_cache_lookup_iterate_ctx {
 	uint32_t offset;
 
 	unsigned int trans_next_idx;
+	/* next column to return after all the records */
+	unsigned int column_idx;
+	uint32_t column_row;
 
 	bool stop:1;
 	bool failed:1;
 	bool memory_appends_checked:1;
 	bool disk_appends_checked:1;
+	bool columns_checked:1;
+	bool column_row_found:1;
 };
 
 /* Explicitly lock the cache file. Returns -1 if error / timed out,
@@ -256,6 +312,25 @@ int mail_cache_map(struct mail_cache *cache, size_t offset, size_t size,
 void mail_cache_file_close(struct mail_cache *cache);
 int mail_cache_reopen(struct mail_cache *cache);
 
+/* Read the columns of the current cache file. Returns 0 if ok (also when
+   there are no columns), -1 if the columns are corrupted. */
+int mail_cache_columns_read(struct mail_cache *cache);
+/* Find the column row for seq. Returns 1 if found, 0 if the message has no
+   row, -1 if error. */
+int mail_cache_columns_find_row(struct mail_cache_view *view, uint32_t seq,
+				uint32_t *row_r);
+/* Returns the given column's field for the row. Returns 1 if found, 0 if
+   the row doesn't have the field, -1 if error. */
+int mail_cache_column_get_field(struct mail_cache *cache,
+				unsigned int column_idx, uint32_t row,
+				struct mail_cache_iterate_field *field_r);
+/* Look up field from columns. Returns 1 if found, 0 if not, -1 if error. */
+int mail_cache_columns_lookup(struct mail_cache_view *view, uint32_t seq,
+			      unsigned int field_idx,
+			      struct mail_cache_iterate_field *field_r);
+/* Returns TRUE if the cache file has columns. */
+bool mail_cache_have_columns(struct mail_cache *cache);
+
 /* Notify the decision handling code that field was looked up for seq.
    This should be called even for fields that aren't currently in cache file */
 void mail_cache_decision_state_update(struct mail_cache_view *view,
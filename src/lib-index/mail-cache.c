@@ -67,6 +67,7 @@ void mail_cache_file_close(struct mail_cache *cache)
 	cache->hdr = NULL;
 	cache->mmap_length = 0;
 	cache->last_field_header_offset = 0;
+	cache->columns_read = FALSE;
 
 	if (cache->file_lock != NULL)
 		file_lock_free(&cache->file_lock);
@@ -263,6 +264,13 @@ static void mail_cache_update_need_compress(struct mail_cache *cache)
 		want_compress = TRUE;
 	}
 
+	if ((cache->index->flags & MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS) != 0 &&
+	    hdr->minor_version < 2) {
+		/* file was written by an older version that didn't know about
+		   columns. compress to convert the fields into columns. */
+		want_compress = TRUE;
+	}
+
 	if (want_compress) {
 		if (fstat(cache->fd, &st) < 0) {
 			if (!ESTALE_FSTAT(errno))
@@ -279,7 +287,8 @@ static bool mail_cache_verify_header(struct mail_cache *cache,
 				     const struct mail_cache_header *hdr)
 {
 	/* check that the header is still ok */
-	if (cache->mmap_length < sizeof(struct mail_cache_header)) {
+	if (cache->mmap_length < MAIL_CACHE_HEADER_V1_SIZE ||
+	    cache->mmap_length < MAIL_CACHE_HEADER_SIZE(hdr)) {
 		mail_cache_set_corrupted(cache, "File too small");
 		return FALSE;
 	}
@@ -329,8 +338,10 @@ mail_cache_map_finish(struct mail_cache *cache, uoff_t offset, size_t size,
 		if (!copy_hdr)
 			cache->hdr = hdr;
 		else {
-			memcpy(&cache->hdr_ro_copy, hdr,
+			memset(&cache->hdr_ro_copy, 0,
 			       sizeof(cache->hdr_ro_copy));
+			memcpy(&cache->hdr_ro_copy, hdr,
+			       MAIL_CACHE_HEADER_SIZE(hdr));
 			cache->hdr = &cache->hdr_ro_copy;
 		}
 		mail_cache_update_need_compress(cache);
@@ -562,6 +573,8 @@ void mail_cache_free(struct mail_cache **_cache)
 
 	if (cache->read_buf != NULL)
 		buffer_free(&cache->read_buf);
+	if (array_is_created(&cache->columns))
+		array_free(&cache->columns);
 	hash_table_destroy(&cache->field_name_hash);
 	pool_unref(&cache->field_pool);
 	i_free(cache->field_file_map);
@@ -728,7 +741,8 @@ int mail_cache_unlock(struct mail_cache *cache)
 	if (cache->hdr_modified) {
 		cache->hdr_modified = FALSE;
 		if (mail_cache_write(cache, &cache->hdr_copy,
-				     sizeof(cache->hdr_copy), 0) < 0)
+				     MAIL_CACHE_HEADER_SIZE(&cache->hdr_copy),
+				     0) < 0)
 			ret = -1;
 		cache->hdr_ro_copy = cache->hdr_copy;
 		mail_cache_update_need_compress(cache);
@@ -32,6 +32,15 @@ enum mail_cache_field_type {
 	MAIL_CACHE_FIELD_COUNT
 };
 
+struct mail_cache_compress_stats {
+	/* Number of successful compressions since the cache was opened */
+	unsigned int count;
+	/* Time spent on the last compression */
+	unsigned int last_usecs;
+	/* File size before and after the last compression */
+	uoff_t last_old_size, last_new_size;
+};
+
 struct mail_cache_field {
 	const char *name;
 	unsigned int idx;
@@ -74,6 +83,15 @@ int mail_cache_compress(struct mail_cache *cache,
 			struct mail_index_transaction *trans,
 			struct mail_cache_compress_lock **lock_r);
 void mail_cache_compress_unlock(struct mail_cache_compress_lock **lock);
+/* Compress the cache file in its own transaction if it needs it. The cache
+   is opened first, so this also works in processes that haven't accessed it
+   yet (e.g. indexer compressing for MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_
+   BACKGROUND sessions). Returns 1 if compressed, 0 if it wasn't needed,
+   -1 if error. */
+int mail_cache_compress_if_needed(struct mail_cache *cache);
+/* Returns statistics about compressions done by this process. */
+void mail_cache_get_compress_stats(struct mail_cache *cache,
+				   struct mail_cache_compress_stats *stats_r);
 /* Returns TRUE if there is at least something in the cache. */
 bool mail_cache_exists(struct mail_cache *cache);
 /* Open and read cache header. Returns 0 if ok, -1 if error/corrupted. */
@@ -26,6 +26,37 @@ static void mail_index_map_copy_hdr(struct mail_index_map *map,
 	map->hdr.unused_old_recent_messages_count = 0;
 }
 
+static int
+mail_index_mmap_reserve(struct mail_index_record_map *rec_map, int fd,
+			size_t file_size)
+{
+#ifdef MAP_ANON
+	size_t alloc_size = file_size + MAIL_INDEX_MMAP_APPEND_SPACE(file_size);
+	void *base;
+
+	/* map the file on top of a larger anonymous mapping. the file pages
+	   are shared with all the other processes that have the index
+	   mapped until they're modified, and the records appended while
+	   syncing are written to the anonymous pages after them, so the
+	   whole file doesn't need to be copied to private memory. */
+	base = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (base == MAP_FAILED)
+		return -1;
+	if (mmap(base, file_size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		if (munmap(base, alloc_size) < 0)
+			i_error("munmap() failed: %m");
+		return -1;
+	}
+	rec_map->mmap_base = base;
+	rec_map->mmap_alloc_size = alloc_size;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 {
 	struct mail_index *index = map->index;
@@ -43,8 +74,12 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		return -1;
 	}
 
-	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
-				  MAP_PRIVATE, index->fd, 0);
+	if (mail_index_mmap_reserve(rec_map, index->fd, file_size) < 0) {
+		rec_map->mmap_base = mmap(NULL, file_size,
+					  PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE, index->fd, 0);
+		rec_map->mmap_alloc_size = file_size;
+	}
 	if (rec_map->mmap_base == MAP_FAILED) {
 		rec_map->mmap_base = NULL;
 		mail_index_set_syscall_error(index, "mmap()");
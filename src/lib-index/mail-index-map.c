@@ -271,7 +271,7 @@ static void mail_index_record_map_free(struct mail_index_map *map,
 		buffer_free(&rec_map->buffer);
 	} else if (rec_map->mmap_base != NULL) {
 		i_assert(rec_map->buffer == NULL);
-		if (munmap(rec_map->mmap_base, rec_map->mmap_size) < 0)
+		if (munmap(rec_map->mmap_base, rec_map->mmap_alloc_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		rec_map->mmap_base = NULL;
 	}
@@ -477,7 +477,7 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 		mail_index_record_map_unlink(map);
 		map->rec_map = new_map;
 	} else {
-		if (munmap(new_map->mmap_base, new_map->mmap_size) < 0)
+		if (munmap(new_map->mmap_base, new_map->mmap_alloc_size) < 0)
 			mail_index_set_syscall_error(map->index, "munmap()");
 		new_map->mmap_base = NULL;
 	}
@@ -15,6 +15,11 @@ struct mail_index_sync_map_ctx;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
+/* How much address space to reserve after the mmap()ed index file for
+   appending new records in place. The pages use memory only after records
+   are actually written to them. */
+#define MAIL_INDEX_MMAP_APPEND_SPACE(file_size) \
+	I_MAX((file_size) / 8, 1024*64)
 /* How many times to retry opening index files if read/fstat returns ESTALE.
    This happens with NFS when the file has been deleted (ie. index file was
    rewritten by another computer than us). */
@@ -122,6 +127,8 @@ struct mail_index_record_map {
 
 	void *mmap_base;
 	size_t mmap_size, mmap_used_size;
+	/* mmap_size + reserved append space */
+	size_t mmap_alloc_size;
 
 	buffer_t *buffer;
 
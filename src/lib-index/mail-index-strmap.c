@@ -985,11 +985,41 @@ mail_index_strmap_recreate_write(struct mail_index_strmap_view *view,
 	mail_index_strmap_write_block(view, output, 0, 1);
 }
 
+static void
+mail_index_strmap_open_recreated(struct mail_index_strmap *strmap,
+				 const struct stat *st)
+{
+	struct stat st2;
+
+	/* keep the file we just wrote open. the view already matches its
+	   contents, so the next sync doesn't need to reset the view and
+	   read the whole file again. */
+	mail_index_strmap_close(strmap);
+	strmap->fd = open(strmap->path, O_RDWR);
+	if (strmap->fd == -1) {
+		if (errno != ENOENT)
+			mail_index_strmap_set_syscall_error(strmap, "open()");
+		return;
+	}
+	if (fstat(strmap->fd, &st2) < 0) {
+		mail_index_strmap_set_syscall_error(strmap, "fstat()");
+		mail_index_strmap_close(strmap);
+		return;
+	}
+	if (st2.st_ino != st->st_ino || !CMP_DEV_T(st2.st_dev, st->st_dev)) {
+		/* another process already recreated it */
+		mail_index_strmap_close(strmap);
+		return;
+	}
+	strmap->input = i_stream_create_fd(strmap->fd, (size_t)-1);
+}
+
 static int mail_index_strmap_recreate(struct mail_index_strmap_view *view)
 {
 	struct mail_index_strmap *strmap = view->strmap;
 	string_t *str;
 	struct ostream *output;
+	struct stat st;
 	const char *temp_path;
 	int fd, ret = 0;
 
@@ -1022,6 +1052,11 @@ static int mail_index_strmap_recreate(struct mail_index_strmap_view *view)
 		ret = -1;
 	}
 	o_stream_destroy(&output);
+	if (ret == 0 && fstat(fd, &st) < 0) {
+		mail_index_set_error(strmap->index,
+				     "fstat(%s) failed: %m", temp_path);
+		ret = -1;
+	}
 	if (close(fd) < 0) {
 		mail_index_set_error(strmap->index,
 				     "close(%s) failed: %m", temp_path);
@@ -1034,6 +1069,8 @@ static int mail_index_strmap_recreate(struct mail_index_strmap_view *view)
 	}
 	if (ret < 0)
 		i_unlink(temp_path);
+	else
+		mail_index_strmap_open_recreated(strmap, &st);
 	return ret;
 }
 
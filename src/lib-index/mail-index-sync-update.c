@@ -298,12 +298,48 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 	}
 }
 
+static struct mail_index_map *
+mail_index_sync_get_append_map(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map = ctx->view->map;
+	struct mail_index_record_map *rec_map = map->rec_map;
+	size_t append_end;
+
+	if (MAIL_INDEX_MAP_IS_IN_MEMORY(map))
+		return mail_index_sync_move_to_private_memory(ctx);
+
+	/* the map is mmap()ed. if there's still reserved space after the
+	   records, append there and keep sharing the unmodified file pages
+	   instead of copying the whole file to memory. */
+	append_end = ((const char *)rec_map->records -
+		      (const char *)rec_map->mmap_base) +
+		(rec_map->records_count + 1) * map->hdr.record_size;
+	if (append_end > rec_map->mmap_alloc_size)
+		return mail_index_sync_move_to_private_memory(ctx);
+
+	if (map->refcount > 1) {
+		map = mail_index_map_clone(map);
+		mail_index_sync_replace_map(ctx, map);
+	}
+	return map;
+}
+
 static void *sync_append_record(struct mail_index_map *map)
 {
+	struct mail_index_record_map *rec_map = map->rec_map;
 	size_t append_pos;
 	void *ret;
 
 	append_pos = map->rec_map->records_count * map->hdr.record_size;
+	if (rec_map->buffer == NULL) {
+		/* mail_index_sync_get_append_map() checked that there's
+		   space */
+		ret = PTR_OFFSET(rec_map->records, append_pos);
+		rec_map->mmap_used_size = ((char *)ret + map->hdr.record_size) -
+			(char *)rec_map->mmap_base;
+		i_assert(rec_map->mmap_used_size <= rec_map->mmap_alloc_size);
+		return ret;
+	}
 	ret = buffer_get_space_unsafe(map->rec_map->buffer, append_pos,
 				      map->hdr.record_size);
 	map->rec_map->records =
@@ -391,10 +427,10 @@ static int sync_append(const struct mail_index_record *rec,
 		return -1;
 	}
 
-	/* move to memory. the mapping is written when unlocking so we don't
+	/* append to memory. the mapping is written when unlocking so we don't
 	   waste time re-mmap()ing multiple times or waste space growing index
 	   file too large */
-	map = mail_index_sync_move_to_private_memory(ctx);
+	map = mail_index_sync_get_append_map(ctx);
 
 	if (rec->uid <= map->rec_map->last_appended_uid) {
 		i_assert(map->hdr.messages_count < map->rec_map->records_count);
@@ -1065,7 +1101,10 @@ int mail_index_sync_map(struct mail_index_map **_map,
 	}
 
 	buffer_write(map->hdr_copy_buf, 0, &map->hdr, sizeof(map->hdr));
-	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map)) {
+	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(map) &&
+	    array_count(&map->rec_map->maps) == 1) {
+		/* other maps sharing the records may still be using the
+		   mmap()ed header */
 		memcpy(map->rec_map->mmap_base, map->hdr_copy_buf->data,
 		       map->hdr_copy_buf->used);
 	}
@@ -269,6 +269,8 @@ mail_index_need_sync(struct mail_index *index, enum mail_index_sync_flags flags,
 		return TRUE;
 
 	/* already synced */
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND) != 0)
+		return FALSE;
 	return mail_cache_need_compress(index->cache);
 }
 
@@ -846,7 +848,8 @@ int mail_index_sync_commit(struct mail_index_sync_ctx **_ctx)
 	}
 
 	mail_index_sync_update_mailbox_offset(ctx);
-	if (mail_cache_need_compress(index->cache)) {
+	if ((index->flags & MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND) == 0 &&
+	    mail_cache_need_compress(index->cache)) {
 		/* if cache compression fails, we don't really care.
 		   the cache offsets are updated only if the compression was
 		   successful. */
@@ -34,7 +34,14 @@ enum mail_index_open_flags {
 	MAIL_INDEX_OPEN_FLAG_NEVER_IN_MEMORY	= 0x200,
 	/* We're only going to save new messages to the index.
 	   Avoid unnecessary reads. */
-	MAIL_INDEX_OPEN_FLAG_SAVEONLY		= 0x400
+	MAIL_INDEX_OPEN_FLAG_SAVEONLY		= 0x400,
+	/* Store small fixed size cache fields in per-field columns when
+	   compressing the cache file. */
+	MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS	= 0x800,
+	/* Don't compress the cache file while syncing the index. The caller
+	   is expected to check mail_cache_need_compress() and compress the
+	   cache later in some other process (e.g. indexer). */
+	MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND = 0x1000
 };
 
 enum mail_index_header_compat_flags {
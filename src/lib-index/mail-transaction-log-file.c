@@ -12,6 +12,8 @@
 #include "mail-index-modseq.h"
 #include "mail-transaction-log-private.h"
 
+#include <stdio.h>
+
 #define LOG_PREFETCH IO_BLOCK_SIZE
 #define MEMORY_LOG_NAME "(in-memory transaction log file)"
 #define LOG_NEW_DOTLOCK_SUFFIX ".newlock"
@@ -115,6 +117,7 @@ void mail_transaction_log_file_free(struct mail_transaction_log_file **_file)
 
 	if (file->buffer != NULL) 
 		buffer_free(&file->buffer);
+	mail_transaction_log_file_modseq_free(file);
 
 	if (file->mmap_base != NULL) {
 		if (munmap(file->mmap_base, file->mmap_size) < 0)
@@ -664,6 +667,23 @@ static void log_write_ext_hdr_init_data(struct mail_index *index, buffer_t *buf)
 	hdr->size = mail_index_uint32_to_offset(buf->used - hdr_offset);
 }
 
+static void
+mail_transaction_log_file_rename_modseq(struct mail_transaction_log_file *file,
+					const char *path2)
+{
+	const char *old_path, *new_path;
+
+	/* the saved modseq checkpoints now belong to the .log.2 */
+	old_path = t_strconcat(file->filepath,
+			       MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL);
+	new_path = t_strconcat(path2, MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL);
+	if (rename(old_path, new_path) < 0 && errno != ENOENT) {
+		mail_index_set_error(file->log->index,
+				     "rename(%s, %s) failed: %m",
+				     old_path, new_path);
+	}
+}
+
 static int
 mail_transaction_log_file_create2(struct mail_transaction_log_file *file,
 				  int new_fd, bool reset,
@@ -808,6 +828,7 @@ mail_transaction_log_file_create2(struct mail_transaction_log_file *file,
 		/* NOTE: here's a race condition where both .log and .log.2
 		   point to the same file. our reading code should ignore that
 		   though by comparing the inodes. */
+		mail_transaction_log_file_rename_modseq(file, path2);
 	}
 
 	if (file_dotlock_replace(dotlock,
@@ -1135,8 +1156,8 @@ int mail_transaction_log_file_get_highest_modseq_at(
 		uoff_t offset, uint64_t *highest_modseq_r)
 {
 	const struct mail_transaction_header *hdr;
-	struct modseq_cache *cache;
-	uoff_t cur_offset;
+	const struct modseq_cache *cache, *checkpoint;
+	uoff_t cur_offset, next_checkpoint;
 	uint64_t cur_modseq;
 	int ret;
 
@@ -1148,14 +1169,20 @@ int mail_transaction_log_file_get_highest_modseq_at(
 	}
 
 	cache = modseq_cache_get_offset(file, offset);
+	if (cache != NULL && cache->offset == offset) {
+		/* exact cache hit */
+		*highest_modseq_r = cache->highest_modseq;
+		return 0;
+	}
+	checkpoint = mail_transaction_log_file_modseq_lookup_offset(file, offset);
+	if (checkpoint != NULL &&
+	    (cache == NULL || checkpoint->offset > cache->offset))
+		cache = checkpoint;
+
 	if (cache == NULL) {
 		/* nothing usable in cache - scan from beginning */
 		cur_offset = file->hdr.hdr_size;
 		cur_modseq = file->hdr.initial_modseq;
-	} else if (cache->offset == offset) {
-		/* exact cache hit */
-		*highest_modseq_r = cache->highest_modseq;
-		return 0;
 	} else {
 		/* use cache to skip over some records */
 		cur_offset = cache->offset;
@@ -1174,11 +1201,19 @@ int mail_transaction_log_file_get_highest_modseq_at(
 
 	i_assert(cur_offset >= file->buffer_offset);
 	i_assert(cur_offset + file->buffer->used >= offset);
+	next_checkpoint = cur_offset + MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL;
 	while (cur_offset < offset) {
 		if (log_get_synced_record(file, &cur_offset, &hdr) < 0)
 			return- 1;
 		mail_transaction_update_modseq(hdr, hdr + 1, &cur_modseq);
+		if (cur_offset >= next_checkpoint) {
+			mail_transaction_log_file_modseq_checkpoint(file,
+				cur_offset, cur_modseq);
+			next_checkpoint = cur_offset +
+				MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL;
+		}
 	}
+	mail_transaction_log_file_modseq_save(file);
 
 	/* @UNSAFE: cache the value */
 	memmove(file->modseq_cache + 1, file->modseq_cache,
@@ -1196,8 +1231,8 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		uint64_t modseq, uoff_t *next_offset_r)
 {
 	const struct mail_transaction_header *hdr;
-	struct modseq_cache *cache;
-	uoff_t cur_offset;
+	const struct modseq_cache *cache, *checkpoint;
+	uoff_t cur_offset, next_checkpoint;
 	uint64_t cur_modseq;
 	int ret;
 
@@ -1211,14 +1246,20 @@ int mail_transaction_log_file_get_modseq_next_offset(
 	}
 
 	cache = modseq_cache_get_modseq(file, modseq);
+	if (cache != NULL && cache->highest_modseq == modseq) {
+		/* exact cache hit */
+		*next_offset_r = cache->offset;
+		return 0;
+	}
+	checkpoint = mail_transaction_log_file_modseq_lookup_modseq(file, modseq);
+	if (checkpoint != NULL &&
+	    (cache == NULL || checkpoint->offset > cache->offset))
+		cache = checkpoint;
+
 	if (cache == NULL) {
 		/* nothing usable in cache - scan from beginning */
 		cur_offset = file->hdr.hdr_size;
 		cur_modseq = file->hdr.initial_modseq;
-	} else if (cache->highest_modseq == modseq) {
-		/* exact cache hit */
-		*next_offset_r = cache->offset;
-		return 0;
 	} else {
 		/* use cache to skip over some records */
 		cur_offset = cache->offset;
@@ -1237,13 +1278,21 @@ int mail_transaction_log_file_get_modseq_next_offset(
 	}
 
 	i_assert(cur_offset >= file->buffer_offset);
+	next_checkpoint = cur_offset + MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL;
 	while (cur_offset < file->sync_offset) {
 		if (log_get_synced_record(file, &cur_offset, &hdr) < 0)
 			return -1;
 		mail_transaction_update_modseq(hdr, hdr + 1, &cur_modseq);
 		if (cur_modseq >= modseq)
 			break;
+		if (cur_offset >= next_checkpoint) {
+			mail_transaction_log_file_modseq_checkpoint(file,
+				cur_offset, cur_modseq);
+			next_checkpoint = cur_offset +
+				MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL;
+		}
 	}
+	mail_transaction_log_file_modseq_save(file);
 	if (cur_offset == file->sync_offset) {
 		/* if we got to sync_offset, cur_modseq should be
 		   sync_highest_modseq */
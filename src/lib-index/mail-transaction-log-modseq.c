@@ -0,0 +1,317 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "crc32.h"
+#include "str.h"
+#include "read-full.h"
+#include "write-full.h"
+#include "safe-mkstemp.h"
+#include "mail-index-private.h"
+#include "mail-transaction-log-private.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* Sparse modseq -> offset index for a transaction log file. The checkpoints
+   are collected while scanning the log for modseqs and saved to
+   <log path>.modseq, so that the following processes don't have to scan the
+   log from the beginning when a client gives an old modseq. The file is only
+   a cache: if it doesn't match the log file, it's ignored and rewritten. */
+
+struct mail_transaction_log_modseq_header {
+	uint32_t indexid;
+	uint32_t file_seq;
+	uint32_t create_stamp;
+	uint32_t count;
+	/* crc32c of the records */
+	uint32_t records_crc;
+	uint32_t unused_padding;
+};
+
+struct mail_transaction_log_modseq_record {
+	uint64_t offset;
+	uint64_t highest_modseq;
+};
+
+static const char *
+mail_transaction_log_file_modseq_path(struct mail_transaction_log_file *file)
+{
+	struct mail_transaction_log *log = file->log;
+
+	return t_strconcat(file == log->head ? log->filepath : log->filepath2,
+			   MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL);
+}
+
+static bool
+mail_transaction_log_file_modseq_persistent(struct mail_transaction_log_file *file)
+{
+	return !MAIL_TRANSACTION_LOG_FILE_IN_MEMORY(file) &&
+		!MAIL_INDEX_IS_IN_MEMORY(file->log->index);
+}
+
+static int
+mail_transaction_log_modseq_parse(struct mail_transaction_log_file *file,
+				  const unsigned char *data, size_t size,
+				  const char **error_r)
+{
+	const struct mail_transaction_log_modseq_header *hdr = (const void *)data;
+	const struct mail_transaction_log_modseq_record *recs;
+	struct modseq_cache checkpoint;
+	uoff_t prev_offset = 0;
+	uint64_t prev_modseq = file->hdr.initial_modseq;
+	unsigned int i;
+
+	if (size < sizeof(*hdr)) {
+		*error_r = "File too small";
+		return -1;
+	}
+	if (hdr->indexid != file->hdr.indexid ||
+	    hdr->file_seq != file->hdr.file_seq ||
+	    hdr->create_stamp != file->hdr.create_stamp) {
+		/* belongs to another log file */
+		return 0;
+	}
+	if (hdr->count != (size - sizeof(*hdr)) / sizeof(*recs) ||
+	    (size - sizeof(*hdr)) % sizeof(*recs) != 0) {
+		*error_r = "Invalid record count";
+		return -1;
+	}
+	recs = CONST_PTR_OFFSET(data, sizeof(*hdr));
+	if (crc32c_data(recs, hdr->count * sizeof(*recs)) != hdr->records_crc) {
+		*error_r = "Checksum mismatch";
+		return -1;
+	}
+
+	array_clear(&file->modseq_checkpoints);
+	for (i = 0; i < hdr->count; i++) {
+		if (recs[i].offset <= prev_offset ||
+		    recs[i].offset < file->hdr.hdr_size ||
+		    recs[i].highest_modseq < prev_modseq) {
+			array_clear(&file->modseq_checkpoints);
+			*error_r = t_strdup_printf("Record %u out of order", i);
+			return -1;
+		}
+		checkpoint.offset = prev_offset = recs[i].offset;
+		checkpoint.highest_modseq = prev_modseq =
+			recs[i].highest_modseq;
+		array_append(&file->modseq_checkpoints, &checkpoint, 1);
+	}
+	return 1;
+}
+
+static void
+mail_transaction_log_file_modseq_read(struct mail_transaction_log_file *file)
+{
+	struct mail_index *index = file->log->index;
+	const char *path, *error;
+	unsigned char *data;
+	struct stat st;
+	int fd, ret;
+
+	path = mail_transaction_log_file_modseq_path(file);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			mail_index_file_set_syscall_error(index, path, "open()");
+		return;
+	}
+	if (fstat(fd, &st) < 0) {
+		mail_index_file_set_syscall_error(index, path, "fstat()");
+		i_close_fd(&fd);
+		return;
+	}
+	if (st.st_size > MAIL_TRANSACTION_LOG_MODSEQ_MAX_SIZE) {
+		i_warning("%s: File too large (%"PRIuUOFF_T"), ignoring",
+			  path, (uoff_t)st.st_size);
+		i_close_fd(&fd);
+		return;
+	}
+
+	data = i_malloc(st.st_size + 1);
+	ret = read_full(fd, data, st.st_size);
+	if (ret < 0)
+		mail_index_file_set_syscall_error(index, path, "read()");
+	else if (ret > 0 &&
+		 mail_transaction_log_modseq_parse(file, data, st.st_size,
+						   &error) < 0) {
+		/* it's just a cache, rewrite it later */
+		i_warning("%s: Corrupted modseq index, ignoring: %s",
+			  path, error);
+	}
+	i_free(data);
+	i_close_fd(&fd);
+}
+
+static void
+mail_transaction_log_file_modseq_init(struct mail_transaction_log_file *file)
+{
+	if (array_is_created(&file->modseq_checkpoints))
+		return;
+
+	i_array_init(&file->modseq_checkpoints, 64);
+	if (mail_transaction_log_file_modseq_persistent(file))
+		mail_transaction_log_file_modseq_read(file);
+}
+
+void mail_transaction_log_file_modseq_checkpoint(
+		struct mail_transaction_log_file *file,
+		uoff_t offset, uint64_t highest_modseq)
+{
+	const struct modseq_cache *checkpoints;
+	struct modseq_cache checkpoint;
+	unsigned int idx, left, right, count;
+
+	mail_transaction_log_file_modseq_init(file);
+
+	/* find the first checkpoint after offset */
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	left = 0; right = count;
+	while (left < right) {
+		idx = left + (right - left) / 2;
+		if (checkpoints[idx].offset <= offset)
+			left = idx + 1;
+		else
+			right = idx;
+	}
+	idx = left;
+
+	/* keep the checkpoints sparse */
+	if (idx > 0 && offset - checkpoints[idx-1].offset <
+	    MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL)
+		return;
+	if (idx < count && checkpoints[idx].offset - offset <
+	    MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL)
+		return;
+
+	checkpoint.offset = offset;
+	checkpoint.highest_modseq = highest_modseq;
+	array_insert(&file->modseq_checkpoints, idx, &checkpoint, 1);
+	file->modseq_checkpoints_unsaved++;
+}
+
+const struct modseq_cache *
+mail_transaction_log_file_modseq_lookup_offset(
+		struct mail_transaction_log_file *file, uoff_t offset)
+{
+	const struct modseq_cache *checkpoints;
+	unsigned int idx, left, right, count;
+
+	mail_transaction_log_file_modseq_init(file);
+
+	/* find the last checkpoint at or before offset */
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	left = 0; right = count;
+	while (left < right) {
+		idx = left + (right - left) / 2;
+		if (checkpoints[idx].offset <= offset)
+			left = idx + 1;
+		else
+			right = idx;
+	}
+	return left == 0 ? NULL : &checkpoints[left-1];
+}
+
+const struct modseq_cache *
+mail_transaction_log_file_modseq_lookup_modseq(
+		struct mail_transaction_log_file *file, uint64_t modseq)
+{
+	const struct modseq_cache *checkpoints;
+	unsigned int idx, left, right, count;
+
+	mail_transaction_log_file_modseq_init(file);
+
+	/* find the last checkpoint before modseq was reached. there may be
+	   several checkpoints with the same modseq, so an exact match can't
+	   be used to find the first offset with it. */
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	left = 0; right = count;
+	while (left < right) {
+		idx = left + (right - left) / 2;
+		if (checkpoints[idx].highest_modseq < modseq)
+			left = idx + 1;
+		else
+			right = idx;
+	}
+	if (left == 0 || checkpoints[left-1].offset >= file->sync_offset)
+		return NULL;
+	return &checkpoints[left-1];
+}
+
+static int
+mail_transaction_log_file_modseq_write(struct mail_transaction_log_file *file)
+{
+	struct mail_index *index = file->log->index;
+	struct mail_transaction_log_modseq_header hdr;
+	struct mail_transaction_log_modseq_record *recs;
+	const struct modseq_cache *checkpoints;
+	const char *path, *temp_path;
+	unsigned int i, count;
+	string_t *str;
+	int fd, ret = 0;
+
+	checkpoints = array_get(&file->modseq_checkpoints, &count);
+	recs = i_new(struct mail_transaction_log_modseq_record, count);
+	for (i = 0; i < count; i++) {
+		recs[i].offset = checkpoints[i].offset;
+		recs[i].highest_modseq = checkpoints[i].highest_modseq;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.indexid = file->hdr.indexid;
+	hdr.file_seq = file->hdr.file_seq;
+	hdr.create_stamp = file->hdr.create_stamp;
+	hdr.count = count;
+	hdr.records_crc = crc32c_data(recs, count * sizeof(*recs));
+
+	path = mail_transaction_log_file_modseq_path(file);
+	str = t_str_new(256);
+	str_append(str, path);
+	fd = safe_mkstemp_hostpid_group(str, index->mode, index->gid,
+					index->gid_origin);
+	temp_path = str_c(str);
+	if (fd == -1) {
+		mail_index_set_error(index, "safe_mkstemp_hostpid(%s) failed: %m",
+				     temp_path);
+		i_free(recs);
+		return -1;
+	}
+
+	if (write_full(fd, &hdr, sizeof(hdr)) < 0 ||
+	    write_full(fd, recs, count * sizeof(*recs)) < 0) {
+		mail_index_file_set_syscall_error(index, temp_path, "write()");
+		ret = -1;
+	}
+	i_free(recs);
+	if (close(fd) < 0) {
+		mail_index_file_set_syscall_error(index, temp_path, "close()");
+		ret = -1;
+	} else if (ret == 0 && rename(temp_path, path) < 0) {
+		mail_index_set_error(index, "rename(%s, %s) failed: %m",
+				     temp_path, path);
+		ret = -1;
+	}
+	if (ret < 0)
+		i_unlink(temp_path);
+	return ret;
+}
+
+void mail_transaction_log_file_modseq_save(struct mail_transaction_log_file *file)
+{
+	if (file->modseq_checkpoints_unsaved <
+	    MAIL_TRANSACTION_LOG_MODSEQ_SAVE_MIN_COUNT)
+		return;
+	if (!mail_transaction_log_file_modseq_persistent(file) ||
+	    file->log->index->readonly)
+		return;
+
+	/* try again later if it fails */
+	if (mail_transaction_log_file_modseq_write(file) == 0)
+		file->modseq_checkpoints_unsaved = 0;
+}
+
+void mail_transaction_log_file_modseq_free(struct mail_transaction_log_file *file)
+{
+	if (array_is_created(&file->modseq_checkpoints))
+		array_free(&file->modseq_checkpoints);
+}
@@ -25,6 +25,15 @@ struct dotlock_settings;
 
 #define LOG_FILE_MODSEQ_CACHE_SIZE 10
 
+/* Suffix for the file containing the saved modseq checkpoints */
+#define MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX ".modseq"
+/* Minimum distance between two modseq checkpoints in the log */
+#define MAIL_TRANSACTION_LOG_MODSEQ_INTERVAL (1024*16)
+/* Save the checkpoints after this many new ones have been added */
+#define MAIL_TRANSACTION_LOG_MODSEQ_SAVE_MIN_COUNT 8
+/* Ignore the checkpoint files larger than this */
+#define MAIL_TRANSACTION_LOG_MODSEQ_MAX_SIZE (1024*1024*16)
+
 struct modseq_cache {
 	uoff_t offset;
 	uint64_t highest_modseq;
@@ -72,6 +81,10 @@ struct mail_transaction_log_file {
 	uoff_t index_deleted_offset, index_undeleted_offset;
 
 	struct modseq_cache modseq_cache[LOG_FILE_MODSEQ_CACHE_SIZE];
+	/* sparse offset -> highest_modseq checkpoints, sorted by offset.
+	   created lazily when they're first needed. */
+	ARRAY(struct modseq_cache) modseq_checkpoints;
+	unsigned int modseq_checkpoints_unsaved;
 
 	struct file_lock *file_lock;
 	time_t lock_created;
@@ -150,4 +163,22 @@ int mail_transaction_log_file_get_modseq_next_offset(
 		struct mail_transaction_log_file *file,
 		uint64_t modseq, uoff_t *next_offset_r);
 
+/* Add a checkpoint for the highest modseq at the given offset. It's ignored
+   if there's already a checkpoint nearby. */
+void mail_transaction_log_file_modseq_checkpoint(
+		struct mail_transaction_log_file *file,
+		uoff_t offset, uint64_t highest_modseq);
+/* Returns the last checkpoint at or before offset, or NULL if none. */
+const struct modseq_cache *
+mail_transaction_log_file_modseq_lookup_offset(
+		struct mail_transaction_log_file *file, uoff_t offset);
+/* Returns the last checkpoint with highest_modseq below modseq, or NULL if
+   none. */
+const struct modseq_cache *
+mail_transaction_log_file_modseq_lookup_modseq(
+		struct mail_transaction_log_file *file, uint64_t modseq);
+/* Save the checkpoints if enough new ones have been added. */
+void mail_transaction_log_file_modseq_save(struct mail_transaction_log_file *file);
+void mail_transaction_log_file_modseq_free(struct mail_transaction_log_file *file);
+
 #endif
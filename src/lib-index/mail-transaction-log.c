@@ -52,8 +52,11 @@ static void mail_transaction_log_2_unlink_old(struct mail_transaction_log *log)
 	}
 
 	if (st.st_mtime + MAIL_TRANSACTION_LOG2_STALE_SECS <= ioloop_time &&
-	    !log->index->readonly)
+	    !log->index->readonly) {
 		i_unlink_if_exists(log->filepath2);
+		i_unlink_if_exists(t_strconcat(log->filepath2,
+			MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL));
+	}
 }
 
 int mail_transaction_log_open(struct mail_transaction_log *log)
@@ -571,6 +574,8 @@ int mail_transaction_log_unlink(struct mail_transaction_log *log)
 						  "unlink()");
 		return -1;
 	}
+	i_unlink_if_exists(t_strconcat(log->filepath,
+				       MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL));
 	return 0;
 }
 
@@ -0,0 +1,283 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-cache-private.h"
+
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-mail-cache-columns"
+#define TEST_MSG_COUNT 100
+
+enum {
+	TEST_FIELD_DATE,
+	TEST_FIELD_FLAGS,
+	TEST_FIELD_BODY,
+
+	TEST_FIELD_COUNT
+};
+
+static struct mail_cache_field test_fields[TEST_FIELD_COUNT] = {
+	{ .name = "date", .type = MAIL_CACHE_FIELD_FIXED_SIZE,
+	  .field_size = sizeof(uint32_t),
+	  .decision = MAIL_CACHE_DECISION_YES | MAIL_CACHE_DECISION_FORCED },
+	{ .name = "flags", .type = MAIL_CACHE_FIELD_BITMASK,
+	  .field_size = 1,
+	  .decision = MAIL_CACHE_DECISION_YES | MAIL_CACHE_DECISION_FORCED },
+	{ .name = "body", .type = MAIL_CACHE_FIELD_VARIABLE_SIZE,
+	  .field_size = UINT_MAX,
+	  .decision = MAIL_CACHE_DECISION_YES | MAIL_CACHE_DECISION_FORCED }
+};
+
+static struct mail_index *
+test_index_open(enum mail_index_open_flags flags)
+{
+	struct mail_index *index;
+	struct mail_cache_field fields[TEST_FIELD_COUNT];
+
+	index = mail_index_alloc(TEST_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+			MAIL_INDEX_OPEN_FLAG_CREATE | flags) == 0);
+	memcpy(fields, test_fields, sizeof(fields));
+	mail_cache_register_fields(mail_index_get_cache(index), fields,
+				   TEST_FIELD_COUNT);
+	memcpy(test_fields, fields, sizeof(fields));
+	return index;
+}
+
+static void test_index_close(struct mail_index **index)
+{
+	mail_index_close(*index);
+	mail_index_free(index);
+}
+
+static void test_sync(struct mail_index *index, uint32_t expunge_seq)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans,
+					  0) == 1);
+	if (expunge_seq != 0)
+		mail_index_expunge(trans, expunge_seq);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_add_messages(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	uint32_t seq, date, uid_validity = 12345;
+	uint8_t flags;
+	const char *body;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (seq = 1; seq <= TEST_MSG_COUNT; seq++)
+		mail_index_append(trans, seq, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_sync(index, 0);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(mail_index_get_cache(index), view);
+	trans = mail_index_transaction_begin(view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	for (seq = 1; seq <= TEST_MSG_COUNT; seq++) {
+		/* leave every 10th message without a date */
+		if (seq % 10 != 0) {
+			date = 1000000 + seq;
+			mail_cache_add(cache_trans, seq,
+				       test_fields[TEST_FIELD_DATE].idx,
+				       &date, sizeof(date));
+		}
+		flags = seq & 0x0f;
+		mail_cache_add(cache_trans, seq,
+			       test_fields[TEST_FIELD_FLAGS].idx,
+			       &flags, sizeof(flags));
+		body = t_strdup_printf("body %u", seq);
+		mail_cache_add(cache_trans, seq,
+			       test_fields[TEST_FIELD_BODY].idx,
+			       body, strlen(body));
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void test_compress(struct mail_index *index)
+{
+	struct mail_cache *cache = mail_index_get_cache(index);
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_compress_lock *lock;
+
+	test_assert(mail_index_refresh(index) == 0);
+	if (cache->hdr != NULL) {
+		/* the file is too small to be compressed otherwise */
+		cache->need_compress_file_seq = cache->hdr->file_seq;
+	}
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	test_assert(mail_cache_compress(cache, trans, &lock) == 0);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_compress_unlock(&lock);
+	mail_index_view_close(&view);
+}
+
+static void
+test_verify(struct mail_index *index, uint32_t count, uint8_t extra_flags)
+{
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = buffer_create_dynamic(pool_datastack_create(), 64);
+	const char *body;
+	uint32_t seq, uid, date;
+	int ret;
+
+	test_assert(mail_index_refresh(index) == 0);
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(mail_index_get_cache(index), view);
+	test_assert(mail_index_view_get_messages_count(view) == count);
+	for (seq = 1; seq <= count; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+
+		buffer_set_used_size(buf, 0);
+		ret = mail_cache_lookup_field(cache_view, buf, seq,
+					      test_fields[TEST_FIELD_DATE].idx);
+		if (uid % 10 == 0)
+			test_assert(ret == 0);
+		else {
+			test_assert(ret == 1 && buf->used == sizeof(date));
+			memcpy(&date, buf->data, sizeof(date));
+			test_assert(date == 1000000 + uid);
+		}
+
+		buffer_set_used_size(buf, 0);
+		ret = mail_cache_lookup_field(cache_view, buf, seq,
+					      test_fields[TEST_FIELD_FLAGS].idx);
+		test_assert(ret == 1 && buf->used == 1 &&
+			    ((const uint8_t *)buf->data)[0] ==
+			    ((uid & 0x0f) | extra_flags));
+
+		buffer_set_used_size(buf, 0);
+		ret = mail_cache_lookup_field(cache_view, buf, seq,
+					      test_fields[TEST_FIELD_BODY].idx);
+		body = t_strdup_printf("body %u", uid);
+		test_assert(ret == 1 && buf->used == strlen(body) &&
+			    memcmp(buf->data, body, buf->used) == 0);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void test_add_flags(struct mail_index *index, uint8_t flags)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	uint32_t seq;
+
+	test_assert(mail_index_refresh(index) == 0);
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(mail_index_get_cache(index), view);
+	trans = mail_index_transaction_begin(view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	for (seq = 1; seq <= mail_index_view_get_messages_count(view); seq++) {
+		mail_cache_add(cache_trans, seq,
+			       test_fields[TEST_FIELD_FLAGS].idx,
+			       &flags, sizeof(flags));
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_cache_columns(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_cache *cache;
+
+	test_begin("mail cache columns");
+	/* indexid is taken from ioloop_time */
+	ioloop = io_loop_create();
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+
+	index = test_index_open(MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS);
+	cache = mail_index_get_cache(index);
+	test_add_messages(index);
+	test_verify(index, TEST_MSG_COUNT, 0);
+	test_assert(!mail_cache_have_columns(cache));
+
+	test_compress(index);
+	test_assert(mail_cache_have_columns(cache));
+	test_assert(mail_cache_columns_read(cache) == 0);
+	test_assert(cache->column_row_count == TEST_MSG_COUNT);
+	test_assert(array_count(&cache->columns) == 2);
+	test_verify(index, TEST_MSG_COUNT, 0);
+
+	/* rows are found by UID after expunges */
+	test_sync(index, 1);
+	test_sync(index, 50);
+	test_verify(index, TEST_MSG_COUNT - 2, 0);
+
+	/* bitmask bits added after compression are merged */
+	test_add_flags(index, 0x40);
+	test_verify(index, TEST_MSG_COUNT - 2, 0x40);
+	test_compress(index);
+	test_assert(mail_cache_columns_read(cache) == 0);
+	test_assert(cache->column_row_count == TEST_MSG_COUNT - 2);
+	test_verify(index, TEST_MSG_COUNT - 2, 0x40);
+	test_index_close(&index);
+
+	/* the columns aren't read in SAVEONLY mode, but they're still
+	   copied when compressing */
+	index = test_index_open(MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS |
+				MAIL_INDEX_OPEN_FLAG_SAVEONLY);
+	cache = mail_index_get_cache(index);
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(mail_cache_columns_read(cache) == 0);
+	test_assert(array_count(&cache->columns) == 0);
+	test_compress(index);
+	test_assert(mail_cache_columns_read(cache) == 0);
+	test_assert(array_count(&cache->columns) == 2);
+	test_verify(index, TEST_MSG_COUNT - 2, 0x40);
+	test_index_close(&index);
+
+	/* columns are converted back into records without the flag */
+	index = test_index_open(0);
+	cache = mail_index_get_cache(index);
+	test_verify(index, TEST_MSG_COUNT - 2, 0x40);
+	test_compress(index);
+	test_assert(!mail_cache_have_columns(cache));
+	test_verify(index, TEST_MSG_COUNT - 2, 0x40);
+	test_index_close(&index);
+
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_cache_columns,
+		NULL
+	};
+	return test_run(test_functions);
+}
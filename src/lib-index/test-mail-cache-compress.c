@@ -0,0 +1,190 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-cache-private.h"
+
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-mail-cache-compress"
+#define TEST_MSG_COUNT 100
+#define TEST_BODY_SIZE 1000
+
+static struct mail_cache_field test_field = {
+	.name = "body", .type = MAIL_CACHE_FIELD_VARIABLE_SIZE,
+	.field_size = UINT_MAX,
+	.decision = MAIL_CACHE_DECISION_YES | MAIL_CACHE_DECISION_FORCED
+};
+
+static struct mail_index *test_index_open(void)
+{
+	struct mail_index *index;
+	struct mail_cache_field field = test_field;
+
+	index = mail_index_alloc(TEST_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+			MAIL_INDEX_OPEN_FLAG_CREATE |
+			MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND) == 0);
+	mail_cache_register_fields(mail_index_get_cache(index), &field, 1);
+	test_field.idx = field.idx;
+	return index;
+}
+
+static void test_index_close(struct mail_index **index)
+{
+	mail_index_close(*index);
+	mail_index_free(index);
+}
+
+static const char *test_body(uint32_t uid)
+{
+	string_t *str = t_str_new(TEST_BODY_SIZE);
+
+	str_printfa(str, "body %u ", uid);
+	while (str_len(str) < TEST_BODY_SIZE)
+		str_append_c(str, 'x');
+	return str_c(str);
+}
+
+static void test_add_messages(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	uint32_t seq, uid_validity = 12345;
+	const char *body;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (seq = 1; seq <= TEST_MSG_COUNT; seq++)
+		mail_index_append(trans, seq, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans,
+					  0) == 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(mail_index_get_cache(index), view);
+	trans = mail_index_transaction_begin(view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	for (seq = 1; seq <= TEST_MSG_COUNT; seq++) {
+		body = test_body(seq);
+		mail_cache_add(cache_trans, seq, test_field.idx,
+			       body, strlen(body));
+	}
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void test_expunge_half(struct mail_index *index)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans,
+					  0) == 1);
+	for (seq = 1; seq <= TEST_MSG_COUNT / 2; seq++)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_verify(struct mail_index *index)
+{
+	struct mail_index_view *view;
+	struct mail_cache_view *cache_view;
+	buffer_t *buf = buffer_create_dynamic(pool_datastack_create(), 1024);
+	const char *body;
+	uint32_t seq, uid;
+
+	view = mail_index_view_open(index);
+	cache_view = mail_cache_view_open(mail_index_get_cache(index), view);
+	test_assert(mail_index_view_get_messages_count(view) ==
+		    TEST_MSG_COUNT / 2);
+	for (seq = 1; seq <= TEST_MSG_COUNT / 2; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		buffer_set_used_size(buf, 0);
+		body = test_body(uid);
+		test_assert_idx(mail_cache_lookup_field(cache_view, buf, seq,
+						test_field.idx) == 1, seq);
+		test_assert_idx(buf->used == strlen(body) &&
+				memcmp(buf->data, body, buf->used) == 0, seq);
+	}
+	mail_cache_view_close(&cache_view);
+	mail_index_view_close(&view);
+}
+
+static void test_mail_cache_compress_background(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_cache *cache;
+	struct mail_cache_compress_stats stats;
+	struct stat st1, st2;
+	const char *cache_path = TEST_DIR"/test.index"MAIL_CACHE_FILE_SUFFIX;
+
+	test_begin("mail cache compress background");
+	/* indexid is taken from ioloop_time */
+	ioloop = io_loop_create();
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+
+	index = test_index_open();
+	test_add_messages(index);
+	if (stat(cache_path, &st1) < 0)
+		i_fatal("stat(%s) failed: %m", cache_path);
+
+	/* the sync doesn't compress, even though half of the cache is now
+	   deleted records */
+	test_expunge_half(index);
+	if (stat(cache_path, &st2) < 0)
+		i_fatal("stat(%s) failed: %m", cache_path);
+	test_assert(st1.st_ino == st2.st_ino);
+	test_index_close(&index);
+
+	/* a new process (the indexer) hasn't read the cache header yet */
+	index = test_index_open();
+	cache = mail_index_get_cache(index);
+	test_assert(!cache->opened && !mail_cache_need_compress(cache));
+	test_assert(mail_cache_compress_if_needed(cache) == 1);
+	mail_cache_get_compress_stats(cache, &stats);
+	test_assert(stats.count == 1);
+	test_assert(stats.last_new_size < stats.last_old_size);
+	if (stat(cache_path, &st2) < 0)
+		i_fatal("stat(%s) failed: %m", cache_path);
+	test_assert(st1.st_ino != st2.st_ino);
+	test_assert(st2.st_size < st1.st_size);
+	test_verify(index);
+
+	/* nothing more to do */
+	test_assert(mail_cache_compress_if_needed(cache) == 0);
+	test_index_close(&index);
+
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_cache_compress_background,
+		NULL
+	};
+	return test_run(test_functions);
+}
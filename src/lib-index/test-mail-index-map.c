@@ -2,11 +2,19 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
 #include "test-common.h"
 #include "mail-index-private.h"
 #include "mail-index-modseq.h"
 #include "mail-index-transaction-private.h"
 
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-mail-index-map"
+/* large enough for the index file to be mmap()ed */
+#define TEST_MMAP_MSG_COUNT 10000
+
 static void test_mail_index_map_lookup_seq_range_count(unsigned int messages_count)
 {
 	struct mail_index_record_map rec_map;
@@ -47,10 +55,106 @@ static void test_mail_index_map_lookup_seq_range(void)
 	test_end();
 }
 
+static void test_append_sync(struct mail_index *index, uint32_t count)
+{
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	const struct mail_index_header *hdr;
+	uint32_t seq, uid, uid_validity = 12345;
+
+	view = mail_index_view_open(index);
+	hdr = mail_index_get_header(view);
+	trans = mail_index_transaction_begin(view, 0);
+	if (hdr->uid_validity == 0) {
+		mail_index_update_header(trans,
+			offsetof(struct mail_index_header, uid_validity),
+			&uid_validity, sizeof(uid_validity), TRUE);
+	}
+	for (uid = hdr->next_uid; count > 0; count--)
+		mail_index_append(trans, uid++, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans,
+					  0) == 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+}
+
+static void test_verify_uids(struct mail_index_view *view, uint32_t count)
+{
+	uint32_t seq, uid;
+
+	test_assert(mail_index_view_get_messages_count(view) == count);
+	for (seq = 1; seq <= count; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		if (uid != seq) {
+			test_assert_idx(uid == seq, seq);
+			break;
+		}
+	}
+}
+
+static void test_mail_index_map_mmap_append(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct mail_index_view *old_view, *view;
+
+	test_begin("mail index map mmap append");
+	/* indexid is taken from ioloop_time */
+	ioloop = io_loop_create();
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+
+	index = mail_index_alloc(TEST_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+				MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	test_append_sync(index, TEST_MMAP_MSG_COUNT);
+	mail_index_close(index);
+
+	test_assert(mail_index_open(index, 0) == 1);
+	test_assert(index->map->rec_map->mmap_base != NULL);
+	old_view = mail_index_view_open(index);
+
+	/* appends keep the file mapped */
+	test_append_sync(index, 100);
+	test_assert(index->map->rec_map->mmap_base != NULL);
+	test_assert(index->map->rec_map->buffer == NULL);
+	test_assert(index->map->rec_map->mmap_used_size >
+		    index->map->rec_map->mmap_size);
+
+	view = mail_index_view_open(index);
+	test_verify_uids(view, TEST_MMAP_MSG_COUNT + 100);
+	mail_index_view_close(&view);
+	test_verify_uids(old_view, TEST_MMAP_MSG_COUNT);
+	mail_index_view_close(&old_view);
+
+	/* running out of the reserved space moves the map to memory */
+	test_append_sync(index, TEST_MMAP_MSG_COUNT);
+	view = mail_index_view_open(index);
+	test_verify_uids(view, TEST_MMAP_MSG_COUNT*2 + 100);
+	mail_index_view_close(&view);
+	mail_index_close(index);
+
+	test_assert(mail_index_open(index, 0) == 1);
+	view = mail_index_view_open(index);
+	test_verify_uids(view, TEST_MMAP_MSG_COUNT*2 + 100);
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_mail_index_map_lookup_seq_range,
+		test_mail_index_map_mmap_append,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,215 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-index-strmap.h"
+
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-mail-index-strmap"
+#define TEST_STRMAP_SUFFIX ".strmap"
+#define TEST_MSG_COUNT 30
+
+/* Each message has a new Message-ID <msg-uid>, which gets str_idx=uid.
+   Some of them also refer to older messages with In-Reply-To: or
+   References:, so str_idx values may be much lower than the highest one
+   seen so far. */
+static unsigned int test_ref_count(uint32_t uid)
+{
+	if (uid > 1 && uid % 3 == 1)
+		return 2;
+	if (uid % 3 == 2)
+		return 3;
+	return 1;
+}
+
+static uint32_t test_ref_index(uint32_t uid, unsigned int i)
+{
+	return i == 0 ? 0 : (test_ref_count(uid) == 2 ? 1 : i + 1);
+}
+
+static uint32_t test_ref_msg(uint32_t uid, uint32_t ref_index)
+{
+	switch (ref_index) {
+	case 0:
+		return uid;
+	case 1:
+		return uid / 2;
+	case 2:
+		return 1;
+	default:
+		return uid - 1;
+	}
+}
+
+static const char *test_ref_key(uint32_t uid, uint32_t ref_index)
+{
+	return t_strdup_printf("<msg-%u>", test_ref_msg(uid, ref_index));
+}
+
+static bool
+test_key_cmp(const char *key, const struct mail_index_strmap_rec *rec,
+	     void *context ATTR_UNUSED)
+{
+	return strcmp(key, test_ref_key(rec->uid, rec->ref_index)) == 0;
+}
+
+static int
+test_rec_cmp(const struct mail_index_strmap_rec *rec1,
+	     const struct mail_index_strmap_rec *rec2,
+	     void *context ATTR_UNUSED)
+{
+	return strcmp(test_ref_key(rec1->uid, rec1->ref_index),
+		      test_ref_key(rec2->uid, rec2->ref_index)) == 0 ? 1 : 0;
+}
+
+static void
+test_remap(const uint32_t *idx_map ATTR_UNUSED,
+	   unsigned int old_count ATTR_UNUSED,
+	   unsigned int new_count ATTR_UNUSED, void *context ATTR_UNUSED)
+{
+}
+
+static struct mail_index *test_index_create(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 12345;
+
+	index = mail_index_alloc(TEST_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+					      MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (seq = 1; seq <= TEST_MSG_COUNT; seq++)
+		mail_index_append(trans, seq, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	return index;
+}
+
+static void
+test_strmap_add_block(struct mail_index *index, uint32_t uid1, uint32_t uid2)
+{
+	struct mail_index_strmap *strmap;
+	struct mail_index_strmap_view *strmap_view;
+	struct mail_index_strmap_view_sync *sync;
+	struct mail_index_view *view;
+	const ARRAY_TYPE(mail_index_strmap_rec) *recs;
+	const struct hash2_table *hash;
+	uint32_t uid, ref_index, last_uid;
+	unsigned int i;
+
+	strmap = mail_index_strmap_init(index, TEST_STRMAP_SUFFIX);
+	view = mail_index_view_open(index);
+	strmap_view = mail_index_strmap_view_open(strmap, view,
+		test_key_cmp, test_rec_cmp, test_remap, NULL, &recs, &hash);
+	sync = mail_index_strmap_view_sync_init(strmap_view, &last_uid);
+	test_assert(last_uid == uid1 - 1);
+	for (uid = uid1; uid <= uid2; uid++) {
+		for (i = 0; i < test_ref_count(uid); i++) T_BEGIN {
+			ref_index = test_ref_index(uid, i);
+			mail_index_strmap_view_sync_add(sync, uid, ref_index,
+				test_ref_key(uid, ref_index));
+		} T_END;
+	}
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(mail_index_strmap_view_get_highest_idx(strmap_view) == uid2);
+
+	mail_index_strmap_view_close(&strmap_view);
+	mail_index_view_close(&view);
+	mail_index_strmap_deinit(&strmap);
+}
+
+static void test_strmap_verify(struct mail_index *index)
+{
+	struct mail_index_strmap *strmap;
+	struct mail_index_strmap_view *strmap_view;
+	struct mail_index_strmap_view_sync *sync;
+	struct mail_index_view *view;
+	const ARRAY_TYPE(mail_index_strmap_rec) *recs;
+	const struct mail_index_strmap_rec *rec;
+	const struct hash2_table *hash;
+	uint32_t uid, last_uid;
+	unsigned int i, count, n = 0;
+
+	strmap = mail_index_strmap_init(index, TEST_STRMAP_SUFFIX);
+	view = mail_index_view_open(index);
+	strmap_view = mail_index_strmap_view_open(strmap, view,
+		test_key_cmp, test_rec_cmp, test_remap, NULL, &recs, &hash);
+	sync = mail_index_strmap_view_sync_init(strmap_view, &last_uid);
+	test_assert(last_uid == TEST_MSG_COUNT);
+	mail_index_strmap_view_sync_commit(&sync);
+	test_assert(mail_index_strmap_view_get_highest_idx(strmap_view) ==
+		    TEST_MSG_COUNT);
+
+	rec = array_get(recs, &count);
+	for (uid = 1; uid <= TEST_MSG_COUNT; uid++) {
+		for (i = 0; i < test_ref_count(uid) && n < count; i++, n++) {
+			test_assert_idx(rec[n].uid == uid, n);
+			test_assert_idx(rec[n].ref_index ==
+					test_ref_index(uid, i), n);
+			test_assert_idx(rec[n].str_idx ==
+					test_ref_msg(uid, rec[n].ref_index), n);
+		}
+	}
+	test_assert(n == count);
+
+	mail_index_strmap_view_close(&strmap_view);
+	mail_index_view_close(&view);
+	mail_index_strmap_deinit(&strmap);
+}
+
+static void test_mail_index_strmap_blocks(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	struct stat st1, st2;
+	const char *path = TEST_DIR"/test.index"TEST_STRMAP_SUFFIX;
+
+	test_begin("mail index strmap blocks");
+	ioloop = io_loop_create();
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	index = test_index_create();
+
+	/* the first block creates the file. the following ones are appended
+	   and start with str_idx values above their highest_str_idx=0, so
+	   their first relative values are negative. */
+	test_strmap_add_block(index, 1, 12);
+	if (stat(path, &st1) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	test_strmap_add_block(index, 13, 20);
+	test_strmap_add_block(index, 21, TEST_MSG_COUNT);
+	test_assert(stat(path, &st2) == 0 && st1.st_ino == st2.st_ino);
+	test_assert(st2.st_size > st1.st_size);
+
+	/* read back all the blocks. the file must not have been found
+	   corrupted and rewritten. */
+	test_strmap_verify(index);
+	test_assert(stat(path, &st2) == 0 && st1.st_ino == st2.st_ino);
+
+	mail_index_close(index);
+	mail_index_free(&index);
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_index_strmap_blocks,
+		NULL
+	};
+	return test_run(test_functions);
+}
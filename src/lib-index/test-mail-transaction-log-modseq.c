@@ -0,0 +1,190 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "unlink-directory.h"
+#include "write-full.h"
+#include "test-common.h"
+#include "mail-index-private.h"
+#include "mail-index-modseq.h"
+#include "mail-transaction-log-private.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-mail-transaction-log-modseq"
+#define TEST_TRANSACTION_COUNT 10000
+
+struct test_log_pos {
+	uoff_t offset;
+	uint64_t highest_modseq;
+};
+
+static ARRAY(struct test_log_pos) test_positions;
+
+static struct mail_index *test_index_open(void)
+{
+	struct mail_index *index;
+
+	index = mail_index_alloc(TEST_DIR, "test.index");
+	test_assert(mail_index_open_or_create(index,
+				MAIL_INDEX_OPEN_FLAG_CREATE) == 0);
+	return index;
+}
+
+static void test_index_create(void)
+{
+	struct mail_index *index;
+	struct mail_index_sync_ctx *sync_ctx;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid_validity = 12345;
+	unsigned int i;
+
+	index = test_index_open();
+	mail_index_modseq_enable(index);
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	mail_index_append(trans, 1, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+	test_assert(mail_index_sync_begin(index, &sync_ctx, &view, &trans,
+					  0) == 1);
+	test_assert(mail_index_sync_commit(&sync_ctx) == 0);
+
+	/* each flag change increases the modseq */
+	view = mail_index_view_open(index);
+	for (i = 0; i < TEST_TRANSACTION_COUNT; i++) {
+		trans = mail_index_transaction_begin(view, 0);
+		mail_index_update_flags(trans, 1, i % 2 == 0 ?
+					MODIFY_ADD : MODIFY_REMOVE, MAIL_SEEN);
+		test_assert(mail_index_transaction_commit(&trans) == 0);
+	}
+	mail_index_view_close(&view);
+	mail_index_close(index);
+	mail_index_free(&index);
+}
+
+static struct mail_transaction_log_file *
+test_log_file_get(struct mail_index *index)
+{
+	struct mail_transaction_log_file *file = index->log->head;
+
+	test_assert(mail_index_refresh(index) == 0);
+	test_assert(mail_transaction_log_file_map(file, file->hdr.hdr_size,
+						  (uoff_t)-1) == 1);
+	return file;
+}
+
+static void test_positions_init(struct mail_index *index)
+{
+	struct mail_transaction_log_file *file = test_log_file_get(index);
+	const struct mail_transaction_header *hdr;
+	struct test_log_pos pos;
+	uint32_t trans_size;
+
+	/* walk through the whole log to get the expected values */
+	i_array_init(&test_positions, TEST_TRANSACTION_COUNT + 16);
+	pos.offset = file->hdr.hdr_size;
+	pos.highest_modseq = file->hdr.initial_modseq;
+	array_append(&test_positions, &pos, 1);
+	while (pos.offset < file->sync_offset) {
+		hdr = CONST_PTR_OFFSET(file->buffer->data,
+				       pos.offset - file->buffer_offset);
+		trans_size = mail_index_offset_to_uint32(hdr->size);
+		mail_transaction_update_modseq(hdr, hdr + 1,
+					       &pos.highest_modseq);
+		pos.offset += trans_size;
+		array_append(&test_positions, &pos, 1);
+	}
+	test_assert(pos.highest_modseq == file->sync_highest_modseq);
+}
+
+static void test_lookups(struct mail_index *index)
+{
+	struct mail_transaction_log_file *file = test_log_file_get(index);
+	const struct test_log_pos *positions;
+	unsigned int i, j, count;
+	uint64_t modseq;
+	uoff_t offset;
+
+	positions = array_get(&test_positions, &count);
+	for (i = count - 1; i > 0; i -= I_MIN(i, 97)) {
+		test_assert_idx(mail_transaction_log_file_get_highest_modseq_at(
+			file, positions[i].offset, &modseq) == 0, i);
+		test_assert_idx(modseq == positions[i].highest_modseq, i);
+
+		/* the first position where the modseq was reached */
+		for (j = i; j > 0; j--) {
+			if (positions[j-1].highest_modseq <
+			    positions[i].highest_modseq)
+				break;
+		}
+		test_assert_idx(mail_transaction_log_file_get_modseq_next_offset(
+			file, positions[i].highest_modseq, &offset) == 0, i);
+		test_assert_idx(offset == positions[j].offset, i);
+	}
+}
+
+static void test_mail_transaction_log_modseq(void)
+{
+	struct ioloop *ioloop;
+	struct mail_index *index;
+	const char *path;
+	struct stat st;
+	int fd;
+
+	test_begin("mail transaction log modseq");
+	/* indexid is taken from ioloop_time */
+	ioloop = io_loop_create();
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(TEST_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_DIR);
+	test_index_create();
+
+	/* scanning the log saves the checkpoints */
+	index = test_index_open();
+	test_positions_init(index);
+	test_lookups(index);
+	test_assert(array_count(&index->log->head->modseq_checkpoints) > 0);
+	path = t_strconcat(index->log->filepath,
+			   MAIL_TRANSACTION_LOG_MODSEQ_SUFFIX, NULL);
+	test_assert(stat(path, &st) == 0 && st.st_size > 0);
+	mail_index_close(index);
+
+	/* the next process uses them */
+	test_assert(mail_index_open(index, 0) == 1);
+	test_lookups(index);
+	test_assert(index->log->head->modseq_checkpoints_unsaved == 0);
+	mail_index_close(index);
+
+	/* corrupted checkpoints are ignored */
+	fd = open(path, O_WRONLY);
+	test_assert(fd != -1 &&
+		    pwrite_full(fd, "garbage", 7, st.st_size / 2) == 0);
+	i_close_fd(&fd);
+	test_expect_error_string("Corrupted modseq index");
+	test_assert(mail_index_open(index, 0) == 1);
+	test_lookups(index);
+	test_expect_no_more_errors();
+	mail_index_close(index);
+	mail_index_free(&index);
+
+	array_free(&test_positions);
+	(void)unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_mail_transaction_log_modseq,
+		NULL
+	};
+	return test_run(test_functions);
+}
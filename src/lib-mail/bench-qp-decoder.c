@@ -0,0 +1,84 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Measures qp_decoder throughput with input that resembles quoted-printable
+   encoded non-ASCII text: mostly plain text with frequent =XX escapes and
+   soft line breaks. Usage: bench-qp-decoder [<megabytes>] */
+
+#include "lib.h"
+#include "str.h"
+#include "qp-decoder.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_MB 64
+#define BENCH_BLOCK_SIZE (64*1024)
+#define BENCH_LINE_LEN 75
+
+static double bench_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+	long long usecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, start);
+	return (double)usecs;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char hex[] = "0123456789ABCDEF";
+	static const char text[] = "abcdefghijklmnopqrstuvwxyz.,  ";
+	string_t *input, *output;
+	struct qp_decoder *qp;
+	struct timeval start;
+	unsigned int i, rounds, line_len = 0, mb = BENCH_DEFAULT_MB;
+	const char *error;
+	size_t error_pos;
+	double usecs;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &mb) < 0)
+		i_fatal("Usage: bench-qp-decoder [<megabytes>]");
+	rounds = I_MAX(mb * 1024*1024 / BENCH_BLOCK_SIZE, 1);
+
+	input = str_new(default_pool, BENCH_BLOCK_SIZE + 16);
+	srand(1);
+	while (str_len(input) < BENCH_BLOCK_SIZE) {
+		if (line_len >= BENCH_LINE_LEN) {
+			str_append(input, "=\r\n");
+			line_len = 0;
+		} else if (rand() % 5 == 0) {
+			str_printfa(input, "=%c%c", hex[0x8 + rand() % 8],
+				    hex[rand() % 16]);
+			line_len += 3;
+		} else {
+			str_append_c(input, text[rand() % (sizeof(text)-1)]);
+			line_len++;
+		}
+	}
+
+	output = str_new(default_pool, BENCH_BLOCK_SIZE);
+	qp = qp_decoder_init(output);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < rounds; i++) {
+		str_truncate(output, 0);
+		if (qp_decoder_more(qp, str_data(input), str_len(input),
+				    &error_pos, &error) < 0 ||
+		    qp_decoder_finish(qp, &error) < 0)
+			i_fatal("qp_decoder failed: %s", error);
+	}
+	usecs = bench_usecs_since(&start);
+	printf("decode   %8.2f GB/s\n", usecs == 0 ? 0 :
+	       (double)rounds * str_len(input) / (usecs * 1000.0));
+
+	qp_decoder_deinit(&qp);
+	str_free(&output);
+	str_free(&input);
+	lib_deinit();
+	return 0;
+}
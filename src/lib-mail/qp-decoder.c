@@ -2,7 +2,6 @@
 
 #include "lib.h"
 #include "buffer.h"
-#include "hex-binary.h"
 #include "qp-decoder.h"
 
 /* quoted-printable lines can be max 76 characters. if we've seen more than
@@ -10,9 +9,18 @@
    in the line except trailing whitespace. */
 #define QP_MAX_WHITESPACE_LEN 76
 
+/* Size of the local block where qp_decoder_more_text() collects its output
+   before appending it to the destination buffer */
+#define QP_DECODE_BLOCK_SIZE 1024
+
 #define QP_IS_TRAILING_WHITESPACE(c) \
 	((c) == ' ' || (c) == '\t')
 
+/* Characters that need special handling in text */
+static const bool qp_special_chars[256] = {
+	['='] = TRUE, ['\r'] = TRUE, ['\n'] = TRUE, [' '] = TRUE, ['\t'] = TRUE
+};
+
 enum qp_state {
 	STATE_TEXT = 0,
 	STATE_WHITESPACE,
@@ -48,19 +56,68 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+/* Hex digit value + 1 for each character, 0 if it's not a hex digit.
+   Lowercase hex isn't strictly valid, but allow it. */
+static const unsigned char qp_hex_values[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6,
+	['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10, ['A'] = 11, ['B'] = 12,
+	['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16, ['a'] = 11,
+	['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+static inline int qp_hex_value(unsigned char c)
+{
+	return (int)qp_hex_values[c] - 1;
+}
+
+static void
+qp_decoder_block_append(struct qp_decoder *qp, unsigned char *block,
+			size_t *block_pos, const unsigned char *data,
+			size_t size)
+{
+	if (*block_pos + size > QP_DECODE_BLOCK_SIZE) {
+		buffer_append(qp->dest, block, *block_pos);
+		*block_pos = 0;
+		if (size > QP_DECODE_BLOCK_SIZE) {
+			buffer_append(qp->dest, data, size);
+			return;
+		}
+	}
+	memcpy(block + *block_pos, data, size);
+	*block_pos += size;
+}
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
 {
-	size_t i, start = 0, ret = src_size;
+	/* decoded output is collected into a local block, which avoids
+	   calling buffer_append() separately for each =<hex><hex> */
+	unsigned char block[QP_DECODE_BLOCK_SIZE+2], chr;
+	size_t i, start = 0, block_pos = 0, ret = src_size;
+	int hi, lo;
 
 	for (i = 0; i < src_size; i++) {
-		if (src[i] > '=') {
+		if (!qp_special_chars[src[i]]) {
 			/* fast path */
 			continue;
 		}
 		switch (src[i]) {
 		case '=':
+			if (src_size - i > 2 &&
+			    (hi = qp_hex_value(src[i+1])) >= 0 &&
+			    (lo = qp_hex_value(src[i+2])) >= 0) {
+				/* fast path for =<hex><hex> that doesn't go
+				   through the states */
+				qp_decoder_block_append(qp, block, &block_pos,
+							src+start, i-start);
+				chr = (hi << 4) | lo;
+				qp_decoder_block_append(qp, block, &block_pos,
+							&chr, 1);
+				i += 2;
+				start = i+1;
+				continue;
+			}
 			qp->state = STATE_EQUALS;
 			break;
 		case '\r':
@@ -68,12 +125,21 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 			break;
 		case '\n':
 			/* LF without preceding CR */
-			buffer_append(qp->dest, src+start, i-start);
-			buffer_append(qp->dest, "\r\n", 2);
+			qp_decoder_block_append(qp, block, &block_pos,
+						src+start, i-start);
+			qp_decoder_block_append(qp, block, &block_pos,
+						(const void *)"\r\n", 2);
 			start = i+1;
 			continue;
 		case ' ':
 		case '\t':
+			if (src_size - i > 1 &&
+			    !QP_IS_TRAILING_WHITESPACE(src[i+1]) &&
+			    src[i+1] != '\r' && src[i+1] != '\n') {
+				/* fast path for whitespace within text - it
+				   can't be trailing whitespace */
+				continue;
+			}
 			i_assert(qp->whitespace->used == 0);
 			qp->state = STATE_WHITESPACE;
 			buffer_append_c(qp->whitespace, src[i]);
@@ -84,7 +150,8 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		ret = i+1;
 		break;
 	}
-	buffer_append(qp->dest, src+start, i-start);
+	qp_decoder_block_append(qp, block, &block_pos, src+start, i-start);
+	buffer_append(qp->dest, block, block_pos);
 	return ret;
 }
 
@@ -175,10 +242,7 @@ int qp_decoder_more(struct qp_decoder *qp, const unsigned char *src,
 			}
 			break;
 		case STATE_EQUALS:
-			if ((src[i] >= '0' && src[i] <= '9') ||
-			    (src[i] >= 'A' && src[i] <= 'F') ||
-			    /* lowercase hex isn't strictly valid, but allow */
-			    (src[i] >= 'a' && src[i] <= 'f')) {
+			if (qp_hex_value(src[i]) >= 0) {
 				qp->hexchar = src[i];
 				qp->state = STATE_HEX2;
 			} else if (QP_IS_TRAILING_WHITESPACE(src[i])) {
@@ -200,16 +264,10 @@ int qp_decoder_more(struct qp_decoder *qp, const unsigned char *src,
 			}
 			break;
 		case STATE_HEX2:
-			if ((src[i] >= '0' && src[i] <= '9') ||
-			    (src[i] >= 'A' && src[i] <= 'F') ||
-			    (src[i] >= 'a' && src[i] <= 'f')) {
-				char data[3];
-
-				data[0] = qp->hexchar;
-				data[1] = src[i];
-				data[2] = '\0';
-				if (hex_to_binary(data, qp->dest) < 0)
-					i_unreached();
+			if (qp_hex_value(src[i]) >= 0) {
+				buffer_append_c(qp->dest,
+					(qp_hex_value(qp->hexchar) << 4) |
+					qp_hex_value(src[i]));
 				qp->state = STATE_TEXT;
 			} else {
 				/* invalid input */
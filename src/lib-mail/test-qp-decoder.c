@@ -85,10 +85,57 @@ static void test_qp_decoder(void)
 	test_end();
 }
 
+static void test_qp_decoder_random(void)
+{
+	static const char chars[] = "=\r\n \t09AFafxz_";
+	unsigned char input[500];
+	string_t *str, *str2;
+	struct qp_decoder *qp;
+	size_t error_pos;
+	const char *error;
+	unsigned int i, j, len;
+	int ret, ret2;
+
+	test_begin("qp-decoder random");
+	str = t_str_new(sizeof(input));
+	str2 = t_str_new(sizeof(input));
+	for (i = 0; i < 1000; i++) {
+		len = rand() % sizeof(input);
+		for (j = 0; j < len; j++)
+			input[j] = chars[rand() % (sizeof(chars)-1)];
+
+		/* decoding everything at once uses the fast paths, while
+		   decoding a byte at a time goes through all the states.
+		   the results must be identical. */
+		str_truncate(str, 0);
+		qp = qp_decoder_init(str);
+		ret = qp_decoder_more(qp, input, len, &error_pos, &error);
+		if (qp_decoder_finish(qp, &error) < 0)
+			ret = -1;
+		qp_decoder_deinit(&qp);
+
+		str_truncate(str2, 0);
+		qp = qp_decoder_init(str2);
+		ret2 = 0;
+		for (j = 0; j < len; j++) {
+			if (qp_decoder_more(qp, input+j, 1, &error_pos, &error) < 0)
+				ret2 = -1;
+		}
+		if (qp_decoder_finish(qp, &error) < 0)
+			ret2 = -1;
+		qp_decoder_deinit(&qp);
+
+		test_assert_idx(ret == ret2, i);
+		test_assert_idx(str_equals(str, str2), i);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*test_functions[])(void) = {
 		test_qp_decoder,
+		test_qp_decoder_random,
 		NULL
 	};
 	return test_run(test_functions);
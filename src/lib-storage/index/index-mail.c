@@ -314,11 +314,19 @@ int index_mail_get_parts(struct mail *_mail, struct message_part **parts_r)
 	struct index_mail *mail = (struct index_mail *)_mail;
 	struct index_mail_data *data = &mail->data;
 
-	data->cache_fetch_fields |= MAIL_FETCH_MESSAGE_PARTS;
 	if (data->parts != NULL || get_cached_parts(mail)) {
 		*parts_r = data->parts;
 		return 0;
 	}
+	if (_mail->lookup_abort == MAIL_LOOKUP_ABORT_NOT_IN_CACHE) {
+		/* the parser may already be running, in which case
+		   index_mail_parse_body() wouldn't notice the abort.
+		   a lookup that only peeks into the cache doesn't make the
+		   parts wanted in the cache. */
+		mail_set_aborted(_mail);
+		return -1;
+	}
+	data->cache_fetch_fields |= MAIL_FETCH_MESSAGE_PARTS;
 
 	if (data->parser_ctx == NULL) {
 		if (index_mail_parse_headers(mail, NULL) < 0)
@@ -1127,6 +1135,9 @@ void index_mail_set_read_buffer_size(struct mail *_mail, struct istream *input)
 	block_size = (mail->data.access_part & (READ_BODY | PARSE_BODY)) != 0 ?
 		MAIL_READ_FULL_BLOCK_SIZE : MAIL_READ_HDR_BLOCK_SIZE;
 	i_stream_set_init_buffer_size(input, block_size);
+	if (block_size == MAIL_READ_FULL_BLOCK_SIZE &&
+	    _mail->box->storage->set->mail_async_readahead)
+		i_stream_set_async_readahead(input, TRUE);
 }
 
 int index_mail_init_stream(struct index_mail *mail,
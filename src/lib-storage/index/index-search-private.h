@@ -16,13 +16,21 @@ struct index_search_context {
 	struct mailbox_header_lookup_ctx *extra_wanted_headers;
 
 	uint32_t seq1, seq2;
+	/* Messages that may match according to the index-only args */
+	ARRAY_TYPE(seq_range) index_seqs;
+	unsigned int index_seqs_idx;
 	struct mail *cur_mail;
 	struct index_mail *cur_imail;
 	struct mail_thread_context *thread_ctx;
+	struct index_search_workers *workers;
 
 	ARRAY(struct mail *) mails;
 	unsigned int unused_mail_idx;
 	unsigned int max_mails;
+	/* Number of mails currently being prefetched ahead (<= max_mails).
+	   Grows when the prefetching doesn't finish in time. */
+	unsigned int prefetch_window;
+	unsigned int prefetch_fast_count;
 
 	struct timeval search_start_time, last_notify;
 	struct timeval last_nonblock_timeval;
@@ -33,8 +41,33 @@ struct index_search_context {
 	bool have_seqsets:1;
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
+	bool workers_checked:1;
+	bool workers_pending:1;
 };
 
+/* For unit tests: a worker process whose chunk contains this sequence fails
+   without searching it. */
+extern uint32_t index_search_workers_test_fail_seq;
+
 struct mail *index_search_get_mail(struct index_search_context *ctx);
+/* Update the prefetch window after accessing the oldest prefetched mail.
+   slow is TRUE if it still had to wait for its data. */
+void index_search_prefetch_update_window(struct index_search_context *ctx,
+					 bool slow);
+
+/* Fork worker processes to search ctx->seq1..seq2 if it's useful for this
+   search. Only the messages in ctx->index_seqs are searched if it's set.
+   Returns NULL if not. */
+struct index_search_workers *
+index_search_workers_init(struct index_search_context *ctx);
+void index_search_workers_deinit(struct index_search_workers **workers);
+/* Returns 1 if the message may match, 0 if the workers found it doesn't
+   match, -1 if the workers haven't finished with it yet. The sequences must
+   be looked up in ascending order. */
+int index_search_workers_lookup(struct index_search_workers *workers,
+				uint32_t seq);
+/* Wait for up to msecs for the workers to finish more messages. */
+void index_search_workers_wait(struct index_search_workers *workers,
+			       unsigned int msecs);
 
 #endif
@@ -0,0 +1,541 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "fd-set-nonblock.h"
+#include "file-lock.h"
+#include "write-full.h"
+#include "seq-range-array.h"
+#include "mail-namespace.h"
+#include "mail-search-build.h"
+#include "index-storage.h"
+#include "index-search-private.h"
+
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Searching message bodies in a large mailbox is split into chunks of
+   sequences, which are searched by forked child processes. The children
+   open the mailbox again, so they don't share file offsets or locks with the
+   parent, and only tell which messages matched in their chunk. The parent
+   skips the messages that didn't match and searches the rest normally, so
+   the results and their side effects (caching, expunge handling) are the
+   same as without workers. Chunks are started and consumed in sequence
+   order. They contain only the messages that may match according to the
+   index-only args (e.g. UID sets and flags), so no processes are forked for
+   parts of the mailbox that aren't going to be searched at all.
+
+   The number of workers is limited for the whole user, including its other
+   sessions. Each running worker holds a lock on one of the
+   mail_search_workers slot files in the user's INBOX index directory. */
+
+/* don't bother forking for fewer messages than this */
+#define INDEX_SEARCH_WORKER_MIN_MESSAGES 1000
+/* use smaller chunks than messages/workers, so the parent gets the first
+   results sooner and a slow chunk doesn't leave the other workers idle */
+#define INDEX_SEARCH_WORKER_CHUNKS_PER_WORKER 4
+#define INDEX_SEARCH_WORKER_LOCK_FNAME_PREFIX "dovecot.search-worker."
+
+struct index_search_worker {
+	uint32_t seq1, seq2;
+	pid_t pid;
+	int fd;
+	int lock_fd;
+	struct file_lock *lock;
+	buffer_t *input;
+	ARRAY_TYPE(seq_range) matches;
+
+	bool started:1;
+	bool finished:1;
+	bool failed:1;
+};
+
+struct index_search_workers {
+	struct index_search_context *ctx;
+	unsigned int max_running;
+	char *lock_dir;
+
+	ARRAY(struct index_search_worker) chunks;
+	unsigned int next_start_idx;
+	/* the chunk that contains or follows the last looked up sequence */
+	unsigned int lookup_idx;
+};
+
+uint32_t index_search_workers_test_fail_seq = 0;
+static bool index_search_worker_process = FALSE;
+
+static bool search_args_have_body(const struct mail_search_arg *arg)
+{
+	for (; arg != NULL; arg = arg->next) {
+		if (arg->match_always || arg->nonmatch_always)
+			continue;
+
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			if (search_args_have_body(arg->value.subargs))
+				return TRUE;
+			break;
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			return TRUE;
+		default:
+			break;
+		}
+	}
+	return FALSE;
+}
+
+static int
+index_search_worker_search(struct index_search_context *ctx,
+			   uint32_t seq1, uint32_t seq2,
+			   ARRAY_TYPE(seq_range) *matches)
+{
+	struct mailbox *box;
+	struct mailbox_transaction_context *t;
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	uint32_t seq, our_seq, uid, uid1, uid2;
+	int ret = 0;
+
+	box = mailbox_alloc(ctx->box->list, ctx->box->vname, 0);
+	box->mail_cache_disabled = TRUE;
+	if (mailbox_open(box) < 0) {
+		mailbox_free(&box);
+		return -1;
+	}
+	t = mailbox_transaction_begin(box, 0);
+
+	/* our view may have different sequences than the parent's. use UIDs
+	   for the chunk and for any seqsets in the search args. */
+	args = mail_search_args_dup(ctx->mail_ctx.args);
+	args->box = ctx->box;
+	mail_search_args_seq2uid(args);
+	args->box = NULL;
+	mail_index_lookup_uid(ctx->view, seq1, &uid1);
+	mail_index_lookup_uid(ctx->view, seq2, &uid2);
+	arg = mail_search_build_add(args, SEARCH_UIDSET);
+	p_array_init(&arg->value.seqset, args->pool, 1);
+	seq_range_array_add_range(&arg->value.seqset, uid1, uid2);
+	mail_search_args_init(args, box, TRUE, NULL);
+
+	search_ctx = mailbox_search_init(t, args, NULL, 0, NULL);
+	search_ctx->progress_hidden = TRUE;
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (mail_index_lookup_seq(ctx->view, mail->uid, &seq))
+			seq_range_array_add(matches, seq);
+	}
+	if (mailbox_search_seen_lost_data(search_ctx))
+		ret = -1;
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		ret = -1;
+
+	/* let the parent notice the messages that were already expunged */
+	for (seq = seq1; seq <= seq2 && ret == 0; seq++) {
+		mail_index_lookup_uid(ctx->view, seq, &uid);
+		if (!mail_index_lookup_seq(t->view, uid, &our_seq))
+			seq_range_array_add(matches, seq);
+	}
+	mail_search_args_unref(&args);
+	mailbox_transaction_rollback(&t);
+	mailbox_free(&box);
+	return ret;
+}
+
+static void
+index_search_worker_child(struct index_search_workers *workers,
+			  struct index_search_worker *worker, int fd)
+{
+	struct index_search_worker *chunk;
+	ARRAY_TYPE(seq_range) matches;
+	struct seq_range end;
+	int ret;
+
+	/* SIGTERM from the parent should kill us immediately */
+	(void)signal(SIGTERM, SIG_DFL);
+	index_search_worker_process = TRUE;
+	/* the parent's ioloop has an epoll set and an io_uring ring that
+	   are shared with the parent. don't use them. */
+	(void)io_loop_create();
+	/* the slot locks stay with the parent */
+	array_foreach_modifiable(&workers->chunks, chunk) {
+		if (chunk->lock_fd != -1)
+			i_close_fd(&chunk->lock_fd);
+	}
+
+	if (index_search_workers_test_fail_seq >= worker->seq1 &&
+	    index_search_workers_test_fail_seq <= worker->seq2)
+		_exit(1);
+
+	i_array_init(&matches, 128);
+	T_BEGIN {
+		ret = index_search_worker_search(workers->ctx, worker->seq1,
+						 worker->seq2, &matches);
+	} T_END;
+	if (ret < 0) {
+		/* exit without the end marker. the parent will search
+		   this chunk by itself. */
+		_exit(1);
+	}
+
+	memset(&end, 0, sizeof(end));
+	array_append(&matches, &end, 1);
+	if (write_full(fd, array_idx(&matches, 0),
+		       array_count(&matches) * sizeof(end)) < 0) {
+		if (errno != EPIPE)
+			i_error("write(search worker pipe) failed: %m");
+		_exit(1);
+	}
+	_exit(0);
+}
+
+static void index_search_worker_unlock(struct index_search_worker *worker)
+{
+	if (worker->lock != NULL)
+		file_unlock(&worker->lock);
+	if (worker->lock_fd != -1)
+		i_close_fd(&worker->lock_fd);
+}
+
+static int
+index_search_worker_lock(struct index_search_workers *workers,
+			 struct index_search_worker *worker)
+{
+	const char *path;
+	unsigned int i;
+	int fd, ret;
+
+	/* flock() locks conflict also within the same process, so this
+	   counts the workers of the user's other searches in this process
+	   as well. */
+	for (i = 0; i < workers->max_running; i++) {
+		path = t_strdup_printf("%s/"INDEX_SEARCH_WORKER_LOCK_FNAME_PREFIX
+				       "%u", workers->lock_dir, i);
+		fd = open(path, O_RDWR | O_CREAT, 0600);
+		if (fd == -1) {
+			i_error("open(%s) failed: %m", path);
+			return -1;
+		}
+		ret = file_try_lock(fd, path, F_WRLCK, FILE_LOCK_METHOD_FLOCK,
+				    &worker->lock);
+		if (ret > 0) {
+			worker->lock_fd = fd;
+			return 1;
+		}
+		i_close_fd(&fd);
+		if (ret < 0)
+			return -1;
+	}
+	/* all the slots are in use */
+	return 0;
+}
+
+static void
+index_search_worker_start(struct index_search_workers *workers,
+			  struct index_search_worker *worker)
+{
+	int fd[2];
+
+	i_assert(!worker->started);
+	i_assert(worker->lock != NULL);
+
+	worker->started = TRUE;
+	worker->fd = -1;
+	if (pipe(fd) < 0) {
+		i_error("pipe() failed: %m");
+		index_search_worker_unlock(worker);
+		worker->failed = TRUE;
+		return;
+	}
+	if ((worker->pid = fork()) == (pid_t)-1) {
+		i_error("fork() failed: %m");
+		i_close_fd(&fd[0]);
+		i_close_fd(&fd[1]);
+		index_search_worker_unlock(worker);
+		worker->failed = TRUE;
+		return;
+	}
+	if (worker->pid == 0) {
+		/* child */
+		i_close_fd(&fd[0]);
+		index_search_worker_child(workers, worker, fd[1]);
+		i_unreached();
+	}
+	i_close_fd(&fd[1]);
+	fd_set_nonblock(fd[0], TRUE);
+	worker->fd = fd[0];
+	worker->input = buffer_create_dynamic(default_pool, 256);
+}
+
+static void
+index_search_workers_start_more(struct index_search_workers *workers)
+{
+	struct index_search_worker *chunks, *worker;
+	unsigned int count;
+
+	chunks = array_get_modifiable(&workers->chunks, &count);
+	while (workers->next_start_idx < count) {
+		worker = &chunks[workers->next_start_idx];
+		if (index_search_worker_lock(workers, worker) <= 0)
+			break;
+		workers->next_start_idx++;
+		index_search_worker_start(workers, worker);
+	}
+}
+
+static void
+index_search_worker_stop(struct index_search_worker *worker, bool kill_child)
+{
+	int status;
+
+	if (worker->fd == -1)
+		return;
+
+	if (kill_child && kill(worker->pid, SIGTERM) < 0 && errno != ESRCH)
+		i_error("kill(%s, SIGTERM) failed: %m", dec2str(worker->pid));
+	if (waitpid(worker->pid, &status, 0) < 0 && errno != ECHILD)
+		i_error("waitpid(%s) failed: %m", dec2str(worker->pid));
+	i_close_fd(&worker->fd);
+	buffer_free(&worker->input);
+	index_search_worker_unlock(worker);
+}
+
+static void
+index_search_worker_input(struct index_search_workers *workers,
+			  struct index_search_worker *worker)
+{
+	const struct seq_range *range;
+	unsigned char buf[1024];
+	size_t pos;
+	ssize_t ret;
+
+	while ((ret = read(worker->fd, buf, sizeof(buf))) > 0)
+		buffer_append(worker->input, buf, ret);
+	if (ret < 0 && errno == EAGAIN)
+		return;
+
+	/* the child is finished */
+	if (ret < 0)
+		i_error("read(search worker pipe) failed: %m");
+	for (pos = 0; pos + sizeof(*range) <= worker->input->used;
+	     pos += sizeof(*range)) {
+		range = CONST_PTR_OFFSET(worker->input->data, pos);
+		if (range->seq1 == 0) {
+			worker->finished = pos + sizeof(*range) ==
+				worker->input->used;
+			break;
+		}
+		if (range->seq1 < worker->seq1 || range->seq2 > worker->seq2 ||
+		    range->seq1 > range->seq2)
+			break;
+		seq_range_array_add_range(&worker->matches,
+					  range->seq1, range->seq2);
+	}
+	if (!worker->finished) {
+		/* crashed or failed. the parent searches this chunk. */
+		worker->failed = TRUE;
+	}
+	index_search_worker_stop(worker, FALSE);
+	index_search_workers_start_more(workers);
+}
+
+static void index_search_workers_read(struct index_search_workers *workers)
+{
+	struct index_search_worker *worker;
+
+	array_foreach_modifiable(&workers->chunks, worker) {
+		if (worker->fd != -1)
+			index_search_worker_input(workers, worker);
+	}
+}
+
+static void
+index_search_workers_add_chunks(struct index_search_workers *workers,
+				const ARRAY_TYPE(seq_range) *seqs,
+				unsigned int chunk_size)
+{
+	struct index_search_worker *worker = NULL;
+	const struct seq_range *range;
+	unsigned int n = 0;
+	uint32_t seq, len;
+
+	array_foreach(seqs, range) {
+		for (seq = range->seq1; seq <= range->seq2; seq += len) {
+			if (worker == NULL || n == chunk_size) {
+				worker = array_append_space(&workers->chunks);
+				worker->fd = -1;
+				worker->lock_fd = -1;
+				worker->seq1 = seq;
+				i_array_init(&worker->matches, 32);
+				n = 0;
+			}
+			len = I_MIN(range->seq2 - seq + 1, chunk_size - n);
+			n += len;
+			worker->seq2 = seq + len - 1;
+		}
+	}
+}
+
+struct index_search_workers *
+index_search_workers_init(struct index_search_context *ctx)
+{
+	struct index_search_workers *workers;
+	struct mail_namespace *inbox_ns;
+	ARRAY_TYPE(seq_range) all_seqs;
+	const ARRAY_TYPE(seq_range) *seqs;
+	unsigned int max_workers = ctx->box->storage->set->mail_search_workers;
+	unsigned int count, chunk_count, chunk_size;
+	const char *lock_dir;
+
+	if (max_workers == 0 || index_search_worker_process)
+		return NULL;
+	if (ctx->seq1 == 0 || ctx->seq1 > ctx->seq2)
+		return NULL;
+	/* virtual mailboxes iterate their own way through the sequences */
+	if (ctx->box->virtual_vfuncs != NULL)
+		return NULL;
+	if (ctx->mail_ctx.args->stop_on_nonmatch ||
+	    !search_args_have_body(ctx->mail_ctx.args->args))
+		return NULL;
+
+	/* only the messages that may still match are searched */
+	if (array_is_created(&ctx->index_seqs))
+		seqs = &ctx->index_seqs;
+	else {
+		t_array_init(&all_seqs, 1);
+		seq_range_array_add_range(&all_seqs, ctx->seq1, ctx->seq2);
+		seqs = &all_seqs;
+	}
+	count = seq_range_count(seqs);
+	if (count < INDEX_SEARCH_WORKER_MIN_MESSAGES)
+		return NULL;
+
+	/* the slot locks need a directory. without one (e.g. in-memory
+	   indexes) there's no way to limit the workers per user. */
+	inbox_ns = mail_namespace_find_inbox(ctx->box->storage->user->namespaces);
+	if (inbox_ns == NULL ||
+	    !mailbox_list_get_root_path(inbox_ns->list,
+					MAILBOX_LIST_PATH_TYPE_INDEX,
+					&lock_dir))
+		return NULL;
+
+	chunk_count = max_workers * INDEX_SEARCH_WORKER_CHUNKS_PER_WORKER;
+	chunk_size = I_MAX((count + chunk_count - 1) / chunk_count,
+			   INDEX_SEARCH_WORKER_MIN_MESSAGES /
+			   INDEX_SEARCH_WORKER_CHUNKS_PER_WORKER);
+
+	workers = i_new(struct index_search_workers, 1);
+	workers->ctx = ctx;
+	workers->max_running = max_workers;
+	workers->lock_dir = i_strdup(lock_dir);
+	i_array_init(&workers->chunks, chunk_count);
+	index_search_workers_add_chunks(workers, seqs, chunk_size);
+
+	if (ctx->box->storage->set->mail_debug) {
+		i_debug("%s: Searching %u messages within %u..%u in %u chunks "
+			"with max %u worker processes", ctx->box->vname,
+			count, ctx->seq1, ctx->seq2,
+			array_count(&workers->chunks), max_workers);
+	}
+	index_search_workers_start_more(workers);
+	return workers;
+}
+
+void index_search_workers_deinit(struct index_search_workers **_workers)
+{
+	struct index_search_workers *workers = *_workers;
+	struct index_search_worker *worker;
+
+	*_workers = NULL;
+
+	array_foreach_modifiable(&workers->chunks, worker) {
+		index_search_worker_stop(worker, TRUE);
+		array_free(&worker->matches);
+	}
+	array_free(&workers->chunks);
+	i_free(workers->lock_dir);
+	i_free(workers);
+}
+
+int index_search_workers_lookup(struct index_search_workers *workers,
+				uint32_t seq)
+{
+	struct index_search_worker *chunks, *worker;
+	unsigned int count;
+	bool stopped = FALSE;
+
+	/* the sequences are looked up in ascending order */
+	chunks = array_get_modifiable(&workers->chunks, &count);
+	while (workers->lookup_idx < count &&
+	       chunks[workers->lookup_idx].seq2 < seq) {
+		/* none of the remaining messages in this chunk are going to
+		   be looked up. a worker still running for it would only
+		   keep a slot in use. */
+		worker = &chunks[workers->lookup_idx++];
+		if (worker->fd != -1) {
+			index_search_worker_stop(worker, TRUE);
+			stopped = TRUE;
+		}
+	}
+	if (workers->next_start_idx < workers->lookup_idx) {
+		/* don't start workers for the chunks that were passed */
+		workers->next_start_idx = workers->lookup_idx;
+	}
+	if (stopped)
+		index_search_workers_start_more(workers);
+
+	if (workers->lookup_idx == count ||
+	    seq < chunks[workers->lookup_idx].seq1) {
+		/* not in any chunk */
+		return 1;
+	}
+	worker = &chunks[workers->lookup_idx];
+
+	if (!worker->started) {
+		/* all the earlier chunks are finished, but the user's other
+		   searches are using all the workers. search this chunk
+		   ourself. */
+		i_assert(workers->next_start_idx == workers->lookup_idx);
+		workers->next_start_idx++;
+		worker->started = TRUE;
+		worker->failed = TRUE;
+		return 1;
+	}
+	if (worker->fd != -1)
+		index_search_workers_read(workers);
+	if (worker->failed)
+		return 1;
+	if (!worker->finished)
+		return -1;
+	return seq_range_exists(&worker->matches, seq) ? 1 : 0;
+}
+
+void index_search_workers_wait(struct index_search_workers *workers,
+			       unsigned int msecs)
+{
+	struct index_search_worker *worker;
+	ARRAY(struct pollfd) pollfds;
+	struct pollfd *pfd;
+
+	t_array_init(&pollfds, workers->max_running);
+	array_foreach_modifiable(&workers->chunks, worker) {
+		if (worker->fd != -1) {
+			pfd = array_append_space(&pollfds);
+			pfd->fd = worker->fd;
+			pfd->events = POLLIN;
+		}
+	}
+	if (array_count(&pollfds) == 0)
+		return;
+
+	if (poll(array_idx_modifiable(&pollfds, 0), array_count(&pollfds),
+		 msecs) < 0 && errno != EINTR)
+		i_error("poll(search workers) failed: %m");
+	index_search_workers_read(workers);
+}
@@ -36,6 +36,13 @@
 #define SEARCH_INITIAL_MAX_COST 30000
 #define SEARCH_RECALC_MIN_USECS 50000
 
+/* Waiting longer than this for a prefetched mail's data means the prefetching
+   didn't finish in time, i.e. we should be prefetching further ahead. */
+#define SEARCH_PREFETCH_SLOW_USECS 1000
+#define SEARCH_PREFETCH_MIN_WINDOW 2
+/* Shrink the prefetch window after this many mails were accessed fast */
+#define SEARCH_PREFETCH_SHRINK_COUNT 32
+
 struct search_header_context {
         struct index_search_context *index_ctx;
         struct index_mail *imail;
@@ -237,6 +244,207 @@ static void search_index_arg(struct mail_search_arg *arg,
 	}
 }
 
+static bool
+search_arg_get_index_seqs(struct index_search_context *ctx,
+			  struct mail_search_arg *arg,
+			  const ARRAY_TYPE(seq_range) *limit,
+			  ARRAY_TYPE(seq_range) *seqs);
+
+static bool search_arg_is_seqset(const struct mail_search_arg *arg)
+{
+	return arg->type == SEARCH_SEQSET || arg->type == SEARCH_UIDSET ||
+		arg->type == SEARCH_INTHREAD;
+}
+
+static bool
+search_args_get_index_seqs(struct index_search_context *ctx,
+			   struct mail_search_arg *args, bool or_list,
+			   const ARRAY_TYPE(seq_range) *limit,
+			   ARRAY_TYPE(seq_range) *seqs)
+{
+	ARRAY_TYPE(seq_range) cur_seqs, arg_seqs;
+	struct mail_search_arg *arg;
+	unsigned int pass;
+	bool found = FALSE;
+
+	if (or_list) {
+		/* any arg that isn't known may match anything */
+		for (arg = args; arg != NULL; arg = arg->next) {
+			t_array_init(&arg_seqs, 16);
+			if (!search_arg_get_index_seqs(ctx, arg, limit,
+						       &arg_seqs))
+				return FALSE;
+			seq_range_array_merge(seqs, &arg_seqs);
+		}
+		return TRUE;
+	}
+
+	/* check the sequence/UID sets first, so the other args only need
+	   to look at the records that are still left */
+	t_array_init(&cur_seqs, array_count(limit));
+	array_append_array(&cur_seqs, limit);
+	for (pass = 0; pass < 2 && array_count(&cur_seqs) > 0; pass++) {
+		for (arg = args; arg != NULL; arg = arg->next) {
+			if (search_arg_is_seqset(arg) != (pass == 0))
+				continue;
+
+			t_array_init(&arg_seqs, 16);
+			if (!search_arg_get_index_seqs(ctx, arg, &cur_seqs,
+						       &arg_seqs))
+				continue;
+			array_clear(&cur_seqs);
+			array_append_array(&cur_seqs, &arg_seqs);
+			found = TRUE;
+			if (array_count(&cur_seqs) == 0)
+				break;
+		}
+	}
+	if (!found)
+		return FALSE;
+	array_append_array(seqs, &cur_seqs);
+	return TRUE;
+}
+
+static void
+search_uidset_get_seqs(struct index_search_context *ctx,
+		       const ARRAY_TYPE(seq_range) *uids,
+		       ARRAY_TYPE(seq_range) *seqs)
+{
+	const struct seq_range *range;
+	uint32_t seq1, seq2;
+
+	array_foreach(uids, range) {
+		if (mail_index_lookup_seq_range(ctx->view, range->seq1,
+						range->seq2, &seq1, &seq2))
+			seq_range_array_add_range(seqs, seq1, seq2);
+	}
+}
+
+static void
+search_records_get_seqs(struct index_search_context *ctx,
+			struct mail_search_arg *arg,
+			const ARRAY_TYPE(seq_range) *limit,
+			ARRAY_TYPE(seq_range) *seqs)
+{
+	const struct mail_index_record *rec;
+	const struct seq_range *range;
+	uint32_t seq, orig_seq = ctx->mail_ctx.seq;
+
+	array_foreach(limit, range) {
+		for (seq = range->seq1; seq <= range->seq2; seq++) {
+			/* keywords and modseqs are looked up using the
+			   current sequence */
+			ctx->mail_ctx.seq = seq;
+			rec = mail_index_lookup(ctx->view, seq);
+			if (search_arg_match_index(ctx, arg, rec) > 0)
+				seq_range_array_add(seqs, seq);
+		}
+	}
+	ctx->mail_ctx.seq = orig_seq;
+}
+
+/* Get the sequences within limit that match the arg using only the index.
+   Returns FALSE if the arg can't be evaluated that way. */
+static bool
+search_arg_get_index_seqs(struct index_search_context *ctx,
+			  struct mail_search_arg *arg,
+			  const ARRAY_TYPE(seq_range) *limit,
+			  ARRAY_TYPE(seq_range) *seqs)
+{
+	ARRAY_TYPE(seq_range) matches;
+
+	if (arg->match_always || arg->nonmatch_always) {
+		/* the result is already known and it doesn't depend on the
+		   arg's value */
+		return FALSE;
+	}
+
+	t_array_init(&matches, 16);
+	switch (arg->type) {
+	case SEARCH_SUB:
+	case SEARCH_OR:
+		if (arg->match_not)
+			return FALSE;
+		return search_args_get_index_seqs(ctx, arg->value.subargs,
+						  arg->type == SEARCH_OR,
+						  limit, seqs);
+	case SEARCH_SEQSET:
+		array_append_array(&matches, &arg->value.seqset);
+		break;
+	case SEARCH_UIDSET:
+	case SEARCH_INTHREAD:
+		search_uidset_get_seqs(ctx, &arg->value.seqset, &matches);
+		break;
+	case SEARCH_FLAGS:
+	case SEARCH_KEYWORDS:
+	case SEARCH_MODSEQ:
+		search_records_get_seqs(ctx, arg, limit, &matches);
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (!arg->match_not) {
+		seq_range_array_intersect(&matches, limit);
+		array_append_array(seqs, &matches);
+	} else {
+		array_append_array(seqs, limit);
+		seq_range_array_remove_seq_range(seqs, &matches);
+	}
+	return TRUE;
+}
+
+static void search_index_seqs_init(struct index_search_context *ctx)
+{
+	ARRAY_TYPE(seq_range) limit, seqs;
+
+	if (!ctx->have_seqsets && !ctx->have_index_args)
+		return;
+	if (array_is_created(&ctx->index_seqs))
+		return;
+	if (ctx->seq1 > ctx->seq2)
+		return;
+	/* virtual mailboxes iterate their own way through the sequences */
+	if (ctx->box->virtual_vfuncs != NULL)
+		return;
+	/* the caller is going to stop at the first non-match anyway */
+	if (ctx->mail_ctx.args->stop_on_nonmatch)
+		return;
+
+	T_BEGIN {
+		t_array_init(&limit, 1);
+		seq_range_array_add_range(&limit, ctx->seq1, ctx->seq2);
+		t_array_init(&seqs, 64);
+		if (search_args_get_index_seqs(ctx, ctx->mail_ctx.args->args,
+					       FALSE, &limit, &seqs)) {
+			i_array_init(&ctx->index_seqs, array_count(&seqs) + 1);
+			array_append_array(&ctx->index_seqs, &seqs);
+		}
+	} T_END;
+}
+
+/* Move seq forward to the next message that may match according to
+   index_seqs. */
+static void search_index_seqs_skip(struct index_search_context *ctx)
+{
+	const struct seq_range *range;
+	unsigned int count;
+	uint32_t seq = ctx->mail_ctx.seq;
+
+	range = array_get(&ctx->index_seqs, &count);
+	if (ctx->index_seqs_idx < count &&
+	    range[ctx->index_seqs_idx].seq1 > seq)
+		ctx->index_seqs_idx = 0;
+	while (ctx->index_seqs_idx < count &&
+	       range[ctx->index_seqs_idx].seq2 < seq)
+		ctx->index_seqs_idx++;
+
+	if (ctx->index_seqs_idx == count)
+		ctx->mail_ctx.seq = ctx->seq2 + 1;
+	else if (range[ctx->index_seqs_idx].seq1 > seq)
+		ctx->mail_ctx.seq = range[ctx->index_seqs_idx].seq1;
+}
+
 /* Returns >0 = matched, 0 = not matched, -1 = unknown */
 static int search_arg_match_mailbox(struct index_search_context *ctx,
 				    struct mail_search_arg *arg)
@@ -1220,6 +1428,7 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 	ctx->max_mails = t->box->storage->set->mail_prefetch_count + 1;
 	if (ctx->max_mails == 0)
 		ctx->max_mails = UINT_MAX;
+	ctx->prefetch_window = I_MIN(ctx->max_mails, SEARCH_PREFETCH_MIN_WINDOW);
 	ctx->next_time_check_cost = SEARCH_INITIAL_MAX_COST;
 	if (gettimeofday(&ctx->last_nonblock_timeval, NULL) < 0)
 		i_fatal("gettimeofday() failed: %m");
@@ -1288,6 +1497,10 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 		index_sort_program_deinit(&ctx->mail_ctx.sort_program);
 	if (ctx->thread_ctx != NULL)
 		mail_thread_deinit(&ctx->thread_ctx);
+	if (ctx->workers != NULL)
+		index_search_workers_deinit(&ctx->workers);
+	if (array_is_created(&ctx->index_seqs))
+		array_free(&ctx->index_seqs);
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
 
@@ -1510,6 +1723,25 @@ static bool search_would_block(struct index_search_context *ctx)
 	return ret;
 }
 
+static void search_workers_wait(struct index_search_context *ctx)
+{
+	struct timeval now;
+	long long usecs;
+
+	/* wait for the rest of this time slice */
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, &ctx->last_nonblock_timeval);
+	if (usecs >= 0 && usecs < SEARCH_MAX_NONBLOCK_USECS) {
+		index_search_workers_wait(ctx->workers,
+			(SEARCH_MAX_NONBLOCK_USECS - usecs + 999) / 1000);
+		if (gettimeofday(&now, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+	}
+	ctx->last_nonblock_timeval = now;
+	ctx->cost = 0;
+}
+
 static int search_more_with_mail(struct index_search_context *ctx,
 				 struct mail *mail)
 {
@@ -1583,6 +1815,13 @@ static int search_more_with_mail(struct index_search_context *ctx,
 	}
 	cost2 = search_get_cost(mail->transaction);
 	ctx->cost += cost2 - cost1;
+
+	if (ctx->workers_pending) {
+		/* search workers haven't finished the next message yet */
+		ctx->workers_pending = FALSE;
+		search_workers_wait(ctx);
+		ret = 0;
+	}
 	return ret;
 }
 
@@ -1592,7 +1831,7 @@ struct mail *index_search_get_mail(struct index_search_context *ctx)
 	struct mail *const *mails, *mail;
 	unsigned int count;
 
-	if (ctx->unused_mail_idx == ctx->max_mails)
+	if (ctx->unused_mail_idx >= ctx->prefetch_window)
 		return NULL;
 
 	mails = array_get(&ctx->mails, &count);
@@ -1610,6 +1849,51 @@ struct mail *index_search_get_mail(struct index_search_context *ctx)
 	return mail;
 }
 
+void index_search_prefetch_update_window(struct index_search_context *ctx,
+					 bool slow)
+{
+	/* If the oldest prefetched mail still had to wait for disk I/O,
+	   prefetch further ahead. If nothing has blocked for a while the
+	   mails are coming from memory anyway, so slowly go back to keeping
+	   fewer mails open. */
+	if (slow) {
+		ctx->prefetch_fast_count = 0;
+		if (ctx->prefetch_window <= ctx->max_mails / 2)
+			ctx->prefetch_window *= 2;
+		else
+			ctx->prefetch_window = ctx->max_mails;
+	} else if (++ctx->prefetch_fast_count >= SEARCH_PREFETCH_SHRINK_COUNT) {
+		ctx->prefetch_fast_count = 0;
+		if (ctx->prefetch_window > SEARCH_PREFETCH_MIN_WINDOW)
+			ctx->prefetch_window--;
+	}
+}
+
+static void
+search_prefetch_access(struct index_search_context *ctx, struct mail *mail)
+{
+	struct index_mail *imail = (struct index_mail *)mail;
+	struct timeval start, end;
+	const unsigned char *data;
+	size_t size;
+	bool slow = FALSE;
+
+	if (imail->data.prefetch_sent && imail->data.stream != NULL) {
+		/* Time only waiting for the prefetched data. Parsing it
+		   afterwards costs CPU regardless of how far ahead we
+		   prefetch. */
+		if (gettimeofday(&start, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		(void)i_stream_read_data(imail->data.stream, &data, &size, 0);
+		if (gettimeofday(&end, NULL) < 0)
+			i_fatal("gettimeofday() failed: %m");
+		slow = timeval_diff_usecs(&end, &start) >=
+			SEARCH_PREFETCH_SLOW_USECS;
+	}
+	index_mail_update_access_parts_post(mail);
+	index_search_prefetch_update_window(ctx, slow);
+}
+
 static int search_more_with_prefetching(struct index_search_context *ctx,
 					struct mail **mail_r)
 {
@@ -1662,7 +1946,7 @@ static int search_more_with_prefetching(struct index_search_context *ctx,
 		array_delete(&ctx->mails, 0, 1);
 		array_append(&ctx->mails, mail_r, 1);
 	}
-	index_mail_update_access_parts_post(*mail_r);
+	search_prefetch_access(ctx, *mail_r);
 	return 1;
 }
 
@@ -1718,6 +2002,15 @@ bool index_storage_search_next_nonblock(struct mail_search_context *_ctx,
 
 	*tryagain_r = FALSE;
 
+	if (!ctx->workers_checked) {
+		/* plugins may have changed the search args after init, so
+		   decide this only when the searching starts. the workers
+		   search only the messages left by the index-only args. */
+		ctx->workers_checked = TRUE;
+		search_index_seqs_init(ctx);
+		ctx->workers = index_search_workers_init(ctx);
+	}
+
 	if (_ctx->sort_program == NULL) {
 		ret = search_more(ctx, &mail);
 		if (ret == 0) {
@@ -1768,18 +2061,26 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 	if (_ctx->seq == 0) {
 		/* first time */
 		_ctx->seq = ctx->seq1;
+		search_index_seqs_init(ctx);
 	} else {
 		_ctx->seq++;
 	}
 
 	if (!ctx->have_seqsets && !ctx->have_index_args &&
-	    _ctx->update_result == NULL) {
+	    _ctx->update_result == NULL && ctx->workers == NULL) {
 		_ctx->progress_cur = _ctx->seq;
 		return _ctx->seq <= ctx->seq2;
 	}
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (array_is_created(&ctx->index_seqs)) {
+			/* skip over the messages that were already found
+			   not to match */
+			search_index_seqs_skip(ctx);
+			if (_ctx->seq > ctx->seq2)
+				break;
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
@@ -1789,6 +2090,17 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 			ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 						       search_index_arg, ctx);
 		}
+		if (ret != 0 && ctx->workers != NULL) {
+			ret = index_search_workers_lookup(ctx->workers,
+							  _ctx->seq);
+			if (ret < 0) {
+				/* not known yet. continue from this message
+				   after waiting for the workers. */
+				ctx->workers_pending = TRUE;
+				_ctx->seq--;
+				return FALSE;
+			}
+		}
 		if (ret != 0 && _ctx->update_result != NULL) {
 			/* see if this message never matches */
 			mail_index_lookup_uid(ctx->view, _ctx->seq, &uid);
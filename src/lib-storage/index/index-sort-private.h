@@ -7,6 +7,8 @@ struct mail_search_sort_program {
 	struct mailbox_transaction_context *t;
 	enum mail_sort_type sort_program[MAX_SORT_PROGRAM_SIZE];
 	struct mail *temp_mail;
+	/* ARRIVAL/DATE: extension containing the date+1 of each message */
+	uint32_t date_ext_id;
 
 	void (*sort_list_add)(struct mail_search_sort_program *program,
 			      struct mail *mail);
@@ -37,17 +37,56 @@ struct sort_cmp_context {
 
 static struct sort_cmp_context static_node_cmp_context;
 
+static bool
+index_sort_date_lookup(struct mail_search_sort_program *program,
+		       uint32_t seq, time_t *date_r, bool *expunged_r)
+{
+	const void *data;
+	uint32_t value;
+
+	mail_index_lookup_ext(program->t->view, seq, program->date_ext_id,
+			      &data, expunged_r);
+	if (data == NULL)
+		return FALSE;
+	memcpy(&value, data, sizeof(value));
+	if (value == 0)
+		return FALSE;
+	*date_r = (time_t)(value - 1);
+	return TRUE;
+}
+
+static void
+index_sort_date_update(struct mail_search_sort_program *program,
+		       uint32_t seq, time_t date)
+{
+	uint32_t value;
+
+	/* 0 means that the date isn't known yet. dates that don't fit are
+	   simply looked up every time. */
+	if (date < 0 || (uint64_t)date >= (uint32_t)-1)
+		return;
+	value = date + 1;
+	mail_index_update_ext(program->t->itrans, seq, program->date_ext_id,
+			      &value, NULL);
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	bool expunged;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
+	if (index_sort_date_lookup(program, mail->seq, &node->date, &expunged))
+		return;
+
 	if (mail_get_received_date(mail, &node->date) < 0)
 		node->date = 0;
+	else if (!expunged)
+		index_sort_date_update(program, mail->seq, node->date);
 }
 
 static void
@@ -56,16 +95,23 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
+	bool expunged;
 	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
+	if (index_sort_date_lookup(program, mail->seq, &node->date, &expunged))
+		return;
+
 	if (mail_get_date(mail, &node->date, &tz) < 0)
 		node->date = 0;
 	else if (node->date == 0) {
 		if (mail_get_received_date(mail, &node->date) < 0)
 			node->date = 0;
-	}
+		else if (!expunged)
+			index_sort_date_update(program, mail->seq, node->date);
+	} else if (!expunged)
+		index_sort_date_update(program, mail->seq, node->date);
 }
 
 static void
@@ -152,12 +198,50 @@ static int sort_node_date_cmp(const struct mail_sort_node_date *n1,
 					n1->seq, n2->seq);
 }
 
+static bool
+index_sort_list_date_presorted(struct mail_search_sort_program *program,
+			       ARRAY_TYPE(mail_sort_node_date) *nodes)
+{
+	struct mail_sort_node_date *n, tmp;
+	unsigned int i, j, start, count;
+
+	/* messages usually arrive in the same order as they're in the
+	   mailbox. if there's no secondary sort condition, there's no need to
+	   sort them. */
+	if (program->sort_program[1] != MAIL_SORT_END)
+		return FALSE;
+	n = array_get_modifiable(nodes, &count);
+	for (i = 1; i < count; i++) {
+		if (n[i-1].date > n[i].date || n[i-1].seq > n[i].seq)
+			return FALSE;
+	}
+	if (!static_node_cmp_context.reverse)
+		return TRUE;
+
+	/* reverse the list, but keep the messages with the same date in
+	   ascending sequence order */
+	array_reverse(nodes);
+	for (start = 0; start < count; start = i) {
+		for (i = start + 1; i < count; i++) {
+			if (n[i].date != n[start].date)
+				break;
+		}
+		for (j = i - 1; start < j; start++, j--) {
+			tmp = n[start];
+			n[start] = n[j];
+			n[j] = tmp;
+		}
+	}
+	return TRUE;
+}
+
 static void
 index_sort_list_finish_date(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 
-	array_sort(nodes, sort_node_date_cmp);
+	if (!index_sort_list_date_presorted(program, nodes))
+		array_sort(nodes, sort_node_date_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -271,15 +355,23 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	case MAIL_SORT_ARRIVAL:
 	case MAIL_SORT_DATE: {
 		ARRAY_TYPE(mail_sort_node_date) *nodes;
+		const char *name;
 
 		nodes = i_malloc(sizeof(*nodes));
 		i_array_init(nodes, 128);
 
 		if ((program->sort_program[0] &
-		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL)
+		     MAIL_SORT_MASK) == MAIL_SORT_ARRIVAL) {
 			program->sort_list_add = index_sort_list_add_arrival;
-		else
+			name = "sort-a";
+		} else {
 			program->sort_list_add = index_sort_list_add_date;
+			name = "sort-d";
+		}
+		program->date_ext_id =
+			mail_index_ext_register(t->box->index, name, 0,
+						sizeof(uint32_t),
+						sizeof(uint32_t));
 		program->sort_list_finish = index_sort_list_finish_date;
 		program->context = nodes;
 		break;
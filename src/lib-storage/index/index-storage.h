@@ -44,6 +44,9 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* indexer has been asked to compress the cache file */
+	bool cache_compress_queued;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
@@ -4,9 +4,19 @@
 #include "seq-range-array.h"
 #include "ioloop.h"
 #include "array.h"
+#include "str.h"
+#include "strescape.h"
+#include "net.h"
+#include "mail-cache.h"
+#include "mail-user.h"
 #include "index-mailbox-size.h"
 #include "index-sync-private.h"
 
+#include <unistd.h>
+
+#define INDEXER_SOCKET_NAME "indexer"
+#define INDEXER_HANDSHAKE "VERSION\tindexer\t1\t0\n"
+
 struct index_storage_list_index_record {
 	uint32_t size;
 	uint32_t mtime;
@@ -302,6 +312,95 @@ static void index_mailbox_sync_free(struct index_mailbox_sync_context *ctx)
 	i_free(ctx);
 }
 
+static int index_mailbox_cache_compress(struct mailbox *box)
+{
+	struct mail_cache_compress_stats stats;
+	int ret;
+
+	if ((ret = mail_cache_compress_if_needed(box->cache)) < 0) {
+		mailbox_set_index_error(box);
+		return -1;
+	}
+	if (ret > 0 && box->storage->set->mail_debug) {
+		mail_cache_get_compress_stats(box->cache, &stats);
+		i_debug("%s: Cache file compressed in %u.%03u secs: "
+			"%"PRIuUOFF_T" -> %"PRIuUOFF_T" bytes", box->vname,
+			stats.last_usecs / 1000000,
+			(stats.last_usecs / 1000) % 1000,
+			stats.last_old_size, stats.last_new_size);
+	}
+	return 0;
+}
+
+static int index_mailbox_queue_cache_compress(struct mailbox *box)
+{
+	struct mail_user *user = box->storage->user;
+	string_t *str = t_str_new(256);
+	const char *path;
+	ssize_t ret;
+	int fd;
+
+	/* the socket is non-blocking. the request is small enough to fit
+	   into a new socket's buffer, so if it doesn't get sent right away
+	   the indexer is in trouble and we'll just compress by ourself. */
+	path = t_strconcat(user->set->base_dir, "/"INDEXER_SOCKET_NAME, NULL);
+	fd = net_connect_unix(path);
+	if (fd == -1) {
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			i_warning("net_connect_unix(%s) failed: %m", path);
+		return -1;
+	}
+
+	str_append(str, INDEXER_HANDSHAKE);
+	str_append(str, "OPTIMIZE\t0\t");
+	str_append_tabescaped(str, user->username);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, box->vname);
+	str_append_c(str, '\n');
+	ret = write(fd, str_data(str), str_len(str));
+	/* the caller compresses the cache by itself if this fails,
+	   so these aren't errors */
+	if (ret < 0 && errno != EAGAIN)
+		i_warning("write(%s) failed: %m", path);
+	else if ((size_t)ret != str_len(str) && box->storage->set->mail_debug) {
+		i_debug("%s: Indexer busy, compressing cache ourself",
+			box->vname);
+	}
+	i_close_fd(&fd);
+	return (size_t)ret == str_len(str) ? 0 : -1;
+}
+
+static void
+index_mailbox_sync_cache_compress(struct mailbox *box,
+				  enum mailbox_sync_flags flags)
+{
+	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
+
+	if ((ibox->index_flags &
+	     MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND) == 0)
+		return;
+
+	if ((flags & MAILBOX_SYNC_FLAG_OPTIMIZE) != 0) {
+		/* we're the indexer (or doveadm) doing the compression.
+		   the cache may not have been opened by this process yet,
+		   which mail_cache_compress_if_needed() handles. */
+		(void)index_mailbox_cache_compress(box);
+		return;
+	}
+	if (!mail_cache_need_compress(box->cache)) {
+		ibox->cache_compress_queued = FALSE;
+		return;
+	}
+	if (!ibox->cache_compress_queued) {
+		/* the compression can take a while with large cache files.
+		   let the indexer do it so this session isn't stalled. */
+		if (index_mailbox_queue_cache_compress(box) == 0)
+			ibox->cache_compress_queued = TRUE;
+		else
+			(void)index_mailbox_cache_compress(box);
+	}
+}
+
 int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 			      struct mailbox_sync_status *status_r)
 {
@@ -344,6 +443,8 @@ int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 	index_sync_search_results_update(ctx);
 	/* update vsize header if wanted */
 	index_mailbox_vsize_update_appends(_ctx->box);
+	/* compress cache file if it was skipped while syncing */
+	index_mailbox_sync_cache_compress(_ctx->box, _ctx->flags);
 
 	index_mailbox_sync_free(ctx);
 	return ret;
@@ -10,6 +10,9 @@
 
 struct mail_thread_shadow_node {
 	uint32_t first_child_idx, next_sibling_idx;
+	/* children sorted by iteration are cached in
+	   thread_finish_context.sorted_children */
+	uint32_t sorted_children_idx, sorted_children_count;
 };
 
 struct mail_thread_root_node {
@@ -40,8 +43,12 @@ struct thread_finish_context {
 
 	ARRAY(struct mail_thread_root_node) roots;
 	ARRAY(struct mail_thread_shadow_node) shadow_nodes;
+	ARRAY_TYPE(mail_thread_child_node) sorted_children;
 	unsigned int next_new_root_idx;
 
+	enum mail_thread_type thread_type;
+	unsigned int change_counter;
+
 	bool use_sent_date:1;
 	bool return_seqs:1;
 };
@@ -61,6 +68,8 @@ struct subject_gather_context {
 	HASH_TABLE(char *, struct mail_thread_root_node *) subject_hash;
 };
 
+unsigned int index_thread_test_finish_count = 0;
+
 static void
 add_base_subject(struct subject_gather_context *ctx, const char *subject,
 		 struct mail_thread_root_node *node)
@@ -590,6 +599,31 @@ mail_thread_iterate_fill_root(struct mail_thread_iterate_context *iter)
 	}
 }
 
+static void
+thread_get_sorted_children(struct thread_finish_context *ctx,
+			   uint32_t parent_idx,
+			   ARRAY_TYPE(mail_thread_child_node) *sorted_children)
+{
+	struct mail_thread_shadow_node *shadow;
+	const struct mail_thread_child_node *children;
+
+	shadow = array_idx_modifiable(&ctx->shadow_nodes, parent_idx);
+	if (shadow->sorted_children_count > 0) {
+		/* sorted already by a previous iteration */
+		children = array_idx(&ctx->sorted_children,
+				     shadow->sorted_children_idx);
+		array_clear(sorted_children);
+		array_append(sorted_children, children,
+			     shadow->sorted_children_count);
+		return;
+	}
+
+	thread_sort_children(ctx, parent_idx, sorted_children);
+	shadow->sorted_children_idx = array_count(&ctx->sorted_children);
+	shadow->sorted_children_count = array_count(sorted_children);
+	array_append_array(&ctx->sorted_children, sorted_children);
+}
+
 static struct mail_thread_iterate_context *
 mail_thread_iterate_children(struct mail_thread_iterate_context *parent_iter,
 			     uint32_t parent_idx)
@@ -601,8 +635,8 @@ mail_thread_iterate_children(struct mail_thread_iterate_context *parent_iter,
 	child_iter->ctx->refcount++;
 
 	i_array_init(&child_iter->children, 8);
-	thread_sort_children(child_iter->ctx, parent_idx,
-			     &child_iter->children);
+	thread_get_sorted_children(child_iter->ctx, parent_idx,
+				   &child_iter->children);
 	if (child_iter->ctx->return_seqs)
 		nodes_change_uids_to_seqs(child_iter, FALSE);
 	return child_iter;
@@ -617,14 +651,34 @@ mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 	struct mail_thread_iterate_context *iter;
 	struct thread_finish_context *ctx;
 
-	iter = i_new(struct mail_thread_iterate_context, 1);
-	ctx = iter->ctx = i_new(struct thread_finish_context, 1);
-	ctx->refcount = 1;
-	ctx->cache = cache;
+	ctx = cache->finish_ctx;
+	if (ctx != NULL && (ctx->change_counter != cache->change_counter ||
+			    ctx->thread_type != thread_type)) {
+		/* messages were added or removed since the tree was
+		   finished */
+		mail_thread_cache_finish_free(cache);
+		ctx = NULL;
+	}
+	if (ctx == NULL) {
+		ctx = i_new(struct thread_finish_context, 1);
+		ctx->refcount = 1;
+		ctx->cache = cache;
+		ctx->tmp_mail = tmp_mail;
+		ctx->thread_type = thread_type;
+		ctx->change_counter = cache->change_counter;
+		i_array_init(&ctx->sorted_children, 64);
+		mail_thread_finish(ctx, thread_type);
+		index_thread_test_finish_count++;
+		cache->finish_ctx = ctx;
+	}
+	/* the children are sorted lazily while iterating, so these must
+	   be the current caller's */
 	ctx->tmp_mail = tmp_mail;
 	ctx->return_seqs = return_seqs;
-	mail_thread_finish(ctx, thread_type);
+	ctx->refcount++;
 
+	iter = i_new(struct mail_thread_iterate_context, 1);
+	iter->ctx = ctx;
 	mail_thread_iterate_fill_root(iter);
 	if (return_seqs)
 		nodes_change_uids_to_seqs(iter, TRUE);
@@ -660,17 +714,33 @@ unsigned int mail_thread_iterate_count(struct mail_thread_iterate_context *iter)
 	return array_count(&iter->children);
 }
 
+static void thread_finish_context_unref(struct thread_finish_context **_ctx)
+{
+	struct thread_finish_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	if (--ctx->refcount > 0)
+		return;
+
+	array_free(&ctx->roots);
+	array_free(&ctx->shadow_nodes);
+	array_free(&ctx->sorted_children);
+	i_free(ctx);
+}
+
+void mail_thread_cache_finish_free(struct mail_thread_cache *cache)
+{
+	if (cache->finish_ctx != NULL)
+		thread_finish_context_unref(&cache->finish_ctx);
+}
+
 int mail_thread_iterate_deinit(struct mail_thread_iterate_context **_iter)
 {
 	struct mail_thread_iterate_context *iter = *_iter;
 
 	*_iter = NULL;
 
-	if (--iter->ctx->refcount == 0) {
-		array_free(&iter->ctx->roots);
-		array_free(&iter->ctx->shadow_nodes);
-		i_free(iter->ctx);
-	}
+	thread_finish_context_unref(&iter->ctx);
 	array_free(&iter->children);
 	i_free(iter);
 	return 0;
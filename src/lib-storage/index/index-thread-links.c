@@ -153,6 +153,7 @@ void mail_thread_add(struct mail_thread_cache *cache,
 	i_assert(cache->last_uid <= msgid_map->uid);
 
 	cache->last_uid = msgid_map->uid;
+	cache->change_counter++;
 
 	idx = thread_msg_add(cache, msgid_map->uid, msgid_map->str_idx);
 	parent_idx = thread_link_references(cache, msgid_map->uid,
@@ -203,6 +204,7 @@ bool mail_thread_remove(struct mail_thread_cache *cache,
 	idx = msgid_map->str_idx;
 	i_assert(idx != 0);
 
+	cache->change_counter++;
 	if (msgid_map->uid > cache->last_uid) {
 		/* this message was never added to the cache, skip */
 		while (msgid_map[count].uid == msgid_map->uid)
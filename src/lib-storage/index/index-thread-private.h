@@ -5,6 +5,8 @@
 #include "mail-thread.h"
 #include "mail-index-strmap.h"
 
+struct mail;
+
 #define MAIL_THREAD_INDEX_SUFFIX ".thread"
 
 /* After initially building the index, assign first_invalid_msgid_idx to
@@ -56,6 +58,12 @@ struct mail_thread_cache {
 
 	/* indexed by mail_index_strmap_rec.str_idx */
 	ARRAY_TYPE(mail_thread_node) thread_nodes;
+	/* increased whenever thread_nodes change */
+	unsigned int change_counter;
+
+	/* the previously finished thread tree. it's reused by the following
+	   THREAD commands as long as thread_nodes don't change. */
+	struct thread_finish_context *finish_ctx;
 };
 
 static inline uint32_t crc32_str_nonzero(const char *str)
@@ -71,6 +79,13 @@ bool mail_thread_remove(struct mail_thread_cache *cache,
 			const struct mail_index_strmap_rec *msgid_map,
 			unsigned int *msgid_map_idx);
 
+/* For unit tests: incremented whenever a thread tree is finished, so the
+   tests can check that a finished tree is reused. Not used otherwise. */
+extern unsigned int index_thread_test_finish_count;
+
+/* Free the finished thread tree kept in the cache */
+void mail_thread_cache_finish_free(struct mail_thread_cache *cache);
+
 struct mail_thread_iterate_context *
 mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 			      struct mail *tmp_mail,
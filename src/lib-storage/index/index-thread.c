@@ -224,6 +224,7 @@ static void mail_thread_strmap_remap(const uint32_t *idx_map,
 	/* replace the old nodes with the renumbered ones */
 	array_free(&cache->thread_nodes);
 	cache->thread_nodes = new_nodes;
+	cache->change_counter++;
 }
 
 static int thread_get_mail_header(struct mail *mail, const char *name,
@@ -472,6 +473,7 @@ mail_thread_cache_fix_invalid_indexes(struct mail_thread_mailbox *tbox)
 			   cache->first_invalid_msgid_str_idx, count);
 		cache->first_invalid_msgid_str_idx = new_first_idx;
 		cache->next_invalid_msgid_str_idx = new_first_idx + count;
+		cache->change_counter++;
 	}
 }
 
@@ -518,6 +520,7 @@ static void mail_thread_cache_sync_add(struct mail_thread_mailbox *tbox,
 		mail_index_strmap_view_get_highest_idx(tbox->strmap_view) + 1 +
 		THREAD_INVALID_MSGID_STR_IDX_SKIP_COUNT;
 	array_clear(&cache->thread_nodes);
+	cache->change_counter++;
 
 	cache->search_result =
 		mailbox_search_result_save(search_ctx,
@@ -624,6 +627,7 @@ static void mail_thread_mailbox_close(struct mailbox *box)
 		mail_index_strmap_view_close(&tbox->strmap_view);
 	if (tbox->cache->search_result != NULL)
 		mailbox_search_result_free(&tbox->cache->search_result);
+	mail_thread_cache_finish_free(tbox->cache);
 	tbox->module_ctx.super.close(box);
 }
 
@@ -634,6 +638,7 @@ static void mail_thread_mailbox_free(struct mailbox *box)
 	mail_index_strmap_deinit(&tbox->strmap);
 	tbox->module_ctx.super.free(box);
 
+	mail_thread_cache_finish_free(tbox->cache);
 	array_free(&tbox->cache->thread_nodes);
 	i_free(tbox->cache);
 	i_free(tbox);
@@ -32,6 +32,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_SIZE, mail_attachment_min_size),
 	DEF(SET_STR_VARS, mail_attribute_dict),
 	DEF(SET_UINT, mail_prefetch_count),
+	DEF(SET_UINT, mail_search_workers),
 	DEF(SET_STR, mail_cache_fields),
 	DEF(SET_STR, mail_always_cache_fields),
 	DEF(SET_STR, mail_never_cache_fields),
@@ -43,6 +44,9 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SET_TIME, mail_max_lock_timeout),
 	DEF(SET_TIME, mail_temp_scan_interval),
 	DEF(SET_BOOL, mail_save_crlf),
+	DEF(SET_BOOL, mail_cache_columns),
+	DEF(SET_BOOL, mail_cache_compress_background),
+	DEF(SET_BOOL, mail_async_readahead),
 	DEF(SET_ENUM, mail_fsync),
 	DEF(SET_BOOL, mmap_disable),
 	DEF(SET_BOOL, dotlock_use_excl),
@@ -72,6 +76,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_min_size = 1024*128,
 	.mail_attribute_dict = "",
 	.mail_prefetch_count = 0,
+	.mail_search_workers = 0,
 	.mail_cache_fields = "flags",
 	.mail_always_cache_fields = "",
 	.mail_never_cache_fields = "imap.envelope",
@@ -83,6 +88,9 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_max_lock_timeout = 0,
 	.mail_temp_scan_interval = 7*24*60*60,
 	.mail_save_crlf = FALSE,
+	.mail_cache_columns = FALSE,
+	.mail_cache_compress_background = FALSE,
+	.mail_async_readahead = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
 	.dotlock_use_excl = TRUE,
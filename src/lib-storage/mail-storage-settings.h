@@ -17,6 +17,7 @@ struct mail_storage_settings {
 	uoff_t mail_attachment_min_size;
 	const char *mail_attribute_dict;
 	unsigned int mail_prefetch_count;
+	unsigned int mail_search_workers;
 	const char *mail_cache_fields;
 	const char *mail_always_cache_fields;
 	const char *mail_never_cache_fields;
@@ -28,6 +29,9 @@ struct mail_storage_settings {
 	unsigned int mail_max_lock_timeout;
 	unsigned int mail_temp_scan_interval;
 	bool mail_save_crlf;
+	bool mail_cache_columns;
+	bool mail_cache_compress_background;
+	bool mail_async_readahead;
 	const char *mail_fsync;
 	bool mmap_disable;
 	bool dotlock_use_excl;
@@ -2423,6 +2423,10 @@ mail_storage_settings_to_index_flags(const struct mail_storage_settings *set)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_DOTLOCK_USE_EXCL;
 	if (set->mail_nfs_index)
 		index_flags |= MAIL_INDEX_OPEN_FLAG_NFS_FLUSH;
+	if (set->mail_cache_columns)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_CACHE_COLUMNS;
+	if (set->mail_cache_compress_background)
+		index_flags |= MAIL_INDEX_OPEN_FLAG_CACHE_COMPRESS_BACKGROUND;
 	return index_flags;
 }
 
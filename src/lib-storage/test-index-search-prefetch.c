@@ -0,0 +1,64 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "index/index-search-private.h"
+#include "test-common.h"
+
+#define TEST_MIN_WINDOW 2
+#define TEST_SHRINK_COUNT 32
+
+static void test_access(struct index_search_context *ctx,
+			bool slow, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		index_search_prefetch_update_window(ctx, slow);
+}
+
+static void test_index_search_prefetch_window(void)
+{
+	struct index_search_context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.max_mails = 11;
+	ctx.prefetch_window = TEST_MIN_WINDOW;
+
+	test_begin("search prefetch window");
+	/* each slow access doubles the window up to max_mails */
+	test_access(&ctx, TRUE, 1);
+	test_assert(ctx.prefetch_window == 4);
+	test_access(&ctx, TRUE, 1);
+	test_assert(ctx.prefetch_window == 8);
+	test_access(&ctx, TRUE, 1);
+	test_assert(ctx.prefetch_window == 11);
+	test_access(&ctx, TRUE, 1);
+	test_assert(ctx.prefetch_window == 11);
+
+	/* it shrinks by one after each SHRINK_COUNT fast accesses */
+	test_access(&ctx, FALSE, TEST_SHRINK_COUNT - 1);
+	test_assert(ctx.prefetch_window == 11);
+	test_access(&ctx, FALSE, 1);
+	test_assert(ctx.prefetch_window == 10);
+
+	/* a slow access resets the fast count */
+	test_access(&ctx, FALSE, TEST_SHRINK_COUNT - 1);
+	test_access(&ctx, TRUE, 1);
+	test_assert(ctx.prefetch_window == 11);
+	test_access(&ctx, FALSE, TEST_SHRINK_COUNT - 1);
+	test_assert(ctx.prefetch_window == 11);
+
+	/* but never below the minimum */
+	test_access(&ctx, FALSE, TEST_SHRINK_COUNT * 20);
+	test_assert(ctx.prefetch_window == TEST_MIN_WINDOW);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*test_functions[])(void) = {
+		test_index_search_prefetch_window,
+		NULL
+	};
+	return test_run(test_functions);
+}
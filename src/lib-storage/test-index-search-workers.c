@@ -0,0 +1,279 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "file-lock.h"
+#include "seq-range-array.h"
+#include "mail-search-build.h"
+#include "index/index-search-private.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TEST_MESSAGE_COUNT 1200
+#define TEST_WORKER_COUNT 2
+
+static bool test_message_matches(unsigned int i)
+{
+	return i % 7 == 0 || i == TEST_MESSAGE_COUNT - 1;
+}
+
+static void test_save_messages(struct mailbox *box)
+{
+	unsigned int i;
+
+	for (i = 0; i < TEST_MESSAGE_COUNT; i++) {
+		test_mail_storage_save(box, t_strdup_printf(
+			"Subject: message %u\n\nbody %s %u\n", i,
+			test_message_matches(i) ? "needle" : "hay", i),
+			(time_t)-1);
+	}
+}
+
+static bool test_message_flagged(unsigned int i)
+{
+	/* leave a gap larger than a chunk in the middle */
+	return i < 500 || i >= 700;
+}
+
+static void test_flag_messages(struct mailbox *box)
+{
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	unsigned int i;
+
+	t = mailbox_transaction_begin(box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	for (i = 0; i < TEST_MESSAGE_COUNT; i++) {
+		if (test_message_flagged(i)) {
+			mail_set_seq(mail, i + 1);
+			mail_update_flags(mail, MODIFY_ADD, MAIL_FLAGGED);
+		}
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&t) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+/* Search for the needle and the given args. The messages in expected_seqs
+   match the given args. */
+static void
+test_search_body_with(struct mailbox *box, struct mail_search_args *args,
+		      const ARRAY_TYPE(seq_range) *expected_seqs)
+{
+	struct mail_search_arg *arg;
+	struct mail_search_context *search_ctx;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	ARRAY_TYPE(seq_range) matches, expected;
+	unsigned int i;
+
+	arg = mail_search_build_add(args, SEARCH_BODY);
+	arg->value.str = p_strdup(args->pool, "needle");
+
+	t_array_init(&matches, 32);
+	t = mailbox_transaction_begin(box, 0);
+	search_ctx = mailbox_search_init(t, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail))
+		seq_range_array_add(&matches, mail->seq);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	mailbox_transaction_rollback(&t);
+	mail_search_args_unref(&args);
+
+	t_array_init(&expected, 32);
+	for (i = 0; i < TEST_MESSAGE_COUNT; i++) {
+		if (test_message_matches(i) &&
+		    (expected_seqs == NULL ||
+		     seq_range_exists(expected_seqs, i + 1)))
+			seq_range_array_add(&expected, i + 1);
+	}
+	test_assert(seq_range_count(&matches) == seq_range_count(&expected));
+	test_assert(seq_range_array_remove_seq_range(&expected, &matches) ==
+		    seq_range_count(&matches));
+}
+
+static void test_search_body(struct mailbox *box)
+{
+	test_search_body_with(box, mail_search_build_init(), NULL);
+}
+
+static void test_search_body_uids(struct mailbox *box)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	ARRAY_TYPE(seq_range) uids;
+
+	/* the UIDs are the same as sequences */
+	t_array_init(&uids, 2);
+	seq_range_array_add_range(&uids, 1, 50);
+	seq_range_array_add_range(&uids, TEST_MESSAGE_COUNT - 50,
+				  TEST_MESSAGE_COUNT);
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_UIDSET);
+	p_array_init(&arg->value.seqset, args->pool, 2);
+	array_append_array(&arg->value.seqset, &uids);
+	test_search_body_with(box, args, &uids);
+}
+
+static void test_search_body_flagged(struct mailbox *box)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	ARRAY_TYPE(seq_range) flagged;
+	unsigned int i;
+
+	t_array_init(&flagged, 2);
+	for (i = 0; i < TEST_MESSAGE_COUNT; i++) {
+		if (test_message_flagged(i))
+			seq_range_array_add(&flagged, i + 1);
+	}
+
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_FLAGS);
+	arg->value.flags = MAIL_FLAGGED;
+	test_search_body_with(box, args, &flagged);
+}
+
+static void test_search_body_not_uids(struct mailbox *box)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg, *subarg;
+	ARRAY_TYPE(seq_range) uids;
+
+	t_array_init(&uids, 2);
+	seq_range_array_add_range(&uids, 1, 50);
+	seq_range_array_add_range(&uids, TEST_MESSAGE_COUNT - 50,
+				  TEST_MESSAGE_COUNT);
+
+	/* NOT (UID 51:1149) isn't evaluated using only the index, so the
+	   chunks cover all the messages, but most of them are never looked
+	   up. */
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_SUB);
+	arg->match_not = TRUE;
+	subarg = p_new(args->pool, struct mail_search_arg, 1);
+	subarg->type = SEARCH_UIDSET;
+	p_array_init(&subarg->value.seqset, args->pool, 1);
+	seq_range_array_add_range(&subarg->value.seqset,
+				  51, TEST_MESSAGE_COUNT - 51);
+	arg->value.subargs = subarg;
+	test_search_body_with(box, args, &uids);
+}
+
+static const char *test_slot_path(struct mailbox *box, unsigned int i)
+{
+	const char *root;
+
+	test_assert(mailbox_list_get_root_path(box->list,
+					       MAILBOX_LIST_PATH_TYPE_INDEX,
+					       &root));
+	return t_strdup_printf("%s/dovecot.search-worker.%u", root, i);
+}
+
+static void
+test_lock_slots(struct mailbox *box, unsigned int count,
+		int *fds, struct file_lock **locks)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		const char *path = test_slot_path(box, i);
+
+		fds[i] = open(path, O_RDWR | O_CREAT, 0600);
+		if (fds[i] == -1)
+			i_fatal("open(%s) failed: %m", path);
+		test_assert(file_try_lock(fds[i], path, F_WRLCK,
+					  FILE_LOCK_METHOD_FLOCK,
+					  &locks[i]) > 0);
+	}
+}
+
+static void
+test_unlock_slots(unsigned int count, int *fds, struct file_lock **locks)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		file_unlock(&locks[i]);
+		i_close_fd(&fds[i]);
+	}
+}
+
+static void test_index_search_workers(void)
+{
+	const char *const fields[] = {
+		t_strdup_printf("mail_search_workers=%u", TEST_WORKER_COUNT),
+		NULL
+	};
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	struct file_lock *locks[TEST_WORKER_COUNT];
+	int fds[TEST_WORKER_COUNT];
+	struct stat st;
+
+	ctx = test_mail_storage_init(fields);
+	box = test_mail_storage_open_inbox(ctx);
+	test_save_messages(box);
+
+	/* the chunks are searched by the workers and merged in order */
+	test_begin("search workers");
+	test_search_body(box);
+	test_assert(stat(test_slot_path(box, 0), &st) == 0);
+	test_end();
+
+	/* only a few messages are left to search after the UID set */
+	test_begin("search workers with UID set");
+	test_search_body_uids(box);
+	test_end();
+
+	/* with only one worker running at a time, the chunks after the
+	   first one aren't all started when the search skips over them */
+	test_begin("search workers skipping chunks");
+	test_lock_slots(box, 1, fds, locks);
+	test_search_body_not_uids(box);
+	test_unlock_slots(1, fds, locks);
+	test_end();
+
+	/* no workers are started for the unflagged messages between the
+	   flagged ones */
+	test_begin("search workers with flags");
+	test_flag_messages(box);
+	test_search_body_flagged(box);
+	test_end();
+
+	/* a failing worker's chunk is searched by the parent */
+	test_begin("search workers failing");
+	index_search_workers_test_fail_seq = TEST_MESSAGE_COUNT / 2;
+	test_search_body(box);
+	index_search_workers_test_fail_seq = 0;
+	test_end();
+
+	/* other sessions of the user are using all the workers */
+	test_begin("search workers used by other sessions");
+	test_lock_slots(box, TEST_WORKER_COUNT, fds, locks);
+	test_search_body(box);
+	test_unlock_slots(TEST_WORKER_COUNT, fds, locks);
+	test_end();
+
+	mailbox_free(&box);
+	test_mail_storage_deinit(&ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_index_search_workers,
+		NULL
+	};
+	int ret;
+
+	test_mail_storage_master_init("test-index-search-workers",
+				      &argc, &argv);
+	ret = test_run(test_functions);
+	test_mail_storage_master_deinit();
+	return ret;
+}
@@ -0,0 +1,167 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "mail-index.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+struct test_message {
+	time_t received_date;
+	/* 0 = no Date: header */
+	time_t date;
+};
+
+static const struct test_message test_messages[] = {
+	{ 100, 1000 },
+	{ 200, 900 },
+	{ 200, 0 },
+	{ 300, 700 },
+	{ 400, 600 },
+	/* appended after the first sorts */
+	{ 150, 800 },
+	{ 500, 1100 }
+};
+#define TEST_INITIAL_MESSAGE_COUNT 5
+
+static void test_save_messages(struct mailbox *box, unsigned int start,
+			       unsigned int end)
+{
+	const struct test_message *msg;
+	const char *date;
+	unsigned int i;
+
+	for (i = start; i < end; i++) {
+		msg = &test_messages[i];
+		date = msg->date == 0 ? "" : t_strdup_printf(
+			"Date: Thu, 1 Jan 1970 00:%02u:%02u +0000\n",
+			(unsigned int)msg->date / 60,
+			(unsigned int)msg->date % 60);
+		test_mail_storage_save(box, t_strdup_printf(
+			"%sSubject: message %u\n\nbody\n", date, i + 1),
+			msg->received_date);
+	}
+}
+
+static void
+test_sort(struct mailbox *box, enum mail_sort_type sort_type,
+	  const uint32_t *expected_seqs, unsigned int expected_count)
+{
+	enum mail_sort_type sort_program[] = { sort_type, MAIL_SORT_END };
+	struct mail_search_args *args;
+	struct mail_search_context *search_ctx;
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+	unsigned int n = 0;
+
+	args = mail_search_build_init();
+	mail_search_build_add_all(args);
+
+	t = mailbox_transaction_begin(box, 0);
+	search_ctx = mailbox_search_init(t, args, sort_program, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		test_assert_idx(n < expected_count &&
+				mail->seq == expected_seqs[n], n);
+		n++;
+	}
+	test_assert(n == expected_count);
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	/* the sort keys are written by the search transaction */
+	test_assert(mailbox_transaction_commit(&t) == 0);
+	mail_search_args_unref(&args);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void
+test_sort_keys(struct mailbox *box, const char *ext_name, bool arrival,
+	       unsigned int count)
+{
+	const void *data;
+	uint32_t ext_id, seq, value, expected;
+	bool expunged;
+
+	test_assert(mail_index_ext_lookup(box->index, ext_name, &ext_id));
+	for (seq = 1; seq <= count; seq++) {
+		mail_index_lookup_ext(box->view, seq, ext_id, &data, &expunged);
+		test_assert_idx(data != NULL, seq);
+		if (data == NULL)
+			continue;
+		memcpy(&value, data, sizeof(value));
+		expected = arrival || test_messages[seq-1].date == 0 ?
+			test_messages[seq-1].received_date :
+			test_messages[seq-1].date;
+		test_assert_idx(value == expected + 1, seq);
+	}
+}
+
+static void test_index_sort_date(void)
+{
+	static const uint32_t arrival1[] = { 1, 2, 3, 4, 5 };
+	static const uint32_t arrival1_rev[] = { 5, 4, 2, 3, 1 };
+	static const uint32_t date1[] = { 3, 5, 4, 2, 1 };
+	static const uint32_t date1_rev[] = { 1, 2, 4, 5, 3 };
+	static const uint32_t arrival2[] = { 1, 6, 2, 3, 4, 5, 7 };
+	static const uint32_t arrival2_rev[] = { 7, 5, 4, 2, 3, 6, 1 };
+	static const uint32_t date2[] = { 3, 5, 4, 6, 2, 1, 7 };
+	static const uint32_t date2_rev[] = { 7, 1, 2, 6, 4, 5, 3 };
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+
+	ctx = test_mail_storage_init(NULL);
+	box = test_mail_storage_open_inbox(ctx);
+	test_save_messages(box, 0, TEST_INITIAL_MESSAGE_COUNT);
+
+	test_begin("index sort arrival");
+	/* the first sort fills the keys, the following ones use them */
+	test_sort(box, MAIL_SORT_ARRIVAL, arrival1, N_ELEMENTS(arrival1));
+	test_sort_keys(box, "sort-a", TRUE, N_ELEMENTS(arrival1));
+	test_sort(box, MAIL_SORT_ARRIVAL, arrival1, N_ELEMENTS(arrival1));
+	test_sort(box, MAIL_SORT_ARRIVAL | MAIL_SORT_FLAG_REVERSE,
+		  arrival1_rev, N_ELEMENTS(arrival1_rev));
+	test_end();
+
+	test_begin("index sort date");
+	test_sort(box, MAIL_SORT_DATE, date1, N_ELEMENTS(date1));
+	test_sort_keys(box, "sort-d", FALSE, N_ELEMENTS(date1));
+	test_sort(box, MAIL_SORT_DATE, date1, N_ELEMENTS(date1));
+	test_sort(box, MAIL_SORT_DATE | MAIL_SORT_FLAG_REVERSE,
+		  date1_rev, N_ELEMENTS(date1_rev));
+	test_end();
+
+	/* the new messages don't have keys yet, and they're no longer in
+	   arrival order */
+	test_save_messages(box, TEST_INITIAL_MESSAGE_COUNT,
+			   N_ELEMENTS(test_messages));
+
+	test_begin("index sort arrival after appends");
+	test_sort(box, MAIL_SORT_ARRIVAL | MAIL_SORT_FLAG_REVERSE,
+		  arrival2_rev, N_ELEMENTS(arrival2_rev));
+	test_sort_keys(box, "sort-a", TRUE, N_ELEMENTS(arrival2));
+	test_sort(box, MAIL_SORT_ARRIVAL, arrival2, N_ELEMENTS(arrival2));
+	test_end();
+
+	test_begin("index sort date after appends");
+	test_sort(box, MAIL_SORT_DATE, date2, N_ELEMENTS(date2));
+	test_sort_keys(box, "sort-d", FALSE, N_ELEMENTS(date2));
+	test_sort(box, MAIL_SORT_DATE | MAIL_SORT_FLAG_REVERSE,
+		  date2_rev, N_ELEMENTS(date2_rev));
+	test_end();
+
+	mailbox_free(&box);
+	test_mail_storage_deinit(&ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_index_sort_date,
+		NULL
+	};
+	int ret;
+
+	test_mail_storage_master_init("test-index-sort", &argc, &argv);
+	ret = test_run(test_functions);
+	test_mail_storage_master_deinit();
+	return ret;
+}
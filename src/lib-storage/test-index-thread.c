@@ -0,0 +1,163 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "mail-search-build.h"
+#include "mail-thread.h"
+#include "index/index-thread-private.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+static const char *const test_messages[] = {
+	"Message-ID: <1@test>\nSubject: a\n"
+	"Date: Thu, 1 Jan 1970 00:00:01 +0000\n\nbody\n",
+	"Message-ID: <2@test>\nIn-Reply-To: <1@test>\nSubject: Re: a\n"
+	"Date: Thu, 1 Jan 1970 00:00:02 +0000\n\nbody\n",
+	"Message-ID: <3@test>\nReferences: <1@test> <2@test>\n"
+	"Subject: Re: a\nDate: Thu, 1 Jan 1970 00:00:03 +0000\n\nbody\n",
+	"Message-ID: <4@test>\nSubject: b\n"
+	"Date: Thu, 1 Jan 1970 00:00:04 +0000\n\nbody\n",
+	"Message-ID: <5@test>\nIn-Reply-To: <4@test>\nSubject: Re: b\n"
+	"Date: Thu, 1 Jan 1970 00:00:05 +0000\n\nbody\n"
+};
+
+static void
+test_thread_append(struct mail_thread_iterate_context *iter, string_t *str)
+{
+	struct mail_thread_iterate_context *child_iter;
+	const struct mail_thread_child_node *node;
+	bool first = TRUE;
+
+	while ((node = mail_thread_iterate_next(iter, &child_iter)) != NULL) {
+		if (!first)
+			str_append_c(str, ' ');
+		first = FALSE;
+		str_printfa(str, "%u", node->uid);
+		if (child_iter != NULL) {
+			str_append_c(str, '(');
+			test_thread_append(child_iter, str);
+			str_append_c(str, ')');
+			test_assert(mail_thread_iterate_deinit(
+				&child_iter) == 0);
+		}
+	}
+}
+
+static const char *
+test_thread(struct mailbox *box, enum mail_thread_type thread_type,
+	    bool unseen)
+{
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+	struct mail_thread_context *ctx;
+	struct mail_thread_iterate_context *iter;
+	string_t *str = t_str_new(64);
+
+	args = mail_search_build_init();
+	if (!unseen)
+		mail_search_build_add_all(args);
+	else {
+		arg = mail_search_build_add(args, SEARCH_FLAGS);
+		arg->value.flags = MAIL_SEEN;
+		arg->match_not = TRUE;
+	}
+	mail_search_args_init(args, box, TRUE, NULL);
+
+	test_assert(mail_thread_init(box, args, &ctx) == 0);
+	iter = mail_thread_iterate_init(ctx, thread_type, FALSE);
+	test_thread_append(iter, str);
+	test_assert(mail_thread_iterate_deinit(&iter) == 0);
+	mail_thread_deinit(&ctx);
+	mail_search_args_unref(&args);
+	return str_c(str);
+}
+
+static void
+test_update_mail(struct mailbox *box, uint32_t seq, bool expunge)
+{
+	struct mailbox_transaction_context *t;
+	struct mail *mail;
+
+	t = mailbox_transaction_begin(box, 0);
+	mail = mail_alloc(t, 0, NULL);
+	mail_set_seq(mail, seq);
+	if (expunge)
+		mail_expunge(mail);
+	else
+		mail_update_flags(mail, MODIFY_ADD, MAIL_SEEN);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&t) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void test_index_thread_reuse(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	unsigned int i, finish_count;
+
+	ctx = test_mail_storage_init(NULL);
+	box = test_mail_storage_open_inbox(ctx);
+	for (i = 0; i < N_ELEMENTS(test_messages); i++)
+		test_mail_storage_save(box, test_messages[i], (time_t)-1);
+
+	test_begin("index thread reuse");
+	finish_count = index_thread_test_finish_count;
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, FALSE),
+			   "1(2(3)) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	/* nothing changed - the finished tree is reused */
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, FALSE),
+			   "1(2(3)) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	/* a different algorithm needs a new tree */
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFS, FALSE),
+			   "1(2(3)) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 2);
+	test_end();
+
+	test_begin("index thread reuse after expunge");
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, FALSE),
+			   "1(2(3)) 4(5)");
+	finish_count = index_thread_test_finish_count;
+	test_update_mail(box, 3, TRUE);
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, FALSE),
+			   "1(2) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, FALSE),
+			   "1(2) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	test_end();
+
+	test_begin("index thread reuse after flag change");
+	finish_count = index_thread_test_finish_count;
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, TRUE),
+			   "1(2) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, TRUE),
+			   "1(2) 4(5)");
+	test_assert(index_thread_test_finish_count == finish_count + 1);
+	/* the message no longer matches the UNSEEN search */
+	test_update_mail(box, 4, FALSE);
+	test_assert_strcmp(test_thread(box, MAIL_THREAD_REFERENCES, TRUE),
+			   "1(2) 4");
+	test_assert(index_thread_test_finish_count == finish_count + 2);
+	test_end();
+
+	mailbox_free(&box);
+	test_mail_storage_deinit(&ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*test_functions[])(void) = {
+		test_index_thread_reuse,
+		NULL
+	};
+	int ret;
+
+	test_mail_storage_master_init("test-index-thread", &argc, &argv);
+	ret = test_run(test_functions);
+	test_mail_storage_master_deinit();
+	return ret;
+}
@@ -0,0 +1,145 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hostpid.h"
+#include "istream.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "mail-namespace.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+static unsigned int test_mail_storage_counter = 0;
+
+void test_mail_storage_master_init(const char *name, int *argc,
+				   char **argv[])
+{
+	master_service = master_service_init(name,
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+		MASTER_SERVICE_FLAG_NO_SSL_INIT |
+		MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+		argc, argv, "");
+	master_service_init_finish(master_service);
+}
+
+void test_mail_storage_master_deinit(void)
+{
+	master_service_deinit(&master_service);
+}
+
+struct test_mail_storage_ctx *
+test_mail_storage_init(const char *const *userdb_fields)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mail_storage_service_input input;
+	ARRAY_TYPE(const_string) fields;
+	const char *field, *error;
+	char cwd[PATH_MAX];
+	pool_t pool;
+
+	pool = pool_alloconly_create("test mail storage", 1024);
+	ctx = p_new(pool, struct test_mail_storage_ctx, 1);
+	ctx->pool = pool;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		i_fatal("getcwd() failed: %m");
+	ctx->home = p_strdup_printf(pool, "%s/.test-mail-storage.%s.%u",
+				    cwd, my_pid, ++test_mail_storage_counter);
+	(void)unlink_directory(ctx->home, UNLINK_DIRECTORY_FLAG_RMDIR);
+	if (mkdir(ctx->home, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", ctx->home);
+
+	t_array_init(&fields, 8);
+	field = t_strconcat("home=", ctx->home, NULL);
+	array_append(&fields, &field, 1);
+	field = "mail=sdbox:~/mail";
+	array_append(&fields, &field, 1);
+	for (; userdb_fields != NULL && *userdb_fields != NULL; userdb_fields++)
+		array_append(&fields, userdb_fields, 1);
+	array_append_zero(&fields);
+
+	ctx->storage_service = mail_storage_service_init(master_service, NULL,
+		MAIL_STORAGE_SERVICE_FLAG_NO_RESTRICT_ACCESS |
+		MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+		MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+		MAIL_STORAGE_SERVICE_FLAG_NO_PLUGINS);
+
+	memset(&input, 0, sizeof(input));
+	input.username = "testuser";
+	input.no_userdb_lookup = TRUE;
+	input.userdb_fields = array_idx(&fields, 0);
+	if (mail_storage_service_lookup_next(ctx->storage_service, &input,
+					     &ctx->service_user, &ctx->user,
+					     &error) < 0)
+		i_fatal("mail_storage_service_lookup_next() failed: %s", error);
+	return ctx;
+}
+
+void test_mail_storage_deinit(struct test_mail_storage_ctx **_ctx)
+{
+	struct test_mail_storage_ctx *ctx = *_ctx;
+
+	*_ctx = NULL;
+	mail_user_unref(&ctx->user);
+	mail_storage_service_user_free(&ctx->service_user);
+	mail_storage_service_deinit(&ctx->storage_service);
+	if (unlink_directory(ctx->home, UNLINK_DIRECTORY_FLAG_RMDIR) < 0)
+		i_error("unlink_directory(%s) failed: %m", ctx->home);
+	pool_unref(&ctx->pool);
+}
+
+struct mailbox *test_mail_storage_open_inbox(struct test_mail_storage_ctx *ctx)
+{
+	struct mail_namespace *ns;
+	struct mailbox *box;
+
+	ns = mail_namespace_find_inbox(ctx->user->namespaces);
+	box = mailbox_alloc(ns->list, "INBOX", 0);
+	if (mailbox_open(box) < 0 || mailbox_sync(box, 0) < 0) {
+		i_fatal("Failed to open INBOX: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+	return box;
+}
+
+void test_mail_storage_save(struct mailbox *box, const char *message,
+			    time_t received_date)
+{
+	struct mailbox_transaction_context *t;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	int ret;
+
+	t = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_EXTERNAL);
+	save_ctx = mailbox_save_alloc(t);
+	if (received_date != (time_t)-1)
+		mailbox_save_set_received_date(save_ctx, received_date, 0);
+	input = i_stream_create_from_data(message, strlen(message));
+	ret = mailbox_save_begin(&save_ctx, input);
+	if (ret == 0) {
+		do {
+			ret = mailbox_save_continue(save_ctx);
+		} while (ret == 0 && i_stream_read(input) > 0);
+		if (ret == 0)
+			ret = mailbox_save_finish(&save_ctx);
+		else
+			mailbox_save_cancel(&save_ctx);
+	}
+	i_stream_unref(&input);
+	if (ret < 0)
+		mailbox_transaction_rollback(&t);
+	if (ret < 0 || mailbox_transaction_commit(&t) < 0) {
+		i_fatal("Saving failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+	if (mailbox_sync(box, 0) < 0) {
+		i_fatal("mailbox_sync() failed: %s",
+			mailbox_get_last_error(box, NULL));
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef TEST_MAIL_STORAGE_COMMON_H
+#define TEST_MAIL_STORAGE_COMMON_H
+
+#include "mail-storage.h"
+
+struct test_mail_storage_ctx {
+	pool_t pool;
+	const char *home;
+
+	struct mail_storage_service_ctx *storage_service;
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+};
+
+/* Initialize master_service for a test program that uses mail storage.
+   Call before test_run() and deinit after it. */
+void test_mail_storage_master_init(const char *name, int *argc,
+				   char **argv[]);
+void test_mail_storage_master_deinit(void);
+
+/* Create a user with an empty home directory and sdbox INBOX. Additional
+   settings can be given as NULL-terminated key=value userdb fields. */
+struct test_mail_storage_ctx *
+test_mail_storage_init(const char *const *userdb_fields) ATTR_NULL(1);
+/* Deinitialize the user and delete its home directory. */
+void test_mail_storage_deinit(struct test_mail_storage_ctx **ctx);
+
+/* Open INBOX and sync it. */
+struct mailbox *test_mail_storage_open_inbox(struct test_mail_storage_ctx *ctx);
+/* Save a message to the mailbox. received_date may be (time_t)-1. */
+void test_mail_storage_save(struct mailbox *box, const char *message,
+			    time_t received_date);
+
+#endif
@@ -18,6 +18,7 @@ static char *test_prefix;
 static bool test_success;
 static unsigned int failure_count;
 static unsigned int total_count;
+static bool test_lib_initialized;
 static unsigned int expected_errors;
 static char *expected_error_str;
 
@@ -332,7 +333,10 @@ static void test_init(void)
 	failure_count = 0;
 	total_count = 0;
 
-	lib_init();
+	/* the test may have already initialized lib via master_service */
+	test_lib_initialized = !lib_is_initialized();
+	if (test_lib_initialized)
+		lib_init();
 	i_set_error_handler(test_error_handler);
 	/* Don't set fatal handler until actually needed for fatal testing */
 }
@@ -341,7 +345,8 @@ static int test_deinit(void)
 {
 	i_assert(test_prefix == NULL);
 	printf("%u / %u tests failed\n", failure_count, total_count);
-	lib_deinit();
+	if (test_lib_initialized)
+		lib_deinit();
 	return failure_count == 0 ? 0 : 1;
 }
 
@@ -46,51 +46,81 @@ static const unsigned char b64dec[256] = {
 void base64_encode(const void *src, size_t src_size, buffer_t *dest)
 {
 	const unsigned char *src_c = src;
-	unsigned char tmp[4];
+	unsigned char *dest_c;
+	uint32_t n;
 	size_t src_pos;
 
-	for (src_pos = 0; src_pos < src_size; ) {
-		tmp[0] = b64enc[src_c[src_pos] >> 2];
-		switch (src_size - src_pos) {
-		case 1:
-			tmp[1] = b64enc[(src_c[src_pos] & 0x03) << 4];
-			tmp[2] = '=';
-			tmp[3] = '=';
-			src_pos++;
-			break;
-		case 2:
-			tmp[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
-					(src_c[src_pos+1] >> 4)];
-			tmp[2] = b64enc[((src_c[src_pos+1] & 0x0f) << 2)];
-			tmp[3] = '=';
-			src_pos += 2;
-			break;
-		default:
-			tmp[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
-					(src_c[src_pos+1] >> 4)];
-			tmp[2] = b64enc[((src_c[src_pos+1] & 0x0f) << 2) |
-					((src_c[src_pos+2] & 0xc0) >> 6)];
-			tmp[3] = b64enc[src_c[src_pos+2] & 0x3f];
-			src_pos += 3;
-			break;
-		}
-		buffer_append(dest, tmp, 4);
+	if (src_size == 0)
+		return;
+
+	/* @UNSAFE: the output size is known, so write it directly to dest
+	   instead of appending each group separately */
+	dest_c = buffer_append_space_unsafe(dest, (src_size + 2) / 3 * 4);
+	for (src_pos = 0; src_size - src_pos >= 3; src_pos += 3) {
+		n = (src_c[src_pos] << 16) | (src_c[src_pos+1] << 8) |
+			src_c[src_pos+2];
+		dest_c[0] = b64enc[n >> 18];
+		dest_c[1] = b64enc[(n >> 12) & 0x3f];
+		dest_c[2] = b64enc[(n >> 6) & 0x3f];
+		dest_c[3] = b64enc[n & 0x3f];
+		dest_c += 4;
+	}
+
+	switch (src_size - src_pos) {
+	case 0:
+		break;
+	case 1:
+		dest_c[0] = b64enc[src_c[src_pos] >> 2];
+		dest_c[1] = b64enc[(src_c[src_pos] & 0x03) << 4];
+		dest_c[2] = '=';
+		dest_c[3] = '=';
+		break;
+	case 2:
+		dest_c[0] = b64enc[src_c[src_pos] >> 2];
+		dest_c[1] = b64enc[((src_c[src_pos] & 0x03) << 4) |
+				   (src_c[src_pos+1] >> 4)];
+		dest_c[2] = b64enc[((src_c[src_pos+1] & 0x0f) << 2)];
+		dest_c[3] = '=';
+		break;
+	default:
+		i_unreached();
 	}
 }
 
 #define IS_EMPTY(c) \
 	((c) == '\n' || (c) == '\r' || (c) == ' ' || (c) == '\t')
 
+/* decoded output is collected into a block of this size before it's
+   appended to the destination buffer */
+#define BASE64_DECODE_BLOCK_SIZE (3*256)
+
 int base64_decode(const void *src, size_t src_size,
 		  size_t *src_pos_r, buffer_t *dest)
 {
 	const unsigned char *src_c = src;
-	size_t src_pos;
-	unsigned char input[4], output[3];
+	size_t src_pos, output_used = 0;
+	unsigned char input[4], output[BASE64_DECODE_BLOCK_SIZE];
 	int ret = 1;
 
 	for (src_pos = 0; src_pos+3 < src_size; ) {
+		if (output_used > sizeof(output) - 3) {
+			buffer_append(dest, output, output_used);
+			output_used = 0;
+		}
+
 		input[0] = b64dec[src_c[src_pos]];
+		input[1] = b64dec[src_c[src_pos+1]];
+		input[2] = b64dec[src_c[src_pos+2]];
+		input[3] = b64dec[src_c[src_pos+3]];
+		if (likely((input[0] | input[1] | input[2] | input[3]) < 0x40)) {
+			/* fast path: 4 valid characters */
+			output[output_used++] = (input[0] << 2) | (input[1] >> 4);
+			output[output_used++] = (input[1] << 4) | (input[2] >> 2);
+			output[output_used++] = ((input[2] << 6) & 0xc0) | input[3];
+			src_pos += 4;
+			continue;
+		}
+
 		if (input[0] == 0xff) {
 			if (unlikely(!IS_EMPTY(src_c[src_pos]))) {
 				ret = -1;
@@ -100,43 +130,35 @@ int base64_decode(const void *src, size_t src_size,
 			continue;
 		}
 
-		input[1] = b64dec[src_c[src_pos+1]];
 		if (unlikely(input[1] == 0xff)) {
 			ret = -1;
 			break;
 		}
-		output[0] = (input[0] << 2) | (input[1] >> 4);
+		output[output_used] = (input[0] << 2) | (input[1] >> 4);
 
-		input[2] = b64dec[src_c[src_pos+2]];
 		if (input[2] == 0xff) {
 			if (unlikely(src_c[src_pos+2] != '=' ||
 				     src_c[src_pos+3] != '=')) {
 				ret = -1;
 				break;
 			}
-			buffer_append(dest, output, 1);
+			output_used++;
 			ret = 0;
 			src_pos += 4;
 			break;
 		}
 
-		output[1] = (input[1] << 4) | (input[2] >> 2);
-		input[3] = b64dec[src_c[src_pos+3]];
-		if (input[3] == 0xff) {
-			if (unlikely(src_c[src_pos+3] != '=')) {
-				ret = -1;
-				break;
-			}
-			buffer_append(dest, output, 2);
-			ret = 0;
-			src_pos += 4;
+		output[output_used+1] = (input[1] << 4) | (input[2] >> 2);
+		if (unlikely(src_c[src_pos+3] != '=')) {
+			ret = -1;
 			break;
 		}
-
-		output[2] = ((input[2] << 6) & 0xc0) | input[3];
-		buffer_append(dest, output, 3);
+		output_used += 2;
+		ret = 0;
 		src_pos += 4;
+		break;
 	}
+	buffer_append(dest, output, output_used);
 
 	for (; src_pos < src_size; src_pos++) {
 		if (!IS_EMPTY(src_c[src_pos]))
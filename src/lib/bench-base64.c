@@ -0,0 +1,95 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Measures base64_encode() and base64_decode() throughput. The decoder input
+   is split into 76 character lines like in MIME bodies.
+   Usage: bench-base64 [<megabytes>] */
+
+#include "lib.h"
+#include "buffer.h"
+#include "base64.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_MB 64
+#define BENCH_BLOCK_SIZE (57*1024)
+#define BENCH_LINE_LEN 76
+
+static double bench_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+	long long usecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, start);
+	return (double)usecs;
+}
+
+static void bench_print(const char *op, size_t bytes, double usecs)
+{
+	printf("%-8s %8.2f GB/s\n", op,
+	       usecs == 0 ? 0 : bytes / (usecs * 1000.0));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *input;
+	buffer_t *encoded, *mime, *decoded;
+	struct timeval start;
+	unsigned int i, rounds, mb = BENCH_DEFAULT_MB;
+	size_t pos, bytes;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &mb) < 0)
+		i_fatal("Usage: bench-base64 [<megabytes>]");
+	rounds = I_MAX(mb * 1024*1024 / BENCH_BLOCK_SIZE, 1);
+
+	input = i_malloc(BENCH_BLOCK_SIZE);
+	srand(1);
+	for (i = 0; i < BENCH_BLOCK_SIZE; i++)
+		input[i] = rand();
+
+	encoded = buffer_create_dynamic(default_pool,
+					MAX_BASE64_ENCODED_SIZE(BENCH_BLOCK_SIZE));
+	decoded = buffer_create_dynamic(default_pool, BENCH_BLOCK_SIZE);
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < rounds; i++) {
+		buffer_set_used_size(encoded, 0);
+		base64_encode(input, BENCH_BLOCK_SIZE, encoded);
+	}
+	bench_print("encode", (size_t)rounds * BENCH_BLOCK_SIZE,
+		    bench_usecs_since(&start));
+
+	/* split into lines */
+	mime = buffer_create_dynamic(default_pool, encoded->used * 2);
+	for (pos = 0; pos < encoded->used; pos += BENCH_LINE_LEN) {
+		buffer_append(mime, CONST_PTR_OFFSET(encoded->data, pos),
+			      I_MIN(BENCH_LINE_LEN, encoded->used - pos));
+		buffer_append(mime, "\r\n", 2);
+	}
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < rounds; i++) {
+		buffer_set_used_size(decoded, 0);
+		if (base64_decode(mime->data, mime->used, &pos, decoded) < 0)
+			i_fatal("base64_decode() failed");
+	}
+	bytes = (size_t)rounds * mime->used;
+	bench_print("decode", bytes, bench_usecs_since(&start));
+	if (decoded->used != BENCH_BLOCK_SIZE ||
+	    memcmp(decoded->data, input, BENCH_BLOCK_SIZE) != 0)
+		i_fatal("base64 decoding produced wrong output");
+
+	buffer_free(&encoded);
+	buffer_free(&mime);
+	buffer_free(&decoded);
+	i_free(input);
+	lib_deinit();
+	return 0;
+}
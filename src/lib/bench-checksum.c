@@ -0,0 +1,82 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Measures crc32, crc32c and xxh64 throughput for small and large inputs.
+   Usage: bench-checksum [<megabytes>] */
+
+#include "lib.h"
+#include "crc32.h"
+#include "xxh64.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_MB 256
+#define BENCH_BLOCK_SIZE (64*1024)
+/* roughly the size of an fts expunge log or cache record */
+#define BENCH_SMALL_SIZE 40
+
+static const unsigned char *bench_data;
+static volatile uint64_t bench_sink;
+
+static uint64_t bench_crc32(const unsigned char *data, size_t size)
+{
+	return crc32_data(data, size);
+}
+
+static uint64_t bench_crc32c(const unsigned char *data, size_t size)
+{
+	return crc32c_data(data, size);
+}
+
+static uint64_t bench_xxh64(const unsigned char *data, size_t size)
+{
+	return xxh64_data(data, size, 0);
+}
+
+static void
+bench_run(const char *name, uint64_t (*func)(const unsigned char *, size_t),
+	  size_t size, unsigned int mb)
+{
+	struct timeval start, now;
+	size_t pos = 0, total = (size_t)mb * 1024*1024;
+	long long usecs;
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (pos = 0; pos < total; pos += size)
+		bench_sink += func(bench_data + pos % BENCH_BLOCK_SIZE, size);
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, &start);
+	printf("%-7s %6"PRIuSIZE_T" bytes %8.2f GB/s\n", name, size,
+	       usecs == 0 ? 0 : (double)total / (usecs * 1000.0));
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *data;
+	unsigned int i, mb = BENCH_DEFAULT_MB;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &mb) < 0)
+		i_fatal("Usage: bench-checksum [<megabytes>]");
+
+	data = i_malloc(BENCH_BLOCK_SIZE * 2);
+	srand(1);
+	for (i = 0; i < BENCH_BLOCK_SIZE * 2; i++)
+		data[i] = rand();
+	bench_data = data;
+
+	bench_run("crc32", bench_crc32, BENCH_SMALL_SIZE, mb / 8);
+	bench_run("crc32c", bench_crc32c, BENCH_SMALL_SIZE, mb / 8);
+	bench_run("xxh64", bench_xxh64, BENCH_SMALL_SIZE, mb / 8);
+	bench_run("crc32", bench_crc32, BENCH_BLOCK_SIZE, mb);
+	bench_run("crc32c", bench_crc32c, BENCH_BLOCK_SIZE, mb);
+	bench_run("xxh64", bench_xxh64, BENCH_BLOCK_SIZE, mb);
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,333 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Compares the open-addressing hash table in hash.c against the old
+   chained hash table that it replaced. Usage: bench-hash [<count>] */
+
+#include "lib.h"
+#include "hash.h"
+#include "primes.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+#define BENCH_DEFAULT_COUNT 1000000
+
+/* The old chained hash table: a prime sized array of nodes, with collisions
+   allocated from a separate pool. Only the parts needed by the benchmark. */
+struct chained_node {
+	struct chained_node *next;
+	void *key;
+	void *value;
+};
+
+struct chained_table {
+	pool_t node_pool;
+	unsigned int size, nodes_count;
+	struct chained_node *nodes;
+	struct chained_node *free_nodes;
+	size_t collision_bytes;
+};
+
+static unsigned int chained_hash_str(const char *p)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	unsigned int g, h = 0;
+
+	while (*s != '\0') {
+		h = (h << 4) + *s;
+		if ((g = h & 0xf0000000UL) != 0) {
+			h = h ^ (g >> 24);
+			h = h ^ g;
+		}
+		s++;
+	}
+	return h;
+}
+
+static void chained_init(struct chained_table *table, unsigned int size)
+{
+	memset(table, 0, sizeof(*table));
+	table->node_pool = default_pool;
+	table->size = I_MAX(primes_closest(size), 67);
+	table->nodes = i_new(struct chained_node, table->size);
+}
+
+static void chained_deinit(struct chained_table *table)
+{
+	struct chained_node *node, *next;
+	unsigned int i;
+
+	for (i = 0; i < table->size; i++) {
+		for (node = table->nodes[i].next; node != NULL; node = next) {
+			next = node->next;
+			p_free(table->node_pool, node);
+		}
+	}
+	for (node = table->free_nodes; node != NULL; node = next) {
+		next = node->next;
+		p_free(table->node_pool, node);
+	}
+	i_free(table->nodes);
+}
+
+static void *chained_lookup(struct chained_table *table, const char *key)
+{
+	struct chained_node *node;
+
+	node = &table->nodes[chained_hash_str(key) % table->size];
+	do {
+		if (node->key != NULL && strcmp(node->key, key) == 0)
+			return node->value;
+		node = node->next;
+	} while (node != NULL);
+	return NULL;
+}
+
+static void chained_resize(struct chained_table *table);
+
+static void chained_insert(struct chained_table *table, char *key, void *value)
+{
+	struct chained_node *node, *prev;
+
+	node = &table->nodes[chained_hash_str(key) % table->size];
+	if (node->key == NULL) {
+		node->key = key;
+		node->value = value;
+		table->nodes_count++;
+		return;
+	}
+	for (prev = node, node = node->next; node != NULL; node = node->next) {
+		if (node->key == NULL)
+			break;
+		prev = node;
+	}
+	if (node == NULL) {
+		if ((float)table->nodes_count / (float)table->size >= 2.0) {
+			chained_resize(table);
+			chained_insert(table, key, value);
+			return;
+		}
+		if (table->free_nodes != NULL) {
+			node = table->free_nodes;
+			table->free_nodes = node->next;
+			node->next = NULL;
+		} else {
+			node = p_new(table->node_pool, struct chained_node, 1);
+			table->collision_bytes += sizeof(*node);
+		}
+		prev->next = node;
+	}
+	node->key = key;
+	node->value = value;
+	table->nodes_count++;
+}
+
+static void chained_resize(struct chained_table *table)
+{
+	struct chained_node *old_nodes = table->nodes, *node, *next;
+	unsigned int i, old_size = table->size;
+
+	table->size = primes_closest(table->nodes_count + 1);
+	table->nodes = i_new(struct chained_node, table->size);
+	table->nodes_count = 0;
+	for (i = 0; i < old_size; i++) {
+		node = &old_nodes[i];
+		if (node->key != NULL)
+			chained_insert(table, node->key, node->value);
+		for (node = node->next; node != NULL; node = next) {
+			next = node->next;
+			if (node->key != NULL)
+				chained_insert(table, node->key, node->value);
+			node->next = table->free_nodes;
+			table->free_nodes = node;
+		}
+	}
+	i_free(old_nodes);
+}
+
+static bool chained_remove(struct chained_table *table, const char *key)
+{
+	struct chained_node *root, *node, *next;
+
+	root = &table->nodes[chained_hash_str(key) % table->size];
+	for (node = root; node != NULL; node = node->next) {
+		if (node->key != NULL && strcmp(node->key, key) == 0)
+			break;
+	}
+	if (node == NULL)
+		return FALSE;
+	node->key = NULL;
+	table->nodes_count--;
+
+	/* compress the collision list */
+	for (node = root; node->next != NULL; ) {
+		next = node->next;
+		if (next->key == NULL) {
+			node->next = next->next;
+			next->next = table->free_nodes;
+			table->free_nodes = next;
+		} else {
+			node = next;
+		}
+	}
+	if (root->key == NULL && root->next != NULL) {
+		next = root->next;
+		*root = *next;
+		next->next = table->free_nodes;
+		table->free_nodes = next;
+	}
+	return TRUE;
+}
+
+static size_t bench_malloc_used(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || \
+	(__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+
+	/* large tables are allocated with mmap() */
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static double bench_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+	long long usecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, start);
+	return (double)usecs;
+}
+
+static void
+bench_print(const char *table_name, const char *op, unsigned int count,
+	    double usecs)
+{
+	printf("%-8s %-8s %10.1f Mops/s %8.1f ns/op\n", table_name, op,
+	       usecs == 0 ? 0 : count / usecs, usecs * 1000.0 / count);
+}
+
+static void bench_chained(char **keys, char **missing_keys, unsigned int count)
+{
+	struct chained_table table;
+	struct timeval start;
+	unsigned int i, found = 0;
+	size_t mem_before = bench_malloc_used(), mem_used;
+
+	chained_init(&table, 0);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		chained_insert(&table, keys[i], keys[i]);
+	bench_print("chained", "insert", count, bench_usecs_since(&start));
+	mem_used = bench_malloc_used() - mem_before;
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		found += chained_lookup(&table, keys[i]) != NULL ? 1 : 0;
+	bench_print("chained", "hit", count, bench_usecs_since(&start));
+	i_assert(found == count);
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		found += chained_lookup(&table, missing_keys[i]) != NULL ? 1 : 0;
+	bench_print("chained", "miss", count, bench_usecs_since(&start));
+	i_assert(found == count);
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++) {
+		if (!chained_remove(&table, keys[i]))
+			i_unreached();
+	}
+	bench_print("chained", "remove", count, bench_usecs_since(&start));
+	if (mem_used > 0) {
+		printf("chained  memory   %10.1f bytes/entry\n",
+		       (double)mem_used / count);
+	}
+	chained_deinit(&table);
+}
+
+static void bench_hash(char **keys, char **missing_keys, unsigned int count)
+{
+	HASH_TABLE(char *, char *) hash;
+	struct timeval start;
+	unsigned int i, found = 0;
+	size_t mem_before = bench_malloc_used(), mem_used;
+
+	hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		hash_table_insert(hash, keys[i], keys[i]);
+	bench_print("hash", "insert", count, bench_usecs_since(&start));
+	mem_used = bench_malloc_used() - mem_before;
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		found += hash_table_lookup(hash, keys[i]) != NULL ? 1 : 0;
+	bench_print("hash", "hit", count, bench_usecs_since(&start));
+	i_assert(found == count);
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		found += hash_table_lookup(hash, missing_keys[i]) != NULL ? 1 : 0;
+	bench_print("hash", "miss", count, bench_usecs_since(&start));
+	i_assert(found == count);
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		hash_table_remove(hash, keys[i]);
+	bench_print("hash", "remove", count, bench_usecs_since(&start));
+	if (mem_used > 0) {
+		printf("hash     memory   %10.1f bytes/entry\n",
+		       (double)mem_used / count);
+	}
+	hash_table_destroy(&hash);
+}
+
+int main(int argc, char *argv[])
+{
+	char **keys, **missing_keys;
+	unsigned int i, count = BENCH_DEFAULT_COUNT;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &count) < 0)
+		i_fatal("Usage: bench-hash [<count>]");
+	if (count == 0)
+		i_fatal("count must be larger than 0");
+
+	/* keys look like typical usernames */
+	keys = i_new(char *, count);
+	missing_keys = i_new(char *, count);
+	for (i = 0; i < count; i++) {
+		keys[i] = i_strdup_printf("user%u@example.com", i);
+		missing_keys[i] = i_strdup_printf("nouser%u@example.com", i);
+	}
+
+	bench_chained(keys, missing_keys, count);
+	bench_hash(keys, missing_keys, count);
+
+	for (i = 0; i < count; i++) {
+		i_free(keys[i]);
+		i_free(missing_keys[i]);
+	}
+	i_free(keys);
+	i_free(missing_keys);
+	lib_deinit();
+	return 0;
+}
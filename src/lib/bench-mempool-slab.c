@@ -0,0 +1,137 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Compares the slab pool against malloc() (system_pool) with allocation
+   patterns similar to long running services:
+
+   auth: auth cache nodes with variable sized keys and values, where the
+   oldest node is freed whenever a new one is added (LRU eviction).
+
+   director: fixed size user structs that are freed and allocated at random
+   as users come and go.
+
+   Usage: bench-mempool-slab [<count>] */
+
+#include "lib.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_COUNT 100000
+#define BENCH_ROUNDS 20
+/* roughly sizeof(struct auth_cache_node) + key + value */
+#define BENCH_AUTH_MIN_SIZE 80
+#define BENCH_AUTH_MAX_SIZE 500
+/* roughly sizeof(struct user) in director */
+#define BENCH_DIRECTOR_SIZE 56
+
+static double bench_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+	long long usecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, start);
+	return (double)usecs;
+}
+
+static void
+bench_print(const char *name, const char *pattern, unsigned int count,
+	    double usecs, pool_t pool)
+{
+	struct pool_slab_stats stats;
+
+	printf("%-14s %-9s %10.1f Mops/s %8.1f ns/op", name, pattern,
+	       usecs == 0 ? 0 : count / usecs, usecs * 1000.0 / count);
+	if (pool != system_pool) {
+		pool_slab_get_stats(pool, &stats);
+		printf("  slabs=%u (%"PRIuSIZE_T" kB) released=%u",
+		       stats.slab_count, stats.slab_bytes / 1024,
+		       stats.released_slab_count);
+	}
+	printf("\n");
+}
+
+static void bench_auth(const char *name, pool_t pool, unsigned int count)
+{
+	void **nodes;
+	struct timeval start;
+	unsigned int i, head = 0, ops = count * BENCH_ROUNDS;
+
+	nodes = i_new(void *, count);
+	srand(1);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < ops; i++) {
+		if (nodes[head] != NULL)
+			p_free(pool, nodes[head]);
+		nodes[head] = p_malloc(pool, BENCH_AUTH_MIN_SIZE + rand() %
+				       (BENCH_AUTH_MAX_SIZE - BENCH_AUTH_MIN_SIZE));
+		head = (head + 1) % count;
+	}
+	bench_print(name, "auth", ops, bench_usecs_since(&start), pool);
+
+	for (i = 0; i < count; i++)
+		p_free(pool, nodes[i]);
+	i_free(nodes);
+}
+
+static void bench_director(const char *name, pool_t pool, unsigned int count)
+{
+	void **users;
+	struct timeval start;
+	unsigned int i, idx, ops = count * BENCH_ROUNDS;
+
+	users = i_new(void *, count);
+	srand(1);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		users[i] = p_malloc(pool, BENCH_DIRECTOR_SIZE);
+	for (i = 0; i < ops; i++) {
+		idx = rand() % count;
+		if (users[idx] != NULL)
+			p_free(pool, users[idx]);
+		else
+			users[idx] = p_malloc(pool, BENCH_DIRECTOR_SIZE);
+	}
+	bench_print(name, "director", ops + count,
+		    bench_usecs_since(&start), pool);
+
+	for (i = 0; i < count; i++)
+		p_free(pool, users[i]);
+	i_free(users);
+}
+
+static void bench_pool(const char *name, pool_t pool, unsigned int count)
+{
+	bench_auth(name, pool, count);
+	bench_director(name, pool, count);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = BENCH_DEFAULT_COUNT;
+	pool_t pool;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &count) < 0)
+		i_fatal("Usage: bench-mempool-slab [<count>]");
+	if (count == 0)
+		i_fatal("count must be larger than 0");
+
+	bench_pool("malloc", system_pool, count);
+
+	pool = pool_slab_create("bench", 0);
+	bench_pool("slab", pool, count);
+	pool_unref(&pool);
+
+	pool = pool_slab_create("bench", POOL_SLAB_FLAG_RELEASE_EMPTY);
+	bench_pool("slab-release", pool, count);
+	pool_unref(&pool);
+
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,193 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Compares the timing wheel used for ioloop timeouts against the priorityq
+   heap that was used earlier. The workload resembles busy services: a lot of
+   long idle timeouts that are constantly reset, while the clock advances and
+   the expired ones are added back. Usage: bench-timing-wheel [<count>] */
+
+#include "lib.h"
+#include "priorityq.h"
+#include "timing-wheel.h"
+#include "time-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_COUNT 1000000
+/* timeouts are 1..30 minutes */
+#define BENCH_MAX_TIMEOUT_MSECS (30*60*1000)
+/* number of resets for each elapsed millisecond */
+#define BENCH_RESETS_PER_MSEC 10
+
+struct bench_pq_item {
+	struct priorityq_item item;
+	uint64_t expire_msecs;
+};
+
+struct bench_tw_item {
+	struct timing_wheel_item item;
+};
+
+static uint64_t bench_rand_timeout(void)
+{
+	return 60*1000 + rand() % (BENCH_MAX_TIMEOUT_MSECS - 60*1000);
+}
+
+static int bench_pq_cmp(const void *p1, const void *p2)
+{
+	const struct bench_pq_item *i1 = p1, *i2 = p2;
+
+	return i1->expire_msecs < i2->expire_msecs ? -1 :
+		(i1->expire_msecs > i2->expire_msecs ? 1 : 0);
+}
+
+static double bench_usecs_since(const struct timeval *start)
+{
+	struct timeval now;
+	long long usecs;
+
+	if (gettimeofday(&now, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	usecs = timeval_diff_usecs(&now, start);
+	return (double)usecs;
+}
+
+static void
+bench_print(const char *name, const char *op, unsigned int count,
+	    double usecs)
+{
+	printf("%-10s %-8s %10.1f Mops/s %8.1f ns/op\n", name, op,
+	       usecs == 0 ? 0 : count / usecs, usecs * 1000.0 / count);
+}
+
+static void
+bench_priorityq(unsigned int count, unsigned int *order, unsigned int resets)
+{
+	struct bench_pq_item *items;
+	struct priorityq_item *item;
+	struct priorityq *pq;
+	struct timeval start;
+	uint64_t now = 0;
+	unsigned int i, expired = 0;
+
+	items = i_new(struct bench_pq_item, count);
+	pq = priorityq_init(bench_pq_cmp, count);
+
+	srand(1);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++) {
+		items[i].expire_msecs = now + bench_rand_timeout();
+		priorityq_add(pq, &items[i].item);
+	}
+	bench_print("priorityq", "add", count, bench_usecs_since(&start));
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < resets; i++) {
+		struct bench_pq_item *to = &items[order[i]];
+
+		priorityq_remove(pq, &to->item);
+		to->expire_msecs = now + bench_rand_timeout();
+		priorityq_add(pq, &to->item);
+
+		if (i % BENCH_RESETS_PER_MSEC == 0) {
+			now++;
+			while ((item = priorityq_peek(pq)) != NULL &&
+			       ((struct bench_pq_item *)item)->expire_msecs <= now) {
+				to = (struct bench_pq_item *)priorityq_pop(pq);
+				to->expire_msecs = now + bench_rand_timeout();
+				priorityq_add(pq, &to->item);
+				expired++;
+			}
+		}
+	}
+	bench_print("priorityq", "churn", resets, bench_usecs_since(&start));
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		priorityq_remove(pq, &items[i].item);
+	bench_print("priorityq", "remove", count, bench_usecs_since(&start));
+	printf("priorityq  expired  %u\n", expired);
+
+	priorityq_deinit(&pq);
+	i_free(items);
+}
+
+static void
+bench_timing_wheel(unsigned int count, unsigned int *order,
+		   unsigned int resets)
+{
+	struct bench_tw_item *items;
+	struct timing_wheel_item *item;
+	struct timing_wheel *wheel;
+	struct timeval start;
+	uint64_t now = 0;
+	unsigned int i, expired = 0;
+
+	items = i_new(struct bench_tw_item, count);
+	wheel = timing_wheel_init(now);
+
+	srand(1);
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		timing_wheel_add(wheel, &items[i].item, now + bench_rand_timeout());
+	bench_print("wheel", "add", count, bench_usecs_since(&start));
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < resets; i++) {
+		struct bench_tw_item *to = &items[order[i]];
+
+		timing_wheel_remove(wheel, &to->item);
+		timing_wheel_add(wheel, &to->item, now + bench_rand_timeout());
+
+		if (i % BENCH_RESETS_PER_MSEC == 0) {
+			now++;
+			while ((item = timing_wheel_pop_expired(wheel, now)) != NULL) {
+				timing_wheel_add(wheel, item,
+						 now + bench_rand_timeout());
+				expired++;
+			}
+		}
+	}
+	bench_print("wheel", "churn", resets, bench_usecs_since(&start));
+
+	if (gettimeofday(&start, NULL) < 0)
+		i_fatal("gettimeofday() failed: %m");
+	for (i = 0; i < count; i++)
+		timing_wheel_remove(wheel, &items[i].item);
+	bench_print("wheel", "remove", count, bench_usecs_since(&start));
+	printf("wheel      expired  %u\n", expired);
+
+	timing_wheel_deinit(&wheel);
+	i_free(items);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i, *order, resets, count = BENCH_DEFAULT_COUNT;
+
+	lib_init();
+	if (argc > 1 && str_to_uint(argv[1], &count) < 0)
+		i_fatal("Usage: bench-timing-wheel [<count>]");
+	if (count == 0)
+		i_fatal("count must be larger than 0");
+
+	/* reset each timeout a few times on average, so that the clock
+	   advances long enough for some of them to expire */
+	resets = count * 4;
+	order = i_new(unsigned int, resets);
+	for (i = 0; i < resets; i++)
+		order[i] = rand() % count;
+
+	bench_priorityq(count, order, resets);
+	bench_timing_wheel(count, order, resets);
+
+	i_free(order);
+	lib_deinit();
+	return 0;
+}
@@ -3,6 +3,18 @@
 #include "lib.h"
 #include "crc32.h"
 
+#if defined(__x86_64__) && (__GNUC__ >= 5 || defined(__clang__))
+/* SSE4.2 CRC32 instruction, enabled at runtime if the CPU supports it */
+#  define HAVE_CRC32C_SSE42
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/* ARMv8 CRC32 instructions, enabled at compile time */
+#  include <arm_acle.h>
+#  define HAVE_CRC32C_ARMV8
+#endif
+
+/* reversed CRC-32C (Castagnoli) polynomial */
+#define CRC32C_POLY 0x82F63B78
+
 static uint32_t crc32tab[256] = {
 	0x00000000,
 	0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
@@ -58,6 +70,101 @@ static uint32_t crc32tab[256] = {
 	0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
+/* Tables for processing 8 bytes at a time ("slicing-by-8"). Table [0] is
+   the normal byte-at-a-time table and table [n] gives the CRC of a byte
+   followed by n zero bytes. */
+static uint32_t crc32_slice_tab[8][256];
+static uint32_t crc32c_slice_tab[8][256];
+static bool crc32_tables_initialized = FALSE;
+#ifdef HAVE_CRC32C_SSE42
+static bool crc32c_have_sse42 = FALSE;
+#endif
+
+static void crc32_slice_tables_fill(uint32_t tab[8][256])
+{
+	unsigned int i, n;
+
+	for (n = 1; n < 8; n++) {
+		for (i = 0; i < 256; i++) {
+			tab[n][i] = (tab[n-1][i] >> 8) ^
+				tab[0][tab[n-1][i] & 0xff];
+		}
+	}
+}
+
+static void crc32_tables_init(void)
+{
+	uint32_t crc;
+	unsigned int i, j;
+
+	memcpy(crc32_slice_tab[0], crc32tab, sizeof(crc32tab));
+	crc32_slice_tables_fill(crc32_slice_tab);
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) != 0 ? CRC32C_POLY : 0);
+		crc32c_slice_tab[0][i] = crc;
+	}
+	crc32_slice_tables_fill(crc32c_slice_tab);
+#ifdef HAVE_CRC32C_SSE42
+	crc32c_have_sse42 = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+	crc32_tables_initialized = TRUE;
+}
+
+static uint32_t
+crc32_update_slice8(uint32_t tab[8][256], uint32_t crc,
+		    const uint8_t *p, size_t size)
+{
+	uint32_t lo;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		lo = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+			    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+		crc = tab[7][lo & 0xff] ^ tab[6][(lo >> 8) & 0xff] ^
+			tab[5][(lo >> 16) & 0xff] ^ tab[4][lo >> 24] ^
+			tab[3][p[4]] ^ tab[2][p[5]] ^
+			tab[1][p[6]] ^ tab[0][p[7]];
+	}
+	for (; size > 0; size--, p++)
+		crc = (crc >> 8) ^ tab[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+#ifdef HAVE_CRC32C_SSE42
+static uint32_t __attribute__((target("sse4.2")))
+crc32c_update_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t crc64 = crc, value;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&value, p, sizeof(value));
+		crc64 = __builtin_ia32_crc32di(crc64, value);
+	}
+	crc = crc64;
+	for (; size > 0; size--, p++)
+		crc = __builtin_ia32_crc32qi(crc, *p);
+	return crc;
+}
+#endif
+
+#ifdef HAVE_CRC32C_ARMV8
+static uint32_t
+crc32c_update_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	uint64_t value;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&value, p, sizeof(value));
+		crc = __crc32cd(crc, value);
+	}
+	for (; size > 0; size--, p++)
+		crc = __crc32cb(crc, *p);
+	return crc;
+}
+#endif
+
 uint32_t crc32_data(const void *data, size_t size)
 {
 	return crc32_data_more(0, data, size);
@@ -65,11 +172,11 @@ uint32_t crc32_data(const void *data, size_t size)
 
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 {
-	const uint8_t *p = data, *end = p + size;
+	if (unlikely(!crc32_tables_initialized))
+		crc32_tables_init();
 
 	crc ^= 0xffffffff;
-	for (; p != end; p++)
-		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
+	crc = crc32_update_slice8(crc32_slice_tab, crc, data, size);
 	crc ^= 0xffffffff;
 	return crc;
 }
@@ -89,3 +196,28 @@ uint32_t crc32_str_more(uint32_t crc, const char *str)
 	crc ^= 0xffffffff;
 	return crc;
 }
+
+uint32_t crc32c_data(const void *data, size_t size)
+{
+	return crc32c_data_more(0, data, size);
+}
+
+uint32_t crc32c_data_more(uint32_t crc, const void *data, size_t size)
+{
+	if (unlikely(!crc32_tables_initialized))
+		crc32_tables_init();
+
+	crc ^= 0xffffffff;
+#if defined(HAVE_CRC32C_SSE42)
+	if (crc32c_have_sse42)
+		crc = crc32c_update_sse42(crc, data, size);
+	else
+		crc = crc32_update_slice8(crc32c_slice_tab, crc, data, size);
+#elif defined(HAVE_CRC32C_ARMV8)
+	crc = crc32c_update_armv8(crc, data, size);
+#else
+	crc = crc32_update_slice8(crc32c_slice_tab, crc, data, size);
+#endif
+	crc ^= 0xffffffff;
+	return crc;
+}
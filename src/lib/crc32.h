@@ -1,10 +1,18 @@
 #ifndef CRC32_H
 #define CRC32_H
 
-uint32_t crc32_data(const void *data, size_t size) ATTR_PURE;
+/* The _data() functions initialize their lookup tables on the first call,
+   so they aren't ATTR_PURE. */
+uint32_t crc32_data(const void *data, size_t size);
 uint32_t crc32_str(const char *str) ATTR_PURE;
 
-uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
+uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size);
 uint32_t crc32_str_more(uint32_t crc, const char *str) ATTR_PURE;
 
+/* CRC-32C (Castagnoli) uses a different polynomial than the functions above,
+   so the results aren't compatible. It's calculated using the CPU's CRC32
+   instructions when available, which makes it much faster than crc32. */
+uint32_t crc32c_data(const void *data, size_t size);
+uint32_t crc32c_data_more(uint32_t crc, const void *data, size_t size);
+
 #endif
@@ -4,11 +4,22 @@
 
 #include "lib.h"
 #include "hash.h"
-#include "primes.h"
 
 #include <ctype.h>
 
-#define HASH_TABLE_MIN_SIZE 67
+/* The table is split into two arrays: a dense array of key/value entries in
+   insertion order and an open-addressing index of (hash, entry) slots using
+   Robin Hood hashing. Lookups scan only the contiguous slots until the stored
+   hash matches, so there's no pointer chasing through collision lists.
+   Iteration walks the entries array, so the index can be resized freely
+   even while iterating. Removed entries leave holes in the entries array
+   that are compacted away only while the table isn't frozen. */
+
+/* Minimum number of index slots. Always a power of two. */
+#define HASH_TABLE_MIN_SIZE 16
+/* Grow the index when it's more than 4/5 full */
+#define HASH_TABLE_MAX_LOAD_NUM 4
+#define HASH_TABLE_MAX_LOAD_DENOM 5
 
 #undef hash_table_create
 #undef hash_table_create_direct
@@ -26,21 +37,31 @@
 #undef hash_table_thaw
 #undef hash_table_copy
 
-struct hash_node {
-	struct hash_node *next;
+struct hash_entry {
+	/* NULL if the entry has been removed */
 	void *key;
 	void *value;
 };
 
+struct hash_slot {
+	unsigned int hash;
+	/* entries[] index + 1, or 0 if the slot is empty */
+	unsigned int entry_idx;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
 	int frozen;
-	unsigned int initial_size, nodes_count, removed_count;
+	unsigned int initial_size, min_size, nodes_count;
+
+	/* entries[0..entries_count-1] are in use, including removed ones */
+	struct hash_entry *entries;
+	unsigned int entries_count, entries_alloc;
 
+	/* size is a power of two */
 	unsigned int size;
-	struct hash_node *nodes;
-	struct hash_node *free_nodes;
+	struct hash_slot *slots;
 
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
@@ -48,17 +69,55 @@ struct hash_table {
 
 struct hash_iterate_context {
 	struct hash_table *table;
-	struct hash_node *next;
 	unsigned int pos;
 };
 
-enum hash_table_operation{
-	HASH_TABLE_OP_INSERT,
-	HASH_TABLE_OP_UPDATE,
-	HASH_TABLE_OP_RESIZE
-};
+static unsigned int hash_table_max_load(unsigned int size)
+{
+	return size / HASH_TABLE_MAX_LOAD_DENOM * HASH_TABLE_MAX_LOAD_NUM;
+}
 
-static bool hash_table_resize(struct hash_table *table, bool grow);
+static unsigned int hash_table_size_for(unsigned int count)
+{
+	unsigned int size = HASH_TABLE_MIN_SIZE;
+
+	while (hash_table_max_load(size) < count)
+		size <<= 1;
+	return size;
+}
+
+static inline unsigned int hash_table_hash(const struct hash_table *table,
+					   const void *key)
+{
+	/* The hash callbacks are often weak in the lowest bits (e.g. pointers)
+	   and we only use the lowest bits for the slot, so mix them first.
+	   This is the murmurhash3 finalizer. */
+	unsigned int h = table->hash_cb(key);
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void hash_table_alloc(struct hash_table *table, unsigned int count)
+{
+	table->size = hash_table_size_for(count);
+	table->slots = i_new(struct hash_slot, table->size);
+	table->entries_alloc = hash_table_max_load(table->size);
+	table->entries = i_new(struct hash_entry, table->entries_alloc);
+}
+
+static void
+hash_table_realloc_entries(struct hash_table *table, unsigned int new_alloc)
+{
+	table->entries = i_realloc(table->entries,
+		sizeof(struct hash_entry) * table->entries_alloc,
+		sizeof(struct hash_entry) * new_alloc);
+	table->entries_alloc = new_alloc;
+}
 
 void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size, hash_callback_t *hash_cb,
@@ -69,14 +128,13 @@ void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 	pool_ref(node_pool);
 	table = i_new(struct hash_table, 1);
 	table->node_pool = node_pool;
-	table->initial_size =
-		I_MAX(primes_closest(initial_size), HASH_TABLE_MIN_SIZE);
+	table->initial_size = initial_size;
+	table->min_size = hash_table_size_for(initial_size);
 
 	table->hash_cb = hash_cb;
 	table->key_compare_cb = key_compare_cb;
 
-	table->size = table->initial_size;
-	table->nodes = i_new(struct hash_node, table->size);
+	hash_table_alloc(table, initial_size);
 	*table_r = table;
 }
 
@@ -98,259 +156,283 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
-static void free_node(struct hash_table *table, struct hash_node *node)
-{
-	if (!table->node_pool->alloconly_pool)
-		p_free(table->node_pool, node);
-	else {
-		node->next = table->free_nodes;
-		table->free_nodes = node;
-	}
-}
-
-static void destroy_node_list(struct hash_table *table, struct hash_node *node)
-{
-	struct hash_node *next;
-
-	while (node != NULL) {
-		next = node->next;
-		p_free(table->node_pool, node);
-		node = next;
-	}
-}
-
-static void hash_table_destroy_nodes(struct hash_table *table)
-{
-	unsigned int i;
-
-	for (i = 0; i < table->size; i++) {
-		if (table->nodes[i].next != NULL)
-			destroy_node_list(table, table->nodes[i].next);
-	}
-}
-
 void hash_table_destroy(struct hash_table **_table)
 {
 	struct hash_table *table = *_table;
 
 	*_table = NULL;
 
-	if (!table->node_pool->alloconly_pool) {
-		hash_table_destroy_nodes(table);
-		destroy_node_list(table, table->free_nodes);
-	}
-
 	pool_unref(&table->node_pool);
-	i_free(table->nodes);
+	i_free(table->slots);
+	i_free(table->entries);
 	i_free(table);
 }
 
 void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
-	if (!table->node_pool->alloconly_pool)
-		hash_table_destroy_nodes(table);
-
-	if (free_nodes) {
-		if (!table->node_pool->alloconly_pool)
-			destroy_node_list(table, table->free_nodes);
-                table->free_nodes = NULL;
+	if (free_nodes && table->frozen == 0 &&
+	    table->size != table->min_size) {
+		i_free(table->slots);
+		i_free(table->entries);
+		hash_table_alloc(table, table->initial_size);
+	} else {
+		memset(table->slots, 0, sizeof(*table->slots) * table->size);
 	}
 
-	memset(table->nodes, 0, sizeof(struct hash_node) * table->size);
-
 	table->nodes_count = 0;
-	table->removed_count = 0;
+	table->entries_count = 0;
 }
 
-static struct hash_node *
-hash_table_lookup_node(const struct hash_table *table,
-		       const void *key, unsigned int hash)
+static inline unsigned int
+hash_slot_distance(unsigned int mask, unsigned int pos,
+		   const struct hash_slot *slot)
 {
-	struct hash_node *node;
-
-	node = &table->nodes[hash % table->size];
+	return (pos - slot->hash) & mask;
+}
 
-	do {
-		if (node->key != NULL) {
-			if (table->key_compare_cb(node->key, key) == 0)
-				return node;
+/* Returns the slot position of the key, or UINT_MAX if not found. */
+static unsigned int
+hash_table_lookup_slot(const struct hash_table *table,
+		       const void *key, unsigned int hash)
+{
+	const unsigned int mask = table->size - 1;
+	const struct hash_slot *slot;
+	unsigned int pos, dist;
+
+	for (pos = hash & mask, dist = 0;; pos = (pos + 1) & mask, dist++) {
+		slot = &table->slots[pos];
+		if (slot->entry_idx == 0 ||
+		    hash_slot_distance(mask, pos, slot) < dist) {
+			/* Robin Hood invariant: the key would have been
+			   placed before a slot closer to its home */
+			return UINT_MAX;
 		}
-		node = node->next;
-	} while (node != NULL);
+		if (slot->hash == hash &&
+		    table->key_compare_cb(table->entries[slot->entry_idx-1].key,
+					  key) == 0)
+			return pos;
+	}
+}
 
-	return NULL;
+static struct hash_entry *
+hash_table_lookup_entry(const struct hash_table *table, const void *key)
+{
+	unsigned int pos;
+
+	pos = hash_table_lookup_slot(table, key, hash_table_hash(table, key));
+	if (pos == UINT_MAX)
+		return NULL;
+	return &table->entries[table->slots[pos].entry_idx - 1];
 }
 
 void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
-	struct hash_node *node;
+	struct hash_entry *entry;
 
-	node = hash_table_lookup_node(table, key, table->hash_cb(key));
-	return node != NULL ? node->value : NULL;
+	entry = hash_table_lookup_entry(table, key);
+	return entry != NULL ? entry->value : NULL;
 }
 
 bool hash_table_lookup_full(const struct hash_table *table,
 			    const void *lookup_key,
 			    void **orig_key, void **value)
 {
-	struct hash_node *node;
+	struct hash_entry *entry;
 
-	node = hash_table_lookup_node(table, lookup_key,
-				      table->hash_cb(lookup_key));
-	if (node == NULL)
+	entry = hash_table_lookup_entry(table, lookup_key);
+	if (entry == NULL)
 		return FALSE;
 
-	*orig_key = node->key;
-	*value = node->value;
+	*orig_key = entry->key;
+	*value = entry->value;
 	return TRUE;
 }
 
 static void
-hash_table_insert_node(struct hash_table *table, void *key, void *value,
-			     enum hash_table_operation opcode)
+hash_slots_insert(struct hash_slot *slots, unsigned int size,
+		  struct hash_slot new_slot)
 {
-	struct hash_node *node, *prev;
-	unsigned int hash;
-	bool check_existing = TRUE;
-
-	i_assert(key != NULL);
-
-	if(opcode == HASH_TABLE_OP_RESIZE)
-		check_existing = FALSE;
-	hash = table->hash_cb(key);
-
-	if (check_existing && table->removed_count > 0) {
-		/* there may be holes, have to check everything */
-		node = hash_table_lookup_node(table, key, hash);
-		if (node != NULL) {
-			i_assert(opcode == HASH_TABLE_OP_UPDATE);
-			node->value = value;
+	const unsigned int mask = size - 1;
+	struct hash_slot tmp, *slot;
+	unsigned int pos, dist, slot_dist;
+
+	for (pos = new_slot.hash & mask, dist = 0;;
+	     pos = (pos + 1) & mask, dist++) {
+		slot = &slots[pos];
+		if (slot->entry_idx == 0) {
+			*slot = new_slot;
 			return;
 		}
-
-		check_existing = FALSE;
-	}
-
-	/* a) primary node */
-	node = &table->nodes[hash % table->size];
-	if (node->key == NULL) {
-		table->nodes_count++;
-
-		node->key = key;
-		node->value = value;
-		return;
-	}
-	if (check_existing) {
-		if (table->key_compare_cb(node->key, key) == 0) {
-			i_assert(opcode == HASH_TABLE_OP_UPDATE);
-			node->value = value;
-			return;
+		slot_dist = hash_slot_distance(mask, pos, slot);
+		if (slot_dist < dist) {
+			/* steal the slot from the richer entry and continue
+			   finding a place for it instead */
+			tmp = *slot;
+			*slot = new_slot;
+			new_slot = tmp;
+			dist = slot_dist;
 		}
 	}
+}
 
-	/* b) collisions list */
-	prev = node; node = node->next;
-	while (node != NULL) {
-		if (node->key == NULL)
+static void hash_table_remove_slot(struct hash_table *table, unsigned int pos)
+{
+	const unsigned int mask = table->size - 1;
+	unsigned int next;
+
+	/* backward shift the following displaced slots, so no tombstones
+	   are needed */
+	for (;; pos = next) {
+		next = (pos + 1) & mask;
+		if (table->slots[next].entry_idx == 0 ||
+		    hash_slot_distance(mask, next, &table->slots[next]) == 0)
 			break;
-
-		if (check_existing) {
-			if (table->key_compare_cb(node->key, key) == 0) {
-				i_assert(opcode == HASH_TABLE_OP_UPDATE);
-				node->value = value;
-				return;
-			}
-		}
-		prev = node;
-		node = node->next;
+		table->slots[pos] = table->slots[next];
 	}
+	table->slots[pos].entry_idx = 0;
+}
 
-	if (node == NULL) {
-		if (table->frozen == 0 && hash_table_resize(table, TRUE)) {
-			/* resized table, try again */
-			hash_table_insert_node(table, key, value, HASH_TABLE_OP_RESIZE);
-			return;
-		}
+static void hash_table_compress_entries(struct hash_table *table)
+{
+	unsigned int *new_idx, src, dest;
+
+	i_assert(table->frozen == 0);
+
+	/* move the entries down and then fix the slots to point to them */
+	new_idx = i_new(unsigned int, table->entries_count);
+	for (src = dest = 0; src < table->entries_count; src++) {
+		if (table->entries[src].key == NULL)
+			continue;
+		if (src != dest)
+			table->entries[dest] = table->entries[src];
+		new_idx[src] = ++dest;
+	}
+	i_assert(dest == table->nodes_count);
+	table->entries_count = dest;
 
-		if (table->free_nodes == NULL)
-			node = p_new(table->node_pool, struct hash_node, 1);
-		else {
-			node = table->free_nodes;
-			table->free_nodes = node->next;
-			node->next = NULL;
+	for (src = 0; src < table->size; src++) {
+		if (table->slots[src].entry_idx != 0) {
+			table->slots[src].entry_idx =
+				new_idx[table->slots[src].entry_idx - 1];
 		}
-		prev->next = node;
 	}
-
-	node->key = key;
-	node->value = value;
-
-	table->nodes_count++;
+	i_free(new_idx);
 }
 
-void hash_table_insert(struct hash_table *table, void *key, void *value)
+static void hash_table_resize(struct hash_table *table, unsigned int count)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	struct hash_slot *old_slots = table->slots;
+	unsigned int i, old_size = table->size;
+	unsigned int new_size = hash_table_size_for(count);
+	unsigned int new_alloc = hash_table_max_load(new_size);
+
+	if (table->frozen == 0 && table->entries_count != table->nodes_count)
+		hash_table_compress_entries(table);
+
+	if (new_size != old_size) {
+		table->size = new_size;
+		table->slots = i_new(struct hash_slot, new_size);
+		for (i = 0; i < old_size; i++) {
+			if (old_slots[i].entry_idx != 0) {
+				hash_slots_insert(table->slots, new_size,
+						  old_slots[i]);
+			}
+		}
+		i_free(old_slots);
+	}
+	if (new_alloc != table->entries_alloc &&
+	    new_alloc >= table->entries_count)
+		hash_table_realloc_entries(table, new_alloc);
 }
 
-void hash_table_update(struct hash_table *table, void *key, void *value)
+static void hash_table_shrink_if_needed(struct hash_table *table)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->frozen != 0)
+		return;
+
+	if (table->nodes_count < hash_table_max_load(table->size) / 4 &&
+	    table->size > table->min_size) {
+		/* less than 1/5 full. this also bounds the number of removed
+		   entries that iteration has to skip over. */
+		hash_table_resize(table, I_MAX(table->nodes_count * 2,
+					       table->initial_size));
+	}
 }
 
 static void
-hash_table_compress(struct hash_table *table, struct hash_node *root)
+hash_table_insert_node(struct hash_table *table, void *key, void *value,
+		       bool update)
 {
-	struct hash_node *node, *next;
+	struct hash_entry *entry;
+	struct hash_slot slot;
+	unsigned int hash, pos;
 
-	/* remove deleted nodes from the list */
-	for (node = root; node->next != NULL; ) {
-		next = node->next;
+	i_assert(key != NULL);
 
-		if (next->key == NULL) {
-			node->next = next->next;
-			free_node(table, next);
+	hash = hash_table_hash(table, key);
+	pos = hash_table_lookup_slot(table, key, hash);
+	if (pos != UINT_MAX) {
+		i_assert(update);
+		table->entries[table->slots[pos].entry_idx - 1].value = value;
+		return;
+	}
+
+	if (table->nodes_count + 1 > hash_table_max_load(table->size)) {
+		/* growing the index is safe even while frozen, since
+		   iteration goes through the entries array */
+		hash_table_resize(table, table->nodes_count + 1);
+	}
+	if (table->entries_count == table->entries_alloc) {
+		if (table->frozen == 0) {
+			/* reuse the holes left by removals */
+			hash_table_compress_entries(table);
 		} else {
-			node = next;
+			hash_table_realloc_entries(table,
+						   table->entries_alloc * 2);
 		}
 	}
 
-	/* update root */
-	if (root->key == NULL && root->next != NULL) {
-		next = root->next;
-		*root = *next;
-		free_node(table, next);
-	}
+	entry = &table->entries[table->entries_count];
+	entry->key = key;
+	entry->value = value;
+	slot.hash = hash;
+	slot.entry_idx = ++table->entries_count;
+	hash_slots_insert(table->slots, table->size, slot);
+	table->nodes_count++;
 }
 
-static void hash_table_compress_removed(struct hash_table *table)
+void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	unsigned int i;
-
-	for (i = 0; i < table->size; i++)
-		hash_table_compress(table, &table->nodes[i]);
+	hash_table_insert_node(table, key, value, FALSE);
+}
 
-        table->removed_count = 0;
+void hash_table_update(struct hash_table *table, void *key, void *value)
+{
+	hash_table_insert_node(table, key, value, TRUE);
 }
 
 bool hash_table_try_remove(struct hash_table *table, const void *key)
 {
-	struct hash_node *node;
-	unsigned int hash;
-
-	hash = table->hash_cb(key);
+	struct hash_entry *entry;
+	unsigned int pos;
 
-	node = hash_table_lookup_node(table, key, hash);
-	if (unlikely(node == NULL))
+	pos = hash_table_lookup_slot(table, key, hash_table_hash(table, key));
+	if (unlikely(pos == UINT_MAX))
 		return FALSE;
 
-	node->key = NULL;
+	entry = &table->entries[table->slots[pos].entry_idx - 1];
+	entry->key = NULL;
+	entry->value = NULL;
+	hash_table_remove_slot(table, pos);
 	table->nodes_count--;
 
-	if (table->frozen != 0)
-		table->removed_count++;
-	else if (!hash_table_resize(table, FALSE))
-		hash_table_compress(table, &table->nodes[hash % table->size]);
+	if (table->frozen == 0) {
+		/* drop trailing holes immediately */
+		while (table->entries_count > 0 &&
+		       table->entries[table->entries_count-1].key == NULL)
+			table->entries_count--;
+		hash_table_shrink_if_needed(table);
+	}
 	return TRUE;
 }
 
@@ -367,45 +449,26 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
 	return ctx;
 }
 
-static struct hash_node *
-hash_table_iterate_next(struct hash_iterate_context *ctx,
-			struct hash_node *node)
-{
-	do {
-		node = node->next;
-		if (node == NULL) {
-			if (++ctx->pos == ctx->table->size) {
-				ctx->pos--;
-				return NULL;
-			}
-			node = &ctx->table->nodes[ctx->pos];
-		}
-	} while (node->key == NULL);
-
-	return node;
-}
-
 bool hash_table_iterate(struct hash_iterate_context *ctx,
 			void **key_r, void **value_r)
 {
-	struct hash_node *node;
-
-	node = ctx->next;
-	if (node != NULL && node->key == NULL)
-		node = hash_table_iterate_next(ctx, node);
-	if (node == NULL) {
-		*key_r = *value_r = NULL;
-		return FALSE;
+	const struct hash_table *table = ctx->table;
+	const struct hash_entry *entry;
+
+	for (; ctx->pos < table->entries_count; ctx->pos++) {
+		entry = &table->entries[ctx->pos];
+		if (entry->key != NULL) {
+			*key_r = entry->key;
+			*value_r = entry->value;
+			ctx->pos++;
+			return TRUE;
+		}
 	}
-	*key_r = node->key;
-	*value_r = node->value;
-
-	ctx->next = hash_table_iterate_next(ctx, node);
-	return TRUE;
+	*key_r = *value_r = NULL;
+	return FALSE;
 }
 
 void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
@@ -429,65 +492,7 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
-	if (table->removed_count > 0) {
-		if (!hash_table_resize(table, FALSE))
-			hash_table_compress_removed(table);
-	}
-}
-
-static bool hash_table_resize(struct hash_table *table, bool grow)
-{
-	struct hash_node *old_nodes, *node, *next;
-	unsigned int next_size, old_size, i;
-	float nodes_per_list;
-
-        nodes_per_list = (float) table->nodes_count / (float) table->size;
-	if (nodes_per_list > 0.3 && nodes_per_list < 2.0)
-		return FALSE;
-
-	next_size = I_MAX(primes_closest(table->nodes_count+1),
-			  table->initial_size);
-	if (next_size == table->size)
-		return FALSE;
-
-	if (grow && table->size >= next_size)
-		return FALSE;
-
-	/* recreate primary table */
-	old_size = table->size;
-	old_nodes = table->nodes;
-
-	table->size = I_MAX(next_size, HASH_TABLE_MIN_SIZE);
-	table->nodes = i_new(struct hash_node, table->size);
-
-	table->nodes_count = 0;
-	table->removed_count = 0;
-
-	table->frozen++;
-
-	/* move the data */
-	for (i = 0; i < old_size; i++) {
-		node = &old_nodes[i];
-		if (node->key != NULL) {
-			hash_table_insert_node(table, node->key,
-					       node->value, HASH_TABLE_OP_RESIZE);
-		}
-
-		for (node = node->next; node != NULL; node = next) {
-			next = node->next;
-
-			if (node->key != NULL) {
-				hash_table_insert_node(table, node->key,
-						       node->value, HASH_TABLE_OP_RESIZE);
-			}
-			free_node(table, node);
-		}
-	}
-
-	table->frozen--;
-
-	i_free(old_nodes);
-	return TRUE;
+	hash_table_shrink_if_needed(table);
 }
 
 void hash_table_copy(struct hash_table *dest, struct hash_table *src)
@@ -505,55 +510,94 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src)
 	hash_table_thaw(dest);
 }
 
-/* a char* hash function from ASU -- from glib */
-unsigned int str_hash(const char *p)
+/* The string and memory hashes below use the XXH64 mixing primitives on
+   8 bytes at a time. The hash values are only meant to be used in memory:
+   they may change between versions and differ between architectures. */
+#define HASH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME64_3 0x165667B19E3779F9ULL
+#define HASH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t hash_rotl64(uint64_t x, unsigned int r)
 {
-        const unsigned char *s = (const unsigned char *)p;
-	unsigned int g, h = 0;
+	return (x << r) | (x >> (64 - r));
+}
 
-	while (*s != '\0') {
-		h = (h << 4) + *s;
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
-		}
-		s++;
-	}
+static inline uint64_t hash_round64(uint64_t h, uint64_t input)
+{
+	input *= HASH_PRIME64_2;
+	input = hash_rotl64(input, 31) * HASH_PRIME64_1;
+	h ^= input;
+	return hash_rotl64(h, 27) * HASH_PRIME64_1 + HASH_PRIME64_4;
+}
+
+static inline uint64_t
+hash_tail64(uint64_t h, const unsigned char *s, unsigned int size)
+{
+	uint32_t input32;
 
+	if (size >= 4) {
+		memcpy(&input32, s, sizeof(input32));
+		h ^= (uint64_t)input32 * HASH_PRIME64_1;
+		h = hash_rotl64(h, 23) * HASH_PRIME64_2 + HASH_PRIME64_3;
+		s += 4; size -= 4;
+	}
+	for (; size > 0; size--, s++) {
+		h ^= *s * HASH_PRIME64_5;
+		h = hash_rotl64(h, 11) * HASH_PRIME64_1;
+	}
 	return h;
 }
 
-/* a char* hash function from ASU -- from glib */
-unsigned int strcase_hash(const char *p)
+static inline unsigned int hash_finish64(uint64_t h)
 {
-        const unsigned char *s = (const unsigned char *)p;
-	unsigned int g, h = 0;
+	h ^= h >> 33;
+	h *= HASH_PRIME64_2;
+	h ^= h >> 29;
+	h *= HASH_PRIME64_3;
+	h ^= h >> 32;
+	return (unsigned int)h;
+}
 
-	while (*s != '\0') {
-		h = (h << 4) + i_toupper(*s);
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
-		}
-		s++;
-	}
+unsigned int str_hash(const char *p)
+{
+	return mem_hash(p, strlen(p));
+}
 
-	return h;
+unsigned int strcase_hash(const char *p)
+{
+	const unsigned char *s = (const unsigned char *)p;
+	unsigned char buf[sizeof(uint64_t)];
+	uint64_t input, h = HASH_PRIME64_5;
+	unsigned int i, size = 0;
+
+	/* same as mem_hash() of the uppercased string */
+	for (;;) {
+		for (i = 0; i < sizeof(buf) && s[i] != '\0'; i++)
+			buf[i] = i_toupper(s[i]);
+		size += i;
+		if (i < sizeof(buf))
+			break;
+		memcpy(&input, buf, sizeof(input));
+		h = hash_round64(h, input);
+		s += i;
+	}
+	h += (uint64_t)size * HASH_PRIME64_5;
+	return hash_finish64(hash_tail64(h, buf, i));
 }
 
 unsigned int mem_hash(const void *p, unsigned int size)
 {
 	const unsigned char *s = p;
-	unsigned int i, g, h = 0;
+	uint64_t input, h = HASH_PRIME64_5;
+	unsigned int left = size;
 
-	for (i = 0; i < size; i++) {
-		h = (h << 4) + *s;
-		if ((g = h & 0xf0000000UL) != 0) {
-			h = h ^ (g >> 24);
-			h = h ^ g;
-		}
-		s++;
+	for (; left >= sizeof(input); left -= sizeof(input)) {
+		memcpy(&input, s, sizeof(input));
+		h = hash_round64(h, input);
+		s += sizeof(input);
 	}
-	return h;
+	h += (uint64_t)size * HASH_PRIME64_5;
+	return hash_finish64(hash_tail64(h, s, left));
 }
-
@@ -14,10 +14,10 @@ typedef unsigned int hash_callback_t(const void *p);
 /* Returns 0 if the pointers are equal. */
 typedef int hash_cmp_callback_t(const void *p1, const void *p2);
 
-/* Create a new hash table. If initial_size is 0, the default value is used.
-   table_pool is used to allocate/free large hash tables, node_pool is used
-   for smaller allocations and can also be alloconly pool. The pools must not
-   be free'd before hash_table_destroy() is called. */
+/* Create a new hash table. If initial_size is 0, the default value is used,
+   otherwise it's the number of nodes the table can hold without growing.
+   The table memory itself is allocated from the system pool. node_pool is
+   kept referenced until hash_table_destroy() for backwards compatibility. */
 void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size,
 		       hash_callback_t *hash_cb,
@@ -67,9 +67,8 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 void hash_table_destroy(struct hash_table **table);
 #define hash_table_destroy(table) \
 	hash_table_destroy(&(*table)._table)
-/* Remove all nodes from hash table. If free_collisions is TRUE, the
-   memory allocated from node_pool is freed, or discarded with alloconly pools.
-   WARNING: If you p_clear() the node_pool, the free_collisions must be TRUE. */
+/* Remove all nodes from hash table. If free_collisions is TRUE, the table
+   is also shrunk back to its initial size. */
 void hash_table_clear(struct hash_table *table, bool free_collisions);
 #define hash_table_clear(table, free_collisions) \
 	hash_table_clear((table)._table, free_collisions)
@@ -153,8 +152,8 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 
 void hash_table_iterate_deinit(struct hash_iterate_context **ctx);
 
-/* Hash table isn't resized, and removed nodes aren't removed from
-   the list while hash table is freezed. Supports nesting. */
+/* Hash table isn't shrunk, and removed nodes' space isn't reclaimed while
+   hash table is freezed. Supports nesting. */
 void hash_table_freeze(struct hash_table *table);
 void hash_table_thaw(struct hash_table *table);
 #define hash_table_freeze(table) \
@@ -167,7 +166,8 @@ void hash_table_copy(struct hash_table *dest, struct hash_table *src);
 #define hash_table_copy(table1, table2) \
 	hash_table_copy((table1)._table, (table2)._table)
 
-/* hash function for strings */
+/* hash function for strings. The returned values may change between
+   versions, so don't store them anywhere persistently. */
 unsigned int str_hash(const char *p) ATTR_PURE;
 unsigned int strcase_hash(const char *p) ATTR_PURE;
 /* a generic hash for a given memory block */
@@ -11,10 +11,16 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
+/* Maximum number of events returned by a single epoll_wait(). The events
+   array starts small and grows only when epoll_wait() fills it, so processes
+   with lots of mostly idle fds don't need an array entry for each of them.
+   Any events that don't fit are returned by the next call. */
+#define IOLOOP_EPOLL_MAX_EVENTS 1024
+
 struct ioloop_handler_context {
 	int epfd;
 
-	unsigned int deleted_count;
+	unsigned int fd_count;
 	ARRAY(struct io_list *) fd_index;
 	ARRAY(struct epoll_event) events;
 };
@@ -22,10 +28,13 @@ struct ioloop_handler_context {
 void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
 {
 	struct ioloop_handler_context *ctx;
+	unsigned int initial_events_count;
 
 	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
 
-	i_array_init(&ctx->events, initial_fd_count);
+	initial_events_count = I_MIN(initial_fd_count, IOLOOP_EPOLL_MAX_EVENTS);
+	i_array_init(&ctx->events, initial_events_count);
+	array_idx_clear(&ctx->events, initial_events_count - 1);
 	i_array_init(&ctx->fd_index, initial_fd_count);
 
 	ctx->epfd = epoll_create(initial_fd_count);
@@ -114,14 +123,8 @@ void io_loop_handle_add(struct io_file *io)
 			op == EPOLL_CTL_ADD ? "add" : "mod", io->fd);
 	}
 
-	if (first) {
-		/* allow epoll_wait() to return the maximum number of events
-		   by keeping space allocated for each file descriptor */
-		if (ctx->deleted_count > 0)
-			ctx->deleted_count--;
-		else
-			array_append_zero(&ctx->events);
-	}
+	if (first)
+		ctx->fd_count++;
 }
 
 void io_loop_handle_remove(struct io_file *io, bool closed)
@@ -153,10 +156,8 @@ void io_loop_handle_remove(struct io_file *io, bool closed)
 		}
 	}
 	if (last) {
-		/* since we're not freeing memory in any case, just increase
-		   deleted counter so next handle_add() can just decrease it
-		   insteading of appending to the events array */
-		ctx->deleted_count++;
+		i_assert(ctx->fd_count > 0);
+		ctx->fd_count--;
 	}
 	i_free(io);
 }
@@ -177,7 +178,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	msecs = io_loop_get_wait_time(ioloop, &tv);
 
 	events = array_get_modifiable(&ctx->events, &events_count);
-	if (ioloop->io_files != NULL && events_count > ctx->deleted_count) {
+	if (ioloop->io_files != NULL && ctx->fd_count > 0) {
+		events_count = I_MIN(events_count, ctx->fd_count);
 		ret = epoll_wait(ctx->epfd, events, events_count, msecs);
 		if (ret < 0 && errno != EINTR)
 			i_fatal("epoll_wait(): %m");
@@ -189,6 +191,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 		usleep(msecs*1000);
 		ret = 0;
 	}
+	if (ret > 0)
+		ioloop->stats.events += ret;
 
 	/* execute timeout handlers */
         io_loop_handle_timeouts(ioloop);
@@ -221,6 +225,18 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 				io_loop_call_io(&io->io);
 		}
 	}
+
+	if ((unsigned int)ret == events_count && ret > 0) {
+		/* the events array was filled - there may be more events
+		   waiting, so grow it for the following calls. */
+		events_count = array_count(&ctx->events);
+		if (events_count < IOLOOP_EPOLL_MAX_EVENTS &&
+		    events_count < ctx->fd_count) {
+			events_count = I_MIN(events_count * 2,
+					     IOLOOP_EPOLL_MAX_EVENTS);
+			array_idx_clear(&ctx->events, events_count - 1);
+		}
+	}
 }
 
 #endif	/* IOLOOP_EPOLL */
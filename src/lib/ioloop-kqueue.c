@@ -129,6 +129,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	ret = kevent (ctx->kq, NULL, 0, events, events_count, &ts);
 	if (ret < 0 && errno != EINTR)
 		i_panic("kevent(): %m");
+	if (ret > 0)
+		ioloop->stats.events += ret;
 
 	/* reference all IOs */
 	for (i = 0; i < ret; i++) {
@@ -166,6 +166,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 	ret = poll(ctx->fds, ctx->fds_pos, msecs);
 	if (ret < 0 && errno != EINTR)
 		i_fatal("poll(): %m");
+	if (ret > 0)
+		ioloop->stats.events += ret;
 
 	/* execute timeout handlers */
         io_loop_handle_timeouts(ioloop);
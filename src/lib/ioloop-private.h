@@ -1,7 +1,7 @@
 #ifndef IOLOOP_PRIVATE_H
 #define IOLOOP_PRIVATE_H
 
-#include "priorityq.h"
+#include "timing-wheel.h"
 #include "ioloop.h"
 #include "array-decl.h"
 
@@ -16,16 +16,20 @@ struct ioloop {
 
 	struct io_file *io_files;
 	struct io_file *next_io_file;
-	struct priorityq *timeouts;
+	struct timing_wheel *timeouts;
 	ARRAY(struct timeout *) timeouts_new;
 
         struct ioloop_handler_context *handler_context;
         struct ioloop_notify_handler_context *notify_handler_context;
+	struct ioloop_uring_context *uring_context;
 	unsigned int max_fd_count;
 
 	io_loop_time_moved_callback_t *time_moved_callback;
 	time_t next_max_time;
 	uint64_t ioloop_wait_usecs;
+	struct timeval create_timeval;
+	/* wait_usecs and busy_usecs are filled only by io_loop_get_stats() */
+	struct ioloop_stats stats;
 
 	unsigned int io_pending_count;
 
@@ -61,7 +65,7 @@ struct io_file {
 };
 
 struct timeout {
-	struct priorityq_item item;
+	struct timing_wheel_item item;
 	unsigned int source_linenum;
 
         unsigned int msecs;
@@ -105,6 +109,8 @@ void io_loop_handler_deinit(struct ioloop *ioloop);
 void io_loop_notify_remove(struct io *io);
 void io_loop_notify_handler_deinit(struct ioloop *ioloop);
 
+void io_loop_uring_deinit(struct ioloop *ioloop);
+
 void io_loop_context_activate(struct ioloop_context *ctx);
 void io_loop_context_deactivate(struct ioloop_context *ctx);
 
@@ -121,6 +121,8 @@ void io_loop_handler_run_internal(struct ioloop *ioloop)
 		     &ctx->tmp_write_fds, &ctx->tmp_except_fds, &tv);
 	if (ret < 0 && errno != EINTR)
 		i_warning("select() : %m");
+	if (ret > 0)
+		ioloop->stats.events += ret;
 
 	/* execute timeout handlers */
         io_loop_handle_timeouts(ioloop);
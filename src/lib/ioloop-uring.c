@@ -0,0 +1,729 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "ioloop-private.h"
+
+#include <unistd.h>
+#include <sys/uio.h>
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_EVENTFD_H)
+#  include <sys/syscall.h>
+#  ifdef __NR_io_uring_setup
+#    define IOLOOP_URING
+#  endif
+#endif
+
+#ifdef IOLOOP_URING
+#  include <sys/mman.h>
+#  include <sys/poll.h>
+#  include <sys/eventfd.h>
+#  include <linux/io_uring.h>
+#endif
+
+/* Maximum number of operations submitted to the kernel at the same time.
+   The rest wait in a queue until some of the earlier ones are finished. */
+#define IOLOOP_URING_ENTRIES 64
+
+enum io_async_type {
+	IO_ASYNC_TYPE_PREAD,
+	IO_ASYNC_TYPE_PWRITEV,
+	IO_ASYNC_TYPE_FSYNC,
+	IO_ASYNC_TYPE_FDATASYNC
+};
+
+struct io_async {
+	struct io_async *prev, *next;
+	struct ioloop_uring_context *ctx;
+
+	enum io_async_type type;
+	int fd;
+	uoff_t offset;
+	/* The kernel accesses only this buffer, which is owned by us. This way
+	   an operation can be aborted without waiting for the kernel. */
+	struct iovec iov;
+	/* pread: the data is copied here just before calling the callback */
+	void *dest_buf;
+
+	io_async_callback_t *callback;
+	void *context;
+
+	ssize_t ret;
+	int error;
+
+	bool submitted:1;
+	bool completed:1;
+	/* aborted while the kernel was still running it. it's freed when the
+	   kernel finishes, without calling the callback. */
+	bool aborted:1;
+};
+
+struct ioloop_uring_context {
+	struct ioloop *ioloop;
+
+	/* operations not yet submitted to the kernel or still running */
+	struct io_async *pending_head, *pending_tail;
+	/* operations whose callbacks haven't been called yet */
+	struct io_async *completed_head, *completed_tail;
+	unsigned int submitted_count;
+
+	/* used for calling the callbacks when io_uring isn't available */
+	struct timeout *to_completed;
+
+#ifdef IOLOOP_URING
+	int ring_fd, event_fd;
+	struct io *event_io;
+	/* the process that created the ring */
+	pid_t pid;
+
+	void *sq_ring_ptr, *cq_ring_ptr;
+	size_t sq_ring_size, cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int sq_entries;
+
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+#endif
+	/* new operations are run synchronously. the ring may still exist
+	   if it failed after some operations were already submitted. */
+	bool disabled;
+	/* the ioloop is being destroyed */
+	bool deinitializing;
+};
+
+/* io_uring_setup() failed in a way that won't change in this process */
+static bool io_loop_uring_unavailable = FALSE;
+static bool io_loop_uring_error_logged = FALSE;
+/* the context whose ioloop is being destroyed */
+static struct ioloop_uring_context *io_loop_uring_deinit_ctx = NULL;
+
+static void io_loop_uring_call_completed(struct ioloop_uring_context *ctx);
+
+static void io_async_free(struct io_async *async)
+{
+	i_free(async->iov.iov_base);
+	i_free(async);
+}
+
+static void io_async_completed(struct io_async *async, ssize_t ret, int error)
+{
+	struct ioloop_uring_context *ctx = async->ctx;
+
+	DLLIST2_REMOVE(&ctx->pending_head, &ctx->pending_tail, async);
+	if (async->aborted) {
+		io_async_free(async);
+		return;
+	}
+	async->ret = ret;
+	async->error = error;
+	async->completed = TRUE;
+	DLLIST2_APPEND(&ctx->completed_head, &ctx->completed_tail, async);
+}
+
+static void io_async_call(struct io_async *async)
+{
+	struct ioloop_uring_context *ctx = async->ctx;
+
+	i_assert(async->completed);
+
+	DLLIST2_REMOVE(&ctx->completed_head, &ctx->completed_tail, async);
+	if (async->type == IO_ASYNC_TYPE_PREAD && async->ret > 0)
+		memcpy(async->dest_buf, async->iov.iov_base, async->ret);
+	errno = async->error;
+	async->callback(async->ret, async->context);
+	io_async_free(async);
+}
+
+static void io_async_run_sync(struct io_async *async)
+{
+	ssize_t ret;
+
+	switch (async->type) {
+	case IO_ASYNC_TYPE_PREAD:
+		ret = pread(async->fd, async->iov.iov_base,
+			    async->iov.iov_len, async->offset);
+		break;
+	case IO_ASYNC_TYPE_PWRITEV:
+		ret = pwrite(async->fd, async->iov.iov_base,
+			     async->iov.iov_len, async->offset);
+		break;
+	case IO_ASYNC_TYPE_FSYNC:
+		ret = fsync(async->fd);
+		break;
+	case IO_ASYNC_TYPE_FDATASYNC:
+		ret = fdatasync(async->fd);
+		break;
+	default:
+		i_unreached();
+	}
+	io_async_completed(async, ret, ret < 0 ? errno : 0);
+}
+
+static void io_loop_uring_completed_timeout(struct ioloop_uring_context *ctx)
+{
+	timeout_remove(&ctx->to_completed);
+	io_loop_uring_call_completed(ctx);
+}
+
+static void io_loop_uring_call_completed_later(struct ioloop_uring_context *ctx)
+{
+	struct ioloop *prev_ioloop = current_ioloop;
+
+	if (ctx->completed_head == NULL || ctx->to_completed != NULL ||
+	    ctx->deinitializing)
+		return;
+#ifdef IOLOOP_URING
+	if (ctx->event_fd != -1) {
+		/* wake up the ioloop that owns the ring, which might not be
+		   the current one */
+		uint64_t count = 1;
+
+		if (write(ctx->event_fd, &count, sizeof(count)) == sizeof(count))
+			return;
+		i_error("write(io_uring eventfd) failed: %m");
+	}
+#endif
+	if (current_ioloop != ctx->ioloop)
+		io_loop_set_current(ctx->ioloop);
+	ctx->to_completed = timeout_add_short(0,
+		io_loop_uring_completed_timeout, ctx);
+	if (current_ioloop != prev_ioloop)
+		io_loop_set_current(prev_ioloop);
+}
+
+#ifdef IOLOOP_URING
+static void io_loop_uring_event_input(struct ioloop_uring_context *ctx);
+
+static void io_loop_uring_ring_deinit(struct ioloop_uring_context *ctx)
+{
+	if (ctx->event_io != NULL)
+		io_remove(&ctx->event_io);
+	if (ctx->sqes != NULL) {
+		(void)munmap(ctx->sqes, ctx->sqes_size);
+		ctx->sqes = NULL;
+	}
+	if (ctx->cq_ring_ptr != NULL && ctx->cq_ring_ptr != ctx->sq_ring_ptr)
+		(void)munmap(ctx->cq_ring_ptr, ctx->cq_ring_size);
+	ctx->cq_ring_ptr = NULL;
+	if (ctx->sq_ring_ptr != NULL) {
+		(void)munmap(ctx->sq_ring_ptr, ctx->sq_ring_size);
+		ctx->sq_ring_ptr = NULL;
+	}
+	if (ctx->event_fd != -1)
+		i_close_fd(&ctx->event_fd);
+	if (ctx->ring_fd != -1)
+		i_close_fd(&ctx->ring_fd);
+}
+
+static int
+io_loop_uring_ring_init(struct ioloop_uring_context *ctx, const char **error_r)
+{
+	struct io_uring_params params;
+	unsigned char *sq_ptr, *cq_ptr;
+
+	*error_r = NULL;
+	memset(&params, 0, sizeof(params));
+	ctx->ring_fd = syscall(__NR_io_uring_setup, IOLOOP_URING_ENTRIES,
+			       &params);
+	if (ctx->ring_fd < 0) {
+		if (errno == ENOSYS || errno == EPERM || errno == EACCES) {
+			/* kernel is too old or io_uring is disabled by
+			   seccomp or sysctl. don't try again. */
+			io_loop_uring_unavailable = TRUE;
+		} else {
+			*error_r = t_strdup_printf(
+				"io_uring_setup() failed: %m");
+		}
+		ctx->ring_fd = -1;
+		return -1;
+	}
+
+	ctx->pid = getpid();
+	ctx->sq_entries = params.sq_entries;
+	ctx->sq_ring_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ring_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ring_size = ctx->cq_ring_size =
+			I_MAX(ctx->sq_ring_size, ctx->cq_ring_size);
+	}
+#endif
+	ctx->sq_ring_ptr = mmap(NULL, ctx->sq_ring_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				ctx->ring_fd, IORING_OFF_SQ_RING);
+	if (ctx->sq_ring_ptr == MAP_FAILED) {
+		ctx->sq_ring_ptr = NULL;
+		*error_r = t_strdup_printf("mmap(io_uring sq) failed: %m");
+		return -1;
+	}
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ctx->cq_ring_ptr = ctx->sq_ring_ptr;
+	else
+#endif
+	{
+		ctx->cq_ring_ptr = mmap(NULL, ctx->cq_ring_size,
+					PROT_READ | PROT_WRITE, MAP_SHARED,
+					ctx->ring_fd, IORING_OFF_CQ_RING);
+		if (ctx->cq_ring_ptr == MAP_FAILED) {
+			ctx->cq_ring_ptr = NULL;
+			*error_r = t_strdup_printf(
+				"mmap(io_uring cq) failed: %m");
+			return -1;
+		}
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED, ctx->ring_fd, IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED) {
+		ctx->sqes = NULL;
+		*error_r = t_strdup_printf("mmap(io_uring sqes) failed: %m");
+		return -1;
+	}
+
+	sq_ptr = ctx->sq_ring_ptr;
+	ctx->sq_tail = (void *)(sq_ptr + params.sq_off.tail);
+	ctx->sq_mask = (void *)(sq_ptr + params.sq_off.ring_mask);
+	ctx->sq_array = (void *)(sq_ptr + params.sq_off.array);
+	cq_ptr = ctx->cq_ring_ptr;
+	ctx->cq_head = (void *)(cq_ptr + params.cq_off.head);
+	ctx->cq_tail = (void *)(cq_ptr + params.cq_off.tail);
+	ctx->cq_mask = (void *)(cq_ptr + params.cq_off.ring_mask);
+	ctx->cqes = (void *)(cq_ptr + params.cq_off.cqes);
+
+	/* the kernel signals the eventfd for each completion, so the ioloop
+	   notices them the same way as any other I/O */
+	ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ctx->event_fd == -1) {
+		*error_r = t_strdup_printf("eventfd() failed: %m");
+		return -1;
+	}
+	if (syscall(__NR_io_uring_register, ctx->ring_fd,
+		    IORING_REGISTER_EVENTFD, &ctx->event_fd, 1) < 0) {
+		*error_r = t_strdup_printf(
+			"io_uring_register(eventfd) failed: %m");
+		return -1;
+	}
+	ctx->event_io = io_add(ctx->event_fd, IO_READ,
+			       io_loop_uring_event_input, ctx);
+	return 0;
+}
+
+static int io_loop_uring_submit(struct io_async *async)
+{
+	struct ioloop_uring_context *ctx = async->ctx;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+
+	i_assert(ctx->submitted_count < ctx->sq_entries);
+
+	/* we're the only one adding to the submission queue */
+	tail = *ctx->sq_tail;
+	idx = tail & *ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = async->fd;
+	sqe->user_data = (uintptr_t)async;
+	switch (async->type) {
+	case IO_ASYNC_TYPE_PREAD:
+	case IO_ASYNC_TYPE_PWRITEV:
+		sqe->opcode = async->type == IO_ASYNC_TYPE_PREAD ?
+			IORING_OP_READV : IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t)&async->iov;
+		sqe->len = 1;
+		sqe->off = async->offset;
+		break;
+	case IO_ASYNC_TYPE_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	case IO_ASYNC_TYPE_FDATASYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	}
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	while (syscall(__NR_io_uring_enter, ctx->ring_fd, 1, 0, 0,
+		       NULL, 0) < 0) {
+		if (errno == EINTR)
+			continue;
+		/* the kernel didn't consume the entry, so take it back */
+		__atomic_store_n(ctx->sq_tail, tail, __ATOMIC_RELEASE);
+		if (errno != EAGAIN && errno != EBUSY) {
+			i_error("io_uring_enter() failed: %m - "
+				"using synchronous file I/O");
+			ctx->disabled = TRUE;
+		}
+		return -1;
+	}
+	async->submitted = TRUE;
+	ctx->submitted_count++;
+	return 0;
+}
+
+static void io_loop_uring_submit_queued(struct ioloop_uring_context *ctx)
+{
+	struct io_async *async, *next;
+
+	for (async = ctx->pending_head; async != NULL; async = next) {
+		next = async->next;
+		if (async->submitted)
+			continue;
+		if (ctx->disabled)
+			io_async_run_sync(async);
+		else if (ctx->submitted_count == ctx->sq_entries)
+			break;
+		else if (io_loop_uring_submit(async) < 0) {
+			if (!ctx->disabled && ctx->submitted_count > 0) {
+				/* temporary failure - try again after one of
+				   the earlier operations has finished */
+				break;
+			}
+			io_async_run_sync(async);
+		}
+	}
+}
+
+static void io_loop_uring_reap(struct ioloop_uring_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	struct io_async *async;
+	unsigned int head, tail;
+
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cqes[head & *ctx->cq_mask];
+		async = (struct io_async *)(uintptr_t)cqe->user_data;
+		i_assert(async->submitted && !async->completed);
+		i_assert(ctx->submitted_count > 0);
+		ctx->submitted_count--;
+		if (cqe->res < 0)
+			io_async_completed(async, -1, -cqe->res);
+		else
+			io_async_completed(async, cqe->res, 0);
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+
+	io_loop_uring_submit_queued(ctx);
+}
+
+static void io_loop_uring_read_event(struct ioloop_uring_context *ctx)
+{
+	uint64_t count;
+
+	if (read(ctx->event_fd, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		i_error("read(io_uring eventfd) failed: %m");
+}
+
+static void io_loop_uring_wait(struct ioloop_uring_context *ctx)
+{
+	struct pollfd pfd;
+
+	/* the eventfd is signalled after each completion is added, so anything
+	   that finished after the previous read is noticed by poll() */
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = ctx->event_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+		i_fatal("poll(io_uring eventfd) failed: %m");
+	io_loop_uring_read_event(ctx);
+	io_loop_uring_reap(ctx);
+}
+
+static void io_loop_uring_event_input(struct ioloop_uring_context *ctx)
+{
+	io_loop_uring_read_event(ctx);
+	io_loop_uring_reap(ctx);
+	io_loop_uring_call_completed(ctx);
+}
+
+static void io_loop_uring_forked(struct ioloop_uring_context *ctx)
+{
+	struct io_async *async, *next;
+
+	/* The ring, its queues and the eventfd are shared with the parent
+	   process, which still owns everything that was submitted so far.
+	   Forget about them without touching the ring or the (also shared)
+	   epoll set and use synchronous I/O in this process. */
+	for (async = ctx->pending_head; async != NULL; async = next) {
+		next = async->next;
+		if (async->submitted)
+			io_async_completed(async, -1, ECANCELED);
+	}
+	ctx->submitted_count = 0;
+	ctx->disabled = TRUE;
+
+	if (ctx->event_fd != -1)
+		i_close_fd(&ctx->event_fd);
+	if (ctx->event_io != NULL)
+		io_remove_closed(&ctx->event_io);
+	io_loop_uring_ring_deinit(ctx);
+
+	io_loop_uring_submit_queued(ctx);
+	io_loop_uring_call_completed_later(ctx);
+}
+#endif
+
+static void io_loop_uring_check_fork(struct ioloop_uring_context *ctx)
+{
+#ifdef IOLOOP_URING
+	if (ctx->ring_fd != -1 && ctx->pid != getpid())
+		io_loop_uring_forked(ctx);
+#endif
+}
+
+static struct ioloop_uring_context *io_loop_uring_get_context(void)
+{
+	struct ioloop_uring_context *ctx;
+#ifdef IOLOOP_URING
+	const char *error = NULL;
+#endif
+
+	if (io_loop_uring_deinit_ctx != NULL) {
+		/* started by a callback called while destroying an ioloop */
+		return io_loop_uring_deinit_ctx;
+	}
+	ctx = current_ioloop->uring_context;
+	if (ctx != NULL) {
+		io_loop_uring_check_fork(ctx);
+		return ctx;
+	}
+
+	ctx = current_ioloop->uring_context =
+		i_new(struct ioloop_uring_context, 1);
+	ctx->ioloop = current_ioloop;
+#ifdef IOLOOP_URING
+	ctx->ring_fd = ctx->event_fd = -1;
+	if (io_loop_uring_unavailable ||
+	    io_loop_uring_ring_init(ctx, &error) < 0) {
+		if (error != NULL && !io_loop_uring_error_logged) {
+			/* the same error would most likely be logged for
+			   every ioloop */
+			i_error("%s - using synchronous file I/O", error);
+			io_loop_uring_error_logged = TRUE;
+		}
+		io_loop_uring_ring_deinit(ctx);
+		ctx->disabled = TRUE;
+	}
+#else
+	ctx->disabled = TRUE;
+#endif
+	return ctx;
+}
+
+static void io_loop_uring_call_completed(struct ioloop_uring_context *ctx)
+{
+	struct io_async *async;
+	unsigned int count = 0;
+	int old_errno = errno;
+
+	for (async = ctx->completed_head; async != NULL; async = async->next)
+		count++;
+	/* call only the callbacks that were already finished, so that
+	   callbacks starting new operations can't loop forever */
+	while (count-- > 0 && ctx->completed_head != NULL)
+		io_async_call(ctx->completed_head);
+	errno = old_errno;
+	io_loop_uring_call_completed_later(ctx);
+}
+
+bool io_async_is_native(void)
+{
+	struct ioloop_uring_context *ctx;
+
+	if (current_ioloop == NULL)
+		return FALSE;
+	ctx = current_ioloop->uring_context;
+	if (ctx == NULL) {
+		/* don't create a ring only to answer this. it's created
+		   when the first operation is started. */
+#ifdef IOLOOP_URING
+		return !io_loop_uring_unavailable;
+#else
+		return FALSE;
+#endif
+	}
+	io_loop_uring_check_fork(ctx);
+	return !ctx->disabled;
+}
+
+static struct io_async *
+io_async_start(struct io_async *async, io_async_callback_t *callback,
+	       void *context)
+{
+	struct ioloop_uring_context *ctx = io_loop_uring_get_context();
+
+	async->ctx = ctx;
+	async->callback = callback;
+	async->context = context;
+	DLLIST2_APPEND(&ctx->pending_head, &ctx->pending_tail, async);
+
+	if (ctx->deinitializing) {
+		/* io_loop_uring_deinit() calls the callback */
+		io_async_completed(async, -1, ECANCELED);
+		return async;
+	}
+
+#ifdef IOLOOP_URING
+	if (!ctx->disabled) {
+		if (ctx->submitted_count == ctx->sq_entries ||
+		    io_loop_uring_submit(async) == 0)
+			return async;
+		if (!ctx->disabled && ctx->submitted_count > 0) {
+			/* temporary failure - submitted after one of the
+			   earlier operations has finished */
+			return async;
+		}
+		/* nothing would retry it, or io_uring broke - fall back to
+		   doing this one synchronously */
+	}
+#endif
+	io_async_run_sync(async);
+	io_loop_uring_call_completed_later(ctx);
+	return async;
+}
+
+#undef io_async_pread
+struct io_async *
+io_async_pread(int fd, void *buf, size_t size, uoff_t offset,
+	       io_async_callback_t *callback, void *context)
+{
+	struct io_async *async;
+
+	async = i_new(struct io_async, 1);
+	async->type = IO_ASYNC_TYPE_PREAD;
+	async->fd = fd;
+	async->offset = offset;
+	async->dest_buf = buf;
+	async->iov.iov_base = i_malloc(I_MAX(size, 1));
+	async->iov.iov_len = size;
+	return io_async_start(async, callback, context);
+}
+
+#undef io_async_pwritev
+struct io_async *
+io_async_pwritev(int fd, const struct const_iovec *iov,
+		 unsigned int iov_count, uoff_t offset,
+		 io_async_callback_t *callback, void *context)
+{
+	struct io_async *async;
+	unsigned char *data;
+	size_t size = 0;
+	unsigned int i;
+
+	async = i_new(struct io_async, 1);
+	async->type = IO_ASYNC_TYPE_PWRITEV;
+	async->fd = fd;
+	async->offset = offset;
+	for (i = 0; i < iov_count; i++)
+		size += iov[i].iov_len;
+	async->iov.iov_base = data = i_malloc(I_MAX(size, 1));
+	async->iov.iov_len = size;
+	for (i = 0; i < iov_count; i++) {
+		memcpy(data, iov[i].iov_base, iov[i].iov_len);
+		data += iov[i].iov_len;
+	}
+	return io_async_start(async, callback, context);
+}
+
+#undef io_async_fsync
+struct io_async *
+io_async_fsync(int fd, bool datasync,
+	       io_async_callback_t *callback, void *context)
+{
+	struct io_async *async;
+
+	async = i_new(struct io_async, 1);
+	async->type = datasync ? IO_ASYNC_TYPE_FDATASYNC :
+		IO_ASYNC_TYPE_FSYNC;
+	async->fd = fd;
+	return io_async_start(async, callback, context);
+}
+
+void io_async_wait(struct io_async *async)
+{
+	struct ioloop_uring_context *ctx = async->ctx;
+	int old_errno = errno;
+
+	i_assert(!async->aborted);
+
+	io_loop_uring_check_fork(ctx);
+#ifdef IOLOOP_URING
+	if (!async->completed) {
+		io_loop_uring_reap(ctx);
+		while (!async->completed)
+			io_loop_uring_wait(ctx);
+	}
+#endif
+	io_async_call(async);
+	errno = old_errno;
+	/* other operations may have finished while waiting. the eventfd was
+	   already read, so make sure the ioloop notices them. */
+	io_loop_uring_call_completed_later(ctx);
+}
+
+void io_async_abort(struct io_async **_async)
+{
+	struct io_async *async = *_async;
+	struct ioloop_uring_context *ctx = async->ctx;
+
+	*_async = NULL;
+
+	io_loop_uring_check_fork(ctx);
+	if (async->submitted && !async->completed) {
+		/* the kernel is still using the buffer, which is why it's
+		   owned by us. free it after the kernel is finished. */
+		async->aborted = TRUE;
+		return;
+	}
+	if (async->completed) {
+		DLLIST2_REMOVE(&ctx->completed_head, &ctx->completed_tail,
+			       async);
+	} else {
+		DLLIST2_REMOVE(&ctx->pending_head, &ctx->pending_tail, async);
+	}
+	io_async_free(async);
+}
+
+void io_loop_uring_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_uring_context *ctx = ioloop->uring_context;
+	struct io_async *async, *next;
+
+	io_loop_uring_check_fork(ctx);
+	/* operations not yet given to the kernel are canceled */
+	for (async = ctx->pending_head; async != NULL; async = next) {
+		next = async->next;
+		if (!async->submitted)
+			io_async_completed(async, -1, ECANCELED);
+	}
+#ifdef IOLOOP_URING
+	/* wait for the kernel to finish with the buffers */
+	while (ctx->submitted_count > 0)
+		io_loop_uring_wait(ctx);
+	io_loop_uring_ring_deinit(ctx);
+#endif
+	i_assert(ctx->pending_head == NULL);
+	if (ctx->to_completed != NULL)
+		timeout_remove(&ctx->to_completed);
+
+	/* let the callers know that their operations are finished, so they
+	   don't keep pointers to them. the ring is already gone, so the
+	   operations that the callbacks start are canceled. */
+	ctx->disabled = TRUE;
+	ctx->deinitializing = TRUE;
+	i_assert(io_loop_uring_deinit_ctx == NULL);
+	io_loop_uring_deinit_ctx = ctx;
+	while (ctx->completed_head != NULL)
+		io_async_call(ctx->completed_head);
+	io_loop_uring_deinit_ctx = NULL;
+	ioloop->uring_context = NULL;
+	i_free(ctx);
+}
@@ -202,6 +202,17 @@ static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 	}
 }
 
+static uint64_t timeval_to_msecs_ceil(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000 + (tv->tv_usec + 999) / 1000;
+}
+
+static void timeout_add_to_wheel(struct timeout *timeout)
+{
+	timing_wheel_add(timeout->ioloop->timeouts, &timeout->item,
+			 timeval_to_msecs_ceil(&timeout->next_run));
+}
+
 static struct timeout *
 timeout_add_common(unsigned int source_linenum,
 			    timeout_callback_t *callback, void *context)
@@ -209,7 +220,6 @@ timeout_add_common(unsigned int source_linenum,
 	struct timeout *timeout;
 
 	timeout = i_new(struct timeout, 1);
-	timeout->item.idx = UINT_MAX;
 	timeout->source_linenum = source_linenum;
 	timeout->ioloop = current_ioloop;
 
@@ -240,7 +250,7 @@ struct timeout *timeout_add(unsigned int msecs, unsigned int source_linenum,
 		/* trigger zero timeouts as soon as possible */
 		timeout_update_next(timeout, timeout->ioloop->running ?
 			    NULL : &ioloop_timeval);
-		priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+		timeout_add_to_wheel(timeout);
 	}
 	return timeout;
 }
@@ -265,7 +275,7 @@ timeout_add_absolute(const struct timeval *time,
 	timeout->one_shot = TRUE;
 	timeout->next_run = *time;
 
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_add_to_wheel(timeout);
 	return timeout;
 }
 
@@ -280,8 +290,8 @@ timeout_copy(const struct timeout *old_to)
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (old_to->item.slot != 0)
+		timeout_add_to_wheel(new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_append(&new_to->ioloop->timeouts_new, &new_to, 1);
@@ -303,8 +313,8 @@ void timeout_remove(struct timeout **_timeout)
 	struct ioloop *ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout->item.slot != 0)
+		timing_wheel_remove(timeout->ioloop->timeouts, &timeout->item);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		struct timeout *const *to_idx;
 		array_foreach(&ioloop->timeouts_new, to_idx) {
@@ -319,11 +329,8 @@ void timeout_remove(struct timeout **_timeout)
 }
 
 static void ATTR_NULL(2)
-timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
+timeout_reschedule(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
-		return;
-
 	timeout_update_next(timeout, tv_now);
 	if (timeout->msecs <= 1) {
 		/* if we came here from io_loop_handle_timeouts(),
@@ -340,8 +347,17 @@ timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 		 timeout->next_run.tv_sec > tv_now->tv_sec ||
 		 (timeout->next_run.tv_sec == tv_now->tv_sec &&
 		  timeout->next_run.tv_usec > tv_now->tv_usec));
-	priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-	priorityq_add(timeout->ioloop->timeouts, &timeout->item);
+	timeout_add_to_wheel(timeout);
+}
+
+static void ATTR_NULL(2)
+timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
+{
+	if (timeout->item.slot == 0)
+		return;
+
+	timing_wheel_remove(timeout->ioloop->timeouts, &timeout->item);
+	timeout_reschedule(timeout, tv_now);
 }
 
 void timeout_reset(struct timeout *timeout)
@@ -350,8 +366,8 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
-				 struct timeval *tv_now)
+static int timeout_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r, struct timeval *tv_now)
 {
 	int ret;
 
@@ -363,10 +379,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -388,14 +404,11 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 
 int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
-	struct timeval tv_now;
-	struct priorityq_item *item;
-	struct timeout *timeout;
+	struct timeval tv_now, next_run;
+	uint64_t next_msecs;
 	int msecs;
 
-	item = priorityq_peek(ioloop->timeouts);
-	timeout = (struct timeout *)item;
-	if (timeout == NULL) {
+	if (!timing_wheel_get_next(ioloop->timeouts, &next_msecs)) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -404,8 +417,12 @@ int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		return -1;
 	}
 
+	/* this may be earlier than the first timeout's actual run time if
+	   it's far away. we'll just wake up and wait again. */
+	next_run.tv_sec = next_msecs / 1000;
+	next_run.tv_usec = (next_msecs % 1000) * 1000;
 	tv_now.tv_sec = 0;
-	msecs = timeout_get_wait_time(timeout, tv_r, &tv_now);
+	msecs = timeout_get_wait_time(&next_run, tv_r, &tv_now);
 	ioloop->next_max_time = (tv_now.tv_sec + msecs/1000) + 1;
 
 	/* update ioloop_timeval - this is meant for io_loop_handle_timeouts()'s
@@ -416,13 +433,6 @@ int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 	return msecs;
 }
 
-static int timeout_cmp(const void *p1, const void *p2)
-{
-	const struct timeout *to1 = p1, *to2 = p2;
-
-	return timeval_cmp(&to1->next_run, &to2->next_run);
-}
-
 static void io_loop_default_time_moved(time_t old_time, time_t new_time)
 {
 	if (old_time > new_time) {
@@ -447,23 +457,31 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_add_to_wheel(timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
 
 static void io_loop_timeouts_update(struct ioloop *ioloop, long diff_secs)
 {
-	struct priorityq_item *const *items;
-	unsigned int i, count;
+	ARRAY(struct timeout *) timeouts;
+	struct timing_wheel_item *item;
+	struct timeout *const *to_idx;
 
-	count = priorityq_count(ioloop->timeouts);
-	items = priorityq_items(ioloop->timeouts);
-	for (i = 0; i < count; i++) {
-		struct timeout *to = (struct timeout *)items[i];
+	/* the wheel's time may need to move backwards, which can be done
+	   only while it's empty */
+	t_array_init(&timeouts, timing_wheel_count(ioloop->timeouts) + 1);
+	while ((item = timing_wheel_pop(ioloop->timeouts)) != NULL) {
+		struct timeout *to = (struct timeout *)item;
 
 		to->next_run.tv_sec += diff_secs;
+		array_append(&timeouts, &to, 1);
 	}
+	timing_wheel_reset(ioloop->timeouts,
+			   (uint64_t)ioloop_timeval.tv_sec * 1000 +
+			   ioloop_timeval.tv_usec / 1000);
+	array_foreach(&timeouts, to_idx)
+		timeout_add_to_wheel(*to_idx);
 }
 
 static void io_loops_timeouts_update(long diff_secs)
@@ -476,8 +494,9 @@ static void io_loops_timeouts_update(long diff_secs)
 
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
-	struct priorityq_item *item;
-	struct timeval tv, tv_call, prev_ioloop_timeval = ioloop_timeval;
+	struct timing_wheel_item *item;
+	struct timeval tv_call, prev_ioloop_timeval = ioloop_timeval;
+	uint64_t call_msecs;
 	unsigned int t_id;
 
 	if (gettimeofday(&ioloop_timeval, NULL) < 0)
@@ -508,23 +527,24 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 
 	ioloop_time = ioloop_timeval.tv_sec;
 	tv_call = ioloop_timeval;
-
-	while ((item = priorityq_peek(ioloop->timeouts)) != NULL) {
+	ioloop->stats.wakeups++;
+
+	/* use tv_call to make sure we don't get to infinite loop in case
+	   callbacks update ioloop_timeval. timeouts expiring within the
+	   next millisecond are run now, since the wait time couldn't have
+	   been any shorter. */
+	call_msecs = timeval_to_msecs_ceil(&tv_call);
+	while ((item = timing_wheel_pop_expired(ioloop->timeouts,
+						call_msecs)) != NULL) {
 		struct timeout *timeout = (struct timeout *)item;
 
-		/* use tv_call to make sure we don't get to infinite loop in
-		   case callbacks update ioloop_timeval. */
-		if (timeout_get_wait_time(timeout, &tv, &tv_call) > 0)
-			break;
-
-		if (timeout->one_shot) {
-			/* remove timeout from queue */
-			priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
-		} else {
-			/* update timeout's next_run and reposition it in the queue */
-			timeout_reset_timeval(timeout, &tv_call);
+		if (!timeout->one_shot) {
+			/* update timeout's next_run and put it back to
+			   the wheel */
+			timeout_reschedule(timeout, &tv_call);
 		}
 
+		ioloop->stats.timeout_calls++;
 		if (timeout->ctx != NULL)
 			io_loop_context_activate(timeout->ctx);
 		t_id = t_push_named("ioloop timeout handler %p",
@@ -557,6 +577,7 @@ void io_loop_call_io(struct io *io)
 		io->pending = FALSE;
 	}
 
+	ioloop->stats.io_calls++;
 	if (io->ctx != NULL)
 		io_loop_context_activate(io->ctx);
 	t_id = t_push_named("ioloop handler %p",
@@ -650,7 +671,9 @@ struct ioloop *io_loop_create(void)
 	ioloop_time = ioloop_timeval.tv_sec;
 
         ioloop = i_new(struct ioloop, 1);
-	ioloop->timeouts = priorityq_init(timeout_cmp, 32);
+	ioloop->create_timeval = ioloop_timeval;
+	ioloop->timeouts = timing_wheel_init(
+		timeval_to_msecs_ceil(&ioloop_timeval));
 	i_array_init(&ioloop->timeouts_new, 8);
 
 	ioloop->time_moved_callback = current_ioloop != NULL ?
@@ -666,7 +689,7 @@ void io_loop_destroy(struct ioloop **_ioloop)
 {
 	struct ioloop *ioloop = *_ioloop;
 	struct timeout *const *to_idx;
-	struct priorityq_item *item;
+	struct timing_wheel_item *item;
 
 	*_ioloop = NULL;
 
@@ -676,6 +699,8 @@ void io_loop_destroy(struct ioloop **_ioloop)
 
 	if (ioloop->notify_handler_context != NULL)
 		io_loop_notify_handler_deinit(ioloop);
+	if (ioloop->uring_context != NULL)
+		io_loop_uring_deinit(ioloop);
 
 	while (ioloop->io_files != NULL) {
 		struct io_file *io = ioloop->io_files;
@@ -697,14 +722,14 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	}
 	array_free(&ioloop->timeouts_new);
 
-	while ((item = priorityq_pop(ioloop->timeouts)) != NULL) {
+	while ((item = timing_wheel_pop(ioloop->timeouts)) != NULL) {
 		struct timeout *to = (struct timeout *)item;
 
 		i_warning("Timeout leak: %p (line %u)", (void *)to->callback,
 			  to->source_linenum);
 		timeout_free(to);
 	}
-	priorityq_deinit(&ioloop->timeouts);
+	timing_wheel_deinit(&ioloop->timeouts);
 
 	if (ioloop->handler_context != NULL)
 		io_loop_handler_deinit(ioloop);
@@ -954,6 +979,21 @@ uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop)
 	return ioloop->ioloop_wait_usecs;
 }
 
+void io_loop_get_stats(struct ioloop *ioloop, struct ioloop_stats *stats_r)
+{
+	long long usecs;
+
+	*stats_r = ioloop->stats;
+	stats_r->wait_usecs = ioloop->ioloop_wait_usecs;
+
+	/* everything that wasn't spent waiting was spent running callbacks
+	   or the ioloop itself. this doesn't need any extra gettimeofday()
+	   calls, but ioloop_timeval may be slightly outdated. */
+	usecs = timeval_diff_usecs(&ioloop_timeval, &ioloop->create_timeval);
+	if (usecs > 0 && (uint64_t)usecs > stats_r->wait_usecs)
+		stats_r->busy_usecs = usecs - stats_r->wait_usecs;
+}
+
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd)
 {
 	enum io_condition conditions = 0;
@@ -6,6 +6,7 @@
 
 struct io;
 struct timeout;
+struct io_async;
 struct ioloop;
 struct istream;
 
@@ -30,7 +31,22 @@ enum io_notify_result {
 	IO_NOTIFY_NOSUPPORT
 };
 
+struct ioloop_stats {
+	/* Number of times the ioloop returned from waiting */
+	uint64_t wakeups;
+	/* Number of I/O events returned by the kernel. events/wakeups gives
+	   the average number of events handled per wakeup. */
+	uint64_t events;
+	/* Number of I/O and timeout callbacks called */
+	uint64_t io_calls;
+	uint64_t timeout_calls;
+	/* Microseconds spent waiting for events and outside waiting */
+	uint64_t wait_usecs;
+	uint64_t busy_usecs;
+};
+
 typedef void io_callback_t(void *context);
+typedef void io_async_callback_t(ssize_t ret, void *context);
 typedef void timeout_callback_t(void *context);
 typedef void io_loop_time_moved_callback_t(time_t old_time, time_t new_time);
 typedef void io_switch_callback_t(struct ioloop *prev_ioloop);
@@ -110,6 +126,55 @@ void timeout_remove(struct timeout **timeout);
 /* Reset timeout so it's next run after now+msecs. */
 void timeout_reset(struct timeout *timeout);
 
+/* Asynchronous file I/O. The operation is started immediately and the
+   callback is called later from the current ioloop with the same return value
+   as the matching syscall would have returned (-1 = error, errno is set).
+   Linux io_uring is used when the kernel supports it. Otherwise, or if
+   io_uring fails, the operation is done synchronously, but the callback is
+   still called only later from the ioloop. The kernel uses internal copies
+   of the buffers: the written data is copied when the operation is started,
+   and the read data is copied to buf just before the callback is called.
+   Operations may finish in any order, so for example fsync must be started
+   only after the write callback is called. If the ioloop is destroyed first,
+   the callbacks are called at that time (ECANCELED if the operation hadn't
+   been started yet). */
+struct io_async *
+io_async_pread(int fd, void *buf, size_t size, uoff_t offset,
+	       io_async_callback_t *callback, void *context) ATTR_NULL(6);
+#define io_async_pread(fd, buf, size, offset, callback, context) \
+	io_async_pread(fd, buf, size, offset + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t ret, typeof(context))), \
+		(io_async_callback_t *)callback, context)
+struct io_async *
+io_async_pwritev(int fd, const struct const_iovec *iov,
+		 unsigned int iov_count, uoff_t offset,
+		 io_async_callback_t *callback, void *context) ATTR_NULL(6);
+#define io_async_pwritev(fd, iov, iov_count, offset, callback, context) \
+	io_async_pwritev(fd, iov, iov_count, offset + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t ret, typeof(context))), \
+		(io_async_callback_t *)callback, context)
+/* fdatasync() if datasync=TRUE, otherwise fsync(). */
+struct io_async *
+io_async_fsync(int fd, bool datasync,
+	       io_async_callback_t *callback, void *context) ATTR_NULL(4);
+#define io_async_fsync(fd, datasync, callback, context) \
+	io_async_fsync(fd, datasync + \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			ssize_t ret, typeof(context))), \
+		(io_async_callback_t *)callback, context)
+/* Wait until the operation is finished and call its callback. This can be
+   used when the result is needed right away. The ioloop doesn't need to be
+   the current one. */
+void io_async_wait(struct io_async *async);
+/* Abort the operation without calling its callback. This doesn't wait for
+   the kernel, so buf can be freed immediately. */
+void io_async_abort(struct io_async **async);
+/* Returns TRUE if the operations started in the current ioloop are really
+   done asynchronously by the kernel. */
+bool io_async_is_native(void);
+
 /* Refresh ioloop_time and ioloop_timeval variables. */
 void io_loop_time_refresh(void);
 
@@ -187,6 +252,8 @@ bool io_loop_have_ios(struct ioloop *ioloop);
 bool io_loop_have_immediate_timeouts(struct ioloop *ioloop);
 /* Returns number of microseconds spent on the ioloop waiting itself. */
 uint64_t io_loop_get_wait_usecs(struct ioloop *ioloop);
+/* Returns statistics about the ioloop's activity since it was created. */
+void io_loop_get_stats(struct ioloop *ioloop, struct ioloop_stats *stats_r);
 /* Return all io conditions added for the given fd. This needs to scan through
    all the file ios in the ioloop. */
 enum io_condition io_loop_find_fd_conditions(struct ioloop *ioloop, int fd);
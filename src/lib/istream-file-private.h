@@ -8,9 +8,21 @@ struct file_istream {
 
 	uoff_t skip_left;
 
+	/* Reading the next block of a file asynchronously while the previous
+	   one is being processed. Started only after sequential reads, and
+	   only if i_stream_set_async_readahead() enabled it. */
+	struct io_async *readahead;
+	unsigned char *readahead_buf;
+	size_t readahead_buf_size;
+	uoff_t readahead_offset, next_read_offset;
+	ssize_t readahead_ret;
+	unsigned int sequential_reads;
+
 	bool file:1;
 	bool autoclose_fd:1;
 	bool seen_eof:1;
+	/* readahead_ret has the result of a finished readahead */
+	bool readahead_finished:1;
 };
 
 struct istream *
@@ -12,12 +12,27 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 
+/* Start reading ahead after this many sequential reads that filled the
+   whole buffer. Smaller files are read without it. */
+#define I_STREAM_FILE_READAHEAD_MIN_SEQUENTIAL_READS 2
+
+static void i_stream_file_readahead_abort(struct file_istream *fstream)
+{
+	if (fstream->readahead != NULL)
+		io_async_abort(&fstream->readahead);
+	fstream->readahead_finished = FALSE;
+}
+
 void i_stream_file_close(struct iostream_private *stream,
 			 bool close_parent ATTR_UNUSED)
 {
 	struct file_istream *fstream = (struct file_istream *)stream;
 	struct istream_private *_stream = (struct istream_private *)stream;
 
+	i_stream_file_readahead_abort(fstream);
+	i_free_and_null(fstream->readahead_buf);
+	fstream->readahead_buf_size = 0;
+
 	if (fstream->autoclose_fd && _stream->fd != -1) {
 		if (close(_stream->fd) < 0) {
 			i_error("file_istream.close(%s) failed: %m",
@@ -41,6 +56,87 @@ static int i_stream_file_open(struct istream_private *stream)
 	return 0;
 }
 
+static void
+i_stream_file_readahead_callback(ssize_t ret, struct file_istream *fstream)
+{
+	fstream->readahead = NULL;
+	fstream->readahead_ret = ret;
+	fstream->readahead_finished = TRUE;
+}
+
+static void
+i_stream_file_readahead_start(struct file_istream *fstream, uoff_t offset,
+			      size_t size)
+{
+	i_assert(fstream->readahead == NULL);
+
+	if (current_ioloop == NULL || !io_async_is_native()) {
+		/* a synchronous readahead would only add overhead */
+		return;
+	}
+	if (fstream->readahead_buf_size < size) {
+		i_free(fstream->readahead_buf);
+		fstream->readahead_buf = i_malloc(size);
+		fstream->readahead_buf_size = size;
+	}
+	fstream->readahead_offset = offset;
+	fstream->readahead_finished = FALSE;
+	fstream->readahead = io_async_pread(fstream->istream.fd,
+		fstream->readahead_buf, size, offset,
+		i_stream_file_readahead_callback, fstream);
+}
+
+static ssize_t
+i_stream_file_pread(struct file_istream *fstream, size_t size, uoff_t offset)
+{
+	struct istream_private *stream = &fstream->istream;
+	unsigned char *dest = stream->w_buffer + stream->pos;
+	ssize_t ret;
+
+	if (fstream->readahead != NULL &&
+	    fstream->readahead_offset == offset) {
+		/* we need it now */
+		io_async_wait(fstream->readahead);
+		i_assert(fstream->readahead == NULL);
+	}
+	if (fstream->readahead_finished &&
+	    fstream->readahead_offset == offset &&
+	    fstream->readahead_ret > 0) {
+		ret = I_MIN(size, (size_t)fstream->readahead_ret);
+		memcpy(dest, fstream->readahead_buf, ret);
+		if (ret < fstream->readahead_ret) {
+			/* keep the rest for the next read. no new readahead
+			   is started until it's used up. */
+			fstream->readahead_ret -= ret;
+			fstream->readahead_offset += ret;
+			memmove(fstream->readahead_buf,
+				fstream->readahead_buf + ret,
+				fstream->readahead_ret);
+		} else {
+			fstream->readahead_finished = FALSE;
+		}
+	} else {
+		/* not read ahead, or it failed or saw EOF. read again to get
+		   the current state. */
+		i_stream_file_readahead_abort(fstream);
+		ret = pread(stream->fd, dest, size, offset);
+		if (ret <= 0)
+			return ret;
+	}
+
+	if ((size_t)ret < size || offset != fstream->next_read_offset)
+		fstream->sequential_reads = 0;
+	else
+		fstream->sequential_reads++;
+	fstream->next_read_offset = offset + ret;
+	if (stream->async_readahead &&
+	    fstream->sequential_reads >=
+	    I_STREAM_FILE_READAHEAD_MIN_SEQUENTIAL_READS &&
+	    fstream->readahead == NULL && !fstream->readahead_finished)
+		i_stream_file_readahead_start(fstream, offset + ret, size);
+	return ret;
+}
+
 ssize_t i_stream_file_read(struct istream_private *stream)
 {
 	struct file_istream *fstream = (struct file_istream *) stream;
@@ -58,10 +154,9 @@ ssize_t i_stream_file_read(struct istream_private *stream)
 
 	offset = stream->istream.v_offset + (stream->pos - stream->skip);
 	do {
-		if (fstream->file) {
-			ret = pread(stream->fd, stream->w_buffer + stream->pos,
-				    size, offset);
-		} else if (fstream->seen_eof) {
+		if (fstream->file)
+			ret = i_stream_file_pread(fstream, size, offset);
+		else if (fstream->seen_eof) {
 			/* don't try to read() again. EOF from keyboard (^D)
 			   requires this to work right. */
 			ret = 0;
@@ -142,11 +237,15 @@ static void i_stream_file_seek(struct istream_private *stream, uoff_t v_offset,
 
 static void i_stream_file_sync(struct istream_private *stream)
 {
+	struct file_istream *fstream = (struct file_istream *) stream;
+
 	if (!stream->istream.seekable) {
 		/* can't do anything or data would be lost */
 		return;
 	}
 
+	/* the file may have changed after the readahead */
+	i_stream_file_readahead_abort(fstream);
 	stream->skip = stream->pos = 0;
 	stream->istream.eof = FALSE;
 }
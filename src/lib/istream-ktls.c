@@ -0,0 +1,164 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream-file-private.h"
+#include "istream-ktls.h"
+
+#ifdef HAVE_LINUX_TLS_H
+#include <sys/socket.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#  define SOL_TLS 282
+#endif
+
+#define TLS_RECORD_TYPE_ALERT 21
+#define TLS_RECORD_TYPE_HANDSHAKE 22
+#define TLS_RECORD_TYPE_APPLICATION_DATA 23
+
+#define TLS_ALERT_CLOSE_NOTIFY 0
+#define TLS_HANDSHAKE_KEY_UPDATE 24
+
+static bool ktls_fd_has_rx(int fd)
+{
+	struct tls_crypto_info info;
+	socklen_t len = sizeof(info);
+
+	/* fails with ENOPROTOOPT for non-TLS sockets and with EBUSY if
+	   only TX is offloaded */
+	return getsockopt(fd, SOL_TLS, TLS_RX, &info, &len) == 0;
+}
+
+static void
+i_stream_ktls_control_record(struct istream_private *stream,
+			     unsigned char record_type,
+			     const unsigned char *data, size_t size)
+{
+	struct file_istream *fstream = (struct file_istream *)stream;
+
+	switch (record_type) {
+	case TLS_RECORD_TYPE_ALERT:
+		if (size >= 2 && data[1] == TLS_ALERT_CLOSE_NOTIFY) {
+			/* EOF */
+			stream->istream.eof = TRUE;
+			fstream->seen_eof = TRUE;
+			return;
+		}
+		io_stream_set_error(&stream->iostream,
+			"Received TLS alert (level=%u, description=%u)",
+			size >= 1 ? data[0] : 0, size >= 2 ? data[1] : 0);
+		break;
+	case TLS_RECORD_TYPE_HANDSHAKE:
+		if (size > 0 && data[0] == TLS_HANDSHAKE_KEY_UPDATE) {
+			/* the keys are in the kernel, but the secret to
+			   update them stayed in the login process */
+			io_stream_set_error(&stream->iostream,
+				"Received TLS KeyUpdate, which isn't supported "
+				"with kernel TLS");
+			break;
+		}
+		/* the client would wait for our reply forever */
+		io_stream_set_error(&stream->iostream,
+			"Received TLS handshake message type %u, which isn't "
+			"supported with kernel TLS", size > 0 ? data[0] : 0);
+		break;
+	default:
+		io_stream_set_error(&stream->iostream,
+			"Received unexpected TLS record type %u", record_type);
+		break;
+	}
+	stream->istream.stream_errno = EPROTO;
+}
+
+static ssize_t i_stream_ktls_read(struct istream_private *stream)
+{
+	struct file_istream *fstream = (struct file_istream *)stream;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsg_buf;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	unsigned char *data;
+	size_t size;
+	ssize_t ret;
+
+	if (!i_stream_try_alloc(stream, 1, &size))
+		return -2;
+	data = stream->w_buffer + stream->pos;
+
+	do {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = data;
+		iov.iov_len = size;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &cmsg_buf;
+		msg.msg_controllen = sizeof(cmsg_buf);
+
+		ret = recvmsg(stream->fd, &msg, 0);
+	} while (unlikely(ret < 0 && errno == EINTR &&
+			  stream->istream.blocking));
+
+	cmsg = ret > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_TLS &&
+	    cmsg->cmsg_type == TLS_GET_RECORD_TYPE &&
+	    *CMSG_DATA(cmsg) != TLS_RECORD_TYPE_APPLICATION_DATA) {
+		/* control records are never mixed with application data */
+		i_stream_ktls_control_record(stream, *CMSG_DATA(cmsg),
+					     data, ret);
+		return -1;
+	}
+
+	if (ret == 0) {
+		/* EOF */
+		stream->istream.eof = TRUE;
+		fstream->seen_eof = TRUE;
+		return -1;
+	}
+
+	if (unlikely(ret < 0)) {
+		if (errno == EINTR || errno == EAGAIN) {
+			i_assert(!stream->istream.blocking);
+			return 0;
+		} else {
+			i_assert(errno != 0);
+			/* if we get EBADF for a valid fd, it means something's
+			   really wrong and we'd better just crash. */
+			i_assert(errno != EBADF);
+			io_stream_set_error(&stream->iostream,
+				"recvmsg(size=%"PRIuSIZE_T") failed: %m",
+				size);
+			stream->istream.stream_errno = errno;
+			return -1;
+		}
+	}
+	stream->pos += ret;
+	return ret;
+}
+
+struct istream *i_stream_create_ktls(int fd, size_t max_buffer_size)
+{
+	struct file_istream *fstream;
+	struct istream *input;
+
+	i_assert(fd != -1);
+
+	if (!ktls_fd_has_rx(fd))
+		return i_stream_create_fd(fd, max_buffer_size);
+
+	fstream = i_new(struct file_istream, 1);
+	input = i_stream_create_file_common(fstream, fd, NULL,
+					    max_buffer_size, FALSE);
+	/* reading the fd directly would fail on TLS control records */
+	input->readable_fd = FALSE;
+	input->real_stream->read = i_stream_ktls_read;
+	return input;
+}
+#else
+struct istream *i_stream_create_ktls(int fd, size_t max_buffer_size)
+{
+	return i_stream_create_fd(fd, max_buffer_size);
+}
+#endif
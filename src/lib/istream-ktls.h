@@ -0,0 +1,14 @@
+#ifndef ISTREAM_KTLS_H
+#define ISTREAM_KTLS_H
+
+/* Create an input stream for a socket where the kernel may be decrypting
+   TLS (kTLS RX was enabled by the login process before handing over the
+   socket). Such sockets fail plain read()s with EIO when a TLS record other
+   than application data arrives. This stream receives them with recvmsg():
+   close_notify alert is treated as EOF. Other alerts and all post-handshake
+   messages (e.g. KeyUpdate) fail the stream, because the TLS session state
+   needed for replying to them isn't available.
+   If fd doesn't have kTLS RX enabled, returns i_stream_create_fd(). */
+struct istream *i_stream_create_ktls(int fd, size_t max_buffer_size);
+
+#endif
@@ -53,6 +53,7 @@ struct istream_private {
 	bool return_nolf_line:1;
 	bool stream_size_passthrough:1; /* stream is parent's size */
 	bool nonpersistent_buffers:1;
+	bool async_readahead:1;
 };
 
 struct istream * ATTR_NOWARN_UNUSED_RESULT
@@ -146,6 +146,14 @@ void i_stream_set_persistent_buffers(struct istream *stream, bool set)
 	} while (stream != NULL);
 }
 
+void i_stream_set_async_readahead(struct istream *stream, bool set)
+{
+	do {
+		stream->real_stream->async_readahead = set;
+		stream = stream->real_stream->parent;
+	} while (stream != NULL);
+}
+
 static void i_stream_update(struct istream_private *stream)
 {
 	if (stream->parent == NULL)
@@ -108,6 +108,12 @@ void i_stream_set_return_partial_line(struct istream *stream, bool set);
    the memory usage is minimized by freeing the stream's buffers whenever they
    become empty. */
 void i_stream_set_persistent_buffers(struct istream *stream, bool set);
+/* Enable/disable reading the next block of a file asynchronously while the
+   previous one is being processed (default=FALSE). This is done only if the
+   kernel supports asynchronous file I/O (io_async_is_native()). It costs an
+   extra copy of the data, so it's useful only for large files on slow
+   disks. Streams other than file streams ignore this. */
+void i_stream_set_async_readahead(struct istream *stream, bool set);
 
 /* Returns number of bytes read if read was ok, -1 if EOF or error, -2 if the
    input buffer is full. */
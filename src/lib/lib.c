@@ -15,6 +15,7 @@ struct atexit_callback {
 	lib_atexit_callback_t *callback;
 };
 
+static bool lib_initialized = FALSE;
 static ARRAY(struct atexit_callback) atexit_callbacks = ARRAY_INIT;
 
 int close_keep_errno(int *fd)
@@ -124,10 +125,17 @@ void lib_init(void)
 
 	data_stack_init();
 	hostpid_init();
+	lib_initialized = TRUE;
+}
+
+bool lib_is_initialized(void)
+{
+	return lib_initialized;
 }
 
 void lib_deinit(void)
 {
+	lib_initialized = FALSE;
 	lib_atexit_run();
 	ipwd_deinit();
 	hostpid_deinit();
@@ -0,0 +1,421 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "bits.h"
+#include "llist.h"
+#include "mmap-util.h"
+#include "mempool.h"
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Slabs are aligned to their size, so the slab header can be found from any
+   pointer allocated from it. Allocations larger than the largest size class
+   get their own mapping, which is aligned the same way. */
+#define SLAB_SIZE (64*1024)
+#define SLAB_FROM_PTR(mem) \
+	((struct slab *)((uintptr_t)(mem) & ~(uintptr_t)(SLAB_SIZE-1)))
+#define SLAB_HEADER_SIZE 64
+#define SLAB_DATA(slab) ((unsigned char *)(slab) + SLAB_HEADER_SIZE)
+
+/* Size classes are multiples of 16 up to 128 bytes, and after that there
+   are 4 classes for each power of two up to 4096 bytes. */
+#define SLAB_SMALL_CLASS_SIZE 16
+#define SLAB_SMALL_CLASS_COUNT 8
+#define SLAB_MAX_CLASS_SIZE 4096
+#define SLAB_CLASS_COUNT (SLAB_SMALL_CLASS_COUNT + 5*4)
+#define SLAB_CLASS_LARGE UINT_MAX
+
+#ifdef DEBUG
+#  define CLEAR_CHR 0xde
+#endif
+
+struct slab {
+	/* in slab_class's partial or full list, or slab_pool's large list */
+	struct slab *prev, *next;
+	struct slab_pool *pool;
+	/* size of the whole mapping */
+	size_t size;
+
+	unsigned int class_idx;
+	unsigned int used_count;
+	/* number of objects that have been handed out at least once.
+	   the rest of the slab is still unused and zeroed. */
+	unsigned int carved_count;
+	void *free_list;
+};
+
+struct slab_class {
+	size_t obj_size;
+	unsigned int obj_count;
+
+	/* slabs with free space, and slabs that are full */
+	struct slab *partial, *full;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+	char *name;
+	enum pool_slab_flags flags;
+
+	struct slab_class classes[SLAB_CLASS_COUNT];
+	struct slab *large;
+	struct pool_slab_stats stats;
+};
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+
+	pool_slab_ref,
+	pool_slab_unref,
+
+	pool_slab_malloc,
+	pool_slab_free,
+
+	pool_slab_realloc,
+
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+static unsigned int slab_class_idx(size_t size)
+{
+	unsigned int bits;
+
+	i_assert(size > 0 && size <= SLAB_MAX_CLASS_SIZE);
+
+	if (size <= SLAB_SMALL_CLASS_COUNT * SLAB_SMALL_CLASS_SIZE) {
+		return (size + SLAB_SMALL_CLASS_SIZE - 1) /
+			SLAB_SMALL_CLASS_SIZE - 1;
+	}
+	/* 2^(bits-1) < size <= 2^bits */
+	bits = bits_required32(size - 1);
+	return SLAB_SMALL_CLASS_COUNT + (bits - 8) * 4 +
+		((size - 1) >> (bits - 3)) - 4;
+}
+
+static size_t slab_class_size(unsigned int idx)
+{
+	unsigned int range;
+
+	if (idx < SLAB_SMALL_CLASS_COUNT)
+		return (idx + 1) * SLAB_SMALL_CLASS_SIZE;
+	idx -= SLAB_SMALL_CLASS_COUNT;
+	range = idx / 4 + 8;
+	return (size_t)(idx % 4 + 5) << (range - 3);
+}
+
+static void *slab_mmap(size_t size)
+{
+	unsigned char *mem;
+	size_t head;
+
+	/* map an extra slab's worth, so the result can be aligned */
+	mem = mmap(NULL, size + SLAB_SIZE, PROT_READ | PROT_WRITE,
+		   MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (unlikely(mem == MAP_FAILED)) {
+		i_fatal_status(FATAL_OUTOFMEM, "mmap(%"PRIuSIZE_T
+			       ") failed: %m", size + SLAB_SIZE);
+	}
+	head = (SLAB_SIZE - ((uintptr_t)mem & (SLAB_SIZE-1))) & (SLAB_SIZE-1);
+	if (head > 0 && munmap(mem, head) < 0)
+		i_panic("munmap() failed: %m");
+	if (munmap(mem + head + size, SLAB_SIZE - head) < 0)
+		i_panic("munmap() failed: %m");
+	return mem + head;
+}
+
+static void slab_munmap(struct slab *slab)
+{
+	if (munmap(slab, slab->size) < 0)
+		i_panic("munmap() failed: %m");
+}
+
+pool_t pool_slab_create(const char *name, enum pool_slab_flags flags)
+{
+	struct slab_pool *spool;
+	unsigned int i;
+
+	spool = i_new(struct slab_pool, 1);
+	spool->pool = static_slab_pool;
+	spool->refcount = 1;
+	spool->name = i_strdup(name);
+	spool->flags = flags;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		spool->classes[i].obj_size = slab_class_size(i);
+		spool->classes[i].obj_count =
+			(SLAB_SIZE - SLAB_HEADER_SIZE) /
+			spool->classes[i].obj_size;
+	}
+	return &spool->pool;
+}
+
+static const char *pool_slab_get_name(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	return spool->name;
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)*pool;
+
+	*pool = NULL;
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_clear(&spool->pool);
+	i_free(spool->name);
+	i_free(spool);
+}
+
+static void *pool_slab_malloc_large(struct slab_pool *spool, size_t size)
+{
+	struct slab *slab;
+	size_t page_size = mmap_get_page_size();
+	size_t map_size;
+
+	if (size > SSIZE_T_MAX - SLAB_HEADER_SIZE - SLAB_SIZE - page_size) {
+		i_fatal_status(FATAL_OUTOFMEM, "pool_slab_malloc(%"PRIuSIZE_T
+			       "): Out of memory", size);
+	}
+	map_size = (SLAB_HEADER_SIZE + size + page_size - 1) /
+		page_size * page_size;
+
+	slab = slab_mmap(map_size);
+	slab->pool = spool;
+	slab->size = map_size;
+	slab->class_idx = SLAB_CLASS_LARGE;
+	slab->used_count = 1;
+	DLLIST_PREPEND(&spool->large, slab);
+
+	spool->stats.slab_count++;
+	spool->stats.slab_bytes += map_size;
+	spool->stats.alloc_count++;
+	spool->stats.alloc_bytes += map_size - SLAB_HEADER_SIZE;
+	return SLAB_DATA(slab);
+}
+
+static struct slab *
+slab_alloc(struct slab_pool *spool, unsigned int class_idx)
+{
+	struct slab *slab;
+
+	slab = slab_mmap(SLAB_SIZE);
+	slab->pool = spool;
+	slab->size = SLAB_SIZE;
+	slab->class_idx = class_idx;
+	DLLIST_PREPEND(&spool->classes[class_idx].partial, slab);
+
+	spool->stats.slab_count++;
+	spool->stats.slab_bytes += SLAB_SIZE;
+	return slab;
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	struct slab_class *class;
+	struct slab *slab;
+	unsigned int class_idx;
+	void *mem;
+
+	if (unlikely(size == 0 || size > SSIZE_T_MAX))
+		i_panic("Trying to allocate %"PRIuSIZE_T" bytes", size);
+
+	if (size > SLAB_MAX_CLASS_SIZE)
+		return pool_slab_malloc_large(spool, size);
+
+	class_idx = slab_class_idx(size);
+	class = &spool->classes[class_idx];
+	slab = class->partial;
+	if (slab == NULL)
+		slab = slab_alloc(spool, class_idx);
+
+	if (slab->free_list != NULL) {
+		mem = slab->free_list;
+		slab->free_list = *(void **)mem;
+		memset(mem, 0, class->obj_size);
+	} else {
+		/* never used before, so it's still zeroed */
+		i_assert(slab->carved_count < class->obj_count);
+		mem = SLAB_DATA(slab) + slab->carved_count * class->obj_size;
+		slab->carved_count++;
+	}
+
+	if (++slab->used_count == class->obj_count) {
+		DLLIST_REMOVE(&class->partial, slab);
+		DLLIST_PREPEND(&class->full, slab);
+	}
+	spool->stats.alloc_count++;
+	spool->stats.alloc_bytes += class->obj_size;
+	return mem;
+}
+
+static void pool_slab_free_large(struct slab_pool *spool, struct slab *slab)
+{
+	DLLIST_REMOVE(&spool->large, slab);
+
+	spool->stats.slab_count--;
+	spool->stats.slab_bytes -= slab->size;
+	spool->stats.alloc_count--;
+	spool->stats.alloc_bytes -= slab->size - SLAB_HEADER_SIZE;
+	spool->stats.released_slab_count++;
+	slab_munmap(slab);
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	struct slab_class *class;
+	struct slab *slab;
+
+	if (mem == NULL)
+		return;
+
+	slab = SLAB_FROM_PTR(mem);
+	i_assert(slab->pool == spool);
+	i_assert(slab->used_count > 0);
+
+	if (slab->class_idx == SLAB_CLASS_LARGE) {
+		pool_slab_free_large(spool, slab);
+		return;
+	}
+	class = &spool->classes[slab->class_idx];
+	i_assert(((unsigned char *)mem - SLAB_DATA(slab)) %
+		 class->obj_size == 0);
+
+#ifdef DEBUG
+	memset(mem, CLEAR_CHR, class->obj_size);
+#endif
+	*(void **)mem = slab->free_list;
+	slab->free_list = mem;
+
+	if (slab->used_count-- == class->obj_count) {
+		DLLIST_REMOVE(&class->full, slab);
+		DLLIST_PREPEND(&class->partial, slab);
+	}
+	spool->stats.alloc_count--;
+	spool->stats.alloc_bytes -= class->obj_size;
+
+	if (slab->used_count == 0 &&
+	    (spool->flags & POOL_SLAB_FLAG_RELEASE_EMPTY) != 0 &&
+	    (slab->prev != NULL || slab->next != NULL)) {
+		/* keep the last slab of the class, so that allocating and
+		   freeing a single object doesn't keep mapping and
+		   unmapping it. */
+		DLLIST_REMOVE(&class->partial, slab);
+		spool->stats.slab_count--;
+		spool->stats.slab_bytes -= slab->size;
+		spool->stats.released_slab_count++;
+		slab_munmap(slab);
+	}
+}
+
+static size_t slab_get_usable_size(const struct slab_pool *spool,
+				   const struct slab *slab)
+{
+	if (slab->class_idx == SLAB_CLASS_LARGE)
+		return slab->size - SLAB_HEADER_SIZE;
+	return spool->classes[slab->class_idx].obj_size;
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	void *new_mem;
+
+	if (unlikely(new_size == 0 || new_size > SSIZE_T_MAX))
+		i_panic("Trying to allocate %"PRIuSIZE_T" bytes", new_size);
+
+	if (mem == NULL)
+		return pool_slab_malloc(pool, new_size);
+
+	if (new_size <= old_size)
+		return mem;
+
+	i_assert(old_size <= slab_get_usable_size(spool, SLAB_FROM_PTR(mem)));
+	if (new_size <= slab_get_usable_size(spool, SLAB_FROM_PTR(mem))) {
+		/* fits to the same object */
+		memset(PTR_OFFSET(mem, old_size), 0, new_size - old_size);
+		return mem;
+	}
+
+	new_mem = pool_slab_malloc(pool, new_size);
+	memcpy(new_mem, mem, old_size);
+	pool_slab_free(pool, mem);
+	return new_mem;
+}
+
+static void slab_list_free(struct slab_pool *spool, struct slab **list)
+{
+	struct slab *slab, *next;
+
+	for (slab = *list; slab != NULL; slab = next) {
+		next = slab->next;
+		spool->stats.released_slab_count++;
+		slab_munmap(slab);
+	}
+	*list = NULL;
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+	unsigned int i;
+
+	for (i = 0; i < SLAB_CLASS_COUNT; i++) {
+		slab_list_free(spool, &spool->classes[i].partial);
+		slab_list_free(spool, &spool->classes[i].full);
+	}
+	slab_list_free(spool, &spool->large);
+
+	spool->stats.slab_count = 0;
+	spool->stats.slab_bytes = 0;
+	spool->stats.alloc_count = 0;
+	spool->stats.alloc_bytes = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r)
+{
+	struct slab_pool *spool = (struct slab_pool *)pool;
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+
+	*stats_r = spool->stats;
+}
@@ -58,6 +58,20 @@ extern pool_t unsafe_data_stack_pool;
    malloc()ed block size, part of it is used internally. */
 pool_t pool_alloconly_create(const char *name, size_t size);
 
+enum pool_slab_flags {
+	/* Unmap slabs as soon as they become empty, instead of keeping them
+	   around for future allocations. The last slab of each size class is
+	   still kept. */
+	POOL_SLAB_FLAG_RELEASE_EMPTY	= 0x01
+};
+
+/* Create a new slab pool. Allocations are rounded up to size classes, and
+   each class has its own slabs with a freelist, so freeing memory makes it
+   available for later allocations of similar size. This is useful for long
+   lived processes that allocate and free a lot of small fixed-size objects.
+   Allocations larger than 4 kB are mmap()ed separately. */
+pool_t pool_slab_create(const char *name, enum pool_slab_flags flags);
+
 /* When allocating memory from returned pool, the data stack frame must be
    the same as it was when calling this function. pool_unref() also checks
    that the stack frame is the same. This should make it quite safe to use. */
@@ -132,4 +146,19 @@ size_t pool_alloconly_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_alloconly_get_total_alloc_size(pool_t pool);
 
+struct pool_slab_stats {
+	/* Number of allocations and their size rounded up to the size class */
+	unsigned int alloc_count;
+	size_t alloc_bytes;
+	/* Number of slabs (including large allocations) and their total
+	   size */
+	unsigned int slab_count;
+	size_t slab_bytes;
+	/* Number of slabs that have been returned to the OS */
+	unsigned int released_slab_count;
+};
+
+/* This function is only for pools created with pool_slab_create(): */
+void pool_slab_get_stats(pool_t pool, struct pool_slab_stats *stats_r);
+
 #endif
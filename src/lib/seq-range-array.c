@@ -201,18 +201,62 @@ unsigned int seq_range_array_add_range_count(ARRAY_TYPE(seq_range) *array,
 	return count;
 }
 
+static void
+seq_range_array_replace(ARRAY_TYPE(seq_range) *dest,
+			const ARRAY_TYPE(seq_range) *src)
+{
+	array_clear(dest);
+	array_append_array(dest, src);
+}
+
 void seq_range_array_merge(ARRAY_TYPE(seq_range) *dest,
 			   const ARRAY_TYPE(seq_range) *src)
 {
-	const struct seq_range *range;
+	ARRAY_TYPE(seq_range) merged;
+	const struct seq_range *range1, *range2, *range;
+	struct seq_range *last = NULL;
+	unsigned int i1, i2, count1, count2;
 
 	if (array_count(dest) == 0) {
 		array_append_array(dest, src);
 		return;
 	}
 
-	array_foreach(src, range)
-		seq_range_array_add_range(dest, range->seq1, range->seq2);
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	if (count2 == 0)
+		return;
+	if (range2[0].seq1 > range1[count1-1].seq2) {
+		/* appending - no need to rebuild the array */
+		for (i2 = 0; i2 < count2; i2++) {
+			seq_range_array_add_range(dest, range2[i2].seq1,
+						  range2[i2].seq2);
+		}
+		return;
+	}
+
+	/* merge the sorted arrays in one pass instead of doing a lookup for
+	   each range. the result is built in a heap array, because dest may
+	   be a data stack array from a parent frame. */
+	i_array_init(&merged, count1 + count2);
+	for (i1 = i2 = 0; i1 < count1 || i2 < count2; ) {
+		if (i2 == count2 || (i1 < count1 &&
+				     range1[i1].seq1 <= range2[i2].seq1))
+			range = &range1[i1++];
+		else
+			range = &range2[i2++];
+
+		if (last != NULL && (last->seq2 == (uint32_t)-1 ||
+				     range->seq1 <= last->seq2 + 1)) {
+			if (range->seq2 > last->seq2)
+				last->seq2 = range->seq2;
+		} else {
+			last = array_append_space(&merged);
+			*last = *range;
+		}
+	}
+	seq_range_array_replace(dest, &merged);
+	array_free(&merged);
 }
 
 bool seq_range_array_remove(ARRAY_TYPE(seq_range) *array, uint32_t seq)
@@ -330,13 +374,51 @@ unsigned int seq_range_array_remove_range(ARRAY_TYPE(seq_range) *array,
 unsigned int seq_range_array_remove_seq_range(ARRAY_TYPE(seq_range) *dest,
 					      const ARRAY_TYPE(seq_range) *src)
 {
-	unsigned int ret = 0;
-	const struct seq_range *src_range;
-
-	array_foreach(src, src_range) {
-		ret += seq_range_array_remove_range(dest, src_range->seq1,
-						    src_range->seq2);
+	ARRAY_TYPE(seq_range) result;
+	const struct seq_range *range1, *range2;
+	struct seq_range value, *part;
+	unsigned int i1, i2, count1, count2, ret = 0;
+
+	if (!array_is_created(dest) || array_count(dest) == 0)
+		return 0;
+
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	if (count2 == 0)
+		return 0;
+
+	/* go through both arrays once, keeping the parts of dest that aren't
+	   in src */
+	i_array_init(&result, count1 + count2);
+	i2 = 0;
+	for (i1 = 0; i1 < count1; i1++) {
+		value = range1[i1];
+		while (i2 < count2 && range2[i2].seq2 < value.seq1)
+			i2++;
+		while (i2 < count2 && range2[i2].seq1 <= value.seq2) {
+			if (range2[i2].seq1 > value.seq1) {
+				part = array_append_space(&result);
+				part->seq1 = value.seq1;
+				part->seq2 = range2[i2].seq1 - 1;
+			}
+			if (range2[i2].seq2 >= value.seq2) {
+				ret += value.seq2 -
+					I_MAX(value.seq1, range2[i2].seq1) + 1;
+				value.seq1 = 1;
+				value.seq2 = 0;
+				break;
+			}
+			ret += range2[i2].seq2 -
+				I_MAX(value.seq1, range2[i2].seq1) + 1;
+			value.seq1 = range2[i2].seq2 + 1;
+			i2++;
+		}
+		if (value.seq1 <= value.seq2)
+			array_append(&result, &value, 1);
 	}
+	if (ret > 0)
+		seq_range_array_replace(dest, &result);
+	array_free(&result);
 	return ret;
 }
 
@@ -365,22 +447,32 @@ void seq_range_array_remove_nth(ARRAY_TYPE(seq_range) *array,
 unsigned int seq_range_array_intersect(ARRAY_TYPE(seq_range) *dest,
 				       const ARRAY_TYPE(seq_range) *src)
 {
-	const struct seq_range *src_range;
-	unsigned int i, count, ret = 0;
-	uint32_t last_seq = 0;
-
-	src_range = array_get(src, &count);
-	for (i = 0; i < count; i++) {
-		if (last_seq + 1 < src_range[i].seq1) {
-			ret += seq_range_array_remove_range(dest,
-					last_seq + 1, src_range[i].seq1 - 1);
+	ARRAY_TYPE(seq_range) result;
+	const struct seq_range *range1, *range2;
+	struct seq_range value;
+	unsigned int i1, i2, count1, count2, ret;
+
+	range1 = array_get(dest, &count1);
+	range2 = array_get(src, &count2);
+	if (count1 == 0)
+		return 0;
+
+	ret = seq_range_count(dest);
+	i_array_init(&result, I_MAX(count1, count2));
+	for (i1 = i2 = 0; i1 < count1 && i2 < count2; ) {
+		value.seq1 = I_MAX(range1[i1].seq1, range2[i2].seq1);
+		value.seq2 = I_MIN(range1[i1].seq2, range2[i2].seq2);
+		if (value.seq1 <= value.seq2) {
+			array_append(&result, &value, 1);
+			ret -= value.seq2 - value.seq1 + 1;
 		}
-		last_seq = src_range[i].seq2;
-	}
-	if (last_seq != (uint32_t)-1) {
-		ret += seq_range_array_remove_range(dest, last_seq + 1,
-						    (uint32_t)-1);
+		if (range1[i1].seq2 < range2[i2].seq2)
+			i1++;
+		else
+			i2++;
 	}
+	seq_range_array_replace(dest, &result);
+	array_free(&result);
 	return ret;
 }
 
@@ -4,6 +4,8 @@
 #include "str.h"
 #include "base64.h"
 
+static const char b64chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 static void test_base64_encode(void)
 {
@@ -101,9 +103,139 @@ static void test_base64_random(void)
 	test_end();
 }
 
+/* the original byte-at-a-time implementation, used to verify that the
+   optimized base64_decode() behaves identically */
+static int
+test_base64_decode_ref(const unsigned char *src, size_t src_size,
+		       size_t *src_pos_r, buffer_t *dest)
+{
+	size_t src_pos;
+	unsigned char input[4], output[3];
+	int ret = 1;
+
+	for (src_pos = 0; src_pos+3 < src_size; ) {
+		if (!base64_is_valid_char(src[src_pos])) {
+			if (src[src_pos] != '\n' && src[src_pos] != '\r' &&
+			    src[src_pos] != ' ' && src[src_pos] != '\t') {
+				ret = -1;
+				break;
+			}
+			src_pos++;
+			continue;
+		}
+		if (!base64_is_valid_char(src[src_pos+1])) {
+			ret = -1;
+			break;
+		}
+		input[0] = strchr(b64chars, src[src_pos]) - b64chars;
+		input[1] = strchr(b64chars, src[src_pos+1]) - b64chars;
+		output[0] = (input[0] << 2) | (input[1] >> 4);
+		if (!base64_is_valid_char(src[src_pos+2])) {
+			if (src[src_pos+2] != '=' || src[src_pos+3] != '=') {
+				ret = -1;
+				break;
+			}
+			buffer_append(dest, output, 1);
+			ret = 0;
+			src_pos += 4;
+			break;
+		}
+		input[2] = strchr(b64chars, src[src_pos+2]) - b64chars;
+		output[1] = (input[1] << 4) | (input[2] >> 2);
+		if (!base64_is_valid_char(src[src_pos+3])) {
+			if (src[src_pos+3] != '=') {
+				ret = -1;
+				break;
+			}
+			buffer_append(dest, output, 2);
+			ret = 0;
+			src_pos += 4;
+			break;
+		}
+		input[3] = strchr(b64chars, src[src_pos+3]) - b64chars;
+		output[2] = ((input[2] << 6) & 0xc0) | input[3];
+		buffer_append(dest, output, 3);
+		src_pos += 4;
+	}
+	for (; src_pos < src_size; src_pos++) {
+		if (src[src_pos] != '\n' && src[src_pos] != '\r' &&
+		    src[src_pos] != ' ' && src[src_pos] != '\t')
+			break;
+	}
+	*src_pos_r = src_pos;
+	return ret;
+}
+
+static void test_base64_decode_random_input(void)
+{
+	static const char *extra_chars = "=\r\n \t!\xff";
+	unsigned char buf[2000];
+	buffer_t *dest, *ref_dest;
+	size_t src_pos, ref_src_pos;
+	unsigned int i, j, len, extra_len = strlen(extra_chars);
+	int ret, ref_ret;
+
+	dest = buffer_create_dynamic(pool_datastack_create(), sizeof(buf));
+	ref_dest = buffer_create_dynamic(pool_datastack_create(), sizeof(buf));
+
+	test_begin("base64_decode() with random input");
+	for (i = 0; i < 1000; i++) {
+		len = rand() % sizeof(buf);
+		for (j = 0; j < len; j++) {
+			/* mostly valid base64 with occasional other chars */
+			if (rand() % 200 == 0)
+				buf[j] = extra_chars[rand() % extra_len];
+			else
+				buf[j] = b64chars[rand() % 64];
+		}
+		buffer_set_used_size(dest, 0);
+		buffer_set_used_size(ref_dest, 0);
+		ret = base64_decode(buf, len, &src_pos, dest);
+		ref_ret = test_base64_decode_ref(buf, len, &ref_src_pos,
+						 ref_dest);
+		test_assert_idx(ret == ref_ret && src_pos == ref_src_pos, i);
+		test_assert_idx(buffer_cmp(dest, ref_dest), i);
+	}
+	test_end();
+}
+
+static void test_base64_encode_random(void)
+{
+	unsigned char buf[1000];
+	string_t *str;
+	unsigned int i, j, len, n;
+	bool ok;
+
+	str = t_str_new(sizeof(buf)*2);
+	test_begin("base64_encode() with random input");
+	for (i = 0; i < 1000; i++) {
+		len = rand() % sizeof(buf);
+		for (j = 0; j < len; j++)
+			buf[j] = rand();
+		str_truncate(str, 0);
+		base64_encode(buf, len, str);
+		test_assert(str_len(str) == (len + 2) / 3 * 4);
+
+		/* compare each full group against the expected output */
+		ok = TRUE;
+		for (j = 0; j + 3 <= len; j += 3) {
+			n = (buf[j] << 16) | (buf[j+1] << 8) | buf[j+2];
+			if (str_data(str)[j/3*4] != b64chars[n >> 18] ||
+			    str_data(str)[j/3*4+1] != b64chars[(n >> 12) & 0x3f] ||
+			    str_data(str)[j/3*4+2] != b64chars[(n >> 6) & 0x3f] ||
+			    str_data(str)[j/3*4+3] != b64chars[n & 0x3f])
+				ok = FALSE;
+		}
+		test_assert_idx(ok, i);
+	}
+	test_end();
+}
+
 void test_base64(void)
 {
 	test_base64_encode();
 	test_base64_decode();
 	test_base64_random();
+	test_base64_encode_random();
+	test_base64_decode_random_input();
 }
@@ -3,6 +3,49 @@
 #include "test-lib.h"
 #include "crc32.h"
 
+static uint32_t test_crc32_ref(uint32_t poly, const unsigned char *data,
+			       size_t size)
+{
+	uint32_t crc = 0xffffffff;
+	unsigned int i;
+
+	for (; size > 0; size--, data++) {
+		crc ^= *data;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) != 0 ? poly : 0);
+	}
+	return crc ^ 0xffffffff;
+}
+
+static void test_crc32_random(void)
+{
+	unsigned char buf[1024];
+	unsigned int i, n, size, split;
+	uint32_t crc;
+
+	test_begin("crc32 random");
+	for (n = 0; n < 100; n++) {
+		size = rand() % sizeof(buf);
+		for (i = 0; i < size; i++)
+			buf[i] = rand();
+		split = size == 0 ? 0 : rand() % size;
+
+		/* unaligned start and odd sizes go through the tail loops */
+		test_assert(crc32_data(buf, size) ==
+			    test_crc32_ref(0xEDB88320, buf, size));
+		crc = crc32_data_more(crc32_data(buf, split),
+				      buf + split, size - split);
+		test_assert(crc == crc32_data(buf, size));
+
+		test_assert(crc32c_data(buf, size) ==
+			    test_crc32_ref(0x82F63B78, buf, size));
+		crc = crc32c_data_more(crc32c_data(buf, split),
+				       buf + split, size - split);
+		test_assert(crc == crc32c_data(buf, size));
+	}
+	test_end();
+}
+
 void test_crc32(void)
 {
 	const char str[] = "foo\0bar";
@@ -10,5 +53,13 @@ void test_crc32(void)
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	test_assert(crc32_data("123456789", 9) == 0xcbf43926);
 	test_end();
+
+	test_begin("crc32c");
+	test_assert(crc32c_data("", 0) == 0);
+	test_assert(crc32c_data("123456789", 9) == 0xe3069283);
+	test_end();
+
+	test_crc32_random();
 }
@@ -29,19 +29,121 @@ static void test_hash_random_pool(pool_t pool)
 			keyidx--;
 		}
 	}
-	for (i = 0; i < keyidx; i++)
+	test_assert(hash_table_count(hash) == keyidx);
+	for (i = 0; i < keyidx; i++) {
+		test_assert(hash_table_lookup(hash, POINTER_CAST(keys[i])) != NULL);
 		hash_table_remove(hash, POINTER_CAST(keys[i]));
+	}
+	test_assert(hash_table_count(hash) == 0);
 	hash_table_destroy(&hash);
 	i_free(keys);
 }
 
+static void test_hash_iterate_modify(void)
+{
+#define ITER_KEYMAX 1000
+	HASH_TABLE(void *, void *) hash;
+	struct hash_iterate_context *iter;
+	unsigned char seen[ITER_KEYMAX+1];
+	void *key, *value;
+	unsigned int i, count = 0;
+
+	test_begin("hash iterate with modifications");
+	memset(seen, 0, sizeof(seen));
+	hash_table_create_direct(&hash, default_pool, 0);
+	for (i = 1; i <= ITER_KEYMAX; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		test_assert(i == POINTER_CAST_TO(value, unsigned int));
+		if (i > ITER_KEYMAX) {
+			/* added during iteration */
+			continue;
+		}
+		test_assert(seen[i] == 0);
+		seen[i]++;
+		count++;
+		/* removing the next key makes it skipped, while adding new
+		   keys grows the table */
+		if (i % 2 == 1 && i < ITER_KEYMAX)
+			hash_table_remove(hash, POINTER_CAST(i+1));
+		hash_table_insert(hash, POINTER_CAST(i + ITER_KEYMAX*2),
+				  POINTER_CAST(i + ITER_KEYMAX*2));
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(count == ITER_KEYMAX/2);
+	test_assert(hash_table_count(hash) == ITER_KEYMAX/2 + count);
+	for (i = 1; i <= ITER_KEYMAX; i++) {
+		test_assert_idx((hash_table_lookup(hash, POINTER_CAST(i)) != NULL) ==
+				(i % 2 == 1), i);
+	}
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_update_clear(void)
+{
+	HASH_TABLE(const char *, const char *) hash;
+	const char *key1 = "foo", *key2 = "bar", *value1 = "1", *value2 = "2";
+	const char *orig_key, *value;
+
+	test_begin("hash update and clear");
+	hash_table_create(&hash, default_pool, 0, str_hash, strcmp);
+	hash_table_insert(hash, key1, value1);
+	hash_table_update(hash, t_strdup(key1), value2);
+	test_assert(hash_table_count(hash) == 1);
+	test_assert(hash_table_lookup_full(hash, key1, &orig_key, &value));
+	test_assert(orig_key == key1);
+	test_assert(value == value2);
+	test_assert(hash_table_lookup(hash, key2) == NULL);
+	test_assert(!hash_table_try_remove(hash, key2));
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, key1) == NULL);
+	hash_table_insert(hash, key2, value1);
+	test_assert(hash_table_lookup(hash, key2) == value1);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_functions(void)
+{
+	static const char *strings[] = {
+		"", "a", "abcdefg", "abcdefgh", "abcdefghi",
+		"abcdefghijklmnopqrstuvwxyz0123456789"
+	};
+	unsigned int i;
+
+	test_begin("hash functions");
+	for (i = 0; i < N_ELEMENTS(strings); i++) {
+		test_assert_idx(str_hash(strings[i]) ==
+				mem_hash(strings[i], strlen(strings[i])), i);
+		test_assert_idx(strcase_hash(strings[i]) ==
+				str_hash(t_str_ucase(strings[i])), i);
+		test_assert_idx(strcase_hash(t_str_ucase(strings[i])) ==
+				strcase_hash(strings[i]), i);
+	}
+	test_assert(str_hash("abcdefgh") != str_hash("abcdefgi"));
+	test_assert(str_hash("a") != str_hash("b"));
+	test_end();
+}
+
 void test_hash(void)
 {
 	pool_t pool;
 
+	test_begin("hash random");
 	test_hash_random_pool(default_pool);
 
 	pool = pool_alloconly_create("test hash", 1024);
 	test_hash_random_pool(pool);
 	pool_unref(&pool);
+	test_end();
+
+	test_hash_iterate_modify();
+	test_hash_update_clear();
+	test_hash_functions();
 }
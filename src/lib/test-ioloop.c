@@ -2,10 +2,14 @@
 
 #include "test-lib.h"
 #include "net.h"
+#include "str.h"
 #include "time-util.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
 #include "ioloop.h"
 
 #include <unistd.h>
+#include <sys/wait.h>
 
 static void timeout_callback(struct timeval *tv)
 {
@@ -98,8 +102,284 @@ static void test_ioloop_find_fd_conditions(void)
 	test_end();
 }
 
+#define TEST_IOLOOP_STATS_FD_COUNT 200
+struct test_ioloop_stats_fd {
+	int fd[2];
+	struct io *io;
+	unsigned int *read_count;
+};
+
+static void io_stats_callback(struct test_ioloop_stats_fd *sfd)
+{
+	char c;
+
+	if (read(sfd->fd[0], &c, 1) == 1)
+		(*sfd->read_count)++;
+	io_remove(&sfd->io);
+}
+
+static void timeout_stats_callback(unsigned int *read_count)
+{
+	if (*read_count == TEST_IOLOOP_STATS_FD_COUNT)
+		io_loop_stop(current_ioloop);
+}
+
+static void test_ioloop_stats(void)
+{
+	struct test_ioloop_stats_fd *fds;
+	struct ioloop *ioloop;
+	struct ioloop_stats stats;
+	struct timeout *to;
+	unsigned int i, read_count = 0;
+
+	test_begin("ioloop stats");
+	fds = i_new(struct test_ioloop_stats_fd, TEST_IOLOOP_STATS_FD_COUNT);
+	ioloop = io_loop_create();
+	/* use more fds than the initial size of the events array, so that
+	   the ioloop needs multiple wakeups or a larger array */
+	for (i = 0; i < TEST_IOLOOP_STATS_FD_COUNT; i++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i].fd) < 0)
+			i_fatal("socketpair() failed: %m");
+		fds[i].read_count = &read_count;
+		fds[i].io = io_add(fds[i].fd[0], IO_READ,
+				   io_stats_callback, &fds[i]);
+		if (write(fds[i].fd[1], "x", 1) != 1)
+			i_fatal("write() failed: %m");
+	}
+	to = timeout_add_short(1, timeout_stats_callback, &read_count);
+	io_loop_run(ioloop);
+	io_loop_get_stats(ioloop, &stats);
+
+	test_assert(read_count == TEST_IOLOOP_STATS_FD_COUNT);
+	test_assert(stats.io_calls == TEST_IOLOOP_STATS_FD_COUNT);
+	test_assert(stats.events >= TEST_IOLOOP_STATS_FD_COUNT);
+	test_assert(stats.wakeups > 0);
+	test_assert(stats.timeout_calls > 0);
+
+	timeout_remove(&to);
+	for (i = 0; i < TEST_IOLOOP_STATS_FD_COUNT; i++) {
+		i_close_fd(&fds[i].fd[0]);
+		i_close_fd(&fds[i].fd[1]);
+	}
+	io_loop_destroy(&ioloop);
+	i_free(fds);
+	test_end();
+}
+
+#define TEST_IOLOOP_ASYNC_READ_COUNT 100
+struct test_ioloop_async {
+	int fd;
+	unsigned int read_count;
+	char read_buf[TEST_IOLOOP_ASYNC_READ_COUNT];
+	bool fsynced;
+};
+
+static void async_fsync_callback(ssize_t ret, struct test_ioloop_async *ctx)
+{
+	test_assert(ret == 0);
+	ctx->fsynced = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void async_read_callback(ssize_t ret, struct test_ioloop_async *ctx)
+{
+	test_assert(ret == 1);
+	if (++ctx->read_count == TEST_IOLOOP_ASYNC_READ_COUNT)
+		(void)io_async_fsync(ctx->fd, TRUE, async_fsync_callback, ctx);
+}
+
+static void async_write_callback(ssize_t ret, struct test_ioloop_async *ctx)
+{
+	unsigned int i;
+
+	test_assert(ret == 11);
+	/* more reads than can be submitted to the kernel at once */
+	for (i = 0; i < TEST_IOLOOP_ASYNC_READ_COUNT; i++) {
+		(void)io_async_pread(ctx->fd, &ctx->read_buf[i], 1, i % 11,
+				     async_read_callback, ctx);
+	}
+}
+
+static void async_unexpected_callback(ssize_t ret ATTR_UNUSED,
+				      struct test_ioloop_async *ctx ATTR_UNUSED)
+{
+	test_assert(FALSE);
+}
+
+static void test_ioloop_async_file(void)
+{
+	static const struct const_iovec iov[] = {
+		{ "hello ", 6 }, { "world", 5 }
+	};
+	struct test_ioloop_async ctx;
+	struct ioloop *ioloop;
+	struct io_async *async;
+	string_t *path = t_str_new(128);
+	char buf[11];
+	unsigned int i;
+
+	test_begin("ioloop async file");
+	memset(&ctx, 0, sizeof(ctx));
+	str_append(path, ".test-ioloop.");
+	ctx.fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (ctx.fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+
+	ioloop = io_loop_create();
+	/* aborted operations don't call the callback */
+	async = io_async_pread(ctx.fd, buf, sizeof(buf), 0,
+			       async_unexpected_callback, &ctx);
+	io_async_abort(&async);
+
+	(void)io_async_pwritev(ctx.fd, iov, N_ELEMENTS(iov), 0,
+			       async_write_callback, &ctx);
+	io_loop_run(ioloop);
+	io_loop_destroy(&ioloop);
+
+	test_assert(ctx.fsynced);
+	test_assert(ctx.read_count == TEST_IOLOOP_ASYNC_READ_COUNT);
+	for (i = 0; i < TEST_IOLOOP_ASYNC_READ_COUNT; i++)
+		test_assert_idx(ctx.read_buf[i] == "hello world"[i % 11], i);
+	i_close_fd(&ctx.fd);
+	test_end();
+}
+
+static void async_count_callback(ssize_t ret, unsigned int *count)
+{
+	test_assert(ret == 5 || (ret < 0 && errno == ECANCELED));
+	*count += 1;
+}
+
+static int async_restart_fd;
+static char async_restart_buf[5];
+
+static void async_restart_callback(ssize_t ret, unsigned int *count)
+{
+	async_count_callback(ret, count);
+	/* starting a new operation while the ioloop is being destroyed */
+	(void)io_async_pread(async_restart_fd, async_restart_buf,
+			     sizeof(async_restart_buf), 0,
+			     async_count_callback, count);
+}
+
+static void test_ioloop_async_wait(void)
+{
+	struct ioloop *ioloop;
+	struct io_async *async;
+	string_t *path = t_str_new(128);
+	char *abort_buf, buf[5];
+	unsigned int count = 0;
+	int fd;
+
+	test_begin("ioloop async wait");
+	str_append(path, ".test-ioloop.");
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	if (write_full(fd, "hello", 5) < 0)
+		i_fatal("write(%s) failed: %m", str_c(path));
+
+	ioloop = io_loop_create();
+	/* waiting calls the callback immediately */
+	async = io_async_pread(fd, buf, sizeof(buf), 0,
+			       async_count_callback, &count);
+	io_async_wait(async);
+	test_assert(count == 1);
+	test_assert(memcmp(buf, "hello", 5) == 0);
+
+	/* the buffer can be freed immediately after aborting, even if the
+	   kernel is still reading into its own copy */
+	abort_buf = i_malloc(5);
+	async = io_async_pread(fd, abort_buf, 5, 0,
+			       async_count_callback, &count);
+	io_async_abort(&async);
+	i_free(abort_buf);
+
+	/* operations still running are finished when the ioloop is
+	   destroyed. the aborted one's callback isn't called. */
+	(void)io_async_pread(fd, buf, sizeof(buf), 0,
+			     async_count_callback, &count);
+	(void)io_async_pread(fd, buf, sizeof(buf), 0,
+			     async_count_callback, &count);
+	io_loop_destroy(&ioloop);
+	test_assert(count == 3);
+
+	/* operations started by the callbacks while the ioloop is being
+	   destroyed are finished as well */
+	ioloop = io_loop_create();
+	async_restart_fd = fd;
+	(void)io_async_pread(fd, buf, sizeof(buf), 0,
+			     async_restart_callback, &count);
+	io_loop_destroy(&ioloop);
+	test_assert(count == 5);
+	i_close_fd(&fd);
+	test_end();
+}
+
+static void async_fork_callback(ssize_t ret, ssize_t *ret_r)
+{
+	*ret_r = ret < 0 ? -errno : ret;
+}
+
+static void test_ioloop_async_fork(void)
+{
+	struct ioloop *ioloop;
+	struct io_async *async;
+	string_t *path = t_str_new(128);
+	char buf[5], child_buf[5];
+	ssize_t ret = 0, child_ret = 0;
+	bool child_ok;
+	pid_t pid;
+	int fd, status;
+
+	test_begin("ioloop async fork");
+	str_append(path, ".test-ioloop.");
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	if (write_full(fd, "hello", 5) < 0)
+		i_fatal("write(%s) failed: %m", str_c(path));
+
+	ioloop = io_loop_create();
+	async = io_async_pread(fd, buf, sizeof(buf), 0,
+			       async_fork_callback, &ret);
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		/* the parent's operation can't be finished here, but waiting
+		   for it must not hang or steal the parent's completion */
+		io_async_wait(async);
+		child_ok = child_ret == 0 && (ret == 5 || ret == -ECANCELED);
+		/* new operations don't use the parent's ring */
+		child_ok = child_ok && !io_async_is_native();
+		async = io_async_pread(fd, child_buf, sizeof(child_buf), 0,
+				       async_fork_callback, &child_ret);
+		io_async_wait(async);
+		child_ok = child_ok && child_ret == 5 &&
+			memcmp(child_buf, "hello", 5) == 0;
+		io_loop_destroy(&ioloop);
+		_exit(child_ok ? 0 : 1);
+	}
+	if (waitpid(pid, &status, 0) < 0)
+		i_fatal("waitpid() failed: %m");
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+	io_async_wait(async);
+	test_assert(ret == 5 && memcmp(buf, "hello", 5) == 0);
+	io_loop_destroy(&ioloop);
+	i_close_fd(&fd);
+	test_end();
+}
+
 void test_ioloop(void)
 {
 	test_ioloop_timeout();
 	test_ioloop_find_fd_conditions();
+	test_ioloop_stats();
+	test_ioloop_async_file();
+	test_ioloop_async_wait();
+	test_ioloop_async_fork();
 }
@@ -0,0 +1,195 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "net.h"
+#include "istream.h"
+#include "istream-ktls.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_LINUX_TLS_H
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#  define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#  define TCP_ULP 31
+#endif
+
+static bool test_ktls_set_key(int fd, int optname)
+{
+	struct tls12_crypto_info_aes_gcm_128 info;
+
+	memset(&info, 0, sizeof(info));
+	info.info.version = TLS_1_2_VERSION;
+	info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+	memset(info.key, 0x42, sizeof(info.key));
+	memset(info.salt, 0x43, sizeof(info.salt));
+
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0)
+		return FALSE;
+	return setsockopt(fd, SOL_TLS, optname, &info, sizeof(info)) == 0;
+}
+
+/* Returns FALSE if kernel TLS isn't available. */
+static bool test_ktls_socketpair(int fds[2])
+{
+	struct ip_addr ip;
+	in_port_t port = 0;
+	int listen_fd;
+
+	if (net_addr2ip("127.0.0.1", &ip) < 0)
+		i_unreached();
+	listen_fd = net_listen(&ip, &port, 1);
+	if (listen_fd == -1)
+		i_fatal("net_listen() failed: %m");
+	fds[0] = net_connect_ip_blocking(&ip, port, NULL);
+	if (fds[0] == -1)
+		i_fatal("net_connect_ip_blocking() failed: %m");
+	if ((fds[1] = net_accept(listen_fd, NULL, NULL)) < 0)
+		i_fatal("net_accept() failed: %m");
+	i_close_fd(&listen_fd);
+	/* the client fds are non-blocking by default */
+	net_set_nonblock(fds[1], FALSE);
+
+	if (!test_ktls_set_key(fds[0], TLS_TX) ||
+	    !test_ktls_set_key(fds[1], TLS_RX)) {
+		i_close_fd(&fds[0]);
+		i_close_fd(&fds[1]);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+test_ktls_send_record(int fd, unsigned char record_type,
+		      const void *data, size_t size)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsg_buf;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &cmsg_buf;
+	msg.msg_controllen = sizeof(cmsg_buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cmsg) = record_type;
+	if (sendmsg(fd, &msg, 0) != (ssize_t)size)
+		i_fatal("sendmsg() failed: %m");
+}
+
+static void test_istream_ktls_records(void)
+{
+	static const unsigned char new_session_ticket[] = { 4, 0, 0, 0 };
+	static const unsigned char close_notify[] = { 1, 0 };
+	static const unsigned char fatal_alert[] = { 2, 40 };
+	static const unsigned char key_update[] = { 24, 0, 0, 1, 0 };
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int fds[2];
+
+	test_begin("istream ktls records");
+	if (!test_ktls_socketpair(fds)) {
+		/* kernel doesn't support kTLS */
+		test_end();
+		return;
+	}
+	if (write(fds[0], "hello", 5) != 5)
+		i_fatal("write() failed: %m");
+	if (write(fds[0], "world", 5) != 5)
+		i_fatal("write() failed: %m");
+	test_ktls_send_record(fds[0], 21, close_notify, sizeof(close_notify));
+
+	input = i_stream_create_ktls(fds[1], 1024);
+	while (i_stream_read(input) > 0) ;
+	data = i_stream_get_data(input, &size);
+	test_assert(size == 10 && memcmp(data, "helloworld", 10) == 0);
+	test_assert(input->eof && input->stream_errno == 0);
+	i_stream_unref(&input);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	/* fatal alert */
+	if (!test_ktls_socketpair(fds))
+		i_unreached();
+	test_ktls_send_record(fds[0], 21, fatal_alert, sizeof(fatal_alert));
+	input = i_stream_create_ktls(fds[1], 1024);
+	test_assert(i_stream_read(input) == -1);
+	test_assert(input->stream_errno == EPROTO);
+	i_stream_unref(&input);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	/* other handshake messages fail as well, instead of leaving the
+	   client waiting for a reply */
+	if (!test_ktls_socketpair(fds))
+		i_unreached();
+	test_ktls_send_record(fds[0], 22, new_session_ticket,
+			      sizeof(new_session_ticket));
+	input = i_stream_create_ktls(fds[1], 1024);
+	test_assert(i_stream_read(input) == -1);
+	test_assert(input->stream_errno == EPROTO);
+	i_stream_unref(&input);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+
+	/* KeyUpdate can't be handled */
+	if (!test_ktls_socketpair(fds))
+		i_unreached();
+	test_ktls_send_record(fds[0], 22, key_update, sizeof(key_update));
+	input = i_stream_create_ktls(fds[1], 1024);
+	test_assert(i_stream_read(input) == -1);
+	test_assert(input->stream_errno == EPROTO);
+	i_stream_unref(&input);
+	i_close_fd(&fds[0]);
+	i_close_fd(&fds[1]);
+	test_end();
+}
+#endif
+
+static void test_istream_ktls_plain(void)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int fds[2];
+
+	test_begin("istream ktls without kernel TLS");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+		i_fatal("socketpair() failed: %m");
+	if (write(fds[0], "hello", 5) != 5)
+		i_fatal("write() failed: %m");
+	i_close_fd(&fds[0]);
+
+	input = i_stream_create_ktls(fds[1], 1024);
+	while (i_stream_read(input) > 0) ;
+	data = i_stream_get_data(input, &size);
+	test_assert(size == 5 && memcmp(data, "hello", 5) == 0);
+	test_assert(input->eof && input->stream_errno == 0);
+	i_stream_unref(&input);
+	i_close_fd(&fds[1]);
+	test_end();
+}
+
+void test_istream_ktls(void)
+{
+	test_istream_ktls_plain();
+#ifdef HAVE_LINUX_TLS_H
+	test_istream_ktls_records();
+#endif
+}
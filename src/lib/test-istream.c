@@ -1,7 +1,13 @@
 /* Copyright (c) 2014-2016 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
-#include "istream.h"
+#include "str.h"
+#include "ioloop.h"
+#include "safe-mkstemp.h"
+#include "write-full.h"
+#include "istream-file-private.h"
+
+#include <unistd.h>
 
 static void test_istream_children(void)
 {
@@ -56,7 +62,96 @@ static void test_istream_children(void)
 	test_end();
 }
 
+#define TEST_ISTREAM_FILE_SIZE (64*1024)
+#define TEST_ISTREAM_FILE_BUFFER_SIZE 1024
+
+static void test_istream_file_readahead(void)
+{
+	struct ioloop *ioloop;
+	struct istream *input;
+	struct file_istream *fstream;
+	string_t *path = t_str_new(128);
+	unsigned char *buf;
+	const unsigned char *data;
+	size_t size;
+	uoff_t offset;
+	bool readahead_seen = FALSE;
+	unsigned int i;
+	int fd;
+
+	test_begin("istream file readahead");
+	str_append(path, ".test-istream.");
+	fd = safe_mkstemp(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1)
+		i_fatal("safe_mkstemp(%s) failed: %m", str_c(path));
+	i_unlink(str_c(path));
+	buf = i_malloc(TEST_ISTREAM_FILE_SIZE);
+	for (i = 0; i < TEST_ISTREAM_FILE_SIZE; i++)
+		buf[i] = i % 251;
+	if (write_full(fd, buf, TEST_ISTREAM_FILE_SIZE) < 0)
+		i_fatal("write(%s) failed: %m", str_c(path));
+
+	ioloop = io_loop_create();
+	input = i_stream_create_fd(fd, TEST_ISTREAM_FILE_BUFFER_SIZE);
+	fstream = (struct file_istream *)input->real_stream;
+
+	/* no readahead unless it's enabled */
+	while (i_stream_read_data(input, &data, &size, 0) > 0) {
+		i_stream_skip(input, size);
+		test_assert(fstream->readahead == NULL &&
+			    !fstream->readahead_finished);
+	}
+	i_stream_seek(input, 0);
+	i_stream_set_async_readahead(input, TRUE);
+
+	/* sequential reads get the correct data, whether they came from
+	   the readahead or not */
+	offset = 0;
+	while (i_stream_read_data(input, &data, &size, 0) > 0) {
+		test_assert(memcmp(data, buf + offset, size) == 0);
+		offset += size;
+		i_stream_skip(input, size);
+		if (fstream->readahead != NULL || fstream->readahead_finished)
+			readahead_seen = TRUE;
+	}
+	test_assert(input->stream_errno == 0);
+	test_assert(offset == TEST_ISTREAM_FILE_SIZE);
+	test_assert(readahead_seen == io_async_is_native());
+
+	/* seeking away from the readahead offset */
+	i_stream_seek(input, 0);
+	for (i = 0; i < 4; i++) {
+		test_assert(i_stream_read_data(input, &data, &size, 0) > 0);
+		i_stream_skip(input, size);
+	}
+	i_stream_seek(input, 100);
+	test_assert(i_stream_read_data(input, &data, &size, 0) > 0);
+	test_assert(memcmp(data, buf + 100, size) == 0);
+
+	/* file changing after sync isn't hidden by the readahead */
+	i_stream_seek(input, 0);
+	for (i = 0; i < 4; i++) {
+		test_assert(i_stream_read_data(input, &data, &size, 0) > 0);
+		i_stream_skip(input, size);
+	}
+	offset = input->v_offset;
+	memset(buf + offset, 'x', TEST_ISTREAM_FILE_BUFFER_SIZE);
+	if (pwrite(fd, buf + offset, TEST_ISTREAM_FILE_BUFFER_SIZE,
+		   offset) != TEST_ISTREAM_FILE_BUFFER_SIZE)
+		i_fatal("pwrite(%s) failed: %m", str_c(path));
+	i_stream_sync(input);
+	test_assert(i_stream_read_data(input, &data, &size, 0) > 0);
+	test_assert(data[0] == 'x' && memcmp(data, buf + offset, size) == 0);
+
+	/* destroying with a pending readahead */
+	i_stream_destroy(&input);
+	io_loop_destroy(&ioloop);
+	i_free(buf);
+	test_end();
+}
+
 void test_istream(void)
 {
 	test_istream_children();
+	test_istream_file_readahead();
 }
@@ -30,6 +30,7 @@ int main(void)
 		test_istream_concat,
 		test_istream_crlf,
 		test_istream_failure_at,
+		test_istream_ktls,
 		test_istream_seekable,
 		test_istream_tee,
 		test_istream_unix,
@@ -37,6 +38,7 @@ int main(void)
 		test_json_tree,
 		test_llist,
 		test_mempool_alloconly,
+		test_mempool_slab,
 		test_net,
 		test_numpack,
 		test_pkcs5_pbkdf2,
@@ -56,10 +58,12 @@ int main(void)
 		test_str_table,
 		test_time_util,
 		test_timing,
+		test_timing_wheel,
 		test_unichar,
 		test_utc_mktime,
 		test_var_expand,
 		test_wildcard_match,
+		test_xxh64,
 		NULL
 	};
 	static enum fatal_test_state (*fatal_functions[])(int) = {
@@ -31,6 +31,7 @@ void test_istream_chain(void);
 void test_istream_concat(void);
 void test_istream_crlf(void);
 void test_istream_failure_at(void);
+void test_istream_ktls(void);
 void test_istream_seekable(void);
 void test_istream_tee(void);
 void test_istream_unix(void);
@@ -38,6 +39,7 @@ void test_json_parser(void);
 void test_json_tree(void);
 void test_llist(void);
 void test_mempool_alloconly(void);
+void test_mempool_slab(void);
 enum fatal_test_state fatal_mempool(int);
 void test_pkcs5_pbkdf2(void);
 void test_net(void);
@@ -59,9 +61,11 @@ void test_str_sanitize(void);
 void test_str_table(void);
 void test_time_util(void);
 void test_timing(void);
+void test_timing_wheel(void);
 void test_unichar(void);
 void test_utc_mktime(void);
 void test_var_expand(void);
 void test_wildcard_match(void);
+void test_xxh64(void);
 
 #endif
@@ -0,0 +1,132 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc(void)
+{
+#define SLAB_TEST_COUNT 2000
+	struct pool_slab_stats stats;
+	unsigned char *mem[SLAB_TEST_COUNT];
+	size_t sizes[SLAB_TEST_COUNT];
+	unsigned int i, n, alloc_count = 0;
+	pool_t pool;
+
+	test_begin("mempool slab alloc");
+	pool = pool_slab_create("test", 0);
+	memset(mem, 0, sizeof(mem));
+	memset(sizes, 0, sizeof(sizes));
+	for (n = 0; n < 20000; n++) {
+		i = (unsigned int)rand() % SLAB_TEST_COUNT;
+		if (mem[i] != NULL) {
+			test_assert(mem_has_bytes(mem[i], sizes[i], i & 0xff));
+			p_free(pool, mem[i]);
+			alloc_count--;
+		}
+		if (rand() % 10 == 0) {
+			/* leave some slots empty */
+			continue;
+		}
+		/* mostly small allocations, sometimes large ones */
+		sizes[i] = rand() % 50 == 0 ? (size_t)(rand() % 20000 + 1) :
+			(size_t)(rand() % 300 + 1);
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert(mem_has_bytes(mem[i], sizes[i], 0));
+		memset(mem[i], i & 0xff, sizes[i]);
+		alloc_count++;
+	}
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.alloc_count == alloc_count);
+	test_assert(stats.slab_bytes >= stats.alloc_bytes);
+
+	for (i = 0; i < SLAB_TEST_COUNT; i++) {
+		if (mem[i] == NULL)
+			continue;
+		test_assert(mem_has_bytes(mem[i], sizes[i], i & 0xff));
+		p_free(pool, mem[i]);
+	}
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.alloc_count == 0 && stats.alloc_bytes == 0);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	unsigned char *mem, *mem2;
+	pool_t pool;
+
+	test_begin("mempool slab realloc");
+	pool = pool_slab_create("test", 0);
+	mem = p_malloc(pool, 10);
+	memset(mem, 'x', 10);
+	/* still fits to the same size class */
+	mem2 = p_realloc(pool, mem, 10, 16);
+	test_assert(mem2 == mem);
+	test_assert(mem_has_bytes(mem, 10, 'x'));
+	test_assert(mem_has_bytes(mem + 10, 6, 0));
+
+	mem = p_realloc(pool, mem2, 16, 1000);
+	test_assert(mem_has_bytes(mem, 10, 'x'));
+	test_assert(mem_has_bytes(mem + 10, 990, 0));
+	memset(mem, 'y', 1000);
+
+	/* grow to a large allocation */
+	mem = p_realloc(pool, mem, 1000, 100000);
+	test_assert(mem_has_bytes(mem, 1000, 'y'));
+	test_assert(mem_has_bytes(mem + 1000, 99000, 0));
+	p_free(pool, mem);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_release(void)
+{
+#define SLAB_RELEASE_COUNT 10000
+	struct pool_slab_stats stats;
+	void *mem[SLAB_RELEASE_COUNT];
+	unsigned int i;
+	pool_t pool;
+
+	test_begin("mempool slab release empty");
+	pool = pool_slab_create("test", POOL_SLAB_FLAG_RELEASE_EMPTY);
+	for (i = 0; i < SLAB_RELEASE_COUNT; i++)
+		mem[i] = p_malloc(pool, 64);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count > 2);
+	test_assert(stats.released_slab_count == 0);
+
+	for (i = 0; i < SLAB_RELEASE_COUNT; i++)
+		p_free(pool, mem[i]);
+	/* only the last slab is kept */
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 1);
+	test_assert(stats.released_slab_count > 0);
+
+	/* p_clear() frees everything */
+	for (i = 0; i < 100; i++)
+		mem[i] = p_malloc(pool, i + 1);
+	p_clear(pool);
+	pool_slab_get_stats(pool, &stats);
+	test_assert(stats.slab_count == 0 && stats.alloc_count == 0);
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc();
+	test_mempool_slab_realloc();
+	test_mempool_slab_release();
+}
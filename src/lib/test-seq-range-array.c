@@ -234,6 +234,104 @@ static void test_seq_range_array_have_common(void)
 	test_out("seq_range_array_have_common()", success);
 }
 
+static bool test_seq_range_array_equals(ARRAY_TYPE(seq_range) *array,
+					uint8_t byte)
+{
+	ARRAY_TYPE(seq_range) expected;
+	const struct seq_range *range1, *range2;
+	unsigned int i, count1, count2;
+
+	t_array_init(&expected, 8);
+	test_seq_range_create(&expected, byte);
+	range1 = array_get(array, &count1);
+	range2 = array_get(&expected, &count2);
+	if (count1 != count2)
+		return FALSE;
+	for (i = 0; i < count1; i++) {
+		if (range1[i].seq1 != range2[i].seq1 ||
+		    range1[i].seq2 != range2[i].seq2)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static unsigned int test_bit_count(uint8_t byte)
+{
+	unsigned int count = 0;
+
+	for (; byte != 0; byte >>= 1)
+		count += byte & 1;
+	return count;
+}
+
+static void test_seq_range_array_set_ops(void)
+{
+	ARRAY_TYPE(seq_range) arr1, arr2;
+	unsigned int i, j, ret;
+	bool merge_success = TRUE, intersect_success = TRUE;
+	bool remove_success = TRUE;
+
+	t_array_init(&arr1, 8);
+	t_array_init(&arr2, 8);
+	for (i = 0; i < 256; i++) {
+		for (j = 0; j < 256; j++) {
+			test_seq_range_create(&arr2, j);
+
+			test_seq_range_create(&arr1, i);
+			seq_range_array_merge(&arr1, &arr2);
+			if (!test_seq_range_array_equals(&arr1, i | j))
+				merge_success = FALSE;
+
+			test_seq_range_create(&arr1, i);
+			ret = seq_range_array_intersect(&arr1, &arr2);
+			if (!test_seq_range_array_equals(&arr1, i & j) ||
+			    ret != test_bit_count(i & ~j))
+				intersect_success = FALSE;
+
+			test_seq_range_create(&arr1, i);
+			ret = seq_range_array_remove_seq_range(&arr1, &arr2);
+			if (!test_seq_range_array_equals(&arr1, i & ~j) ||
+			    ret != test_bit_count(i & j))
+				remove_success = FALSE;
+		}
+	}
+	test_out("seq_range_array_merge()", merge_success);
+	test_out("seq_range_array_intersect()", intersect_success);
+	test_out("seq_range_array_remove_seq_range()", remove_success);
+}
+
+static void test_seq_range_array_set_ops_datastack(void)
+{
+	ARRAY_TYPE(seq_range) dest, src;
+	unsigned int i;
+
+	test_begin("seq_range_array set ops with growing data stack dest");
+	t_array_init(&src, 1);
+	for (i = 1; i < 1000; i += 2)
+		seq_range_array_add(&src, i);
+
+	t_array_init(&dest, 1);
+	seq_range_array_add(&dest, 1000);
+	seq_range_array_merge(&dest, &src);
+	test_assert(array_count(&dest) == 500);
+	test_assert(seq_range_count(&dest) == 501);
+
+	t_array_init(&dest, 1);
+	seq_range_array_add_range(&dest, 1, 1000);
+	test_assert(seq_range_array_intersect(&dest, &src) == 500);
+	test_assert(array_count(&dest) == 500);
+	test_assert(seq_range_exists(&dest, 999));
+	test_assert(!seq_range_exists(&dest, 1000));
+
+	t_array_init(&dest, 1);
+	seq_range_array_add_range(&dest, 1, 1000);
+	test_assert(seq_range_array_remove_seq_range(&dest, &src) == 500);
+	test_assert(array_count(&dest) == 500);
+	test_assert(seq_range_exists(&dest, 1000));
+	test_assert(!seq_range_exists(&dest, 999));
+	test_end();
+}
+
 void test_seq_range_array(void)
 {
 	test_seq_range_array_add_boundaries();
@@ -241,5 +339,7 @@ void test_seq_range_array(void)
 	test_seq_range_array_remove_nth();
 	test_seq_range_array_invert();
 	test_seq_range_array_have_common();
+	test_seq_range_array_set_ops();
+	test_seq_range_array_set_ops_datastack();
 	test_seq_range_array_random();
 }
@@ -0,0 +1,134 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "timing-wheel.h"
+
+struct tw_test_item {
+	struct timing_wheel_item item;
+	bool added;
+};
+
+static uint64_t tw_min_expire(struct tw_test_item *items, unsigned int count)
+{
+	uint64_t min_expire = (uint64_t)-1;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (items[i].added && items[i].item.expire_msecs < min_expire)
+			min_expire = items[i].item.expire_msecs;
+	}
+	return min_expire;
+}
+
+static void test_timing_wheel_simple(void)
+{
+	struct tw_test_item items[3];
+	struct timing_wheel *wheel;
+	uint64_t next;
+
+	test_begin("timing wheel simple");
+	memset(items, 0, sizeof(items));
+	wheel = timing_wheel_init(1000);
+	test_assert(!timing_wheel_get_next(wheel, &next));
+	test_assert(timing_wheel_pop_expired(wheel, 2000) == NULL);
+
+	timing_wheel_add(wheel, &items[0].item, 2010);
+	timing_wheel_add(wheel, &items[1].item, 2005);
+	timing_wheel_add(wheel, &items[2].item, 100000000);
+	test_assert(timing_wheel_count(wheel) == 3);
+	test_assert(timing_wheel_get_next(wheel, &next) && next == 2005);
+	test_assert(timing_wheel_pop_expired(wheel, 2004) == NULL);
+	test_assert(timing_wheel_pop_expired(wheel, 2005) == &items[1].item);
+	test_assert(timing_wheel_pop_expired(wheel, 2005) == NULL);
+
+	timing_wheel_remove(wheel, &items[0].item);
+	test_assert(items[0].item.slot == 0);
+	test_assert(timing_wheel_get_next(wheel, &next) && next <= 100000000);
+	test_assert(timing_wheel_pop_expired(wheel, 99999999) == NULL);
+	test_assert(timing_wheel_get_next(wheel, &next) && next == 100000000);
+	test_assert(timing_wheel_pop_expired(wheel, 200000000) == &items[2].item);
+	test_assert(timing_wheel_pop_expired(wheel, 200000000) == NULL);
+	test_assert(timing_wheel_count(wheel) == 0);
+
+	/* already expired items are returned immediately */
+	timing_wheel_add(wheel, &items[0].item, 1);
+	test_assert(timing_wheel_get_next(wheel, &next) && next == 200000000);
+	test_assert(timing_wheel_pop_expired(wheel, 200000000) == &items[0].item);
+
+	/* time moving backwards */
+	timing_wheel_reset(wheel, 500);
+	timing_wheel_add(wheel, &items[0].item, 600);
+	test_assert(timing_wheel_pop_expired(wheel, 599) == NULL);
+	test_assert(timing_wheel_pop(wheel) == &items[0].item);
+	test_assert(timing_wheel_pop(wheel) == NULL);
+	timing_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timing_wheel_random(void)
+{
+#define TW_MAX_ITEMS 500
+	struct tw_test_item items[TW_MAX_ITEMS];
+	struct timing_wheel_item *item;
+	struct tw_test_item *titem;
+	struct timing_wheel *wheel;
+	uint64_t now, next, min_expire;
+	unsigned int i, n, idx, count = 0;
+
+	test_begin("timing wheel random");
+	memset(items, 0, sizeof(items));
+	now = 1452000000000ULL + rand() % 100000;
+	wheel = timing_wheel_init(now);
+	for (n = 0; n < 20000; n++) {
+		idx = rand() % TW_MAX_ITEMS;
+		switch (rand() % 4) {
+		case 0:
+		case 1:
+			if (items[idx].added)
+				timing_wheel_remove(wheel, &items[idx].item);
+			else
+				count++;
+			/* mostly short timeouts, but some very long ones */
+			timing_wheel_add(wheel, &items[idx].item, now +
+				(rand() % 10 == 0 ? (uint64_t)rand() * 1000 :
+				 (uint64_t)(rand() % 70000)));
+			items[idx].added = TRUE;
+			break;
+		case 2:
+			if (items[idx].added) {
+				timing_wheel_remove(wheel, &items[idx].item);
+				items[idx].added = FALSE;
+				count--;
+			}
+			break;
+		case 3:
+			min_expire = tw_min_expire(items, N_ELEMENTS(items));
+			if (count > 0) {
+				test_assert(timing_wheel_get_next(wheel, &next));
+				test_assert(next <= I_MAX(min_expire, now));
+			}
+			now += rand() % 5000;
+			while ((item = timing_wheel_pop_expired(wheel, now)) != NULL) {
+				titem = (struct tw_test_item *)item;
+				test_assert(titem->added);
+				test_assert(item->expire_msecs <= now);
+				titem->added = FALSE;
+				count--;
+			}
+			test_assert(tw_min_expire(items, N_ELEMENTS(items)) > now);
+			break;
+		}
+		test_assert(timing_wheel_count(wheel) == count);
+	}
+	for (i = 0; i < count; i++)
+		test_assert(timing_wheel_pop(wheel) != NULL);
+	test_assert(timing_wheel_pop(wheel) == NULL);
+	timing_wheel_deinit(&wheel);
+	test_end();
+}
+
+void test_timing_wheel(void)
+{
+	test_timing_wheel_simple();
+	test_timing_wheel_random();
+}
@@ -0,0 +1,50 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "xxh64.h"
+
+static void test_xxh64_vectors(void)
+{
+	static const char fox[] = "The quick brown fox jumps over the lazy dog";
+	unsigned char buf[1024];
+	unsigned int i;
+
+	test_begin("xxh64");
+	test_assert(xxh64_data("", 0, 0) == 0xef46db3751d8e999ULL);
+	test_assert(xxh64_data("a", 1, 0) == 0xd24ec4f1a98c6e5bULL);
+	test_assert(xxh64_data("abc", 3, 0) == 0x44bc2cf5ad770999ULL);
+	test_assert(xxh64_data(fox, strlen(fox), 0) == 0x0b242d361fda71bcULL);
+	test_assert(xxh64_data(fox, strlen(fox), 12345) == 0xd1b38ddc85a6fba1ULL);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i;
+	test_assert(xxh64_data(buf, sizeof(buf), 0) == 0x6f3914f18fe4df57ULL);
+	test_end();
+}
+
+static void test_xxh64_incremental(void)
+{
+	struct xxh64_context ctx;
+	unsigned char buf[300];
+	unsigned int i, n, pos, len;
+
+	test_begin("xxh64 incremental");
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+	for (n = 0; n < 100; n++) {
+		xxh64_init(&ctx, n);
+		for (pos = 0; pos < sizeof(buf); pos += len) {
+			len = rand() % 40;
+			len = I_MIN(len, sizeof(buf) - pos);
+			xxh64_update(&ctx, buf + pos, len);
+		}
+		test_assert(xxh64_final(&ctx) ==
+			    xxh64_data(buf, sizeof(buf), n));
+	}
+	test_end();
+}
+
+void test_xxh64(void)
+{
+	test_xxh64_vectors();
+	test_xxh64_incremental();
+}
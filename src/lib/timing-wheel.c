@@ -0,0 +1,240 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "bits.h"
+#include "timing-wheel.h"
+
+/* Each level has 64 slots, so a single 64bit integer can be used as a bitmap
+   of the used slots. An item is stored in the level of the highest 6 bit
+   group where its expire time differs from the wheel's current time, and in
+   the slot specified by the expire time's bits in that group. So level 0
+   contains the items expiring in the current 64 ms block, level 1 the items
+   expiring in the current 4096 ms block, etc. When the current time reaches
+   a higher level slot, its items are moved to the lower levels. */
+#define TIMING_WHEEL_SLOT_BITS 6
+#define TIMING_WHEEL_SLOT_COUNT (1 << TIMING_WHEEL_SLOT_BITS)
+#define TIMING_WHEEL_LEVELS \
+	((64 + TIMING_WHEEL_SLOT_BITS - 1) / TIMING_WHEEL_SLOT_BITS)
+
+struct timing_wheel {
+	/* Current time. All items expiring before it have been returned. */
+	uint64_t now_msecs;
+	unsigned int count;
+
+	uint64_t used_slots[TIMING_WHEEL_LEVELS];
+	struct timing_wheel_item *
+		slots[TIMING_WHEEL_LEVELS][TIMING_WHEEL_SLOT_COUNT];
+};
+
+static inline unsigned int
+timing_wheel_slot_idx(uint64_t msecs, unsigned int level)
+{
+	return (msecs >> (level * TIMING_WHEEL_SLOT_BITS)) &
+		(TIMING_WHEEL_SLOT_COUNT - 1);
+}
+
+struct timing_wheel *timing_wheel_init(uint64_t now_msecs)
+{
+	struct timing_wheel *wheel;
+
+	wheel = i_new(struct timing_wheel, 1);
+	wheel->now_msecs = now_msecs;
+	return wheel;
+}
+
+void timing_wheel_deinit(struct timing_wheel **_wheel)
+{
+	struct timing_wheel *wheel = *_wheel;
+
+	*_wheel = NULL;
+	i_free(wheel);
+}
+
+unsigned int timing_wheel_count(const struct timing_wheel *wheel)
+{
+	return wheel->count;
+}
+
+static void
+timing_wheel_link(struct timing_wheel *wheel, struct timing_wheel_item *item)
+{
+	struct timing_wheel_item **list;
+	unsigned int level, idx;
+
+	if (item->expire_msecs <= wheel->now_msecs) {
+		/* already expired - return it as soon as possible */
+		level = 0;
+		idx = timing_wheel_slot_idx(wheel->now_msecs, 0);
+	} else {
+		level = (bits_required64(item->expire_msecs ^
+					 wheel->now_msecs) - 1) /
+			TIMING_WHEEL_SLOT_BITS;
+		idx = timing_wheel_slot_idx(item->expire_msecs, level);
+	}
+
+	list = &wheel->slots[level][idx];
+	item->prev = NULL;
+	item->next = *list;
+	if (*list != NULL)
+		(*list)->prev = item;
+	*list = item;
+
+	wheel->used_slots[level] |= 1ULL << idx;
+	item->slot = level * TIMING_WHEEL_SLOT_COUNT + idx + 1;
+}
+
+void timing_wheel_add(struct timing_wheel *wheel,
+		      struct timing_wheel_item *item, uint64_t expire_msecs)
+{
+	i_assert(item->slot == 0);
+
+	item->expire_msecs = expire_msecs;
+	timing_wheel_link(wheel, item);
+	wheel->count++;
+}
+
+void timing_wheel_remove(struct timing_wheel *wheel,
+			 struct timing_wheel_item *item)
+{
+	unsigned int level, idx;
+
+	i_assert(item->slot > 0);
+	i_assert(wheel->count > 0);
+
+	level = (item->slot - 1) / TIMING_WHEEL_SLOT_COUNT;
+	idx = (item->slot - 1) % TIMING_WHEEL_SLOT_COUNT;
+
+	if (item->prev != NULL)
+		item->prev->next = item->next;
+	else {
+		i_assert(wheel->slots[level][idx] == item);
+		wheel->slots[level][idx] = item->next;
+		if (item->next == NULL)
+			wheel->used_slots[level] &= ~(1ULL << idx);
+	}
+	if (item->next != NULL)
+		item->next->prev = item->prev;
+
+	item->prev = item->next = NULL;
+	item->slot = 0;
+	wheel->count--;
+}
+
+static bool
+timing_wheel_find_next(struct timing_wheel *wheel,
+		       unsigned int *level_r, uint64_t *msecs_r)
+{
+	unsigned int level, shift, idx;
+	uint64_t mask, msecs;
+
+	/* the items in the lowest used level always expire before the items
+	   in the higher levels. */
+	for (level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+		mask = wheel->used_slots[level] &
+			(~0ULL << timing_wheel_slot_idx(wheel->now_msecs, level));
+		if (mask == 0)
+			continue;
+
+		idx = bits_required64(mask & (~mask + 1)) - 1;
+		i_assert(level == 0 ||
+			 idx > timing_wheel_slot_idx(wheel->now_msecs, level));
+
+		/* the start of the slot: the higher bits come from the
+		   current time */
+		shift = (level + 1) * TIMING_WHEEL_SLOT_BITS;
+		msecs = shift >= 64 ? 0 : (wheel->now_msecs >> shift) << shift;
+		msecs |= (uint64_t)idx << (level * TIMING_WHEEL_SLOT_BITS);
+
+		*level_r = level;
+		*msecs_r = I_MAX(msecs, wheel->now_msecs);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+bool timing_wheel_get_next(struct timing_wheel *wheel, uint64_t *msecs_r)
+{
+	unsigned int level;
+
+	return timing_wheel_find_next(wheel, &level, msecs_r);
+}
+
+static void
+timing_wheel_cascade(struct timing_wheel *wheel, unsigned int level,
+		     unsigned int idx)
+{
+	struct timing_wheel_item *item, *next;
+
+	item = wheel->slots[level][idx];
+	wheel->slots[level][idx] = NULL;
+	wheel->used_slots[level] &= ~(1ULL << idx);
+
+	for (; item != NULL; item = next) {
+		next = item->next;
+		timing_wheel_link(wheel, item);
+	}
+}
+
+struct timing_wheel_item *
+timing_wheel_pop_expired(struct timing_wheel *wheel, uint64_t now_msecs)
+{
+	struct timing_wheel_item *item;
+	unsigned int level, idx;
+	uint64_t next_msecs;
+
+	for (;;) {
+		/* the current slot contains the items expiring right now and
+		   the ones that were added already expired */
+		idx = timing_wheel_slot_idx(wheel->now_msecs, 0);
+		for (item = wheel->slots[0][idx]; item != NULL;
+		     item = item->next) {
+			if (item->expire_msecs <= now_msecs) {
+				timing_wheel_remove(wheel, item);
+				return item;
+			}
+		}
+		if (wheel->now_msecs >= now_msecs)
+			return NULL;
+
+		if (!timing_wheel_find_next(wheel, &level, &next_msecs) ||
+		    next_msecs > now_msecs) {
+			/* nothing expires before now_msecs, so none of the
+			   slots we're skipping over contain items. */
+			wheel->now_msecs = now_msecs;
+			return NULL;
+		}
+		i_assert(next_msecs > wheel->now_msecs);
+		wheel->now_msecs = next_msecs;
+		if (level > 0) {
+			timing_wheel_cascade(wheel, level,
+				timing_wheel_slot_idx(next_msecs, level));
+		}
+	}
+}
+
+struct timing_wheel_item *timing_wheel_pop(struct timing_wheel *wheel)
+{
+	struct timing_wheel_item *item;
+	uint64_t mask;
+	unsigned int level, idx;
+
+	for (level = 0; level < TIMING_WHEEL_LEVELS; level++) {
+		mask = wheel->used_slots[level];
+		if (mask == 0)
+			continue;
+
+		idx = bits_required64(mask & (~mask + 1)) - 1;
+		item = wheel->slots[level][idx];
+		timing_wheel_remove(wheel, item);
+		return item;
+	}
+	i_assert(wheel->count == 0);
+	return NULL;
+}
+
+void timing_wheel_reset(struct timing_wheel *wheel, uint64_t now_msecs)
+{
+	i_assert(wheel->count == 0);
+
+	wheel->now_msecs = now_msecs;
+}
@@ -0,0 +1,54 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+/* Hierarchical timing wheel with millisecond resolution. Adding and removing
+   items is O(1), and each item is moved between the wheel's levels at most
+   a few times before it expires. The items you add to the wheel must begin
+   with a struct timing_wheel_item. */
+
+struct timing_wheel_item {
+	/* Linked list of items in the same slot, updated automatically. */
+	struct timing_wheel_item *prev, *next;
+	/* Time when the item expires, set by timing_wheel_add(). */
+	uint64_t expire_msecs;
+	/* Slot where the item currently is + 1, updated automatically.
+	   0 when the item isn't in the wheel. */
+	unsigned int slot;
+	/* [your own data] */
+};
+
+/* Create a new timing wheel. now_msecs is the current time, using the same
+   clock as the items' expire times. */
+struct timing_wheel *timing_wheel_init(uint64_t now_msecs);
+void timing_wheel_deinit(struct timing_wheel **wheel);
+
+/* Return number of items in the wheel. */
+unsigned int timing_wheel_count(const struct timing_wheel *wheel) ATTR_PURE;
+
+/* Add a new item to the wheel. If expire_msecs is already in the past, the
+   item is returned by the next timing_wheel_pop_expired() call. */
+void timing_wheel_add(struct timing_wheel *wheel,
+		      struct timing_wheel_item *item, uint64_t expire_msecs);
+/* Remove the specified item from the wheel. */
+void timing_wheel_remove(struct timing_wheel *wheel,
+			 struct timing_wheel_item *item);
+
+/* Returns FALSE if the wheel is empty. Otherwise returns the time when
+   timing_wheel_pop_expired() should be called next. This is exact for items
+   expiring within the next 64 milliseconds. For items further away it may be
+   earlier than the actual expire time, in which case the next call only
+   moves the items closer to their expiration. */
+bool timing_wheel_get_next(struct timing_wheel *wheel, uint64_t *msecs_r);
+/* Advance the wheel's time to now_msecs and return an item that has expired
+   by then, removing it from the wheel. Returns NULL if there are no more
+   expired items. */
+struct timing_wheel_item *
+timing_wheel_pop_expired(struct timing_wheel *wheel, uint64_t now_msecs);
+/* Remove and return any item from the wheel, or NULL if it's empty. */
+struct timing_wheel_item *timing_wheel_pop(struct timing_wheel *wheel);
+
+/* Change the wheel's current time. This can also move the time backwards,
+   which is why the wheel must be empty. */
+void timing_wheel_reset(struct timing_wheel *wheel, uint64_t now_msecs);
+
+#endif
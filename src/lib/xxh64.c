@@ -0,0 +1,173 @@
+/* Copyright (c) 2016 Dovecot authors, see the included COPYING file */
+
+/* Implementation of the XXH64 hash algorithm designed by Yann Collet.
+   The output is compatible with the reference implementation. */
+
+#include "lib.h"
+#include "xxh64.h"
+
+#define XXH64_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME3 0x165667B19E3779F9ULL
+#define XXH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME5 0x27D4EB2F165667C5ULL
+
+#define XXH64_ROTL(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static inline uint64_t xxh64_read64(const unsigned char *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t xxh64_read32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+	acc += input * XXH64_PRIME2;
+	acc = XXH64_ROTL(acc, 31);
+	return acc * XXH64_PRIME1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * XXH64_PRIME1 + XXH64_PRIME4;
+}
+
+static const unsigned char *
+xxh64_stripes(struct xxh64_context *ctx, const unsigned char *p,
+	      const unsigned char *end)
+{
+	uint64_t v1 = ctx->v1, v2 = ctx->v2, v3 = ctx->v3, v4 = ctx->v4;
+
+	/* process as many full 32 byte stripes as there are */
+	for (; end - p >= 32; p += 32) {
+		v1 = xxh64_round(v1, xxh64_read64(p));
+		v2 = xxh64_round(v2, xxh64_read64(p + 8));
+		v3 = xxh64_round(v3, xxh64_read64(p + 16));
+		v4 = xxh64_round(v4, xxh64_read64(p + 24));
+	}
+	ctx->v1 = v1; ctx->v2 = v2; ctx->v3 = v3; ctx->v4 = v4;
+	return p;
+}
+
+void xxh64_init(struct xxh64_context *ctx, uint64_t seed)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->seed = seed;
+	ctx->v1 = seed + XXH64_PRIME1 + XXH64_PRIME2;
+	ctx->v2 = seed + XXH64_PRIME2;
+	ctx->v3 = seed;
+	ctx->v4 = seed - XXH64_PRIME1;
+}
+
+void xxh64_update(struct xxh64_context *ctx, const void *data, size_t size)
+{
+	const unsigned char *p = data, *end = p + size;
+	size_t n;
+
+	ctx->total_len += size;
+	if (ctx->buffer_size > 0) {
+		/* fill the partial stripe first */
+		n = I_MIN(size, sizeof(ctx->buffer) - ctx->buffer_size);
+		memcpy(ctx->buffer + ctx->buffer_size, p, n);
+		ctx->buffer_size += n;
+		p += n;
+		if (ctx->buffer_size < sizeof(ctx->buffer))
+			return;
+		(void)xxh64_stripes(ctx, ctx->buffer,
+				    ctx->buffer + sizeof(ctx->buffer));
+		ctx->buffer_size = 0;
+	}
+	p = xxh64_stripes(ctx, p, end);
+	if (p != end) {
+		memcpy(ctx->buffer, p, end - p);
+		ctx->buffer_size = end - p;
+	}
+}
+
+uint64_t xxh64_final(struct xxh64_context *ctx)
+{
+	const unsigned char *p = ctx->buffer, *end = p + ctx->buffer_size;
+	uint64_t h;
+
+	if (ctx->total_len >= 32) {
+		h = XXH64_ROTL(ctx->v1, 1) + XXH64_ROTL(ctx->v2, 7) +
+			XXH64_ROTL(ctx->v3, 12) + XXH64_ROTL(ctx->v4, 18);
+		h = xxh64_merge_round(h, ctx->v1);
+		h = xxh64_merge_round(h, ctx->v2);
+		h = xxh64_merge_round(h, ctx->v3);
+		h = xxh64_merge_round(h, ctx->v4);
+	} else {
+		h = ctx->seed + XXH64_PRIME5;
+	}
+	h += ctx->total_len;
+
+	for (; end - p >= 8; p += 8) {
+		h ^= xxh64_round(0, xxh64_read64(p));
+		h = XXH64_ROTL(h, 27) * XXH64_PRIME1 + XXH64_PRIME4;
+	}
+	if (end - p >= 4) {
+		h ^= (uint64_t)xxh64_read32(p) * XXH64_PRIME1;
+		h = XXH64_ROTL(h, 23) * XXH64_PRIME2 + XXH64_PRIME3;
+		p += 4;
+	}
+	for (; p != end; p++) {
+		h ^= *p * XXH64_PRIME5;
+		h = XXH64_ROTL(h, 11) * XXH64_PRIME1;
+	}
+
+	/* avalanche */
+	h ^= h >> 33;
+	h *= XXH64_PRIME2;
+	h ^= h >> 29;
+	h *= XXH64_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+uint64_t xxh64_data(const void *data, size_t size, uint64_t seed)
+{
+	struct xxh64_context ctx;
+
+	xxh64_init(&ctx, seed);
+	xxh64_update(&ctx, data, size);
+	return xxh64_final(&ctx);
+}
+
+static void hash_method_init_xxh64(void *context)
+{
+	xxh64_init(context, 0);
+}
+
+static void
+hash_method_loop_xxh64(void *context, const void *data, size_t size)
+{
+	xxh64_update(context, data, size);
+}
+
+static void hash_method_result_xxh64(void *context, unsigned char *result_r)
+{
+	uint64_t h = xxh64_final(context);
+	unsigned int i;
+
+	for (i = 0; i < XXH64_RESULTLEN; i++)
+		result_r[i] = h >> (8 * (XXH64_RESULTLEN - 1 - i));
+}
+
+const struct hash_method hash_method_xxh64 = {
+	"xxh64",
+	sizeof(struct xxh64_context),
+	XXH64_RESULTLEN,
+
+	hash_method_init_xxh64,
+	hash_method_loop_xxh64,
+	hash_method_result_xxh64
+};
@@ -0,0 +1,29 @@
+#ifndef XXH64_H
+#define XXH64_H
+
+#include "hash-method.h"
+
+/* XXH64 is a fast non-cryptographic 64bit hash. It's useful for hashing and
+   checksumming data where md5/sha1 would be needlessly slow, but it must
+   never be used where collisions could be maliciously created. */
+#define XXH64_RESULTLEN (64/8)
+
+struct xxh64_context {
+	uint64_t v1, v2, v3, v4;
+	uint64_t total_len;
+	unsigned char buffer[32];
+	unsigned int buffer_size;
+	uint64_t seed;
+};
+
+void xxh64_init(struct xxh64_context *ctx, uint64_t seed);
+void xxh64_update(struct xxh64_context *ctx, const void *data, size_t size);
+uint64_t xxh64_final(struct xxh64_context *ctx);
+
+/* Returns the 64bit hash of the data. */
+uint64_t xxh64_data(const void *data, size_t size, uint64_t seed) ATTR_PURE;
+
+/* The hash method's digest is the 64bit hash with seed 0 in big endian. */
+extern const struct hash_method hash_method_xxh64;
+
+#endif
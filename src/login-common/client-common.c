@@ -199,7 +199,8 @@ void client_destroy(struct client *client, const char *reason)
 
 	if (client->output != NULL)
 		o_stream_uncork(client->output);
-	if (!client->login_success && client->ssl_proxy != NULL)
+	if (client->ssl_proxy != NULL &&
+	    (!client->login_success || client->ssl_ktls_suspended))
 		ssl_proxy_destroy(client->ssl_proxy);
 	if (client->input != NULL)
 		i_stream_close(client->input);
@@ -162,6 +162,7 @@ struct client {
 	bool secured:1;
 	bool trusted:1;
 	bool ssl_servername_settings_read:1;
+	bool ssl_ktls_suspended:1;
 	bool authenticating:1;
 	bool auth_tried_disabled_plaintext:1;
 	bool auth_tried_unsupported_mech:1;
@@ -6,6 +6,7 @@
 #include "hex-binary.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "ostream.h"
 #include "write-full.h"
 #include "strescape.h"
 #include "str-sanitize.h"
@@ -18,6 +19,7 @@
 #include "master-auth.h"
 #include "client-common.h"
 
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #define ERR_TOO_MANY_USERIP_CONNECTIONS \
@@ -102,6 +104,12 @@ master_auth_callback(const struct master_auth_reply *reply, void *context)
 
 	client->master_tag = 0;
 	client->authenticating = FALSE;
+	if (client->ssl_ktls_suspended &&
+	    (reply == NULL || reply->status != MASTER_AUTH_STATUS_OK)) {
+		/* the client's socket wasn't taken into use after all */
+		client->ssl_ktls_suspended = FALSE;
+		ssl_proxy_ktls_resume(client->ssl_proxy);
+	}
 	if (reply != NULL) {
 		switch (reply->status) {
 		case MASTER_AUTH_STATUS_OK:
@@ -118,6 +126,28 @@ master_auth_callback(const struct master_auth_reply *reply, void *context)
 	call_client_callback(client, sasl_reply, data, NULL);
 }
 
+static int master_get_client_fd(struct client *client)
+{
+	int fd, pending;
+
+	if (client->ssl_proxy == NULL || !client->set->ssl_ktls)
+		return client->fd;
+
+	/* With kernel TLS the post-login process can use the client's socket
+	   directly, avoiding the proxying. Everything we've sent or received
+	   via the proxy must have been processed first though. */
+	if (o_stream_get_buffer_used_size(client->output) > 0)
+		return client->fd;
+	if (ioctl(client->fd, FIONREAD, &pending) < 0 || pending > 0)
+		return client->fd;
+
+	fd = ssl_proxy_ktls_suspend(client->ssl_proxy);
+	if (fd == -1)
+		return client->fd;
+	client->ssl_ktls_suspended = TRUE;
+	return fd;
+}
+
 static void master_send_request(struct anvil_request *anvil_request)
 {
 	struct client *client = anvil_request->client;
@@ -154,7 +184,7 @@ static void master_send_request(struct anvil_request *anvil_request)
 	client->master_auth_id = req.auth_id;
 
 	memset(&params, 0, sizeof(params));
-	params.client_fd = client->fd;
+	params.client_fd = master_get_client_fd(client);
 	params.socket_path = client->postlogin_socket_path;
 	params.request = req;
 	params.data = buf->data;
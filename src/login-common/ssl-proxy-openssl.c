@@ -17,6 +17,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 
 #ifdef HAVE_OPENSSL
 
@@ -81,6 +82,7 @@ struct ssl_proxy {
 	bool client_proxy:1;
 	bool flushing:1;
 	bool failed:1;
+	bool ktls_suspended:1;
 };
 
 struct ssl_parameters {
@@ -630,10 +632,21 @@ int ssl_proxy_alloc(int fd, const struct ip_addr *ip, pool_t set_pool,
 		    struct ssl_proxy **proxy_r)
 {
 	struct ssl_server_context *ctx;
+	int ret;
 
 	ctx = ssl_server_context_get(login_set, ssl_set);
-	return ssl_proxy_alloc_common(ctx->ctx, fd, ip,
-				      set_pool, login_set, ssl_set, proxy_r);
+	ret = ssl_proxy_alloc_common(ctx->ctx, fd, ip,
+				     set_pool, login_set, ssl_set, proxy_r);
+	if (ret < 0)
+		return -1;
+
+#ifdef SSL_OP_ENABLE_KTLS
+	/* OpenSSL enables kernel TLS by itself after the handshake if the
+	   kernel supports the negotiated cipher. */
+	if (login_set->ssl_ktls)
+		SSL_set_options((*proxy_r)->ssl, SSL_OP_ENABLE_KTLS);
+#endif
+	return ret;
 }
 
 int ssl_proxy_client_alloc(int fd, struct ip_addr *ip, pool_t set_pool,
@@ -763,6 +776,57 @@ const char *ssl_proxy_get_cert_error(struct ssl_proxy *proxy)
 		"(Unknown error)";
 }
 
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && \
+	defined(BIO_get_ktls_recv)
+static bool ssl_proxy_has_ktls(struct ssl_proxy *proxy)
+{
+	return BIO_get_ktls_send(SSL_get_wbio(proxy->ssl)) &&
+		BIO_get_ktls_recv(SSL_get_rbio(proxy->ssl));
+}
+#else
+static bool ssl_proxy_has_ktls(struct ssl_proxy *proxy ATTR_UNUSED)
+{
+	return FALSE;
+}
+#endif
+
+int ssl_proxy_ktls_suspend(struct ssl_proxy *proxy)
+{
+	int pending;
+
+	if (!proxy->handshaked || proxy->destroyed || proxy->client_proxy)
+		return -1;
+	if (!ssl_proxy_has_ktls(proxy))
+		return -1;
+
+	/* the kernel can't know about data that is still buffered by us or
+	   by OpenSSL, or that is waiting to be proxied */
+	if (proxy->plainout_size > 0 || proxy->sslout_size > 0 ||
+	    SSL_pending(proxy->ssl) > 0)
+		return -1;
+	if (ioctl(proxy->fd_plain, FIONREAD, &pending) < 0 || pending > 0)
+		return -1;
+
+	if (proxy->io_ssl_read != NULL)
+		io_remove(&proxy->io_ssl_read);
+	if (proxy->io_ssl_write != NULL)
+		io_remove(&proxy->io_ssl_write);
+	if (proxy->io_plain_read != NULL)
+		io_remove(&proxy->io_plain_read);
+	proxy->ktls_suspended = TRUE;
+	return proxy->fd_ssl;
+}
+
+void ssl_proxy_ktls_resume(struct ssl_proxy *proxy)
+{
+	if (!proxy->ktls_suspended || proxy->destroyed)
+		return;
+
+	proxy->ktls_suspended = FALSE;
+	ssl_set_io(proxy, SSL_ADD_INPUT);
+	plain_block_input(proxy, FALSE);
+}
+
 void ssl_proxy_free(struct ssl_proxy **_proxy)
 {
 	struct ssl_proxy *proxy = *_proxy;
@@ -797,7 +861,7 @@ void ssl_proxy_destroy(struct ssl_proxy *proxy)
 	if (proxy->destroyed || proxy->flushing)
 		return;
 	proxy->flushing = TRUE;
-	if (!proxy->failed && proxy->handshaked)
+	if (!proxy->failed && proxy->handshaked && !proxy->ktls_suspended)
 		ssl_proxy_flush(proxy);
 	proxy->destroyed = TRUE;
 
@@ -813,7 +877,10 @@ void ssl_proxy_destroy(struct ssl_proxy *proxy)
 	if (proxy->io_plain_write != NULL)
 		io_remove(&proxy->io_plain_write);
 
-	(void)SSL_shutdown(proxy->ssl);
+	/* with a suspended kTLS session the post-login process may already be
+	   using the connection, so it mustn't be shut down here */
+	if (!proxy->ktls_suspended)
+		(void)SSL_shutdown(proxy->ssl);
 
 	net_disconnect(proxy->fd_ssl);
 	net_disconnect(proxy->fd_plain);
@@ -86,6 +86,12 @@ const char *ssl_proxy_get_cert_error(struct ssl_proxy *proxy ATTR_UNUSED)
 	return "";
 }
 
+int ssl_proxy_ktls_suspend(struct ssl_proxy *proxy ATTR_UNUSED)
+{
+	return -1;
+}
+
+void ssl_proxy_ktls_resume(struct ssl_proxy *proxy ATTR_UNUSED) {}
 void ssl_proxy_destroy(struct ssl_proxy *proxy ATTR_UNUSED) {}
 
 void ssl_proxy_free(struct ssl_proxy **proxy ATTR_UNUSED) {}
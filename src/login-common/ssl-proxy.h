@@ -34,6 +34,16 @@ const char *ssl_proxy_get_last_error(const struct ssl_proxy *proxy) ATTR_PURE;
 const char *ssl_proxy_get_security_string(struct ssl_proxy *proxy);
 const char *ssl_proxy_get_compression(struct ssl_proxy *proxy);
 const char *ssl_proxy_get_cert_error(struct ssl_proxy *proxy);
+/* If the TLS session was offloaded to kernel (ssl_ktls=yes) and there's no
+   buffered data, stop proxying and return the client's socket, which can
+   be used with plaintext from now on. The post-login process must read it
+   with i_stream_create_ktls() to handle TLS alerts. Returns -1 if the
+   connection must still be proxied. If the returned fd ends up not being
+   used after all, ssl_proxy_ktls_resume() continues proxying. Otherwise
+   destroying the proxy only closes its fds without shutting down the TLS
+   session. */
+int ssl_proxy_ktls_suspend(struct ssl_proxy *proxy);
+void ssl_proxy_ktls_resume(struct ssl_proxy *proxy);
 void ssl_proxy_destroy(struct ssl_proxy *proxy);
 void ssl_proxy_free(struct ssl_proxy **proxy);
 
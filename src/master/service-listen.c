@@ -186,7 +186,8 @@ systemd_listen_fd(const struct ip_addr *ip, in_port_t port, int *fd_r)
 }
 #endif
 
-static int service_inet_listener_listen(struct service_listener *l)
+static int
+service_inet_listener_create(struct service_listener *l, int *fd_r)
 {
         struct service *service = l->service;
 	enum net_listen_flags flags = 0;
@@ -194,31 +195,58 @@ static int service_inet_listener_listen(struct service_listener *l)
 	in_port_t port = set->port;
 	int fd;
 
-#ifdef HAVE_SYSTEMD
-	if (systemd_listen_fd(&l->set.inetset.ip, port, &fd) < 0)
-		return -1;
-
-	if (fd == -1)
-#endif
-	{
-		if (set->reuse_port)
-			flags |= NET_LISTEN_FLAG_REUSEPORT;
-		fd = net_listen_full(&l->set.inetset.ip, &port, &flags,
-				     service_get_backlog(service));
-		if (fd < 0) {
-			service_error(service, "listen(%s, %u) failed: %m",
-				      l->inet_address, set->port);
-			return errno == EADDRINUSE ? 0 : -1;
-		}
-		l->reuse_port = (flags & NET_LISTEN_FLAG_REUSEPORT) != 0;
+	if (set->reuse_port)
+		flags |= NET_LISTEN_FLAG_REUSEPORT;
+	fd = net_listen_full(&l->set.inetset.ip, &port, &flags,
+			     service_get_backlog(service));
+	if (fd < 0) {
+		service_error(service, "listen(%s, %u) failed: %m",
+			      l->inet_address, set->port);
+		return errno == EADDRINUSE ? 0 : -1;
 	}
+	l->reuse_port = (flags & NET_LISTEN_FLAG_REUSEPORT) != 0;
 	net_set_nonblock(fd, TRUE);
 	fd_close_on_exec(fd, TRUE);
+	*fd_r = fd;
+	return 1;
+}
+
+static int service_inet_listener_listen(struct service_listener *l)
+{
+	int fd, ret;
 
+#ifdef HAVE_SYSTEMD
+	if (systemd_listen_fd(&l->set.inetset.ip, l->set.inetset.set->port,
+			      &fd) < 0)
+		return -1;
+
+	if (fd != -1) {
+		/* systemd's socket is shared by all the processes */
+		l->reuse_port = FALSE;
+		net_set_nonblock(fd, TRUE);
+		fd_close_on_exec(fd, TRUE);
+		l->fd = fd;
+		return 1;
+	}
+#endif
+	if ((ret = service_inet_listener_create(l, &fd)) <= 0)
+		return ret;
 	l->fd = fd;
 	return 1;
 }
 
+int service_inet_listener_reopen(struct service_listener *l)
+{
+	int fd;
+
+	i_assert(l->type == SERVICE_LISTENER_INET);
+	i_assert(l->reuse_port);
+
+	if (service_inet_listener_create(l, &fd) <= 0)
+		return -1;
+	return fd;
+}
+
 int service_listener_listen(struct service_listener *l)
 {
 	switch (l->type) {
@@ -430,6 +458,8 @@ int services_listen_using(struct service_list *new_service_list,
 			    listener_equals(new_listeners[i],
 					    old_listeners[j])) {
 				new_listeners[i]->fd = old_listeners[j]->fd;
+				new_listeners[i]->reuse_port =
+					old_listeners[j]->reuse_port;
                                 old_listeners[j]->fd = -1;
 				break;
 			}
@@ -14,5 +14,8 @@ int services_listen_using(struct service_list *new_service_list,
 			  struct service_list *old_service_list);
 
 int service_listener_listen(struct service_listener *l);
+/* Create a new SO_REUSEPORT socket for the reuse_port inet listener, never
+   using the sockets passed by systemd. Returns the fd, or -1 on failure. */
+int service_inet_listener_reopen(struct service_listener *l);
 
 #endif
@@ -38,17 +38,21 @@ static void service_reopen_inet_listeners(struct service *service)
 {
 	struct service_listener *const *listeners;
 	unsigned int i, count;
-	int old_fd;
 
+	/* Each process gets its own SO_REUSEPORT socket, so the kernel can
+	   distribute the new connections between the processes without all of
+	   them waking up for each connection. The shared socket is still
+	   passed to the process, because the master's socket is part of the
+	   same group and the connections balanced to it must be accepted by
+	   someone. */
 	listeners = array_get(&service->listeners, &count);
 	for (i = 0; i < count; i++) {
+		/* sockets passed by systemd never have reuse_port set */
 		if (!listeners[i]->reuse_port || listeners[i]->fd == -1)
 			continue;
 
-		old_fd = listeners[i]->fd;
-		listeners[i]->fd = -1;
-		if (service_listener_listen(listeners[i]) < 0)
-			listeners[i]->fd = old_fd;
+		listeners[i]->reuse_fd =
+			service_inet_listener_reopen(listeners[i]);
 	}
 }
 
@@ -111,6 +115,14 @@ service_dup_fds(struct service *service)
 			env_put(t_strdup_printf("SOCKET%d_SETTINGS=%s",
 				socket_listener_count, str_c(listener_settings)));
 			socket_listener_count++;
+
+			if (listeners[i]->reuse_fd != -1) {
+				dup2_append(&dups, listeners[i]->reuse_fd, fd++);
+				env_put(t_strdup_printf("SOCKET%d_SETTINGS=%s",
+					socket_listener_count,
+					str_c(listener_settings)));
+				socket_listener_count++;
+			}
 		}
 	}
 
@@ -46,6 +46,7 @@ service_create_file_listener(struct service *service,
 	l->service = service;
 	l->type = type;
 	l->fd = -1;
+	l->reuse_fd = -1;
 	l->set.fileset.set = set;
 	l->name = strrchr(set->path, '/');
 	if (l->name != NULL)
@@ -125,6 +126,7 @@ service_create_one_inet_listener(struct service *service,
 	l->service = service;
 	l->type = SERVICE_LISTENER_INET;
 	l->fd = -1;
+	l->reuse_fd = -1;
 	l->set.inetset.set = set;
 	l->set.inetset.ip = *ip;
 	l->inet_address = p_strdup(service->list->pool, address);
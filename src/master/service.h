@@ -40,6 +40,9 @@ struct service_listener {
 	} set;
 
 	bool reuse_port;
+	/* With reuse_port the child process gets its own SO_REUSEPORT socket
+	   in addition to the fd shared with master. Only set in the child. */
+	int reuse_fd;
 };
 
 struct service {
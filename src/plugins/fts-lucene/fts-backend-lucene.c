@@ -152,6 +152,8 @@ fts_backend_lucene_init(struct fts_backend *_backend, const char **error_r)
 
 	path = t_strconcat(backend->dir_path, "/"LUCENE_EXPUNGE_LOG_NAME, NULL);
 	backend->expunge_log = fts_expunge_log_init(path);
+	fts_expunge_log_set_crc32c(backend->expunge_log,
+				   fuser->set.expunge_log_crc32c);
 	return 0;
 }
 
@@ -37,6 +37,8 @@ fts_lucene_plugin_init_settings(struct mail_user *user,
 			set->mime_parts = TRUE;
 		} else if (strcmp(*tmp, "use_libfts") == 0) {
 			set->use_libfts = TRUE;
+		} else if (strcmp(*tmp, "expunge_log_crc32c") == 0) {
+			set->expunge_log_crc32c = TRUE;
 		} else {
 			i_error("fts_lucene: Invalid setting: %s", *tmp);
 			return -1;
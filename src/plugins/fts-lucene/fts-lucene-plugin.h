@@ -16,6 +16,7 @@ struct fts_lucene_settings {
 	bool no_snowball;
 	bool mime_parts;
 	bool use_libfts;
+	bool expunge_log_crc32c;
 };
 
 struct fts_lucene_user {
@@ -15,7 +15,7 @@
 #include <fcntl.h>
 
 struct fts_expunge_log_record {
-	/* CRC32 of this entire record (except this checksum) */
+	/* CRC32 or CRC32C of this entire record (except this checksum) */
 	uint32_t checksum;
 	/* Size of this entire record */
 	uint32_t record_size;
@@ -34,6 +34,9 @@ struct fts_expunge_log {
 
 	int fd;
 	struct stat st;
+
+	/* write new records with CRC32C checksums */
+	bool crc32c;
 };
 
 struct fts_expunge_log_mailbox {
@@ -74,6 +77,21 @@ struct fts_expunge_log *fts_expunge_log_init(const char *path)
 	return log;
 }
 
+void fts_expunge_log_set_crc32c(struct fts_expunge_log *log, bool set)
+{
+	log->crc32c = set;
+}
+
+static uint32_t
+fts_expunge_log_record_checksum(const struct fts_expunge_log_record *rec,
+				bool crc32c)
+{
+	size_t size = rec->record_size - sizeof(rec->checksum);
+
+	return crc32c ? crc32c_data(&rec->record_size, size) :
+		crc32_data(&rec->record_size, size);
+}
+
 void fts_expunge_log_deinit(struct fts_expunge_log **_log)
 {
 	struct fts_expunge_log *log = *_log;
@@ -290,9 +308,8 @@ fts_expunge_log_export(struct fts_expunge_log_append_ctx *ctx,
 		rec = buffer_get_space_unsafe(output, rec_offset,
 					      output->used - rec_offset);
 		rec->record_size = output->used - rec_offset;
-		rec->checksum = crc32_data(&rec->record_size,
-					   rec->record_size -
-					   sizeof(rec->checksum));
+		rec->checksum = fts_expunge_log_record_checksum(rec,
+			ctx->log != NULL && ctx->log->crc32c);
 	}
 	hash_table_iterate_deinit(&iter);
 }
@@ -486,10 +503,13 @@ fts_expunge_log_read_next(struct fts_expunge_log_read_ctx *ctx)
 		rec = (const void *)data;
 	}
 
-	/* verify that the record checksum is valid */
-	checksum = crc32_data(&rec->record_size,
-			      rec->record_size - sizeof(rec->checksum));
-	if (checksum != rec->checksum) {
+	/* verify that the record checksum is valid. the log may contain
+	   records with both CRC32 and CRC32C checksums, so try first the one
+	   that we're writing and then the other one. */
+	checksum = fts_expunge_log_record_checksum(rec, ctx->log->crc32c);
+	if (checksum != rec->checksum &&
+	    fts_expunge_log_record_checksum(rec, !ctx->log->crc32c) !=
+	    rec->checksum) {
 		ctx->corrupted = TRUE;
 		i_error("Corrupted fts expunge log %s: "
 			"Record checksum mismatch: %u != %u",
@@ -11,6 +11,10 @@ struct fts_expunge_log_read_record {
 
 struct fts_expunge_log *fts_expunge_log_init(const char *path);
 void fts_expunge_log_deinit(struct fts_expunge_log **log);
+/* Write new records using CRC32C checksums, which are faster to calculate.
+   Records with both checksums can always be read, but older Dovecot versions
+   see CRC32C records as corrupted. */
+void fts_expunge_log_set_crc32c(struct fts_expunge_log *log, bool set);
 
 struct fts_expunge_log_append_ctx *
 fts_expunge_log_append_begin(struct fts_expunge_log *log);
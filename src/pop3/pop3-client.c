@@ -6,6 +6,7 @@
 #include "net.h"
 #include "iostream.h"
 #include "istream.h"
+#include "istream-ktls.h"
 #include "ostream.h"
 #include "crc32.h"
 #include "str.h"
@@ -395,7 +396,7 @@ int client_create(int fd_in, int fd_out, const char *session_id,
 	client->session_id = p_strdup(pool, session_id);
 	client->fd_in = fd_in;
 	client->fd_out = fd_out;
-	client->input = i_stream_create_fd(fd_in, MAX_INBUF_SIZE);
+	client->input = i_stream_create_ktls(fd_in, MAX_INBUF_SIZE);
 	client->output = o_stream_create_fd(fd_out, (size_t)-1);
 	o_stream_set_no_error_handling(client->output, TRUE);
 	o_stream_set_flush_callback(client->output, client_output, client);